@@ -0,0 +1,571 @@
+/*
+ * Copyright 2017 Katherine Flavel
+ *
+ * See LICENCE for the full copyright terms.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+
+#include <unistd.h>
+
+#include <lf/lf.h>
+
+#include "sample.h"
+
+/*
+ * Parse, compile, render and scan timings for each format given (one
+ * per line, as test/pass.fmt), and for the LF_* formats from <lf/lf.h>.
+ *
+ * Each call is timed alone, into a log-linear histogram after the style
+ * of HdrHistogram, for percentiles to within 1/32 of their value; the
+ * mean is over the same calls, and so includes the cost of reading the
+ * clock. Rendering is for the sample request, and scanning is of what
+ * was rendered. Parsing counts the hooks called for each format.
+ *
+ * Prints a table, or with -j, one JSON object per line for each format
+ * and operation, and a summary for all formats under "fmt": null.
+ */
+
+enum {
+	ROUNDS    = 2000,
+	LINE_MAX_ = 8192,
+	SUB_BITS  = 5,                     /* 32 buckets per power of 2 */
+	HIST      = (64 - SUB_BITS + 1) << SUB_BITS
+};
+
+enum bench_op {
+	BENCH_PARSE,
+	BENCH_COMPILE,
+	BENCH_RENDER,
+	BENCH_SCAN
+};
+
+static const char *const opname[] = { "parse", "compile", "render", "scan" };
+
+struct hist {
+	unsigned long long count[HIST];
+	unsigned long long n;
+	unsigned long long max;
+	double sum;
+	unsigned long long bytes;
+};
+
+struct counts {
+	unsigned long hooks;
+	unsigned long literals;
+};
+
+static int json;
+
+/* exact below 2^(SUB_BITS+1), and to within 1/32 above */
+static size_t
+bucket(unsigned long long v)
+{
+	unsigned e;
+
+	if (v < 2ULL << SUB_BITS) {
+		return (size_t) v;
+	}
+
+	for (e = SUB_BITS + 1; v >> (e + 1) != 0; e++)
+		;
+
+	return ((size_t) (e - SUB_BITS) << SUB_BITS) + (size_t) (v >> (e - SUB_BITS));
+}
+
+/* the highest value in bucket i */
+static unsigned long long
+bucket_max(size_t i)
+{
+	unsigned long long m;
+	unsigned e;
+
+	if (i < 2U << SUB_BITS) {
+		return i;
+	}
+
+	e = (unsigned) (i >> SUB_BITS) + SUB_BITS - 1;
+	m = (i & ((1U << SUB_BITS) - 1)) | 1U << SUB_BITS;
+
+	return ((m + 1) << (e - SUB_BITS)) - 1;
+}
+
+static void
+hist_add(struct hist *h, unsigned long long v)
+{
+	h->count[bucket(v)]++;
+	h->n++;
+	h->sum += v;
+
+	if (v > h->max) {
+		h->max = v;
+	}
+}
+
+static void
+hist_merge(struct hist *h, const struct hist *src)
+{
+	size_t i;
+
+	for (i = 0; i < HIST; i++) {
+		h->count[i] += src->count[i];
+	}
+
+	h->n     += src->n;
+	h->sum   += src->sum;
+	h->bytes += src->bytes;
+
+	if (src->max > h->max) {
+		h->max = src->max;
+	}
+}
+
+static unsigned long long
+hist_pct(const struct hist *h, double p)
+{
+	unsigned long long want, seen;
+	size_t i;
+
+	if (h->n == 0) {
+		return 0;
+	}
+
+	want = (unsigned long long) (p / 100 * h->n + 0.5);
+	if (want == 0) {
+		want = 1;
+	}
+
+	for (seen = 0, i = 0; i < HIST; i++) {
+		seen += h->count[i];
+		if (seen >= want) {
+			return bucket_max(i) < h->max ? bucket_max(i) : h->max;
+		}
+	}
+
+	return h->max;
+}
+
+static unsigned long long
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* hooks which just count, for every kind of directive */
+#define COUNT(opaque) (((struct counts *) (opaque))->hooks++, 1)
+
+static int
+count_literal(void *opaque, const char *p, size_t n)
+{
+	(void) p;
+	(void) n;
+
+	((struct counts *) opaque)->literals++;
+	return 1;
+}
+
+static int
+count_simple(void *opaque, const struct lf_pred *pred, enum lf_redirect redirect)
+{
+	(void) pred;
+	(void) redirect;
+	return COUNT(opaque);
+}
+
+static int
+count_bool(void *opaque, const struct lf_pred *pred, enum lf_redirect redirect, int v)
+{
+	(void) pred;
+	(void) redirect;
+	(void) v;
+	return COUNT(opaque);
+}
+
+static int
+count_ip(void *opaque, const struct lf_pred *pred, enum lf_redirect redirect, enum lf_ip ip)
+{
+	(void) pred;
+	(void) redirect;
+	(void) ip;
+	return COUNT(opaque);
+}
+
+static int
+count_port(void *opaque, const struct lf_pred *pred, enum lf_redirect redirect, enum lf_port port)
+{
+	(void) pred;
+	(void) redirect;
+	(void) port;
+	return COUNT(opaque);
+}
+
+static int
+count_id(void *opaque, const struct lf_pred *pred, enum lf_redirect redirect, enum lf_id id)
+{
+	(void) pred;
+	(void) redirect;
+	(void) id;
+	return COUNT(opaque);
+}
+
+static int
+count_rtime(void *opaque, const struct lf_pred *pred, enum lf_redirect redirect, enum lf_rtime unit)
+{
+	(void) pred;
+	(void) redirect;
+	(void) unit;
+	return COUNT(opaque);
+}
+
+static int
+count_fractime(void *opaque, const struct lf_pred *pred, enum lf_redirect redirect,
+	enum lf_when when, enum lf_rtime unit)
+{
+	(void) pred;
+	(void) redirect;
+	(void) when;
+	(void) unit;
+	return COUNT(opaque);
+}
+
+static int
+count_name(void *opaque, const struct lf_pred *pred, enum lf_redirect redirect,
+	const char *name, size_t n)
+{
+	(void) pred;
+	(void) redirect;
+	(void) name;
+	(void) n;
+	return COUNT(opaque);
+}
+
+static int
+count_time(void *opaque, const struct lf_pred *pred, enum lf_redirect redirect,
+	enum lf_when when, const char *fmt, size_t n)
+{
+	(void) pred;
+	(void) redirect;
+	(void) when;
+	(void) fmt;
+	(void) n;
+	return COUNT(opaque);
+}
+
+static int
+count_custom(const struct lf_config *conf, void *opaque,
+	char c, const struct lf_pred *pred, enum lf_redirect redirect, const char *p, size_t n,
+	enum lf_errno *e)
+{
+	(void) conf;
+	(void) c;
+	(void) pred;
+	(void) redirect;
+	(void) p;
+	(void) n;
+	(void) e;
+	return COUNT(opaque);
+}
+
+static void
+config(struct lf_config *conf)
+{
+	memset(conf, 0, sizeof *conf);
+
+	conf->custom          = count_custom;
+	conf->literal_span    = count_literal;
+	conf->ip              = count_ip;
+	conf->resp_size       = count_simple;
+	conf->resp_size_clf   = count_simple;
+	conf->filename        = count_simple;
+	conf->remote_hostname = count_bool;
+	conf->req_protocol    = count_simple;
+	conf->keepalive_reqs  = count_simple;
+	conf->remote_logname  = count_simple;
+	conf->req_logid       = count_simple;
+	conf->req_method      = count_simple;
+	conf->server_port     = count_port;
+	conf->id              = count_id;
+	conf->query_string    = count_simple;
+	conf->req_first_line  = count_simple;
+	conf->resp_handler    = count_simple;
+	conf->status          = count_simple;
+	conf->time_frac       = count_fractime;
+	conf->time_taken      = count_rtime;
+	conf->remote_user     = count_simple;
+	conf->url_path        = count_simple;
+	conf->server_name     = count_bool;
+	conf->conn_status     = count_simple;
+	conf->bytes_recv      = count_simple;
+	conf->bytes_sent      = count_simple;
+	conf->bytes_xfer      = count_simple;
+
+	conf->req_cookien     = count_name;
+	conf->env_varn        = count_name;
+	conf->req_headern     = count_name;
+	conf->noten           = count_name;
+	conf->reply_headern   = count_name;
+	conf->timen           = count_time;
+	conf->req_trailern    = count_name;
+	conf->resp_trailern   = count_name;
+}
+
+static void
+print_json_str(const char *s)
+{
+	if (s == NULL) {
+		printf("null");
+		return;
+	}
+
+	putchar('"');
+
+	for ( ; *s != '\0'; s++) {
+		unsigned char c = *s;
+
+		if (c == '"' || c == '\\') {
+			printf("\\%c", c);
+		} else if (c < 0x20 || c == 0x7f) {
+			printf("\\u%04x", c);
+		} else {
+			putchar(c);
+		}
+	}
+
+	putchar('"');
+}
+
+static void
+report(const char *fmt, enum bench_op op, const struct hist *h,
+	const struct counts *c)
+{
+	double mean, secs;
+
+	if (h->n == 0) {
+		return;
+	}
+
+	mean = h->sum / h->n;
+	secs = h->sum / 1e9;
+
+	if (json) {
+		printf("{\"fmt\":");
+		print_json_str(fmt);
+		printf(",\"op\":\"%s\",\"n\":%llu,\"mean_ns\":%.1f", opname[op], h->n, mean);
+		printf(",\"p50_ns\":%llu,\"p90_ns\":%llu,\"p99_ns\":%llu,\"p999_ns\":%llu,\"max_ns\":%llu",
+			hist_pct(h, 50), hist_pct(h, 90), hist_pct(h, 99), hist_pct(h, 99.9), h->max);
+		printf(",\"ops_per_s\":%.0f", h->n / secs);
+		if (h->bytes > 0) {
+			printf(",\"bytes_per_s\":%.0f", h->bytes / secs);
+		}
+		if (op == BENCH_PARSE && c != NULL) {
+			printf(",\"hooks\":%lu,\"literals\":%lu", c->hooks, c->literals);
+		}
+		printf("}\n");
+		return;
+	}
+
+	printf("%-8s %9.1f %7llu %7llu %7llu %7llu %9llu %10.0f",
+		opname[op], mean,
+		hist_pct(h, 50), hist_pct(h, 90), hist_pct(h, 99), hist_pct(h, 99.9), h->max,
+		h->n / secs);
+
+	if (h->bytes > 0) {
+		printf(" %8.1f", h->bytes / secs / 1e6);
+	} else {
+		printf(" %8s", "");
+	}
+
+	if (op == BENCH_PARSE && c != NULL) {
+		printf("  %lu hooks, %lu literals", c->hooks, c->literals);
+	}
+
+	printf("\n");
+}
+
+static void
+bench(struct lf_config *conf, const struct lf_config *plain,
+	const char *fmt, struct hist total[], unsigned rounds)
+{
+	static struct hist h[4];
+	struct lf_record rec;
+	struct lf_scanner *sc;
+	struct lf_field *fields;
+	struct lf_prog *prog;
+	struct counts c;
+	struct lf_err err;
+	char line[LINE_MAX_], buf[LINE_MAX_];
+	size_t i, n, cols;
+	unsigned long long t;
+	unsigned r;
+
+	memset(h, 0, sizeof h);
+
+	memset(&c, 0, sizeof c);
+	if (!lf_parse(conf, &c, fmt, &err)) {
+		fprintf(stderr, "%s: error: %s\n", fmt, lf_strerror(err.errnum));
+		return;
+	}
+
+	for (r = 0; r < rounds; r++) {
+		struct counts tmp;
+
+		memset(&tmp, 0, sizeof tmp);
+
+		t = now();
+		(void) lf_parse(conf, &tmp, fmt, &err);
+		hist_add(&h[BENCH_PARSE], now() - t);
+	}
+
+	for (r = 0; r < rounds; r++) {
+		t = now();
+		prog = lf_compile(plain, fmt, &err);
+		lf_free(prog);
+		hist_add(&h[BENCH_COMPILE], now() - t);
+	}
+
+	prog = lf_compile(plain, fmt, &err);
+	if (prog == NULL) {
+		fprintf(stderr, "%s: error: %s\n", fmt, lf_strerror(err.errnum));
+		return;
+	}
+
+	sample(&rec);
+
+	n = 0;
+
+	for (r = 0; r < rounds; r++) {
+		t = now();
+		n = lf_render(prog, &rec, line, sizeof line);
+		hist_add(&h[BENCH_RENDER], now() - t);
+		h[BENCH_RENDER].bytes += n;
+	}
+
+	lf_free(prog);
+
+	/* formats which can't be scanned just aren't */
+	sc = n <= sizeof line ? lf_compile_scanner(plain, fmt, &err) : NULL;
+	if (sc != NULL) {
+		(void) lf_scanner_columns(sc, &cols);
+
+		fields = malloc((cols + 1) * sizeof *fields);
+		if (fields != NULL && lf_scan(sc, line, n, fields, buf, &err)) {
+			for (r = 0; r < rounds; r++) {
+				t = now();
+				(void) lf_scan(sc, line, n, fields, buf, &err);
+				hist_add(&h[BENCH_SCAN], now() - t);
+				h[BENCH_SCAN].bytes += n;
+			}
+		}
+
+		free(fields);
+		lf_free_scanner(sc);
+	}
+
+	if (!json) {
+		printf("%s\n", fmt);
+	}
+
+	for (i = 0; i < 4; i++) {
+		report(fmt, (enum bench_op) i, &h[i], &c);
+		hist_merge(&total[i], &h[i]);
+	}
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: formats [-j] [-n rounds] [file...]\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+	static const char *const macros[] = { LF_CLF, LF_VHLF, LF_NSCA, LF_RLF, LF_ALF };
+	static struct hist total[4];
+	struct lf_config conf, plain;
+	char fmt[LINE_MAX_];
+	unsigned rounds;
+	size_t i;
+
+	{
+		int c;
+
+		rounds = ROUNDS;
+
+		while (c = getopt(argc, argv, "jn:"), c != -1) {
+			switch (c) {
+			case 'j':
+				json = 1;
+				break;
+
+			case 'n':
+				rounds = (unsigned) strtoul(optarg, NULL, 10);
+				break;
+
+			case '?':
+			default:
+				usage();
+				return 1;
+			}
+		}
+
+		argc -= optind;
+		argv += optind;
+
+		if (rounds == 0) {
+			usage();
+			return 1;
+		}
+	}
+
+	config(&conf);
+
+	memset(&plain, 0, sizeof plain);
+
+	if (!json) {
+		printf("%-8s %9s %7s %7s %7s %7s %9s %10s %8s\n",
+			"", "mean ns", "p50", "p90", "p99", "p99.9", "max", "ops/s", "MB/s");
+	}
+
+	for (i = 0; i < sizeof macros / sizeof *macros; i++) {
+		bench(&conf, &plain, macros[i], total, rounds);
+	}
+
+	for (i = 0; i < (size_t) argc; i++) {
+		FILE *f;
+
+		f = fopen(argv[i], "r");
+		if (f == NULL) {
+			perror(argv[i]);
+			return 1;
+		}
+
+		while (fgets(fmt, sizeof fmt, f) != NULL) {
+			fmt[strcspn(fmt, "\n")] = '\0';
+
+			bench(&conf, &plain, fmt, total, rounds);
+		}
+
+		fclose(f);
+	}
+
+	if (!json) {
+		printf("all formats\n");
+	}
+
+	for (i = 0; i < 4; i++) {
+		report(NULL, (enum bench_op) i, &total[i], NULL);
+	}
+
+	return 0;
+}
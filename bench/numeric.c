@@ -0,0 +1,158 @@
+/*
+ * Copyright 2017 Katherine Flavel
+ *
+ * See LICENCE for the full copyright terms.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+
+#include <lf/lf.h>
+
+/*
+ * The numeric directives, rendered by lf_render() and by the snprintf()
+ * a hook implementation would otherwise use, for the same records.
+ * Both must give the same text; prints ns per line for each.
+ */
+
+#define FMT "%>s %b %B %D %T %{ms}T %{msec_frac}t %{usec_frac}t %I %O %S %k %p"
+
+enum {
+	RECORDS = 1024,
+	ROUNDS  = 2000
+};
+
+static unsigned long long seed = 88172645463325252ULL;
+
+/* xorshift, so that runs are repeatable */
+static unsigned long long
+next(void)
+{
+	seed ^= seed << 13;
+	seed ^= seed >> 7;
+	seed ^= seed << 17;
+
+	return seed;
+}
+
+static long long
+fdiv(long long n, long long d)
+{
+	return n / d - (n % d < 0);
+}
+
+static size_t
+render_snprintf(const struct lf_record *r, char *buf, size_t size)
+{
+	long long taken;
+	char b[24];
+	int n;
+
+	taken = r->time[LF_WHEN_END] - r->time[LF_WHEN_BEGIN];
+
+	if (r->resp_size == 0) {
+		strcpy(b, "-");
+	} else {
+		snprintf(b, sizeof b, "%llu", (unsigned long long) r->resp_size);
+	}
+
+	n = snprintf(buf, size, "%u %s %llu %lld %lld %lld %03lld %06lld %llu %llu %llu %u %u",
+		r->status, b, (unsigned long long) r->resp_size,
+		taken, taken / 1000000, taken / 1000,
+		fdiv(r->time[LF_WHEN_BEGIN], 1000) - fdiv(r->time[LF_WHEN_BEGIN], 1000000) * 1000,
+		r->time[LF_WHEN_BEGIN] - fdiv(r->time[LF_WHEN_BEGIN], 1000000) * 1000000,
+		(unsigned long long) r->bytes_recv,
+		(unsigned long long) r->bytes_sent,
+		(unsigned long long) r->bytes_xfer,
+		r->keepalive_reqs, r->port[LF_PORT_CANONICAL]);
+
+	return n < 0 ? 0 : (size_t) n;
+}
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+int
+main(void)
+{
+	static struct lf_record rec[RECORDS];
+	static const unsigned status[] = { 200, 200, 200, 200, 304, 301, 404, 500 };
+	struct lf_config conf;
+	struct lf_prog *prog;
+	struct lf_err err;
+	char a[512], b[512];
+	size_t i, j, n, m, total;
+	double t0, t1, t2;
+
+	memset(&conf, 0, sizeof conf);
+
+	prog = lf_compile(&conf, FMT, &err);
+	if (prog == NULL) {
+		fprintf(stderr, "error: %s\n", lf_strerror(err.errnum));
+		return 1;
+	}
+
+	/* sizes spread over orders of magnitude, and some zero for %b */
+	for (i = 0; i < RECORDS; i++) {
+		memset(&rec[i], 0, sizeof rec[i]);
+
+		rec[i].status         = status[next() % 8];
+		rec[i].resp_size      = next() % 8 == 0 ? 0 : next() >> (next() % 48 + 16);
+		rec[i].bytes_recv     = next() >> (next() % 40 + 24);
+		rec[i].bytes_sent     = rec[i].resp_size + next() % 1024;
+		rec[i].bytes_xfer     = rec[i].bytes_recv + rec[i].bytes_sent;
+		rec[i].keepalive_reqs = next() % 100;
+		rec[i].port[LF_PORT_CANONICAL] = next() % 2 ? 80 : 443;
+
+		rec[i].time[LF_WHEN_BEGIN] = 1500000000LL * 1000000 + (long long) (next() % 1000000000000ULL);
+		rec[i].time[LF_WHEN_END]   = rec[i].time[LF_WHEN_BEGIN] + (long long) (next() >> (next() % 32 + 32));
+
+		n = lf_render(prog, &rec[i], a, sizeof a);
+		m = render_snprintf(&rec[i], b, sizeof b);
+		if (n != m || n > sizeof a || 0 != memcmp(a, b, n)) {
+			fprintf(stderr, "numeric: '%.*s' differs from snprintf '%.*s'\n",
+				(int) n, a, (int) m, b);
+			return 1;
+		}
+	}
+
+	total = 0;
+
+	t0 = now();
+
+	for (j = 0; j < ROUNDS; j++) {
+		for (i = 0; i < RECORDS; i++) {
+			total += lf_render(prog, &rec[i], a, sizeof a);
+		}
+	}
+
+	t1 = now();
+
+	for (j = 0; j < ROUNDS; j++) {
+		for (i = 0; i < RECORDS; i++) {
+			total += render_snprintf(&rec[i], b, sizeof b);
+		}
+	}
+
+	t2 = now();
+
+	printf("%-12s %8.1f ns/line\n", "lf_render", (t1 - t0) / ((double) ROUNDS * RECORDS));
+	printf("%-12s %8.1f ns/line\n", "snprintf",  (t2 - t1) / ((double) ROUNDS * RECORDS));
+
+	lf_free(prog);
+
+	/* so that neither loop is optimised away */
+	return total == 0;
+}
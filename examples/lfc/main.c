@@ -0,0 +1,922 @@
+/*
+ * Copyright 2017 Katherine Flavel
+ *
+ * See LICENCE for the full copyright terms.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <ctype.h>
+
+#include <unistd.h>
+
+#include <lf/lf.h>
+
+/*
+ * lfc compiles one format to C: a function to render a struct lf_record
+ * as lf_render() would, and a function to scan a line as lf_scan() would.
+ * Every decision lf_render() and lf_scan() make per directive is made
+ * here instead, so the generated code is straight-line calls to the
+ * helpers in <lf/lfc.h>, with literals and predicates as constants.
+ *
+ * Directives are collected by lf_parse() first, since generating the
+ * scanner needs to look at the literal text either side of each one.
+ *
+ * The generated NAME_fmt[], NAME_render() and NAME_scan() are prefixed
+ * by -n, or lfc by default; lf would collide with liblf's own names.
+ */
+
+enum kind {
+	K_LITERAL,
+	K_CUSTOM,
+	K_IP,
+	K_RESP_SIZE,
+	K_RESP_SIZE_CLF,
+	K_LOOKUP,
+	K_FILENAME,
+	K_REMOTE_HOSTNAME,
+	K_REQ_PROTOCOL,
+	K_KEEPALIVE_REQS,
+	K_REMOTE_LOGNAME,
+	K_REQ_LOGID,
+	K_REQ_METHOD,
+	K_SERVER_PORT,
+	K_ID,
+	K_QUERY_STRING,
+	K_REQ_FIRST_LINE,
+	K_RESP_HANDLER,
+	K_STATUS,
+	K_TIME,
+	K_TIME_FRAC,
+	K_TIME_TAKEN,
+	K_REMOTE_USER,
+	K_URL_PATH,
+	K_SERVER_NAME,
+	K_CONN_STATUS,
+	K_BYTES_RECV,
+	K_BYTES_SENT,
+	K_BYTES_XFER
+};
+
+struct item {
+	enum kind kind;
+	enum lf_redirect redirect;
+	struct lf_pred pred;
+	unsigned arg;  /* enum lf_ip etc, enum lf_table for K_LOOKUP, or a bool */
+	unsigned when; /* enum lf_when */
+	char *p;       /* the literal text, name, or strftime format */
+	size_t n;
+};
+
+struct items {
+	struct item *a;
+	size_t count;
+	size_t size;
+};
+
+#define CLF_TIME "[%d/%b/%Y:%T %z]"
+
+static const char *table[] = {
+	"LF_TABLE_REQ_COOKIE",
+	"LF_TABLE_ENV_VAR",
+	"LF_TABLE_REQ_HEADER",
+	"LF_TABLE_NOTE",
+	"LF_TABLE_REPLY_HEADER",
+	"LF_TABLE_REQ_TRAILER",
+	"LF_TABLE_RESP_TRAILER"
+};
+
+static const char *rtime[] = {
+	"LF_RTIME_MS_FRAC",
+	"LF_RTIME_US_FRAC",
+	"LF_RTIME_MS",
+	"LF_RTIME_US",
+	"LF_RTIME_S"
+};
+
+static struct item *
+push(struct items *items, enum kind kind, const struct lf_pred *pred,
+	enum lf_redirect redirect)
+{
+	struct item *it;
+
+	assert(items != NULL);
+
+	if (items->count == items->size) {
+		struct item *tmp;
+		size_t z;
+
+		z = items->size == 0 ? 16 : items->size * 2;
+
+		tmp = realloc(items->a, z * sizeof *tmp);
+		if (tmp == NULL) {
+			return NULL;
+		}
+
+		items->a = tmp;
+		items->size = z;
+	}
+
+	it = &items->a[items->count];
+
+	memset(it, 0, sizeof *it);
+
+	it->kind     = kind;
+	it->redirect = redirect;
+
+	if (pred != NULL && pred->count > 0) {
+		it->pred = *pred;
+		it->pred.status = malloc(pred->count * sizeof *pred->status);
+		if (it->pred.status == NULL) {
+			return NULL;
+		}
+
+		memcpy(it->pred.status, pred->status, pred->count * sizeof *pred->status);
+	}
+
+	items->count++;
+
+	return it;
+}
+
+static int
+copy(struct item *it, const char *p, size_t n)
+{
+	char *tmp;
+
+	assert(it != NULL);
+
+	tmp = realloc(it->p, it->n + n + 1);
+	if (tmp == NULL) {
+		return 0;
+	}
+
+	memcpy(tmp + it->n, p, n);
+	tmp[it->n + n] = '\0';
+
+	it->p = tmp;
+	it->n += n;
+
+	return 1;
+}
+
+static int
+add_literal(void *opaque, const char *p, size_t n)
+{
+	struct items *items = opaque;
+	struct item *it;
+
+	/* lf_parse() may split long runs */
+	if (items->count > 0 && items->a[items->count - 1].kind == K_LITERAL) {
+		it = &items->a[items->count - 1];
+	} else {
+		it = push(items, K_LITERAL, NULL, LF_REDIRECT_ORIG);
+		if (it == NULL) {
+			return 0;
+		}
+	}
+
+	return copy(it, p, n);
+}
+
+static int
+add(void *opaque, enum kind kind, const struct lf_pred *pred,
+	enum lf_redirect redirect, unsigned arg)
+{
+	struct item *it;
+
+	it = push(opaque, kind, pred, redirect);
+	if (it == NULL) {
+		return 0;
+	}
+
+	it->arg = arg;
+
+	return 1;
+}
+
+static int
+add_lookup(void *opaque, const struct lf_pred *pred,
+	enum lf_redirect redirect, enum lf_table t, const char *name, size_t n)
+{
+	struct item *it;
+
+	it = push(opaque, K_LOOKUP, pred, redirect);
+	if (it == NULL) {
+		return 0;
+	}
+
+	it->arg = t;
+
+	return copy(it, name, n);
+}
+
+#define SIMPLE(name, kind) \
+	static int \
+	add_ ## name(void *opaque, const struct lf_pred *pred, enum lf_redirect redirect) \
+	{ \
+		return add(opaque, kind, pred, redirect, 0); \
+	}
+
+#define ARG(name, kind, type) \
+	static int \
+	add_ ## name(void *opaque, const struct lf_pred *pred, enum lf_redirect redirect, type arg) \
+	{ \
+		return add(opaque, kind, pred, redirect, arg); \
+	}
+
+#define LOOKUP(name, t) \
+	static int \
+	add_ ## name(void *opaque, const struct lf_pred *pred, enum lf_redirect redirect, \
+		const char *p, size_t n) \
+	{ \
+		return add_lookup(opaque, pred, redirect, t, p, n); \
+	}
+
+SIMPLE(resp_size,      K_RESP_SIZE)
+SIMPLE(resp_size_clf,  K_RESP_SIZE_CLF)
+SIMPLE(filename,       K_FILENAME)
+SIMPLE(req_protocol,   K_REQ_PROTOCOL)
+SIMPLE(keepalive_reqs, K_KEEPALIVE_REQS)
+SIMPLE(remote_logname, K_REMOTE_LOGNAME)
+SIMPLE(req_logid,      K_REQ_LOGID)
+SIMPLE(req_method,     K_REQ_METHOD)
+SIMPLE(query_string,   K_QUERY_STRING)
+SIMPLE(req_first_line, K_REQ_FIRST_LINE)
+SIMPLE(resp_handler,   K_RESP_HANDLER)
+SIMPLE(status,         K_STATUS)
+SIMPLE(remote_user,    K_REMOTE_USER)
+SIMPLE(url_path,       K_URL_PATH)
+SIMPLE(conn_status,    K_CONN_STATUS)
+SIMPLE(bytes_recv,     K_BYTES_RECV)
+SIMPLE(bytes_sent,     K_BYTES_SENT)
+SIMPLE(bytes_xfer,     K_BYTES_XFER)
+
+ARG(ip,              K_IP,              enum lf_ip)
+ARG(remote_hostname, K_REMOTE_HOSTNAME, int)
+ARG(server_port,     K_SERVER_PORT,     enum lf_port)
+ARG(id,              K_ID,              enum lf_id)
+ARG(time_taken,      K_TIME_TAKEN,      enum lf_rtime)
+ARG(server_name,     K_SERVER_NAME,     int)
+
+LOOKUP(req_cookie,   LF_TABLE_REQ_COOKIE)
+LOOKUP(env_var,      LF_TABLE_ENV_VAR)
+LOOKUP(req_header,   LF_TABLE_REQ_HEADER)
+LOOKUP(note,         LF_TABLE_NOTE)
+LOOKUP(reply_header, LF_TABLE_REPLY_HEADER)
+LOOKUP(req_trailer,  LF_TABLE_REQ_TRAILER)
+LOOKUP(resp_trailer, LF_TABLE_RESP_TRAILER)
+
+static int
+add_time(void *opaque, const struct lf_pred *pred, enum lf_redirect redirect,
+	enum lf_when when, const char *fmt, size_t n)
+{
+	struct item *it;
+
+	it = push(opaque, K_TIME, pred, redirect);
+	if (it == NULL) {
+		return 0;
+	}
+
+	it->when = when;
+
+	return copy(it, fmt, n);
+}
+
+static int
+add_time_frac(void *opaque, const struct lf_pred *pred, enum lf_redirect redirect,
+	enum lf_when when, enum lf_rtime unit)
+{
+	struct item *it;
+
+	it = push(opaque, K_TIME_FRAC, pred, redirect);
+	if (it == NULL) {
+		return 0;
+	}
+
+	it->when = when;
+	it->arg  = unit;
+
+	return 1;
+}
+
+static int
+add_custom(const struct lf_config *conf, void *opaque,
+	char c, const struct lf_pred *pred, enum lf_redirect redirect,
+	const char *p, size_t n, enum lf_errno *e)
+{
+	(void) conf;
+	(void) c;
+	(void) p;
+	(void) n;
+	(void) e;
+
+	return add(opaque, K_CUSTOM, pred, redirect, 0);
+}
+
+/* a C string literal; octal escapes can't run on into following digits */
+static void
+cstr(const char *p, size_t n)
+{
+	size_t i;
+
+	putchar('"');
+
+	for (i = 0; i < n; i++) {
+		unsigned char c = p[i];
+
+		switch (c) {
+		case '"':  printf("\\\""); break;
+		case '\\': printf("\\\\"); break;
+		case '?':  printf("\\?");  break;
+
+		default:
+			if (isprint(c)) {
+				putchar(c);
+			} else {
+				printf("\\%03o", c);
+			}
+			break;
+		}
+	}
+
+	putchar('"');
+}
+
+/* the same decisions as lf_compile_scanner() */
+static int
+is_int(const struct item *it)
+{
+	switch (it->kind) {
+	case K_RESP_SIZE:
+	case K_RESP_SIZE_CLF:
+	case K_KEEPALIVE_REQS:
+	case K_SERVER_PORT:
+	case K_ID:
+	case K_STATUS:
+	case K_TIME_FRAC:
+	case K_TIME_TAKEN:
+	case K_BYTES_RECV:
+	case K_BYTES_SENT:
+	case K_BYTES_XFER:
+		return 1;
+
+	default:
+		return 0;
+	}
+}
+
+/* numbers which may be rendered negative */
+static int
+is_sint(const struct item *it)
+{
+	switch (it->kind) {
+	case K_TIME_FRAC:
+		return it->arg != LF_RTIME_MS_FRAC && it->arg != LF_RTIME_US_FRAC;
+
+	case K_TIME_TAKEN:
+		return 1;
+
+	default:
+		return 0;
+	}
+}
+
+/* strings, as opposed to numbers and %t in its default format */
+static int
+is_str(const struct item *it)
+{
+	if (it->kind == K_TIME) {
+		return 0 != strcmp(it->p, CLF_TIME);
+	}
+
+	return !is_int(it);
+}
+
+static int
+is_escaped(const struct item *it)
+{
+	switch (it->kind) {
+	case K_LOOKUP:
+	case K_REMOTE_HOSTNAME:
+	case K_REQ_PROTOCOL:
+	case K_REMOTE_LOGNAME:
+	case K_REQ_METHOD:
+	case K_REQ_FIRST_LINE:
+	case K_RESP_HANDLER:
+	case K_URL_PATH:
+	case K_QUERY_STRING:
+	case K_REMOTE_USER:
+	case K_SERVER_NAME:
+		return 1;
+
+	default:
+		return 0;
+	}
+}
+
+static size_t
+occurrences(const char *fmt, const struct item *delim)
+{
+	const char *s;
+	size_t count;
+
+	count = 0;
+
+	for (s = fmt; *s != '\0'; s++) {
+		if (*s == '%') {
+			if (s[1] == 'E' || s[1] == 'O') {
+				s++;
+			}
+			if (s[1] != '\0') {
+				s++;
+			}
+			continue;
+		}
+
+		if (0 == strncmp(s, delim->p, delim->n)
+		 && memchr(s, '%', delim->n) == NULL) {
+			count++;
+		}
+	}
+
+	return count;
+}
+
+static void
+gen_pred(const char *name, size_t i, const struct lf_pred *pred)
+{
+	size_t j;
+
+	printf("static const unsigned char %s_pred%lu[] = {", name, (unsigned long) i);
+
+	for (j = 0; j < sizeof pred->map; j++) {
+		printf("%s0x%02x", j == 0 ? "\n\t" : j % 12 == 0 ? ",\n\t" : ", ", pred->map[j]);
+	}
+
+	printf("\n};\n\n");
+}
+
+static void
+gen_cond(const char *name, size_t i, const struct lf_pred *pred)
+{
+	size_t j;
+
+	printf("(lfc_map(%s_pred%lu, final->status)", name, (unsigned long) i);
+
+	/* statuses the map can't hold */
+	for (j = 0; j < pred->count; j++) {
+		if (pred->status[j] < LF_PRED_MIN || pred->status[j] > LF_PRED_MAX) {
+			printf(" || final->status == %u", pred->status[j]);
+		}
+	}
+
+	printf(") != %d", pred->neg);
+}
+
+static void
+gen_directive(const struct item *it)
+{
+	const char *r;
+
+	r = it->redirect == LF_REDIRECT_FINAL ? "final" : "rec";
+
+	switch (it->kind) {
+	case K_CUSTOM:
+		printf("lfc_dash(&o);\n");
+		break;
+
+	case K_IP:
+		printf("lfc_str(&o, &%s->ip[%u], 0);\n", r, it->arg);
+		break;
+
+	case K_RESP_SIZE:
+		printf("lfc_uint(&o, %s->resp_size, 10);\n", r);
+		break;
+
+	case K_RESP_SIZE_CLF:
+		printf("if (%s->resp_size == 0) lfc_dash(&o); else lfc_uint(&o, %s->resp_size, 10);\n", r, r);
+		break;
+
+	case K_LOOKUP:
+		printf("lfc_lookup(&o, %s, %s, ", r, table[it->arg]);
+		cstr(it->p, it->n);
+		printf(", %lu);\n", (unsigned long) it->n);
+		break;
+
+	case K_FILENAME:
+		printf("lfc_str(&o, &%s->filename, 0);\n", r);
+		break;
+
+	case K_REMOTE_HOSTNAME:
+		if (it->arg) {
+			printf("lfc_str(&o, %s->remote_host.p != NULL ? &%s->remote_host : &%s->ip[LF_IP_CLIENT], 1);\n", r, r, r);
+		} else {
+			printf("lfc_str(&o, &%s->ip[LF_IP_CLIENT], 1);\n", r);
+		}
+		break;
+
+	case K_REQ_PROTOCOL:   printf("lfc_str(&o, &%s->req_protocol, 1);\n",   r); break;
+	case K_REMOTE_LOGNAME: printf("lfc_str(&o, &%s->remote_logname, 1);\n", r); break;
+	case K_REQ_LOGID:      printf("lfc_str(&o, &%s->req_logid, 0);\n",      r); break;
+	case K_REQ_METHOD:     printf("lfc_str(&o, &%s->req_method, 1);\n",     r); break;
+	case K_REQ_FIRST_LINE: printf("lfc_str(&o, &%s->req_first_line, 1);\n", r); break;
+	case K_RESP_HANDLER:   printf("lfc_str(&o, &%s->resp_handler, 1);\n",   r); break;
+	case K_URL_PATH:       printf("lfc_str(&o, &%s->url_path, 1);\n",       r); break;
+
+	case K_KEEPALIVE_REQS:
+		printf("lfc_uint(&o, %s->keepalive_reqs, 10);\n", r);
+		break;
+
+	case K_SERVER_PORT:
+		printf("lfc_uint(&o, %s->port[%u], 10);\n", r, it->arg);
+		break;
+
+	case K_ID:
+		switch (it->arg) {
+		case LF_ID_PID:    printf("lfc_uint(&o, %s->pid, 10);\n", r); break;
+		case LF_ID_TID:    printf("lfc_uint(&o, %s->tid, 10);\n", r); break;
+		case LF_ID_HEXTID: printf("lfc_uint(&o, %s->tid, 16);\n", r); break;
+		}
+		break;
+
+	case K_QUERY_STRING:
+		printf("if (%s->query_string.p != NULL) { lfc_putc(&o, '?'); "
+			"lfc_escaped(&o, %s->query_string.p, %s->query_string.n); }\n", r, r, r);
+		break;
+
+	case K_STATUS:
+		printf("if (%s->status == 0) lfc_dash(&o); else lfc_uint(&o, %s->status, 10);\n", r, r);
+		break;
+
+	case K_TIME:
+		printf("lfc_time(&o, %s->time[%u], ", r, it->when);
+		cstr(it->p, it->n);
+		printf(");\n");
+		break;
+
+	case K_TIME_FRAC:
+		printf("lfc_frac(&o, %s->time[%u], %s);\n", r, it->when, rtime[it->arg]);
+		break;
+
+	case K_TIME_TAKEN:
+		printf("lfc_int(&o, (%s->time[LF_WHEN_END] - %s->time[LF_WHEN_BEGIN]) / %s);\n", r, r,
+			it->arg == LF_RTIME_S ? "1000000" : it->arg == LF_RTIME_MS ? "1000" : "1");
+		break;
+
+	case K_REMOTE_USER:
+		printf("if (%s->remote_user.p != NULL && %s->remote_user.n == 0) lfc_put(&o, \"\\\"\\\"\", 2); "
+			"else lfc_str(&o, &%s->remote_user, 1);\n", r, r, r);
+		break;
+
+	case K_SERVER_NAME:
+		if (it->arg) {
+			printf("lfc_str(&o, &%s->server_name, 1);\n", r);
+		} else {
+			printf("lfc_str(&o, %s->host.p == NULL ? &%s->server_name : &%s->host, 1);\n", r, r, r);
+		}
+		break;
+
+	case K_CONN_STATUS:
+		printf("lfc_putc(&o, %s->aborted ? 'X' : %s->keepalive ? '+' : '-');\n", r, r);
+		break;
+
+	case K_BYTES_RECV: printf("lfc_uint(&o, %s->bytes_recv, 10);\n", r); break;
+	case K_BYTES_SENT: printf("lfc_uint(&o, %s->bytes_sent, 10);\n", r); break;
+	case K_BYTES_XFER: printf("lfc_uint(&o, %s->bytes_xfer, 10);\n", r); break;
+
+	default:
+		assert(!"unreached");
+		abort();
+	}
+}
+
+static void
+gen_render(const char *name, const struct items *items)
+{
+	size_t i;
+	int final;
+
+	/* final is only needed for > and for predicates */
+	final = 0;
+	for (i = 0; i < items->count; i++) {
+		final |= items->a[i].redirect == LF_REDIRECT_FINAL && items->a[i].kind != K_LITERAL;
+		final |= items->a[i].pred.count > 0;
+	}
+
+	for (i = 0; i < items->count; i++) {
+		if (items->a[i].pred.count > 0) {
+			gen_pred(name, i, &items->a[i].pred);
+		}
+	}
+
+	printf("size_t\n");
+	printf("%s_render(const struct lf_record *rec, char *buf, size_t size)\n", name);
+	printf("{\n");
+	if (final) {
+		printf("\tconst struct lf_record *final;\n");
+	}
+	printf("\tstruct lfc_out o;\n");
+	printf("\n");
+	printf("\to.p    = buf;\n");
+	printf("\to.size = size;\n");
+	printf("\to.n    = 0;\n");
+	printf("\n");
+	if (final) {
+		printf("\tfinal = rec->final != NULL ? rec->final : rec;\n");
+		printf("\n");
+	}
+
+	/* a format of only literal text needs no record */
+	for (i = 0; i < items->count && items->a[i].kind == K_LITERAL; i++)
+		;
+
+	if (i == items->count) {
+		printf("\t(void) rec;\n");
+		printf("\n");
+	}
+
+	for (i = 0; i < items->count; i++) {
+		const struct item *it = &items->a[i];
+
+		if (it->kind == K_LITERAL) {
+			printf("\tlfc_put(&o, ");
+			cstr(it->p, it->n);
+			printf(", %lu);\n", (unsigned long) it->n);
+			continue;
+		}
+
+		if (it->pred.count == 0) {
+			printf("\t");
+			gen_directive(it);
+			continue;
+		}
+
+		printf("\tif (");
+		gen_cond(name, i, &it->pred);
+		printf(") {\n");
+		printf("\t\t");
+		gen_directive(it);
+		printf("\t} else {\n");
+		printf("\t\tlfc_dash(&o);\n");
+		printf("\t}\n");
+	}
+
+	printf("\n");
+	printf("\treturn o.n;\n");
+	printf("}\n");
+}
+
+static void
+gen_scan(const char *name, const struct items *items)
+{
+	size_t i, j;
+	int escapes, fields, delims;
+
+	escapes = 0;
+	fields  = 0;
+	delims  = 0;
+	for (i = 0; i < items->count; i++) {
+		const struct item *it = &items->a[i];
+
+		escapes |= is_escaped(it);
+		fields  |= it->kind != K_LITERAL;
+
+		/* all but a string at the end of the line are found by q */
+		delims |= it->kind != K_LITERAL && (i + 1 < items->count || !is_str(it));
+	}
+
+	printf("int\n");
+	printf("%s_scan(const char *line, size_t len, struct lf_field *fields, char *buf)\n", name);
+	printf("{\n");
+	printf("\tconst char *p, %send;\n", delims ? "*q, *" : "*");
+	if (escapes) {
+		printf("\tsize_t bufn;\n");
+	}
+	printf("\n");
+	printf("\tp   = line;\n");
+	printf("\tend = line + len;\n");
+	printf("\n");
+	if (escapes) {
+		printf("\tbufn = 0;\n");
+	} else {
+		printf("\t(void) buf;\n");
+	}
+	if (!fields) {
+		printf("\t(void) fields;\n");
+	}
+
+	for (i = 0, j = 0; i < items->count; i++) {
+		const struct item *it, *prev, *next;
+
+		it = &items->a[i];
+
+		printf("\n");
+
+		if (it->kind == K_LITERAL) {
+			printf("\tif (!lfc_literal(&p, end, ");
+			cstr(it->p, it->n);
+			printf(", %lu)) {\n", (unsigned long) it->n);
+			printf("\t\treturn 0;\n");
+			printf("\t}\n");
+			continue;
+		}
+
+		prev = i > 0 && items->a[i - 1].kind == K_LITERAL ? &items->a[i - 1] : NULL;
+		next = i + 1 < items->count && items->a[i + 1].kind == K_LITERAL ? &items->a[i + 1] : NULL;
+
+		if (is_sint(it)) {
+			printf("\tq = lf_scan_sint(p, end, &fields[%lu]);\n", (unsigned long) j);
+		} else if (is_int(it)) {
+			printf("\tq = lf_scan_int(p, end, %d, %d, &fields[%lu]);\n",
+				it->kind == K_ID && it->arg == LF_ID_HEXTID ? 16 : 10,
+				it->kind == K_RESP_SIZE_CLF, (unsigned long) j);
+		} else if (!is_str(it)) {
+			printf("\tq = lf_scan_time(p, end, &fields[%lu]);\n", (unsigned long) j);
+		} else {
+			if (prev != NULL && prev->p[prev->n - 1] == '"' && next != NULL && next->p[0] == '"') {
+				printf("\tq = lfc_quote(p, end);\n");
+			} else if (next != NULL) {
+				printf("\tq = lfc_delim(p, end, ");
+				cstr(next->p, next->n);
+				printf(", %lu, %lu);\n", (unsigned long) next->n,
+					(unsigned long) (it->kind == K_TIME ? occurrences(it->p, next) : 0));
+			} else {
+				/* the rest of the line, which can't be missing */
+				printf("\tlf_scan_str(p, end, %d, %d, &fields[%lu], %s, %s);\n",
+					is_escaped(it), it->kind == K_REMOTE_USER, (unsigned long) j,
+					escapes ? "buf" : "NULL", escapes ? "&bufn" : "NULL");
+				printf("\tp = end;\n");
+
+				j++;
+				continue;
+			}
+
+			printf("\tif (q == NULL) {\n");
+			printf("\t\treturn 0;\n");
+			printf("\t}\n");
+			printf("\tlf_scan_str(p, q, %d, %d, &fields[%lu], %s, %s);\n",
+				is_escaped(it), it->kind == K_REMOTE_USER, (unsigned long) j,
+				escapes ? "buf" : "NULL", escapes ? "&bufn" : "NULL");
+			printf("\tp = q;\n");
+
+			j++;
+			continue;
+		}
+
+		printf("\tif (q == NULL) {\n");
+		printf("\t\treturn 0;\n");
+		printf("\t}\n");
+		printf("\tp = q;\n");
+
+		j++;
+	}
+
+	printf("\n");
+	printf("\treturn p == end;\n");
+	printf("}\n");
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: lfc [-n name] fmt\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct lf_scanner *sc;
+	struct lf_config conf;
+	struct items items;
+	struct lf_err err;
+	const char *fmt, *name;
+	size_t i;
+
+	{
+		int c;
+
+		name = "lfc";
+
+		while (c = getopt(argc, argv, "n:"), c != -1) {
+			switch (c) {
+			case 'n':
+				name = optarg;
+				break;
+
+			case '?':
+			default:
+				usage();
+				return 1;
+			}
+		}
+
+		argc -= optind;
+		argv += optind;
+
+		if (argc != 1) {
+			usage();
+			return 1;
+		}
+
+		fmt = argv[0];
+	}
+
+	memset(&conf, 0, sizeof conf);
+
+	conf.literal_span    = add_literal;
+	conf.custom          = add_custom;
+	conf.ip              = add_ip;
+	conf.resp_size       = add_resp_size;
+	conf.resp_size_clf   = add_resp_size_clf;
+	conf.filename        = add_filename;
+	conf.remote_hostname = add_remote_hostname;
+	conf.req_protocol    = add_req_protocol;
+	conf.keepalive_reqs  = add_keepalive_reqs;
+	conf.remote_logname  = add_remote_logname;
+	conf.req_logid       = add_req_logid;
+	conf.req_method      = add_req_method;
+	conf.server_port     = add_server_port;
+	conf.id              = add_id;
+	conf.query_string    = add_query_string;
+	conf.req_first_line  = add_req_first_line;
+	conf.resp_handler    = add_resp_handler;
+	conf.status          = add_status;
+	conf.time_frac       = add_time_frac;
+	conf.time_taken      = add_time_taken;
+	conf.remote_user     = add_remote_user;
+	conf.url_path        = add_url_path;
+	conf.server_name     = add_server_name;
+	conf.conn_status     = add_conn_status;
+	conf.bytes_recv      = add_bytes_recv;
+	conf.bytes_sent      = add_bytes_sent;
+	conf.bytes_xfer      = add_bytes_xfer;
+
+	conf.req_cookien     = add_req_cookie;
+	conf.env_varn        = add_env_var;
+	conf.req_headern     = add_req_header;
+	conf.noten           = add_note;
+	conf.reply_headern   = add_reply_header;
+	conf.timen           = add_time;
+	conf.req_trailern    = add_req_trailer;
+	conf.resp_trailern   = add_resp_trailer;
+
+	memset(&items, 0, sizeof items);
+
+	if (!lf_parse(&conf, &items, fmt, &err)) {
+		if (err.errnum == LF_ERR_ERRNO) {
+			perror("lf_parse");
+		} else {
+			fprintf(stderr, "error: %s at %u\n", lf_strerror(err.errnum),
+				(unsigned) (err.p - fmt));
+		}
+		return 1;
+	}
+
+	/* the scanner decides whether a format can be scanned at all */
+	sc = lf_compile_scanner(&conf, fmt, &err);
+	if (sc == NULL && err.errnum != LF_ERR_AMBIGUOUS_DIRECTIVES) {
+		perror("lf_compile_scanner");
+		return 1;
+	}
+
+	printf("/* generated by lfc */\n");
+	printf("\n");
+	printf("#define _POSIX_C_SOURCE 200809L\n");
+	printf("\n");
+	printf("#include <stddef.h>\n");
+	printf("\n");
+	printf("#include <lf/lf.h>\n");
+	printf("#include <lf/lfc.h>\n");
+	printf("\n");
+	printf("const char %s_fmt[] = ", name);
+	cstr(fmt, strlen(fmt));
+	printf(";\n");
+	printf("\n");
+
+	gen_render(name, &items);
+
+	if (sc != NULL) {
+		printf("\n");
+		gen_scan(name, &items);
+	} else {
+		printf("\n");
+		printf("/* no %s_scan(): %s */\n", name, lf_strerror(err.errnum));
+	}
+
+	lf_free_scanner(sc);
+
+	for (i = 0; i < items.count; i++) {
+		free(items.a[i].pred.status);
+		free(items.a[i].p);
+	}
+
+	free(items.a);
+
+	return 0;
+}
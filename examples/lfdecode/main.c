@@ -0,0 +1,236 @@
+/*
+ * Copyright 2017 Katherine Flavel
+ *
+ * See LICENCE for the full copyright terms.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+
+#include <lf/lf.h>
+
+/*
+ * Replay a stream of binary records (as written by lfrender -b, or
+ * by a server using lf_encode()) through lf_render(), giving the same
+ * text the server would have logged, one line per record.
+ *
+ * Times are rendered in the encoder's zone, by setting TZ as its header
+ * says. Where the encoder had no TZ, its zone was its system's, and the
+ * text is the same only if ours is too.
+ */
+
+/* TZ as we started with, for streams which don't say */
+static char *tz_ours;
+
+struct in {
+	FILE *f;
+	char *p;
+	size_t n;    /* bytes held */
+	size_t size;
+	int eof;
+};
+
+/* read more, keeping the first n bytes held */
+static int
+more(struct in *in)
+{
+	size_t z;
+
+	if (in->n == in->size) {
+		char *tmp;
+
+		tmp = realloc(in->p, in->size * 2);
+		if (tmp == NULL) {
+			return 0;
+		}
+
+		in->p = tmp;
+		in->size *= 2;
+	}
+
+	z = fread(in->p + in->n, 1, in->size - in->n, in->f);
+	if (z == 0) {
+		if (ferror(in->f)) {
+			return 0;
+		}
+
+		in->eof = 1;
+	}
+
+	in->n += z;
+
+	return 1;
+}
+
+static void
+consume(struct in *in, size_t n)
+{
+	memmove(in->p, in->p + n, in->n - n);
+	in->n -= n;
+}
+
+/* the encoder's TZ, or ours if it had none */
+static int
+zone(const char *tz)
+{
+	if (tz == NULL) {
+		tz = tz_ours;
+	}
+
+	if (-1 == (tz != NULL ? setenv("TZ", tz, 1) : unsetenv("TZ"))) {
+		return 0;
+	}
+
+	lf_tzset();
+
+	return 1;
+}
+
+static int
+decode(const char *name, struct in *in)
+{
+	struct lf_decoder *d;
+	struct lf_record rec;
+	struct lf_err err;
+	unsigned long long off;
+	char small[512];
+	char *buf;
+	size_t n, used;
+
+	d   = NULL;
+	off = 0;
+
+	for (;;) {
+		int header;
+		int ok;
+
+		header = d == NULL;
+
+		if (header) {
+			d = lf_new_decoder(in->p, in->n, &used, &err);
+			ok = d != NULL;
+		} else {
+			ok = lf_decode(d, in->p, in->n, &used, &rec, &err);
+		}
+
+		if (!ok && err.errnum == LF_ERR_TRUNCATED_RECORD && !in->eof) {
+			if (!more(in)) {
+				perror(name);
+				goto error;
+			}
+
+			continue;
+		}
+
+		/* the end of the stream, between records */
+		if (!ok && err.errnum == LF_ERR_TRUNCATED_RECORD && in->n == 0) {
+			break;
+		}
+
+		if (!ok) {
+			fprintf(stderr, "%s: error: %s at %llu\n", name,
+				lf_strerror(err.errnum), off);
+			goto error;
+		}
+
+		off += used;
+		consume(in, used);
+
+		if (header) {
+			if (!zone(lf_decoder_tz(d))) {
+				perror("TZ");
+				goto error;
+			}
+
+			continue;
+		}
+
+		n = lf_render(lf_decoder_prog(d), &rec, small, sizeof small);
+		if (n <= sizeof small) {
+			buf = small;
+		} else {
+			buf = malloc(n);
+			if (buf == NULL) {
+				perror("malloc");
+				goto error;
+			}
+
+			(void) lf_render(lf_decoder_prog(d), &rec, buf, n);
+		}
+
+		fwrite(buf, 1, n, stdout);
+		putchar('\n');
+
+		if (buf != small) {
+			free(buf);
+		}
+	}
+
+	lf_free_decoder(d);
+
+	return 1;
+
+error:
+
+	lf_free_decoder(d);
+
+	return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct in in;
+	int i, r;
+
+	if (getenv("TZ") != NULL) {
+		tz_ours = strdup(getenv("TZ"));
+		if (tz_ours == NULL) {
+			perror("strdup");
+			return 1;
+		}
+	}
+
+	in.size = 8192;
+	in.p    = malloc(in.size);
+	if (in.p == NULL) {
+		perror("malloc");
+		return 1;
+	}
+
+	r = 0;
+
+	if (argc < 2) {
+		in.f   = stdin;
+		in.n   = 0;
+		in.eof = 0;
+
+		r |= !decode("stdin", &in);
+	}
+
+	for (i = 1; i < argc; i++) {
+		in.f = fopen(argv[i], "rb");
+		if (in.f == NULL) {
+			perror(argv[i]);
+			r = 1;
+			continue;
+		}
+
+		in.n   = 0;
+		in.eof = 0;
+
+		r |= !decode(argv[i], &in);
+
+		fclose(in.f);
+	}
+
+	free(in.p);
+	free(tz_ours);
+
+	return r;
+}
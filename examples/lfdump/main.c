@@ -4,6 +4,8 @@
  * See LICENCE for the full copyright terms.
  */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <assert.h>
 #include <stdlib.h>
 #include <string.h>
@@ -11,6 +13,8 @@
 #include <errno.h>
 #include <ctype.h>
 
+#include <unistd.h>
+
 #include <lf/lf.h>
 
 static void
@@ -70,6 +74,36 @@ print_literal(void *opaque, char c)
 	return 1;
 }
 
+static int
+print_literal_span(void *opaque, const char *p, size_t n)
+{
+	size_t i;
+
+	assert(opaque == NULL);
+	assert(p != NULL);
+
+	/* as for print_literal(), but shown as one run */
+	for (i = 0; i < n; i++) {
+		if (p[i] == '\n' || p[i] == '\t') {
+			errno = EDOM;
+			return 0;
+		}
+	}
+
+	printf("literal: \"");
+	for (i = 0; i < n; i++) {
+		unsigned char c = p[i];
+
+		if (isalnum(c) || ispunct(c) || c == ' ') {
+			printf("%c", c);
+		} else {
+			printf("\\x%02X", c);
+		}
+	}
+	printf("\"\n");
+	return 1;
+}
+
 static int
 print_ip(void *opaque, const struct lf_pred *pred,
 	enum lf_redirect redirect, enum lf_ip ip)
@@ -536,6 +570,96 @@ print_resp_trailer(void *opaque, const struct lf_pred *pred,
 	return 1;
 }
 
+/*
+ * Pointer and length variants of the named hooks,
+ * for names which are not NUL terminated.
+ */
+
+static int
+print_namen(const struct lf_pred *pred, enum lf_redirect redirect,
+	const char *hook, const char *name, size_t n)
+{
+	print_pred(pred);
+	print_redirect(redirect);
+	printf("%s: %.*s\n", hook, (int) n, name);
+	return 1;
+}
+
+static int
+print_req_cookien(void *opaque, const struct lf_pred *pred,
+	enum lf_redirect redirect, const char *name, size_t n)
+{
+	assert(opaque == NULL);
+
+	return print_namen(pred, redirect, "req_cookie", name, n);
+}
+
+static int
+print_env_varn(void *opaque, const struct lf_pred *pred,
+	enum lf_redirect redirect, const char *name, size_t n)
+{
+	assert(opaque == NULL);
+
+	return print_namen(pred, redirect, "env_var", name, n);
+}
+
+static int
+print_req_headern(void *opaque, const struct lf_pred *pred,
+	enum lf_redirect redirect, const char *name, size_t n)
+{
+	assert(opaque == NULL);
+
+	return print_namen(pred, redirect, "req_header", name, n);
+}
+
+static int
+print_noten(void *opaque, const struct lf_pred *pred,
+	enum lf_redirect redirect, const char *name, size_t n)
+{
+	assert(opaque == NULL);
+
+	return print_namen(pred, redirect, "note", name, n);
+}
+
+static int
+print_reply_headern(void *opaque, const struct lf_pred *pred,
+	enum lf_redirect redirect, const char *name, size_t n)
+{
+	assert(opaque == NULL);
+
+	return print_namen(pred, redirect, "reply_header", name, n);
+}
+
+static int
+print_strftimen(void *opaque, const struct lf_pred *pred,
+	enum lf_redirect redirect, enum lf_when when, const char *fmt, size_t n)
+{
+	assert(opaque == NULL);
+
+	print_pred(pred);
+	print_redirect(redirect);
+	printf("strftime: (when=%d, fmt=%.*s)\n", when, (int) n, fmt);
+	return 1;
+}
+
+static int
+print_req_trailern(void *opaque, const struct lf_pred *pred,
+	enum lf_redirect redirect, const char *name, size_t n)
+{
+	assert(opaque == NULL);
+
+	return print_namen(pred, redirect, "req_trailer", name, n);
+}
+
+static int
+print_resp_trailern(void *opaque, const struct lf_pred *pred,
+	enum lf_redirect redirect, const char *name, size_t n)
+{
+	assert(opaque == NULL);
+
+	return print_namen(pred, redirect, "resp_trailer", name, n);
+}
+
 static int
 custom(const struct lf_config *conf, void *opaque,
 	char c, const struct lf_pred *pred, enum lf_redirect redirect, const char *p, size_t n,
@@ -568,14 +692,124 @@ custom(const struct lf_config *conf, void *opaque,
 	return 1;
 }
 
+static void
+print_error(const char *fmt, const struct lf_err *err)
+{
+	size_t i, z, n;
+	int r;
+
+	assert(fmt != NULL);
+	assert(err != NULL);
+
+	z = strlen(fmt);
+
+	assert(err->p >= fmt);
+	assert(err->n <= z);
+
+	if (err->errnum == LF_ERR_ERRNO && errno == EDOM) {
+		fprintf(stderr, "error: Disallowed character\n");
+	} else {
+		fprintf(stderr, "error: %s\n", lf_strerror(err->errnum));
+	}
+
+	/* note not all directives are exactly one character */
+
+	r = fprintf(stderr, "at %lu: ", (unsigned long) (err->p - fmt));
+	fprintf(stderr, "'");
+	for (i = 0; i < z; i++) {
+		unsigned char c = fmt[i];
+		if (isalnum(c) || ispunct(c) || c == ' ') {
+			fprintf(stderr, "%c", c);
+		} else {
+			fprintf(stderr, "."); /* TODO: would need to lengthen indicator for hex sequences here */
+		}
+	}
+	fprintf(stderr, "'\n");
+
+	for (i = 0; (int) i < r + 1; i++) {
+		fprintf(stderr, "-");
+	}
+
+	for (i = 0; i < (size_t) (err->p - fmt); i++) {
+		fprintf(stderr, "-");
+	}
+
+	n = err->n;
+	if (n == 0) {
+		n++;
+	}
+
+	for (i = 0; i < n; i++) {
+		assert(fmt[i] != '\0');
+		fprintf(stderr, "^");
+	}
+
+	fprintf(stderr, "\n");
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: lfdump [-clns] fmt\n");
+}
+
 int
 main(int argc, char *argv[])
 {
 	struct lf_config conf;
+	struct lf_prog *prog;
 	struct lf_err err;
+	const char *fmt;
+	char *copy;
+	size_t len;
+	int compile;
+	int namen;
+	int bounded;
+	int span;
+
+	{
+		int c;
+
+		compile = 0;
+		namen   = 0;
+		bounded = 0;
+		span    = 0;
+
+		while (c = getopt(argc, argv, "clns"), c != -1) {
+			switch (c) {
+			case 'c':
+				compile = 1;
+				break;
+
+			case 'l':
+				bounded = 1;
+				break;
+
+			case 'n':
+				namen = 1;
+				break;
+
+			case 's':
+				span = 1;
+				break;
+
+			case '?':
+			default:
+				usage();
+				return 1;
+			}
+		}
 
-	(void) argc;
-	(void) argv; /* TODO */
+		argc -= optind;
+		argv += optind;
+
+		if (argc != 1) {
+			usage();
+			return 1;
+		}
+
+		fmt = argv[0];
+	}
 
 	conf.keep_alive         = 0;
 	conf.hostname_lookups   = 0;
@@ -585,7 +819,9 @@ main(int argc, char *argv[])
 	conf.override = NULL; /* XXX: "XYZ"; */
 	conf.custom   = custom;
 
+	/* by default we want to reject individual characters */
 	conf.literal            = print_literal;
+	conf.literal_span       = span ? print_literal_span : NULL;
 
 	conf.ip                 = print_ip;
 	conf.resp_size          = print_resp_size;
@@ -621,58 +857,100 @@ main(int argc, char *argv[])
 	conf.req_trailer        = print_req_trailer;
 	conf.resp_trailer       = print_resp_trailer;
 
-	if (!lf_parse(&conf, NULL, argv[1], &err)) {
-		size_t i, z;
-		int r;
+	if (namen) {
+		conf.req_cookien    = print_req_cookien;
+		conf.env_varn       = print_env_varn;
+		conf.req_headern    = print_req_headern;
+		conf.noten          = print_noten;
+		conf.reply_headern  = print_reply_headern;
+		conf.timen          = print_strftimen;
+		conf.req_trailern   = print_req_trailern;
+		conf.resp_trailern  = print_resp_trailern;
+	} else {
+		conf.req_cookien    = NULL;
+		conf.env_varn       = NULL;
+		conf.req_headern    = NULL;
+		conf.noten          = NULL;
+		conf.reply_headern  = NULL;
+		conf.timen          = NULL;
+		conf.req_trailern   = NULL;
+		conf.resp_trailern  = NULL;
+	}
 
-		z = strlen(argv[1]);
+	len = strlen(fmt);
+
+	/*
+	 * For -l, the format is given by length in a buffer of exactly
+	 * that size, with no terminating NUL. Errors point into that copy,
+	 * and are rebased onto fmt for display.
+	 */
+	if (bounded) {
+		copy = malloc(len + (len == 0));
+		if (copy == NULL) {
+			perror("malloc");
+			return 1;
+		}
 
-		assert(err.p >= argv[1]);
-		assert(err.n <= z);
+		memcpy(copy, fmt, len);
+	} else {
+		copy = NULL;
+	}
+
+	if (!compile) {
+		int r;
 
-		if (err.errnum == LF_ERR_ERRNO && errno == EDOM) {
-			fprintf(stderr, "error: Disallowed character\n");
+		if (bounded) {
+			r = lf_parsen(&conf, NULL, copy, len, &err);
 		} else {
-			fprintf(stderr, "error: %s\n", lf_strerror(err.errnum));
+			r = lf_parse(&conf, NULL, fmt, &err);
 		}
 
-		/* note not all directives are exactly one character */
-
-		r = fprintf(stderr, "at %lu: ", err.p - argv[1]);
-		fprintf(stderr, "'");
-		z = strlen(argv[1]);
-		for (i = 0; i < z; i++) {
-			unsigned char c = argv[1][i];
-			if (isalnum(c) || ispunct(c) || c == ' ') {
-				fprintf(stderr, "%c", c);
-			} else {
-				fprintf(stderr, "."); /* TODO: would need to lengthen indicator for hex sequences here */
+		if (!r) {
+			if (bounded) {
+				err.p = fmt + (err.p - copy);
 			}
-		}
-		fprintf(stderr, "'\n");
 
-		for (i = 0; (int) i < r + 1; i++) {
-			fprintf(stderr, "-");
+			print_error(fmt, &err);
+			free(copy);
+			return 1;
 		}
 
-		for (i = 0; i < (size_t) (err.p - argv[1]); i++) {
-			fprintf(stderr, "-");
-		}
+		free(copy);
+		return 0;
+	}
 
-		if (err.n == 0) {
-			err.n++;
-		}
+	/*
+	 * The output for a compiled format is identical to lf_parse(),
+	 * except errors from hooks point into the program's own copy
+	 * of the format string.
+	 */
+
+	if (bounded) {
+		prog = lf_compilen(&conf, copy, len, &err);
+	} else {
+		prog = lf_compile(&conf, fmt, &err);
+	}
 
-		for (i = 0; i < err.n; i++) {
-			assert(argv[1][i] != '\0');
-			fprintf(stderr, "^");
+	if (prog == NULL) {
+		if (bounded) {
+			err.p = fmt + (err.p - copy);
 		}
 
-		fprintf(stderr, "\n");
+		print_error(fmt, &err);
+		free(copy);
+		return 1;
+	}
 
+	free(copy);
+
+	if (!lf_exec(&conf, NULL, prog, &err)) {
+		print_error(lf_fmt(prog), &err);
+		lf_free(prog);
 		return 1;
 	}
 
+	lf_free(prog);
+
 	return 0;
 }
 
@@ -0,0 +1,314 @@
+/*
+ * Copyright 2017 Katherine Flavel
+ *
+ * See LICENCE for the full copyright terms.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <ctype.h>
+
+#include <unistd.h>
+
+#include <lf/lf.h>
+
+#define STR(s) { s, sizeof s - 1 }
+
+struct entry {
+	enum lf_table table;
+	const char *name;
+	struct lf_str value;
+};
+
+/*
+ * A made-up request, after the example in Apache's documentation.
+ * Every field is populated, so that each directive has something to show.
+ */
+static const struct entry entries[] = {
+	{ LF_TABLE_REQ_HEADER,   "Referer",      STR("http://www.example.com/start.html") },
+	{ LF_TABLE_REQ_HEADER,   "User-agent",   STR("Mozilla/4.08 [en] (Win98; I ;Nav)") },
+	{ LF_TABLE_REQ_HEADER,   "X-Escape",     STR("a\"b\\c\nd\te\001f\377") },
+	{ LF_TABLE_REQ_HEADER,   "X-Empty",      STR("") },
+	{ LF_TABLE_REQ_HEADER,   "X-Long",       STR("Mozilla/5.0 (X11; Linux x86_64; rv:109.0) Gecko/20100101 ~_~ Firefox/115.0 "
+	                                             "\"quoted\" back\\slash\x7f del \xc3\xa9 utf-8 \x1f us, "
+	                                             "and then a clean tail of more than thirty-two bytes") },
+	{ LF_TABLE_REQ_COOKIE,   "session",      STR("abc123") },
+	{ LF_TABLE_ENV_VAR,      "HOME",         STR("/home/frank") },
+	{ LF_TABLE_NOTE,         "note",         STR("noted") },
+	{ LF_TABLE_REPLY_HEADER, "Content-Type", STR("image/gif") },
+	{ LF_TABLE_REQ_TRAILER,  "X-Checksum",   STR("d41d8cd9") },
+	{ LF_TABLE_RESP_TRAILER, "X-Status",     STR("done") }
+};
+
+static int
+caseeq(const char *a, const char *b, size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		if (tolower((unsigned char) a[i]) != tolower((unsigned char) b[i])) {
+			return 0;
+		}
+	}
+
+	return b[n] == '\0';
+}
+
+static struct lf_str
+lookup(void *opaque, enum lf_table table, const char *name, size_t n)
+{
+	struct lf_str none = { NULL, 0 };
+	size_t i;
+
+	assert(opaque == NULL);
+	assert(name != NULL);
+
+	for (i = 0; i < sizeof entries / sizeof *entries; i++) {
+		if (entries[i].table != table) {
+			continue;
+		}
+
+		/* header names are case-insensitive; the rest aren't */
+		if (table == LF_TABLE_REQ_HEADER || table == LF_TABLE_REPLY_HEADER
+		 || table == LF_TABLE_REQ_TRAILER || table == LF_TABLE_RESP_TRAILER) {
+			if (caseeq(name, entries[i].name, n)) {
+				return entries[i].value;
+			}
+		} else if (strlen(entries[i].name) == n && 0 == memcmp(name, entries[i].name, n)) {
+			return entries[i].value;
+		}
+	}
+
+	return none;
+}
+
+static void
+sample(struct lf_record *rec)
+{
+	struct lf_str none = { NULL, 0 };
+
+	assert(rec != NULL);
+
+	rec->final = NULL;
+
+	rec->ip[LF_IP_CLIENT].p = "192.0.2.1";    rec->ip[LF_IP_CLIENT].n = 9;
+	rec->ip[LF_IP_PEER  ].p = "192.0.2.2";    rec->ip[LF_IP_PEER  ].n = 9;
+	rec->ip[LF_IP_LOCAL ].p = "198.51.100.7"; rec->ip[LF_IP_LOCAL ].n = 12;
+
+	rec->port[LF_PORT_CANONICAL] = 80;
+	rec->port[LF_PORT_LOCAL]     = 8080;
+	rec->port[LF_PORT_REMOTE]    = 51234;
+
+	rec->remote_host    = none;
+	rec->remote_logname = none;
+
+	rec->remote_user.p    = "frank";                           rec->remote_user.n    = 5;
+	rec->server_name.p    = "www.example.com";                 rec->server_name.n    = 15;
+	rec->host.p           = "example.com";                     rec->host.n           = 11;
+	rec->req_first_line.p = "GET /apache_pb.gif?x=1 HTTP/1.0"; rec->req_first_line.n = 31;
+	rec->req_method.p     = "GET";                             rec->req_method.n     = 3;
+	rec->req_protocol.p   = "HTTP/1.0";                        rec->req_protocol.n   = 8;
+	rec->url_path.p       = "/apache_pb.gif";                  rec->url_path.n       = 14;
+	rec->query_string.p   = "x=1";                             rec->query_string.n   = 3;
+	rec->filename.p       = "/var/www/apache_pb.gif";          rec->filename.n       = 22;
+	rec->resp_handler     = none;
+	rec->req_logid.p      = "WhR2Uw";                          rec->req_logid.n      = 6;
+
+	rec->status         = 200;
+	rec->keepalive_reqs = 2;
+	rec->aborted        = 0;
+	rec->keepalive      = 1;
+
+	rec->resp_size  = 2326;
+	rec->bytes_recv = 512;
+	rec->bytes_sent = 2600;
+	rec->bytes_xfer = 3112;
+
+	rec->pid = 1234;
+	rec->tid = 140734567890432ULL;
+
+	/* 10/Oct/2000:20:55:36 UTC */
+	rec->time[LF_WHEN_BEGIN] = 971211336LL * 1000000 + 123456;
+	rec->time[LF_WHEN_END]   = rec->time[LF_WHEN_BEGIN] + 1500250;
+
+	rec->lookup = lookup;
+	rec->opaque = NULL;
+}
+
+static int
+write_binary(void *opaque, const void *p, size_t n)
+{
+	return fwrite(p, 1, n, opaque) == n;
+}
+
+/* -b writes the request as a binary record, for lfdecode */
+static int
+binary(const struct lf_config *conf, const struct lf_prog *prog,
+	const struct lf_record *rec)
+{
+	struct lf_encoder *e;
+	int ok;
+
+	e = lf_new_encoder(conf, prog);
+	if (e == NULL) {
+		perror("lf_new_encoder");
+		return 0;
+	}
+
+	ok = lf_encode_header(e, write_binary, stdout)
+	  && lf_encode(e, rec, write_binary, stdout);
+	if (!ok) {
+		perror("lf_encode");
+	}
+
+	lf_free_encoder(e);
+
+	return ok;
+}
+
+/* never called; lf_render() outputs "-" for directives given to .custom */
+static int
+custom(const struct lf_config *conf, void *opaque,
+	char c, const struct lf_pred *pred, enum lf_redirect redirect, const char *p, size_t n,
+	enum lf_errno *e)
+{
+	(void) conf;
+	(void) opaque;
+	(void) c;
+	(void) pred;
+	(void) redirect;
+	(void) p;
+	(void) n;
+	(void) e;
+
+	return 1;
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: lfrender [-br] [-o override] fmt\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct lf_record rec, final;
+	struct lf_config conf;
+	struct lf_prog *prog;
+	struct lf_err err;
+	const char *fmt, *override;
+	char small[32];
+	char *buf;
+	size_t n;
+	int redirect;
+	int bin;
+
+	{
+		int c;
+
+		redirect = 0;
+		bin      = 0;
+		override = NULL;
+
+		while (c = getopt(argc, argv, "bo:r"), c != -1) {
+			switch (c) {
+			case 'b':
+				bin = 1;
+				break;
+
+			case 'o':
+				override = optarg;
+				break;
+
+			case 'r':
+				redirect = 1;
+				break;
+
+			case '?':
+			default:
+				usage();
+				return 1;
+			}
+		}
+
+		argc -= optind;
+		argv += optind;
+
+		if (argc != 1) {
+			usage();
+			return 1;
+		}
+
+		fmt = argv[0];
+	}
+
+	/* lf_compile() doesn't call any hooks */
+	memset(&conf, 0, sizeof conf);
+
+	conf.override = override;
+	conf.custom   = custom;
+
+	prog = lf_compile(&conf, fmt, &err);
+	if (prog == NULL) {
+		fprintf(stderr, "error: %s at %u\n", lf_strerror(err.errnum),
+			(unsigned) (err.p - fmt));
+		return 1;
+	}
+
+	sample(&rec);
+
+	/* -r internally redirects to an error page */
+	if (redirect) {
+		final = rec;
+		final.status = 404;
+		final.url_path.p = "/404.html";
+		final.url_path.n = 9;
+		final.resp_size = 0;
+
+		rec.final = &final;
+	}
+
+	if (bin) {
+		int ok;
+
+		ok = binary(&conf, prog, &rec);
+
+		lf_free(prog);
+
+		return !ok;
+	}
+
+	/*
+	 * Deliberately small, to exercise retrying with the length
+	 * lf_render() says it needs.
+	 */
+	n = lf_render(prog, &rec, small, sizeof small);
+	if (n <= sizeof small) {
+		buf = small;
+	} else {
+		buf = malloc(n);
+		if (buf == NULL) {
+			perror("malloc");
+			lf_free(prog);
+			return 1;
+		}
+
+		(void) lf_render(prog, &rec, buf, n);
+	}
+
+	fwrite(buf, 1, n, stdout);
+	putchar('\n');
+
+	if (buf != small) {
+		free(buf);
+	}
+
+	lf_free(prog);
+
+	return 0;
+}
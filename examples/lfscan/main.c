@@ -0,0 +1,852 @@
+/*
+ * Copyright 2017 Katherine Flavel
+ *
+ * See LICENCE for the full copyright terms.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <ctype.h>
+#include <errno.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <lf/lf.h>
+
+/*
+ * Files are split into chunks of about this size, ending at a newline.
+ * Each chunk is scanned by one thread, start to finish.
+ */
+#define CHUNK (1UL << 20)
+
+/* output is buffered per thread, and written about this much at a time */
+#define OUTBUF (1UL << 16)
+
+struct file {
+	const char *name;
+	const char *p;
+	size_t len;
+	int mapped;
+};
+
+struct chunk {
+	size_t file;
+	size_t begin;
+	size_t end;
+	unsigned long long lines; /* counted by the thread which scans it */
+};
+
+/*
+ * A malformed line, by its chunk. Line numbers aren't known until every
+ * chunk before has been counted, and so errors are reported at the end.
+ */
+struct fault {
+	size_t chunk;
+	unsigned long long line; /* within the chunk, from 0 */
+	size_t col;
+	enum lf_errno errnum;
+};
+
+/*
+ * Each thread takes chunks from the front of its own deque, and when
+ * that's empty, steals from the back of someone else's.
+ */
+struct deque {
+	pthread_mutex_t lock;
+	size_t lo, hi; /* indexes into job.chunk */
+};
+
+struct count {
+	unsigned long long lines;
+	unsigned long long malformed;
+};
+
+struct worker {
+	pthread_t thread;
+	struct job *job;
+	size_t id;
+	struct deque dq;
+	struct count *count; /* per file */
+	struct fault *fault;
+	size_t nfaults;
+	size_t faultsize;
+	struct lf_field *fields;
+	struct lf_batch *batch; /* for -a */
+	char *buf;
+	size_t bufsize;
+	char *out;
+	size_t outsize;
+	size_t outn;
+	int r;
+};
+
+struct job {
+	const struct lf_scanner *sc;
+	const struct lf_column *col;
+	size_t ncol;
+	const struct file *file;
+	struct chunk *chunk;
+	struct worker *worker;
+	size_t nworkers;
+	int counts;
+	int arrow;
+	pthread_mutex_t lock; /* for stdout */
+};
+
+static const struct {
+	const char *name;
+	const char *fmt;
+} nicknames[] = {
+	{ "LF_CLF",  LF_CLF  },
+	{ "LF_VHLF", LF_VHLF },
+	{ "LF_NSCA", LF_NSCA },
+	{ "LF_RLF",  LF_RLF  },
+	{ "LF_ALF",  LF_ALF  }
+};
+
+static int
+take(struct job *job, struct worker *w, size_t *c)
+{
+	size_t i;
+
+	assert(job != NULL);
+	assert(w != NULL);
+	assert(c != NULL);
+
+	for (i = 0; i < job->nworkers; i++) {
+		struct deque *dq;
+		int found;
+
+		dq = &job->worker[(w->id + i) % job->nworkers].dq;
+
+		pthread_mutex_lock(&dq->lock);
+
+		found = dq->lo < dq->hi;
+		if (found) {
+			*c = i == 0 ? dq->lo++ : --dq->hi;
+		}
+
+		pthread_mutex_unlock(&dq->lock);
+
+		if (found) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static void
+flush(struct job *job, struct worker *w)
+{
+	assert(job != NULL);
+	assert(w != NULL);
+
+	if (w->outn == 0) {
+		return;
+	}
+
+	pthread_mutex_lock(&job->lock);
+	fwrite(w->out, 1, w->outn, stdout);
+	pthread_mutex_unlock(&job->lock);
+
+	w->outn = 0;
+}
+
+/*
+ * Output is only flushed between lines, so that lines from different
+ * threads don't interleave. The buffer grows to fit a long line.
+ */
+static void
+put(struct worker *w, const char *p, size_t n)
+{
+	assert(w != NULL);
+	assert(p != NULL);
+
+	if (n > w->outsize - w->outn) {
+		char *tmp;
+		size_t z;
+
+		for (z = w->outsize; n > z - w->outn; z *= 2)
+			;
+
+		tmp = realloc(w->out, z);
+		if (tmp == NULL) {
+			perror("realloc");
+			exit(1);
+		}
+
+		w->out = tmp;
+		w->outsize = z;
+	}
+
+	memcpy(w->out + w->outn, p, n);
+	w->outn += n;
+}
+
+static int
+put_arrow(void *opaque, const void *p, size_t n)
+{
+	put(opaque, p, n);
+
+	return 1;
+}
+
+static int
+write_arrow(void *opaque, const void *p, size_t n)
+{
+	return fwrite(p, 1, n, opaque) == n;
+}
+
+/* fields are tab separated, so tabs and anything unprintable are escaped */
+static void
+put_field(struct worker *w,
+	const struct lf_column *col, const struct lf_field *f)
+{
+	char tmp[32];
+	size_t i;
+	int n;
+
+	assert(col != NULL);
+	assert(f != NULL);
+
+	if (f->absent) {
+		put(w, "-", 1);
+		return;
+	}
+
+	switch (col->type) {
+	case LF_TYPE_INT:
+		n = sprintf(tmp, "%llu", f->u);
+		put(w, tmp, n);
+		return;
+
+	case LF_TYPE_TIME:
+	case LF_TYPE_SINT:
+		n = sprintf(tmp, "%lld", f->t);
+		put(w, tmp, n);
+		return;
+
+	case LF_TYPE_STR:
+		break;
+	}
+
+	for (i = 0; i < f->s.n; i++) {
+		unsigned char c = f->s.p[i];
+
+		if (isprint(c) && c != '\\') {
+			put(w, f->s.p + i, 1);
+		} else {
+			n = sprintf(tmp, "\\x%02x", c);
+			put(w, tmp, n);
+		}
+	}
+}
+
+static void
+fault(struct job *job, struct worker *w, const struct chunk *c,
+	unsigned long long line, size_t col, enum lf_errno errnum)
+{
+	struct fault *f;
+
+	assert(job != NULL);
+	assert(w != NULL);
+	assert(c != NULL);
+
+	if (w->nfaults == w->faultsize) {
+		struct fault *tmp;
+		size_t z;
+
+		z = w->faultsize == 0 ? 64 : w->faultsize * 2;
+
+		tmp = realloc(w->fault, z * sizeof *w->fault);
+		if (tmp == NULL) {
+			perror("realloc");
+			exit(1);
+		}
+
+		w->fault = tmp;
+		w->faultsize = z;
+	}
+
+	f = &w->fault[w->nfaults++];
+
+	f->chunk  = c - job->chunk;
+	f->line   = line;
+	f->col    = col;
+	f->errnum = errnum;
+}
+
+static int
+faultcmp(const void *a, const void *b)
+{
+	const struct fault *fa = a, *fb = b;
+
+	assert(a != NULL);
+	assert(b != NULL);
+
+	if (fa->chunk != fb->chunk) {
+		return fa->chunk < fb->chunk ? -1 : 1;
+	}
+
+	if (fa->line != fb->line) {
+		return fa->line < fb->line ? -1 : 1;
+	}
+
+	return 0;
+}
+
+static void
+scan_chunk(struct job *job, struct worker *w, struct chunk *c)
+{
+	const struct file *file;
+	const char *p, *end;
+	unsigned long long line;
+
+	assert(job != NULL);
+	assert(w != NULL);
+	assert(c != NULL);
+
+	file = &job->file[c->file];
+
+	p   = file->p + c->begin;
+	end = file->p + c->end;
+
+	for (line = 0; p < end; line++) {
+		const char *nl;
+		struct lf_err err;
+		size_t len, i;
+
+		nl = memchr(p, '\n', end - p);
+		if (nl == NULL) {
+			nl = end;
+		}
+
+		len = nl - p;
+
+		/* room for the unescaped text */
+		if (len > w->bufsize) {
+			char *tmp;
+
+			tmp = realloc(w->buf, len);
+			if (tmp == NULL) {
+				perror("realloc");
+				exit(1);
+			}
+
+			w->buf = tmp;
+			w->bufsize = len;
+		}
+
+		w->count[c->file].lines++;
+
+		if (job->arrow ? !lf_batch_scan(w->batch, p, len, &err)
+		               : !lf_scan(job->sc, p, len, w->fields, w->buf, &err)) {
+			w->count[c->file].malformed++;
+			w->r = 1;
+
+			fault(job, w, c, line, err.p - p + 1, err.errnum);
+		} else if (!job->counts && !job->arrow) {
+			for (i = 0; i < job->ncol; i++) {
+				if (i > 0) {
+					put(w, "\t", 1);
+				}
+
+				put_field(w, &job->col[i], &w->fields[i]);
+			}
+
+			put(w, "\n", 1);
+
+			if (w->outn >= OUTBUF) {
+				flush(job, w);
+			}
+		}
+
+		p = nl + 1;
+	}
+
+	c->lines = line;
+
+	/* one record batch per chunk */
+	if (job->arrow && !lf_arrow_batch(w->batch, put_arrow, w)) {
+		perror("lf_arrow_batch");
+		exit(1);
+	}
+
+	flush(job, w);
+}
+
+static void *
+work(void *opaque)
+{
+	struct worker *w;
+	size_t c;
+
+	w = opaque;
+
+	while (take(w->job, w, &c)) {
+		scan_chunk(w->job, w, &w->job->chunk[c]);
+	}
+
+	return NULL;
+}
+
+static int
+load(struct file *f)
+{
+	struct stat st;
+	int fd;
+
+	assert(f != NULL);
+
+	f->mapped = 0;
+
+	/* stdin can't be mapped, and is read in whole instead */
+	if (0 == strcmp(f->name, "-")) {
+		size_t size, n, z;
+		char *p;
+
+		f->name = "stdin";
+
+		p    = NULL;
+		size = 0;
+		n    = 0;
+
+		do {
+			if (n == size) {
+				char *tmp;
+
+				size = size == 0 ? CHUNK : size * 2;
+				tmp = realloc(p, size);
+				if (tmp == NULL) {
+					free(p);
+					return 0;
+				}
+
+				p = tmp;
+			}
+
+			z = fread(p + n, 1, size - n, stdin);
+			n += z;
+		} while (z > 0);
+
+		if (ferror(stdin)) {
+			free(p);
+			return 0;
+		}
+
+		if (n == 0) {
+			free(p);
+			p = "";
+		}
+
+		f->p   = p;
+		f->len = n;
+
+		return 1;
+	}
+
+	fd = open(f->name, O_RDONLY);
+	if (fd == -1) {
+		return 0;
+	}
+
+	if (-1 == fstat(fd, &st)) {
+		close(fd);
+		return 0;
+	}
+
+	f->len = st.st_size;
+
+	if (f->len == 0) {
+		f->p = "";
+		close(fd);
+		return 1;
+	}
+
+	f->p = mmap(NULL, f->len, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (f->p == MAP_FAILED) {
+		return 0;
+	}
+
+	f->mapped = 1;
+
+	(void) posix_madvise((void *) f->p, f->len, POSIX_MADV_SEQUENTIAL);
+
+	return 1;
+}
+
+static void
+unload(struct file *f)
+{
+	assert(f != NULL);
+
+	if (f->mapped) {
+		munmap((void *) f->p, f->len);
+	} else if (f->len > 0) {
+		free((void *) f->p);
+	}
+}
+
+/*
+ * Split files into newline-aligned chunks, or just count them
+ * if chunk is NULL. Returns the number of chunks.
+ */
+static size_t
+split(const struct file *file, size_t nfiles, struct chunk *chunk)
+{
+	size_t i, n;
+
+	n = 0;
+
+	for (i = 0; i < nfiles; i++) {
+		size_t begin, end;
+
+		for (begin = 0; begin < file[i].len; begin = end) {
+			const char *nl;
+
+			end = begin + CHUNK;
+			if (end >= file[i].len) {
+				end = file[i].len;
+			} else {
+				nl = memchr(file[i].p + end, '\n', file[i].len - end);
+				end = nl == NULL ? file[i].len : (size_t) (nl - file[i].p) + 1;
+			}
+
+			if (chunk != NULL) {
+				chunk[n].file  = i;
+				chunk[n].begin = begin;
+				chunk[n].end   = end;
+				chunk[n].lines = 0;
+			}
+
+			n++;
+		}
+	}
+
+	return n;
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: lfscan [-acH] [-j threads] fmt [file ...]\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct lf_scanner *sc;
+	struct lf_config conf;
+	struct lf_err err;
+	struct chunk *chunk;
+	struct fault *fault;
+	struct file *file;
+	struct job job;
+	size_t nfiles, nchunks, nthreads, nfaults;
+	unsigned long long *first;
+	size_t i, j, next;
+	const char *fmt;
+	int counts, header, arrow;
+	int r;
+
+	{
+		long threads;
+		char *e;
+		int c;
+
+		arrow   = 0;
+		counts  = 0;
+		header  = 0;
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+		while (c = getopt(argc, argv, "acHj:"), c != -1) {
+			switch (c) {
+			case 'a':
+				arrow = 1;
+				break;
+
+			case 'c':
+				counts = 1;
+				break;
+
+			case 'H':
+				header = 1;
+				break;
+
+			case 'j':
+				errno = 0;
+				threads = strtol(optarg, &e, 10);
+				if (e == optarg || *e != '\0' || errno != 0 || threads < 1) {
+					fprintf(stderr, "-j: expected a positive number of threads\n");
+					usage();
+					return 1;
+				}
+				break;
+
+			case '?':
+			default:
+				usage();
+				return 1;
+			}
+		}
+
+		argc -= optind;
+		argv += optind;
+
+		if (argc < 1 || (arrow && counts)) {
+			usage();
+			return 1;
+		}
+
+		fmt = argv[0];
+
+		argc--;
+		argv++;
+
+		nthreads = threads < 1 ? 1 : (size_t) threads;
+	}
+
+	for (i = 0; i < sizeof nicknames / sizeof *nicknames; i++) {
+		if (0 == strcmp(fmt, nicknames[i].name)) {
+			fmt = nicknames[i].fmt;
+			break;
+		}
+	}
+
+	/* lf_compile_scanner() doesn't call any hooks */
+	memset(&conf, 0, sizeof conf);
+
+	sc = lf_compile_scanner(&conf, fmt, &err);
+	if (sc == NULL) {
+		fprintf(stderr, "error: %s at %u\n", lf_strerror(err.errnum),
+			(unsigned) (err.p - fmt));
+		return 1;
+	}
+
+	/* no files means stdin */
+	nfiles = argc == 0 ? 1 : (size_t) argc;
+
+	file = malloc(nfiles * sizeof *file);
+	if (file == NULL) {
+		perror("malloc");
+		return 1;
+	}
+
+	for (i = 0; i < nfiles; i++) {
+		file[i].name = argc == 0 ? "-" : argv[i];
+
+		if (!load(&file[i])) {
+			perror(file[i].name);
+			return 1;
+		}
+	}
+
+	nchunks = split(file, nfiles, NULL);
+
+	if (nthreads > nchunks) {
+		nthreads = nchunks > 0 ? nchunks : 1;
+	}
+
+	/* empty files have no chunks, and there's nothing to scan */
+	if (nchunks == 0) {
+		chunk = NULL;
+		first = NULL;
+	} else {
+		chunk = malloc(nchunks * sizeof *chunk);
+		first = malloc(nchunks * sizeof *first);
+		if (chunk == NULL || first == NULL) {
+			perror("malloc");
+			return 1;
+		}
+	}
+
+	job.worker = malloc(nthreads * sizeof *job.worker);
+	if (job.worker == NULL) {
+		perror("malloc");
+		return 1;
+	}
+
+	(void) split(file, nfiles, chunk);
+
+	job.sc       = sc;
+	job.col      = lf_scanner_columns(sc, &job.ncol);
+	job.file     = file;
+	job.chunk    = chunk;
+	job.nworkers = nthreads;
+	job.counts   = counts;
+	job.arrow    = arrow;
+
+	pthread_mutex_init(&job.lock, NULL);
+
+	if (arrow) {
+		if (!lf_arrow_schema(sc, write_arrow, stdout)) {
+			perror("lf_arrow_schema");
+			return 1;
+		}
+		fflush(stdout);
+	} else if (header && !counts) {
+		for (i = 0; i < job.ncol; i++) {
+			printf("%s%.*s", i > 0 ? "\t" : "", (int) job.col[i].n, job.col[i].src);
+		}
+		printf("\n");
+		fflush(stdout);
+	}
+
+	/*
+	 * Chunks are dealt out in order, a contiguous run to each thread,
+	 * so that a thread tends to read through a file sequentially.
+	 * Where files differ in size, or some lines are slower to scan,
+	 * the threads which finish first steal from the others.
+	 */
+	for (i = 0, next = 0; i < nthreads; i++) {
+		struct worker *w = &job.worker[i];
+
+		w->job    = &job;
+		w->id     = i;
+		w->dq.lo  = next;
+		w->dq.hi  = next + nchunks / nthreads + (i < nchunks % nthreads);
+
+		next = w->dq.hi;
+
+		pthread_mutex_init(&w->dq.lock, NULL);
+
+		w->count     = calloc(nfiles, sizeof *w->count);
+		w->fields    = job.ncol > 0 ? malloc(job.ncol * sizeof *w->fields) : NULL;
+		w->out       = malloc(OUTBUF);
+		w->batch     = arrow ? lf_new_batch(sc) : NULL;
+		w->fault     = NULL;
+		w->nfaults   = 0;
+		w->faultsize = 0;
+		w->buf       = NULL;
+		w->bufsize   = 0;
+		w->outsize   = OUTBUF;
+		w->outn      = 0;
+		w->r         = 0;
+
+		if (w->count == NULL || (job.ncol > 0 && w->fields == NULL) || w->out == NULL
+		 || (arrow && w->batch == NULL)) {
+			perror("malloc");
+			return 1;
+		}
+	}
+
+	assert(next == nchunks);
+
+	for (i = 0; i < nthreads; i++) {
+		errno = pthread_create(&job.worker[i].thread, NULL, work, &job.worker[i]);
+		if (errno != 0) {
+			perror("pthread_create");
+			return 1;
+		}
+	}
+
+	r = 0;
+
+	for (i = 0; i < nthreads; i++) {
+		pthread_join(job.worker[i].thread, NULL);
+		r |= job.worker[i].r;
+	}
+
+	/* each chunk's first line, now that every chunk has been counted */
+	for (i = 0; i < nchunks; i++) {
+		first[i] = i == 0 || chunk[i].file != chunk[i - 1].file
+			? 1 : first[i - 1] + chunk[i - 1].lines;
+	}
+
+	/* errors are gathered from every thread, and reported in order */
+	for (i = 0, nfaults = 0; i < nthreads; i++) {
+		nfaults += job.worker[i].nfaults;
+	}
+
+	if (nfaults > 0) {
+		fault = malloc(nfaults * sizeof *fault);
+		if (fault == NULL) {
+			perror("malloc");
+			return 1;
+		}
+
+		for (i = 0, next = 0; i < nthreads; i++) {
+			memcpy(fault + next, job.worker[i].fault,
+				job.worker[i].nfaults * sizeof *fault);
+			next += job.worker[i].nfaults;
+		}
+
+		qsort(fault, nfaults, sizeof *fault, faultcmp);
+
+		for (i = 0; i < nfaults; i++) {
+			const struct fault *f = &fault[i];
+
+			fprintf(stderr, "%s:%llu:%lu: error: %s\n",
+				file[chunk[f->chunk].file].name, first[f->chunk] + f->line,
+				(unsigned long) f->col, lf_strerror(f->errnum));
+		}
+
+		free(fault);
+	}
+
+	if (arrow && !lf_arrow_eos(write_arrow, stdout)) {
+		perror("lf_arrow_eos");
+		return 1;
+	}
+
+	if (counts) {
+		struct count total = { 0, 0 };
+
+		for (i = 0; i < nfiles; i++) {
+			struct count c = { 0, 0 };
+
+			for (j = 0; j < nthreads; j++) {
+				c.lines     += job.worker[j].count[i].lines;
+				c.malformed += job.worker[j].count[i].malformed;
+			}
+
+			printf("%s\t%llu lines\t%llu malformed\n",
+				file[i].name, c.lines, c.malformed);
+
+			total.lines     += c.lines;
+			total.malformed += c.malformed;
+		}
+
+		if (nfiles > 1) {
+			printf("total\t%llu lines\t%llu malformed\n",
+				total.lines, total.malformed);
+		}
+	}
+
+	for (i = 0; i < nthreads; i++) {
+		pthread_mutex_destroy(&job.worker[i].dq.lock);
+		free(job.worker[i].count);
+		free(job.worker[i].fault);
+		free(job.worker[i].fields);
+		lf_free_batch(job.worker[i].batch);
+		free(job.worker[i].out);
+		free(job.worker[i].buf);
+	}
+
+	for (i = 0; i < nfiles; i++) {
+		unload(&file[i]);
+	}
+
+	pthread_mutex_destroy(&job.lock);
+
+	free(job.worker);
+	free(first);
+	free(chunk);
+	free(file);
+
+	lf_free_scanner(sc);
+
+	return r;
+}
@@ -7,6 +7,8 @@
 #ifndef LIBLF_H
 #define LIBLF_H
 
+#include <limits.h>
+
 enum lf_errno {
 	LF_ERR_MISSING_CLOSING_BRACE,
 	LF_ERR_MISSING_DIRECTIVE,
@@ -20,7 +22,7 @@ enum lf_errno {
 	LF_ERR_UNRECOGNISED_PORT_TYPE,
 	LF_ERR_UNRECOGNISED_ID_TYPE,
 
-	LF_ERR_NAME_OVERFLOW,
+	LF_ERR_NAME_OVERFLOW, /* no longer produced */
 	LF_ERR_STATUS_OVERFLOW,
 	LF_ERR_TOO_MANY_STATUSES,
 	LF_ERR_TOO_MANY_REDIRECT_FLAGS,
@@ -28,7 +30,20 @@ enum lf_errno {
 	LF_ERR_UNWANTED_NAME,
 
 	LF_ERR_UNSUPPORTED, /* for hooks to decline output */
-	LF_ERR_ERRNO /* see errno */
+	LF_ERR_ERRNO, /* see errno */
+
+	/* scanning log lines, see lf_scan() */
+	LF_ERR_AMBIGUOUS_DIRECTIVES,
+	LF_ERR_EXPECTED_LITERAL,
+	LF_ERR_MISSING_DELIMITER,
+	LF_ERR_MISSING_CLOSING_QUOTE,
+	LF_ERR_MALFORMED_INTEGER,
+	LF_ERR_MALFORMED_TIME,
+	LF_ERR_TRAILING_TEXT,
+
+	/* decoding binary records, see lf_decode() */
+	LF_ERR_MALFORMED_RECORD,
+	LF_ERR_TRUNCATED_RECORD
 };
 
 struct lf_err {
@@ -73,27 +88,53 @@ enum lf_when {
 	LF_WHEN_END
 };
 
+/*
+ * Statuses in this range are also given as a bitmap, .map,
+ * so that lf_pred_match() needn't search .status.
+ */
+#define LF_PRED_MIN 100U
+#define LF_PRED_MAX 599U
+
 struct lf_pred {
 	unsigned neg :1;
 	size_t count;
 	unsigned *status; /* array, sorted */
+	unsigned char map[(LF_PRED_MAX - LF_PRED_MIN) / CHAR_BIT + 1];
 };
 
+/*
+ * C++ doesn't allow a typedef to share its name with an enum as C does,
+ * so there the hook types for %a, %T, %p and %P are lf_ip_hook and so on.
+ */
+#ifdef __cplusplus
+#define LF_HOOK(name) name ## _hook
+#else
+#define LF_HOOK(name) name
+#endif
+
 /*
  * Return true for success, or false for failure.
  * On failure, you're expected to have errno set.
  */
 typedef int (lf_bool    )(void *opaque, const struct lf_pred *pred, enum lf_redirect redirect, int v);
 typedef int (lf_char    )(void *opaque, char c);
-typedef int (lf_ip      )(void *opaque, const struct lf_pred *pred, enum lf_redirect redirect, enum lf_ip ip);
+typedef int (lf_span    )(void *opaque, const char *p, size_t n);
+typedef int (LF_HOOK(lf_ip))(void *opaque, const struct lf_pred *pred, enum lf_redirect redirect, enum lf_ip ip);
 typedef int (lf_simple  )(void *opaque, const struct lf_pred *pred, enum lf_redirect redirect);
-typedef int (lf_rtime   )(void *opaque, const struct lf_pred *pred, enum lf_redirect redirect, enum lf_rtime unit);
+typedef int (LF_HOOK(lf_rtime))(void *opaque, const struct lf_pred *pred, enum lf_redirect redirect, enum lf_rtime unit);
 typedef int (lf_name    )(void *opaque, const struct lf_pred *pred, enum lf_redirect redirect, const char *name);
-typedef int (lf_port    )(void *opaque, const struct lf_pred *pred, enum lf_redirect redirect, enum lf_port);
-typedef int (lf_id      )(void *opaque, const struct lf_pred *pred, enum lf_redirect redirect, enum lf_id);
+typedef int (LF_HOOK(lf_port))(void *opaque, const struct lf_pred *pred, enum lf_redirect redirect, enum lf_port);
+typedef int (LF_HOOK(lf_id))(void *opaque, const struct lf_pred *pred, enum lf_redirect redirect, enum lf_id);
 typedef int (lf_strftime)(void *opaque, const struct lf_pred *pred, enum lf_redirect redirect, enum lf_when when, const char *fmt);
 typedef int (lf_fractime)(void *opaque, const struct lf_pred *pred, enum lf_redirect redirect, enum lf_when when, enum lf_rtime unit);
 
+/*
+ * Pointer and length variants of lf_name and lf_strftime.
+ * The string is not NUL terminated.
+ */
+typedef int (lf_namen    )(void *opaque, const struct lf_pred *pred, enum lf_redirect redirect, const char *name, size_t n);
+typedef int (lf_strftimen)(void *opaque, const struct lf_pred *pred, enum lf_redirect redirect, enum lf_when when, const char *fmt, size_t n);
+
 struct lf_config;
 
 typedef int (lf_custom)(const struct lf_config *conf, void *opaque,
@@ -112,9 +153,17 @@ struct lf_config {
 	const char *override;
 	lf_custom  *custom;
 
+	/*
+	 * If .literal_span is set, it's called in preference to .literal,
+	 * with runs of consecutive literal characters (escapes are already
+	 * resolved). lf_exec() passes each run whole; lf_parse() does too,
+	 * except that runs longer than 256 bytes may be split. Use .literal
+	 * instead if you need to inspect each character.
+	 */
 	lf_char     *literal;
+	lf_span     *literal_span;
 
-	lf_ip       *ip;                /* %a, %{c}a, %A */
+	LF_HOOK(lf_ip) *ip;             /* %a, %{c}a, %A */
 	lf_simple   *resp_size;         /* %B */
 	lf_simple   *resp_size_clf;     /* %b */
 	lf_name     *req_cookie;        /* %{VARNAME}C */
@@ -130,15 +179,15 @@ struct lf_config {
 	lf_simple   *req_method;        /* %m */
 	lf_name     *note;              /* %{VARNAME}n */
 	lf_name     *reply_header;      /* %{VARNAME}o */
-	lf_port     *server_port;       /* %p, %{format}p */
-	lf_id       *id;                /* %P, %{format}P */
+	LF_HOOK(lf_port) *server_port;  /* %p, %{format}p */
+	LF_HOOK(lf_id) *id;             /* %P, %{format}P */
 	lf_simple   *query_string;      /* %q */
 	lf_simple   *req_first_line;    /* %r */
 	lf_simple   *resp_handler;      /* %R */
 	lf_simple   *status;            /* %s */
 	lf_strftime *time;              /* %t, %{format}t */
 	lf_fractime *time_frac;         /* %{UNIT}t */
-	lf_rtime    *time_taken;        /* %D, %T, %T{UNIT} */
+	LF_HOOK(lf_rtime) *time_taken;  /* %D, %T, %T{UNIT} */
 	lf_simple   *remote_user;       /* %u */
 	lf_simple   *url_path;          /* %U */
 	lf_bool     *server_name;       /* %v, %V */
@@ -148,12 +197,689 @@ struct lf_config {
 	lf_simple   *bytes_xfer;        /* %S */
 	lf_name     *req_trailer;       /* %{VARNAME}^ti */
 	lf_name     *resp_trailer;      /* %{VARNAME}^to */
+
+	/*
+	 * If set, these are called in preference to their counterparts above.
+	 * The name points into the format string (or for lf_exec(), into the
+	 * compiled program), and so lf_parse() need not copy it.
+	 */
+	lf_namen     *req_cookien;      /* %{VARNAME}C */
+	lf_namen     *env_varn;         /* %{VARNAME}e */
+	lf_namen     *req_headern;      /* %{VARNAME}i */
+	lf_namen     *noten;            /* %{VARNAME}n */
+	lf_namen     *reply_headern;    /* %{VARNAME}o */
+	lf_strftimen *timen;            /* %t, %{format}t */
+	lf_namen     *req_trailern;     /* %{VARNAME}^ti */
+	lf_namen     *resp_trailern;    /* %{VARNAME}^to */
 };
 
 int
 lf_parse(struct lf_config *conf, void *opaque, const char *fmt,
 	struct lf_err *ep);
 
+/*
+ * As lf_parse(), for a format of len bytes which needn't be NUL terminated.
+ * Nothing past fmt + len is read.
+ */
+int
+lf_parsen(struct lf_config *conf, void *opaque, const char *fmt, size_t len,
+	struct lf_err *ep);
+
+/*
+ * A compiled format. This holds the same decisions lf_parse() makes,
+ * so that repeatedly calling lf_exec() to output each request does not
+ * need to re-parse the format string.
+ *
+ * The program is immutable, and keeps its own copy of everything it needs
+ * (including the format string), so the fmt passed to lf_compile() need
+ * not outlive it. The config's .override, .hostname_lookups and
+ * .use_canonical_name are resolved at compile time, and the same
+ * .override must be given again to lf_exec().
+ *
+ * lf_compile() returns NULL on error. Errors from lf_exec() come from
+ * hooks only, and .p points into the program's copy of the format string,
+ * see lf_fmt(). That copy is always NUL terminated.
+ */
+struct lf_prog;
+
+struct lf_prog *
+lf_compile(const struct lf_config *conf, const char *fmt,
+	struct lf_err *ep);
+
+struct lf_prog *
+lf_compilen(const struct lf_config *conf, const char *fmt, size_t len,
+	struct lf_err *ep);
+
+int
+lf_exec(const struct lf_config *conf, void *opaque, const struct lf_prog *prog,
+	struct lf_err *ep);
+
+const char *
+lf_fmt(const struct lf_prog *prog);
+
+void
+lf_free(struct lf_prog *prog);
+
+/*
+ * A cache of compiled programs, shared between threads. lf_cache_get()
+ * returns the program for fmt as compiled for conf, compiling it only if
+ * the cache doesn't hold one already for the same format with the same
+ * .override, .hostname_lookups and .use_canonical_name. Other configs
+ * which agree on those share the same program.
+ *
+ * Each program returned holds a reference, which is given back by
+ * lf_cache_put(); don't lf_free() it. Lookups of a format already held
+ * take no lock. Programs no longer referenced stay cached (for the next
+ * reload to find) until lf_cache_purge(), which returns how many it freed.
+ * lf_free_cache() needs every reference given back first.
+ */
+struct lf_cache;
+
+/* Returns NULL with errno set on error */
+struct lf_cache *
+lf_new_cache(void);
+
+const struct lf_prog *
+lf_cache_get(struct lf_cache *c, const struct lf_config *conf, const char *fmt,
+	struct lf_err *ep);
+
+const struct lf_prog *
+lf_cache_getn(struct lf_cache *c, const struct lf_config *conf, const char *fmt, size_t len,
+	struct lf_err *ep);
+
+void
+lf_cache_put(struct lf_cache *c, const struct lf_prog *prog);
+
+size_t
+lf_cache_purge(struct lf_cache *c);
+
+void
+lf_free_cache(struct lf_cache *c);
+
+/*
+ * A handle to a program which may be replaced while in use, for
+ * reloading a config without stopping threads which are logging.
+ * Each thread makes its own reader by lf_handle_reader(). To log,
+ * lf_reader_pin() gives the current program, which stays valid until
+ * lf_reader_unpin(); pinning takes no lock, and never waits.
+ *
+ * lf_handle_reload() compiles fmt for conf and swaps it in for readers
+ * to pin next. The old program is freed once no reader still has it
+ * pinned, when a later reload or lf_free_reader() finds that's so.
+ * If fmt fails to compile, the current program stays, and the error
+ * is as for lf_compile().
+ *
+ * Pins don't nest. lf_free_handle() needs every reader freed first.
+ */
+struct lf_handle;
+struct lf_reader;
+
+struct lf_handle *
+lf_new_handle(const struct lf_config *conf, const char *fmt,
+	struct lf_err *ep);
+
+int
+lf_handle_reload(struct lf_handle *h, const struct lf_config *conf, const char *fmt,
+	struct lf_err *ep);
+
+void
+lf_free_handle(struct lf_handle *h);
+
+/* Returns NULL with errno set on error */
+struct lf_reader *
+lf_handle_reader(struct lf_handle *h);
+
+const struct lf_prog *
+lf_reader_pin(struct lf_reader *r);
+
+void
+lf_reader_unpin(struct lf_reader *r);
+
+void
+lf_free_reader(struct lf_reader *r);
+
+/*
+ * Return true if a directive with this predicate should be output
+ * for a response with the given status. An empty predicate matches
+ * everything.
+ */
+int
+lf_pred_match(const struct lf_pred *pred, unsigned status);
+
+/*
+ * A borrowed string; nothing here is NUL terminated.
+ * A NULL .p means the value is absent, which is logged as "-".
+ */
+struct lf_str {
+	const char *p;
+	size_t n;
+};
+
+/* The named lookups, for lf_lookup */
+enum lf_table {
+	LF_TABLE_REQ_COOKIE,   /* %{VARNAME}C */
+	LF_TABLE_ENV_VAR,      /* %{VARNAME}e */
+	LF_TABLE_REQ_HEADER,   /* %{VARNAME}i */
+	LF_TABLE_NOTE,         /* %{VARNAME}n */
+	LF_TABLE_REPLY_HEADER, /* %{VARNAME}o */
+	LF_TABLE_REQ_TRAILER,  /* %{VARNAME}^ti */
+	LF_TABLE_RESP_TRAILER  /* %{VARNAME}^to */
+};
+
+typedef struct lf_str (lf_lookup)(void *opaque, enum lf_table table,
+	const char *name, size_t n);
+
+/*
+ * Everything lf_render() needs to know about a request. Strings are
+ * borrowed for the duration of the call only.
+ *
+ * For an internally redirected request, .final points to a record for
+ * the final request, and directives with the > modifier read from that
+ * instead. Status predicates are always tested against the final status,
+ * as Apache does.
+ */
+struct lf_record {
+	const struct lf_record *final; /* or NULL for no redirect */
+
+	struct lf_str ip[3];           /* %a, %{c}a, %A by enum lf_ip */
+	unsigned port[3];              /* %p, %{format}p by enum lf_port */
+	struct lf_str remote_host;     /* %h, used with .hostname_lookups */
+	struct lf_str remote_logname;  /* %l */
+	struct lf_str remote_user;     /* %u */
+	struct lf_str server_name;     /* %v */
+	struct lf_str host;            /* %V, unless .use_canonical_name */
+	struct lf_str req_first_line;  /* %r */
+	struct lf_str req_method;      /* %m */
+	struct lf_str req_protocol;    /* %H */
+	struct lf_str url_path;        /* %U */
+	struct lf_str query_string;    /* %q, without the leading '?' */
+	struct lf_str filename;        /* %f */
+	struct lf_str resp_handler;    /* %R */
+	struct lf_str req_logid;       /* %L */
+
+	unsigned status;               /* %s */
+	unsigned keepalive_reqs;       /* %k */
+	unsigned aborted   :1;         /* %X */
+	unsigned keepalive :1;         /* %X */
+
+	unsigned long long resp_size;  /* %B, %b */
+	unsigned long long bytes_recv; /* %I */
+	unsigned long long bytes_sent; /* %O */
+	unsigned long long bytes_xfer; /* %S */
+
+	unsigned long pid;             /* %P */
+	unsigned long long tid;        /* %{tid}P, %{hextid}P */
+
+	/*
+	 * Microseconds since the epoch, by enum lf_when. The time taken
+	 * for %D and %T is the difference.
+	 */
+	long long time[2];
+
+	lf_lookup *lookup;             /* for all named directives */
+	void *opaque;
+};
+
+/*
+ * Render one log line for a compiled format, Apache-style, to buf.
+ * This doesn't allocate, and the output is not NUL terminated.
+ *
+ * Returns the length of the whole line. If that's more than size,
+ * the output was truncated, and the caller may retry with a buffer
+ * of at least the returned length.
+ *
+ * Custom directives have no data here, and are rendered as "-".
+ *
+ * Times are rendered as strftime() would in the C locale; formats are
+ * compiled by lf_compile() where possible, and strftime() is called for
+ * the rest. The text for times is kept per thread for the last few
+ * seconds rendered.
+ */
+size_t
+lf_render(const struct lf_prog *prog, const struct lf_record *rec,
+	char *buf, size_t size);
+
+/*
+ * Call after changing TZ, rather than tzset(), so that no thread renders
+ * text it kept for the old zone. tzset() alone is seen from each thread's
+ * next new second only where the zone's names differ.
+ */
+void
+lf_tzset(void);
+
+/*
+ * The pieces lf_render() is made of, for code generated from a format
+ * (see <lf/lfc.h>). Each writes as lf_render() does for one directive,
+ * up to size bytes, and returns the length of the whole text.
+ *
+ * lf_render_escaped() escapes as Apache's ap_escape_logitem();
+ * lf_render_uint() is in base 10 or 16; lf_render_frac() is t in the
+ * given unit, as %{sec}t and friends; lf_render_time() is t as the
+ * strftime() format fmt, or "-" where the time can't be rendered.
+ */
+size_t
+lf_render_escaped(char *buf, size_t size, const char *p, size_t n);
+
+size_t
+lf_render_uint(char *buf, size_t size, unsigned long long u, unsigned base);
+
+size_t
+lf_render_int(char *buf, size_t size, long long n);
+
+size_t
+lf_render_frac(char *buf, size_t size, long long t, enum lf_rtime unit);
+
+size_t
+lf_render_time(char *buf, size_t size, long long t, const char *fmt);
+
+/*
+ * What a compiled format needs from each request, so that a server
+ * can skip collecting anything else. lf_analyze() summarises:
+ *
+ * .kinds:    1 << enum lf_kind, for each kind of directive present
+ * .needs:    enum lf_need, for things costly to collect
+ * .redirect: 1 << enum lf_redirect, for the records read
+ * .pred:     the union of the directives' predicates, so that a status
+ *            it doesn't match outputs nothing (except literal text)
+ * .table:    the distinct names for each named lookup, by enum lf_table.
+ *            Names differing only in case are given once, except for
+ *            cookies, which are case-sensitive.
+ *
+ * The names point into the program, and the analysis must not outlive it.
+ * Returns NULL with errno set on error.
+ */
+enum lf_kind {
+	LF_KIND_CUSTOM,
+	LF_KIND_IP,
+	LF_KIND_RESP_SIZE,
+	LF_KIND_RESP_SIZE_CLF,
+	LF_KIND_REQ_COOKIE,
+	LF_KIND_ENV_VAR,
+	LF_KIND_FILENAME,
+	LF_KIND_REMOTE_HOSTNAME,
+	LF_KIND_REQ_PROTOCOL,
+	LF_KIND_REQ_HEADER,
+	LF_KIND_KEEPALIVE_REQS,
+	LF_KIND_REMOTE_LOGNAME,
+	LF_KIND_REQ_LOGID,
+	LF_KIND_REQ_METHOD,
+	LF_KIND_NOTE,
+	LF_KIND_REPLY_HEADER,
+	LF_KIND_SERVER_PORT,
+	LF_KIND_ID,
+	LF_KIND_QUERY_STRING,
+	LF_KIND_REQ_FIRST_LINE,
+	LF_KIND_RESP_HANDLER,
+	LF_KIND_STATUS,
+	LF_KIND_TIME,
+	LF_KIND_TIME_FRAC,
+	LF_KIND_TIME_TAKEN,
+	LF_KIND_REMOTE_USER,
+	LF_KIND_URL_PATH,
+	LF_KIND_SERVER_NAME,
+	LF_KIND_CONN_STATUS,
+	LF_KIND_BYTES_RECV,
+	LF_KIND_BYTES_SENT,
+	LF_KIND_BYTES_XFER,
+	LF_KIND_REQ_TRAILER,
+	LF_KIND_RESP_TRAILER
+};
+
+enum lf_need {
+	LF_NEED_HOSTNAME_LOOKUP = 1 << 0, /* .remote_host, for %h */
+	LF_NEED_TIME_BEGIN      = 1 << 1, /* .time[LF_WHEN_BEGIN] */
+	LF_NEED_TIME_END        = 1 << 2, /* .time[LF_WHEN_END], including for %D and %T */
+	LF_NEED_TIME_SUBSEC     = 1 << 3  /* either time to better than a second */
+};
+
+struct lf_names {
+	const struct lf_str *name;
+	size_t count;
+};
+
+struct lf_analysis {
+	unsigned long long kinds;
+	unsigned needs;
+	unsigned redirect;
+	struct lf_pred pred;
+	struct lf_names table[LF_TABLE_RESP_TRAILER + 1];
+};
+
+struct lf_analysis *
+lf_analyze(const struct lf_prog *prog);
+
+void
+lf_free_analysis(struct lf_analysis *a);
+
+/*
+ * Header and trailer names are case-insensitive. Rather than compare
+ * each of a format's %{NAME}i, %{NAME}o, %{NAME}^ti and %{NAME}^to
+ * names against every header, lf_headers_resolve() hashes each header
+ * once, and finds the directives wanting it by the hashes lf_compile()
+ * made of their names. The first header of each name is kept.
+ *
+ * For each request, call lf_headers_reset() and then resolve the
+ * request's headers (and if needed its response headers and trailers)
+ * for the tables they belong to. Then use lf_headers_lookup() as the
+ * record's .lookup, with the struct lf_headers as .opaque; it gives
+ * the values resolved, and passes other lookups to the lookup given to
+ * lf_headers_reset(), if any. lf_render() reads the values directly.
+ *
+ * A struct lf_headers is for one program, and for one thread at a time.
+ */
+struct lf_header {
+	struct lf_str name;
+	struct lf_str value;
+};
+
+struct lf_headers;
+
+/* Returns NULL with errno set on error */
+struct lf_headers *
+lf_new_headers(const struct lf_prog *prog);
+
+void
+lf_headers_reset(struct lf_headers *hs, lf_lookup *lookup, void *opaque);
+
+/* Returns how many of the program's names for this table were found */
+size_t
+lf_headers_resolve(struct lf_headers *hs, enum lf_table table,
+	const struct lf_header *h, size_t n);
+
+struct lf_str
+lf_headers_lookup(void *opaque, enum lf_table table, const char *name, size_t n);
+
+void
+lf_free_headers(struct lf_headers *hs);
+
+/*
+ * The reverse of lf_render(): a scanner splits log lines written in
+ * a given format back into one field per directive.
+ *
+ * Each field's extent is found by the literal text following it in the
+ * format, except for fields which delimit themselves (numbers, and %t
+ * in its default format), and fields between double quotes, which end
+ * at the first unescaped quote. So two directives may not be adjacent
+ * unless the first delimits itself.
+ *
+ * A %{format}t extends past as many occurrences of its delimiter as
+ * there are in the strftime format's literal text.
+ */
+enum lf_type {
+	LF_TYPE_STR,  /* .s only */
+	LF_TYPE_INT,  /* .u */
+	LF_TYPE_TIME, /* .t, microseconds since the epoch */
+	LF_TYPE_SINT  /* .t, in the directive's own unit, e.g. %D */
+};
+
+struct lf_column {
+	enum lf_type type;
+	enum lf_redirect redirect;
+	const char *src;  /* the directive as written, e.g. "%>s" */
+	size_t n;
+	const char *name; /* NUL terminated, or NULL for unnamed directives */
+};
+
+/*
+ * .s is the text as logged, with Apache's escaping undone for fields
+ * which have it. A field logged as "-" is absent, except for %b,
+ * where "-" means 0.
+ */
+struct lf_field {
+	unsigned absent :1;
+	struct lf_str s;
+	unsigned long long u;
+	long long t;
+};
+
+struct lf_scanner;
+
+struct lf_scanner *
+lf_compile_scanner(const struct lf_config *conf, const char *fmt,
+	struct lf_err *ep);
+
+const struct lf_column *
+lf_scanner_columns(const struct lf_scanner *sc, size_t *count);
+
+/*
+ * Scan one line of len bytes, without its newline, filling one field
+ * per column. Unescaped text is written to buf, which must have room
+ * for len bytes; fields point into either the line or buf.
+ *
+ * Returns true on success. On failure, ep (if non-NULL) is set with .p
+ * and .n pointing into the line.
+ */
+int
+lf_scan(const struct lf_scanner *sc, const char *line, size_t len,
+	struct lf_field *fields, char *buf, struct lf_err *ep);
+
+/*
+ * The pieces lf_scan() is made of, for code generated from a format
+ * (see <lf/lfc.h>). Each fills one field as lf_scan() does.
+ *
+ * lf_scan_int() scans a number in base 10 or 16 from p, where "-" is 0
+ * if clf is true (as for %b) and absent otherwise. lf_scan_sint() scans
+ * a signed decimal number into .t, as rendered for %D, %T and %{sec}t
+ * when negative; a "-" with no digits is absent. lf_scan_time() scans
+ * %t in its default format. These return the end of the field, or NULL
+ * if it's malformed.
+ *
+ * lf_scan_str() takes the string field p..q, where the field's extent
+ * was found by its delimiter; user is true for %u, which logs an empty
+ * user as "". Escaping is undone if escaped is true, writing to buf at
+ * *bufn and advancing *bufn.
+ */
+const char *
+lf_scan_int(const char *p, const char *end, unsigned base, int clf,
+	struct lf_field *f);
+
+const char *
+lf_scan_sint(const char *p, const char *end, struct lf_field *f);
+
+const char *
+lf_scan_time(const char *p, const char *end, struct lf_field *f);
+
+void
+lf_scan_str(const char *p, const char *q, int escaped, int user,
+	struct lf_field *f, char *buf, size_t *bufn);
+
+void
+lf_free_scanner(struct lf_scanner *sc);
+
+/*
+ * Columnar output: a batch scans lines straight into one buffer per
+ * column, and is written out as an Arrow IPC stream, for loading logs
+ * into dataframe and query engines without converting them first.
+ *
+ * Each column's Arrow type comes from its directive: %s and %p are
+ * uint16, sizes and byte counts are uint64, %t and %{sec}t etc are UTC
+ * timestamps, %D and %T are durations, and anything else is utf8.
+ * Strings are the bytes as scanned, and are not checked for valid UTF-8.
+ * Absent fields are null. Fields are named for the directive as written.
+ *
+ * A stream is one schema, then any number of batches, then the end of
+ * stream marker. Output goes to lf_write, which returns true on success,
+ * or false with errno set. Batches may be written in any order, so each
+ * thread may have its own batch for the same scanner.
+ */
+typedef int (lf_write)(void *opaque, const void *p, size_t n);
+
+struct lf_batch;
+
+struct lf_batch *
+lf_new_batch(const struct lf_scanner *sc);
+
+/*
+ * Scan one line as lf_scan(), and append it as a row. On failure,
+ * nothing is appended. Numbers too large for their column are malformed,
+ * and a batch may hold at most 2GiB of text for each string column,
+ * past which this fails with LF_ERR_ERRNO and errno set to EOVERFLOW.
+ */
+int
+lf_batch_scan(struct lf_batch *b, const char *line, size_t len,
+	struct lf_err *ep);
+
+/* The number of rows held, and the number of bytes of buffers */
+size_t
+lf_batch_rows(const struct lf_batch *b);
+
+size_t
+lf_batch_size(const struct lf_batch *b);
+
+int
+lf_arrow_schema(const struct lf_scanner *sc, lf_write *w, void *opaque);
+
+/*
+ * Write the rows held as one record batch, and empty the batch.
+ * This writes nothing for an empty batch.
+ */
+int
+lf_arrow_batch(struct lf_batch *b, lf_write *w, void *opaque);
+
+int
+lf_arrow_eos(lf_write *w, void *opaque);
+
+void
+lf_free_batch(struct lf_batch *b);
+
+/*
+ * A writer collects whole lines from any number of threads, and writes
+ * them to one file descriptor from a thread of its own, many lines to
+ * each writev(). Each thread appends to a ring of its own, which takes
+ * no lock, and lines from different threads are never interleaved.
+ *
+ * Pending lines are written every flush_ms milliseconds, or as soon as
+ * any one ring holds flush_size bytes. When a thread's ring is full,
+ * its line is handled by enum lf_full.
+ */
+enum lf_full {
+	LF_FULL_BLOCK, /* wait for the writer to make space */
+	LF_FULL_DROP,  /* discard the line, and count it */
+	LF_FULL_SPILL  /* queue the line on the heap, for the writer */
+};
+
+struct lf_writer_config {
+	int fd;
+	size_t ring_size;    /* bytes per thread, rounded up to a power of 2 */
+	size_t flush_size;
+	unsigned flush_ms;
+	enum lf_full full;
+};
+
+struct lf_writer;
+struct lf_ring;
+
+/* Returns NULL with errno set on error */
+struct lf_writer *
+lf_new_writer(const struct lf_writer_config *wc);
+
+/*
+ * A ring for the calling thread. Each ring has one thread appending
+ * to it at a time; lf_free_ring() gives it back, once the thread is
+ * done. Lines still pending are written regardless.
+ */
+struct lf_ring *
+lf_writer_ring(struct lf_writer *w);
+
+/*
+ * Append one line, which ought to end in a newline. Returns true if it
+ * was queued to be written, or false with errno set if it was dropped:
+ * ENOBUFS for a full ring and LF_FULL_DROP, EMSGSIZE for a line longer
+ * than the ring except for LF_FULL_SPILL, or ENOMEM when spilling.
+ */
+int
+lf_ring_write(struct lf_ring *r, const char *line, size_t n);
+
+/*
+ * Render one line as lf_render(), and append it with a newline.
+ * Where the ring has space, the line is rendered into it in place.
+ */
+int
+lf_ring_render(struct lf_ring *r, const struct lf_prog *prog,
+	const struct lf_record *rec);
+
+void
+lf_free_ring(struct lf_ring *r);
+
+/* The number of lines dropped so far, for all rings */
+unsigned long long
+lf_writer_dropped(const struct lf_writer *w);
+
+/*
+ * Write everything pending, stop the writer, and free it along with
+ * any rings which remain; none may be in use. The file descriptor is
+ * not closed. Returns false with errno set if any write failed; lines
+ * which could not be written are discarded, rather than retried.
+ */
+int
+lf_free_writer(struct lf_writer *w);
+
+/*
+ * Binary records: rather than render text for each request, an encoder
+ * writes just the values its format reads from a struct lf_record, and
+ * a decoder gives them back later, for lf_render() to give the same text.
+ *
+ * The values are those the compiled format's directives read: numbers
+ * are varints, times are microseconds as 8 bytes little-endian, and
+ * strings are prefixed by their length, or refer to the same string
+ * seen in an earlier record, by a dictionary kept by both sides.
+ *
+ * A stream is a header naming the format and the lf_config flags it was
+ * compiled with, and the encoder's TZ, followed by any number of records,
+ * each prefixed by its length. Records depend on those before them, and so a stream must be
+ * decoded in order from the start. Output goes to lf_write, as for Arrow.
+ */
+struct lf_encoder;
+struct lf_decoder;
+
+/* For prog, which was compiled for conf. Returns NULL with errno set on error */
+struct lf_encoder *
+lf_new_encoder(const struct lf_config *conf, const struct lf_prog *prog);
+
+/* TZ is recorded as it is when the header is written */
+int
+lf_encode_header(const struct lf_encoder *e, lf_write *w, void *opaque);
+
+int
+lf_encode(struct lf_encoder *e, const struct lf_record *rec,
+	lf_write *w, void *opaque);
+
+void
+lf_free_encoder(struct lf_encoder *e);
+
+/*
+ * Read a stream's header from p..n, and compile its format. *used is
+ * set to the length of the header. LF_ERR_TRUNCATED_RECORD means there
+ * wasn't enough of it; otherwise errors are as for lf_compile().
+ */
+struct lf_decoder *
+lf_new_decoder(const char *p, size_t n, size_t *used, struct lf_err *ep);
+
+const struct lf_prog *
+lf_decoder_prog(const struct lf_decoder *d);
+
+/*
+ * The encoder's TZ, or NULL if it was unset. Times are UTC, and render as
+ * the encoder's did only in its zone: set TZ to this, and call lf_tzset().
+ * Where TZ was unset, the encoder's zone was its system's, which the
+ * stream can't say; the decoder must then run in the same zone.
+ */
+const char *
+lf_decoder_tz(const struct lf_decoder *d);
+
+/*
+ * Decode the record at the start of p..n to rec, for lf_render() with
+ * lf_decoder_prog(), and set *used to its length. Strings are copied,
+ * and are valid until the next call. LF_ERR_TRUNCATED_RECORD means the
+ * record continues past n, and may be retried with more.
+ */
+int
+lf_decode(struct lf_decoder *d, const char *p, size_t n, size_t *used,
+	struct lf_record *rec, struct lf_err *ep);
+
+void
+lf_free_decoder(struct lf_decoder *d);
+
 const char *
 lf_strerror(enum lf_errno errnum);
 
@@ -0,0 +1,1548 @@
+/*
+ * Copyright 2017 Katherine Flavel
+ *
+ * See LICENCE for the full copyright terms.
+ */
+
+#ifndef LIBLF_HPP
+#define LIBLF_HPP
+
+/*
+ * C++20, for formats known at compile time.
+ *
+ * lf::format<"..."> parses its format as a constant expression. This
+ * follows the same grammar as lf_parse() (see doc/logfmt.ebnf), makes
+ * the same decisions, and finds the same errors, and the resulting ops
+ * are kept as constants. lf::render() expands these to straight-line
+ * code, one step per op, with nothing parsed or dispatched at runtime.
+ * It writes exactly what lf_render() would.
+ *
+ * An invalid format is a compile error, and the diagnostic carries
+ * lf_strerror()'s message, along with its enum lf_errno and the offset
+ * lf_parse() would give in .p.
+ *
+ * In the place of a struct lf_config, lf::exec() visits each op with
+ * a visitor: any class with members named as the lf_config hooks, less
+ * the opaque pointer. These are resolved statically and so may inline.
+ * A visitor only needs the hooks its formats use; a directive with no
+ * hook is LF_ERR_UNSUPPORTED, at compile time for an lf::format.
+ *
+ * Custom directives need a callback, and so only lf_parse() has them;
+ * their characters are unrecognised here, as for a config with no
+ * .override. Formats only known at runtime are parsed once to an
+ * lf::program, which is visited the same way, see lf::parse() below.
+ * Or they go to lf_parse() itself, see lf::compile().
+ *
+ * This needs <lf/lf.h> and <lf/lfc.h>, and links liblf for the pieces
+ * lf_render() is made of, so that rendering stays the same as at runtime.
+ */
+
+#include <stddef.h>
+
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+extern "C" {
+#include <lf/lf.h>
+}
+
+#include <lf/lfc.h>
+
+namespace lf {
+
+/*
+ * A format string, as a template argument. Embedded NULs are taken
+ * literally; the string ends at its last character.
+ */
+template <std::size_t N>
+struct fmt {
+	char s[N];
+
+	constexpr
+	fmt(const char (&a)[N])
+	{
+		for (std::size_t i = 0; i < N; i++) {
+			s[i] = a[i];
+		}
+	}
+
+	constexpr std::size_t
+	len() const
+	{
+		return N - 1;
+	}
+};
+
+/*
+ * The flags from struct lf_config which decide how a format parses.
+ */
+struct options {
+	bool hostname_lookups   = false;
+	bool use_canonical_name = false;
+};
+
+/*
+ * As enum op_type in liblf, less OP_CUSTOM.
+ */
+enum class op_type : unsigned char {
+	literal,
+
+	ip,
+	resp_size,
+	resp_size_clf,
+	req_cookie,
+	env_var,
+	filename,
+	remote_hostname,
+	req_protocol,
+	req_header,
+	keepalive_reqs,
+	remote_logname,
+	req_logid,
+	req_method,
+	note,
+	reply_header,
+	server_port,
+	id,
+	query_string,
+	req_first_line,
+	resp_handler,
+	status,
+	time,
+	time_frac,
+	time_taken,
+	remote_user,
+	url_path,
+	server_name,
+	conn_status,
+	bytes_recv,
+	bytes_sent,
+	bytes_xfer,
+	req_trailer,
+	resp_trailer
+};
+
+/*
+ * One op per directive, and one per run of literal text.
+ * Offsets are into the program's .status and .text arrays.
+ */
+struct op {
+	op_type type;
+	lf_redirect redirect;
+	lf_when when;
+	unsigned arg;         /* enum lf_ip, lf_port, lf_id, lf_rtime or a boolean */
+
+	bool neg;
+	std::size_t status;   /* the predicate's statuses, sorted and unique */
+	std::size_t count;
+
+	/*
+	 * The name for named directives (including the strftime format
+	 * for op_type::time), or the text for op_type::literal. Names are
+	 * NUL terminated. A %t without a name has no text, and .p is npos.
+	 */
+	std::size_t p;
+	std::size_t n;
+
+	std::size_t src;      /* offset into the format string */
+	std::size_t srcn;     /* and the length of the text it came from */
+};
+
+inline constexpr std::size_t npos = std::size_t(-1);
+
+/* LogFormat's default for %t */
+inline constexpr char clf_time[] = "[%d/%b/%Y:%T %z]";
+
+/*
+ * A parsed format of at most N - 1 characters. Every op, status and
+ * name takes at least one character of the format, and names take one
+ * more for their NUL, so these are big enough for any such format.
+ */
+template <std::size_t N>
+struct prog {
+	bool ok;
+	lf_errno err;
+	std::size_t at;       /* as lf_err's .p, an offset into the format */
+	std::size_t width;    /* as lf_err's .n */
+
+	std::size_t count;
+	struct op op[N];
+
+	std::size_t nstatus;
+	unsigned status[N];
+
+	std::size_t ntext;
+	char text[N * 2];
+};
+
+namespace detail {
+
+constexpr unsigned max_status      = 0xffffU; /* as lf_parse() */
+constexpr std::size_t max_statuses = 128;
+
+/* the C locale's, which is what lf_parse() sees */
+constexpr bool
+isdigit(char c)
+{
+	return c >= '0' && c <= '9';
+}
+
+constexpr bool
+isalpha(char c)
+{
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+constexpr bool
+eq(const char *p, std::size_t n, const char *s)
+{
+	return std::string_view(p, n) == std::string_view(s);
+}
+
+enum class name {
+	optional,
+	required,
+	forbidden
+};
+
+enum class handler {
+	unrecognised,
+	missing,
+	percent,
+	simple,
+	ip,
+	port,
+	id,
+	time,
+	rtime,
+	trailer
+};
+
+struct spec {
+	handler h;
+	enum name name;
+	op_type type;
+	unsigned arg;
+	lf_redirect redirect;
+};
+
+/*
+ * The rules for a single specifier character, as lf_parse()'s.
+ */
+constexpr spec
+specifier(char c, options o)
+{
+	lf_redirect r;
+
+	switch (c) {
+	case 's':
+	case 'U':
+	case 'T':
+	case 'D':
+	case 'r': r = LF_REDIRECT_ORIG;  break;
+	default:  r = LF_REDIRECT_FINAL; break;
+	}
+
+	switch (c) {
+	case '\0': return { handler::missing,  name::optional,  op_type::literal,         0, r };
+	case '%':  return { handler::percent,  name::optional,  op_type::literal,         0, r };
+
+	case 'A':  return { handler::simple,   name::forbidden, op_type::ip,              LF_IP_LOCAL, r };
+	case 'B':  return { handler::simple,   name::forbidden, op_type::resp_size,       0, r };
+	case 'b':  return { handler::simple,   name::forbidden, op_type::resp_size_clf,   0, r };
+	case 'C':  return { handler::simple,   name::required,  op_type::req_cookie,      0, r };
+	case 'D':  return { handler::simple,   name::forbidden, op_type::time_taken,      LF_RTIME_US, r };
+	case 'e':  return { handler::simple,   name::required,  op_type::env_var,         0, r };
+	case 'f':  return { handler::simple,   name::forbidden, op_type::filename,        0, r };
+	case 'h':  return { handler::simple,   name::forbidden, op_type::remote_hostname, o.hostname_lookups, r };
+	case 'H':  return { handler::simple,   name::forbidden, op_type::req_protocol,    0, r };
+	case 'i':  return { handler::simple,   name::required,  op_type::req_header,      0, r };
+	case 'k':  return { handler::simple,   name::forbidden, op_type::keepalive_reqs,  0, r };
+	case 'l':  return { handler::simple,   name::forbidden, op_type::remote_logname,  0, r };
+	case 'L':  return { handler::simple,   name::forbidden, op_type::req_logid,       0, r };
+	case 'm':  return { handler::simple,   name::forbidden, op_type::req_method,      0, r };
+	case 'n':  return { handler::simple,   name::required,  op_type::note,            0, r };
+	case 'o':  return { handler::simple,   name::required,  op_type::reply_header,    0, r };
+	case 'u':  return { handler::simple,   name::forbidden, op_type::remote_user,     0, r };
+	case 'U':  return { handler::simple,   name::forbidden, op_type::url_path,        0, r };
+	case 'v':  return { handler::simple,   name::forbidden, op_type::server_name,     1, r };
+	case 'V':  return { handler::simple,   name::forbidden, op_type::server_name,     o.use_canonical_name, r };
+	case 'X':  return { handler::simple,   name::forbidden, op_type::conn_status,     0, r };
+	case 'I':  return { handler::simple,   name::forbidden, op_type::bytes_recv,      0, r };
+	case 'O':  return { handler::simple,   name::forbidden, op_type::bytes_sent,      0, r };
+	case 'q':  return { handler::simple,   name::forbidden, op_type::query_string,    0, r };
+	case 'r':  return { handler::simple,   name::forbidden, op_type::req_first_line,  0, r };
+	case 'R':  return { handler::simple,   name::forbidden, op_type::resp_handler,    0, r };
+	case 's':  return { handler::simple,   name::forbidden, op_type::status,          0, r };
+	case 'S':  return { handler::simple,   name::forbidden, op_type::bytes_xfer,      0, r };
+
+	case 'a':  return { handler::ip,       name::optional,  op_type::ip,              0, r };
+	case 'p':  return { handler::port,     name::optional,  op_type::server_port,     0, r };
+	case 'P':  return { handler::id,       name::optional,  op_type::id,              0, r };
+	case 't':  return { handler::time,     name::optional,  op_type::time,            0, r };
+	case 'T':  return { handler::rtime,    name::optional,  op_type::time_taken,      0, r };
+	case '^':  return { handler::trailer,  name::required,  op_type::req_trailer,     0, r };
+
+	default:
+		if (isalpha(c)) {
+			return { handler::unrecognised, name::forbidden, op_type::literal, 0, r };
+		} else {
+			return { handler::unrecognised, name::optional,  op_type::literal, 0, r };
+		}
+	}
+}
+
+/*
+ * A constant-expression counterpart to lf_parsen(), element for element.
+ * Each step leaves i at the last character it consumed, as lf_parse()
+ * does, and the offsets for errors are those lf_parse() reports.
+ *
+ * The ops go to R, which is either a prog<N> or an lf::program, and has
+ * room enough for the format, as prog<N> describes.
+ */
+template <class R>
+class parser {
+	const char *s;
+	std::size_t len;
+	options o;
+
+	std::size_t i;
+
+	/* as lf_parse()'s struct errstuff, with npos for NULL */
+	std::size_t toomanyredirect;
+	std::size_t percent;
+	std::size_t openingbrace;
+
+	R &r;
+
+public:
+	constexpr
+	parser(R &r, const char *s, std::size_t len, options o):
+		s(s), len(len), o(o), i(0),
+		toomanyredirect(npos), percent(npos), openingbrace(npos),
+		r(r)
+	{
+		r.ok    = true;
+		r.err   = LF_ERR_ERRNO;
+		r.at    = 0;
+		r.width = 0;
+
+		r.count   = 0;
+		r.nstatus = 0;
+		r.ntext   = 0;
+
+		while (i < len) {
+			if (!element()) {
+				r.ok = false;
+				r.count = 0;
+				return;
+			}
+
+			i++;
+		}
+	}
+
+private:
+	constexpr char
+	peek(std::size_t j) const
+	{
+		return j < len ? s[j] : '\0';
+	}
+
+	/* the length of the run from j which is (or isn't) in set */
+	constexpr std::size_t
+	span(std::size_t j, std::string_view set, bool in) const
+	{
+		std::size_t k;
+
+		for (k = j; k < len && (set.find(s[k]) != set.npos) == in; k++)
+			;
+
+		return k - j;
+	}
+
+	/* as lf_parse()'s seterr() */
+	constexpr bool
+	error(lf_errno e)
+	{
+		r.err = e;
+
+		switch (e) {
+		case LF_ERR_MISSING_CLOSING_BRACE:
+			r.at    = openingbrace;
+			r.width = 1;
+			break;
+
+		case LF_ERR_MISSING_ESCAPE:
+		case LF_ERR_UNRECOGNISED_ESCAPE:
+			r.at    = i - 1;
+			r.width = 1 + (i < len);
+			break;
+
+		case LF_ERR_TOO_MANY_STATUSES:
+			r.at    = i;
+			r.width = 0;
+			break;
+
+		case LF_ERR_STATUS_OVERFLOW:
+			r.at    = i;
+			r.width = span(i, "0123456789", true);
+			break;
+
+		case LF_ERR_TOO_MANY_REDIRECT_FLAGS:
+			r.at    = toomanyredirect;
+			r.width = span(toomanyredirect, "<>", true);
+			break;
+
+		case LF_ERR_UNRECOGNISED_IP_TYPE:
+		case LF_ERR_UNRECOGNISED_PORT_TYPE:
+		case LF_ERR_UNRECOGNISED_ID_TYPE:
+		case LF_ERR_UNRECOGNISED_RTIME_UNIT:
+			r.at    = openingbrace + 1;
+			r.width = span(r.at, "}", false);
+			break;
+
+		case LF_ERR_EMPTY_NAME:
+		case LF_ERR_UNWANTED_NAME:
+			r.at    = openingbrace;
+			r.width = span(r.at, "}", false) + 1;
+			break;
+
+		case LF_ERR_MISSING_DIRECTIVE:
+			r.at    = percent;
+			r.width = i - percent;
+			break;
+
+		default:
+			r.at    = percent;
+			r.width = i - percent + (i < len);
+			break;
+		}
+
+		return false;
+	}
+
+	/* copied to .text, NUL terminated */
+	constexpr void
+	copy(struct op &op, const char *p, std::size_t n)
+	{
+		op.p = r.ntext;
+		op.n = n;
+
+		for (std::size_t j = 0; j < n; j++) {
+			r.text[r.ntext++] = p[j];
+		}
+
+		r.text[r.ntext++] = '\0';
+	}
+
+	/* runs of literal text are one op, as for lf_compile() */
+	constexpr bool
+	literal(std::size_t src, char c)
+	{
+		if (r.count == 0 || r.op[r.count - 1].type != op_type::literal) {
+			struct op &op = r.op[r.count++];
+
+			op = {};
+			op.type     = op_type::literal;
+			op.redirect = LF_REDIRECT_FINAL;
+			op.when     = LF_WHEN_BEGIN;
+			op.p        = r.ntext;
+			op.src      = src;
+		}
+
+		r.text[r.ntext++] = c;
+		r.op[r.count - 1].n++;
+		r.op[r.count - 1].srcn = i + 1 - r.op[r.count - 1].src;
+
+		return true;
+	}
+
+	constexpr bool
+	escape()
+	{
+		std::size_t src = i;
+
+		i++;
+
+		switch (peek(i)) {
+		case 't':  return literal(src, '\t');
+		case 'n':  return literal(src, '\n');
+		case '\'': return literal(src, '\'');
+		case '\"': return literal(src, '\"');
+		case '\\': return literal(src, '\\');
+
+		case '\0':
+			return error(LF_ERR_MISSING_ESCAPE);
+
+		default:
+			return error(LF_ERR_UNRECOGNISED_ESCAPE);
+		}
+	}
+
+	/* as lf_parse()'s parse_status(); 0 for overflow or no digits */
+	constexpr unsigned
+	status(std::size_t *q) const
+	{
+		unsigned u = 0;
+
+		*q = i;
+
+		while (*q < len && isdigit(s[*q])) {
+			if (u >= max_status / 10U) {
+				return 0;
+			}
+
+			u *= 10;
+			u += s[*q] - '0';
+			(*q)++;
+		}
+
+		return u;
+	}
+
+	constexpr void
+	sort(unsigned a[], std::size_t *count)
+	{
+		std::size_t j, k;
+
+		for (j = 1; j < *count; j++) {
+			unsigned u = a[j];
+
+			for (k = j; k > 0 && a[k - 1] > u; k--) {
+				a[k] = a[k - 1];
+			}
+
+			a[k] = u;
+		}
+
+		if (*count <= 1) {
+			return;
+		}
+
+		k = 0;
+
+		for (j = 1; j < *count; j++) {
+			if (a[k] != a[j]) {
+				a[++k] = a[j];
+			}
+		}
+
+		*count = k + 1;
+	}
+
+	constexpr bool
+	directive()
+	{
+		struct op op = {};
+		std::size_t redirectp;
+		std::size_t np, nn;
+		spec sp;
+		char c;
+
+		percent = i;
+
+		op.redirect = LF_REDIRECT_FINAL;
+		op.when     = LF_WHEN_BEGIN;
+		op.status   = r.nstatus;
+		op.src      = i;
+
+		i++;
+
+		if (peek(i) == '!') {
+			op.neg = true;
+			i++;
+		}
+
+		do {
+			std::size_t q = i;
+			unsigned u;
+
+			u = status(&q);
+			if (u == 0 && q != i) {
+				/* parse_status() stops at the overflowing digit */
+				return error(LF_ERR_STATUS_OVERFLOW);
+			}
+
+			if (u == 0) {
+				break;
+			}
+
+			i = q;
+
+			if (op.count == max_statuses) {
+				return error(LF_ERR_TOO_MANY_STATUSES);
+			}
+
+			r.status[op.status + op.count++] = u;
+		} while (peek(i) == ',' && ++i);
+
+		sort(&r.status[op.status], &op.count);
+
+		if (peek(i) == '<' || peek(i) == '>') {
+			redirectp = i;
+			i++;
+		} else {
+			redirectp = npos;
+		}
+
+		np = npos;
+		nn = 0;
+
+		if (peek(i) == '{') {
+			std::size_t n;
+
+			openingbrace = i;
+
+			i++;
+
+			for (n = 0; i + n < len && s[i + n] != '}'; n++)
+				;
+
+			if (peek(i + n) != '}') {
+				return error(LF_ERR_MISSING_CLOSING_BRACE);
+			}
+
+			if (n == 0) {
+				return error(LF_ERR_EMPTY_NAME);
+			}
+
+			np = i;
+			nn = n;
+
+			i += n;
+			i++;
+		}
+
+		c = peek(i);
+
+		sp = specifier(c, o);
+
+		op.redirect = sp.redirect;
+
+		if (redirectp != npos) {
+			op.redirect = s[redirectp] == '<' ? LF_REDIRECT_ORIG : LF_REDIRECT_FINAL;
+
+			toomanyredirect = redirectp;
+
+			if (peek(redirectp + 1) == '<' || peek(redirectp + 1) == '>') {
+				return error(LF_ERR_TOO_MANY_REDIRECT_FLAGS);
+			}
+		}
+
+		if (!decode(sp, op, np, nn)) {
+			return false;
+		}
+
+		/* %% is literal text, whatever else was given */
+		if (op.type == op_type::literal) {
+			return literal(op.src, '%');
+		}
+
+		op.srcn = i + 1 - op.src;
+
+		r.nstatus += op.count;
+		r.op[r.count++] = op;
+
+		return true;
+	}
+
+	constexpr bool
+	decode(const spec &sp, struct op &op, std::size_t np, std::size_t nn)
+	{
+		bool named = np != npos;
+		const char *p = named ? s + np : s;
+
+		switch (sp.name) {
+		case name::required:
+			if (!named) {
+				return error(LF_ERR_MISSING_NAME);
+			}
+			break;
+
+		case name::forbidden:
+			if (named) {
+				return error(LF_ERR_UNWANTED_NAME);
+			}
+			break;
+
+		case name::optional:
+			break;
+		}
+
+		op.type = sp.type;
+		op.arg  = sp.arg;
+		op.p    = npos;
+
+		switch (sp.h) {
+		case handler::simple:
+			if (sp.name == name::required) {
+				copy(op, p, nn);
+			}
+			return true;
+
+		case handler::percent:
+			return true;
+
+		case handler::ip:
+			if (!named) {
+				op.arg = LF_IP_CLIENT;
+			} else if (eq(p, nn, "c")) {
+				op.arg = LF_IP_PEER;
+			} else {
+				return error(LF_ERR_UNRECOGNISED_IP_TYPE);
+			}
+			return true;
+
+		case handler::port:
+			if (!named || eq(p, nn, "canonical")) {
+				op.arg = LF_PORT_CANONICAL;
+			} else if (eq(p, nn, "local")) {
+				op.arg = LF_PORT_LOCAL;
+			} else if (eq(p, nn, "remote")) {
+				op.arg = LF_PORT_REMOTE;
+			} else {
+				return error(LF_ERR_UNRECOGNISED_PORT_TYPE);
+			}
+			return true;
+
+		case handler::id:
+			if (!named || eq(p, nn, "pid")) {
+				op.arg = LF_ID_PID;
+			} else if (eq(p, nn, "tid")) {
+				op.arg = LF_ID_TID;
+			} else if (eq(p, nn, "hextid")) {
+				op.arg = LF_ID_HEXTID;
+			} else {
+				return error(LF_ERR_UNRECOGNISED_ID_TYPE);
+			}
+			return true;
+
+		case handler::time: {
+			std::string_view f;
+
+			/* the default has no prefix, and is none of the tokens below */
+			if (!named) {
+				return true;
+			}
+
+			f = std::string_view(p, nn);
+
+			if (f.starts_with("begin:")) {
+				op.when = LF_WHEN_BEGIN;
+				f.remove_prefix(6);
+			} else if (f.starts_with("end:")) {
+				op.when = LF_WHEN_END;
+				f.remove_prefix(4);
+			}
+
+			if (f == "sec") {
+				op.type = op_type::time_frac;
+				op.arg  = LF_RTIME_S;
+			} else if (f == "msec") {
+				op.type = op_type::time_frac;
+				op.arg  = LF_RTIME_MS;
+			} else if (f == "usec") {
+				op.type = op_type::time_frac;
+				op.arg  = LF_RTIME_US;
+			} else if (f == "msec_frac") {
+				op.type = op_type::time_frac;
+				op.arg  = LF_RTIME_MS_FRAC;
+			} else if (f == "usec_frac") {
+				op.type = op_type::time_frac;
+				op.arg  = LF_RTIME_US_FRAC;
+			} else {
+				copy(op, f.data(), f.size());
+			}
+			return true;
+		}
+
+		case handler::rtime:
+			if (!named || eq(p, nn, "s")) {
+				op.arg = LF_RTIME_S;
+			} else if (eq(p, nn, "ms")) {
+				op.arg = LF_RTIME_MS;
+			} else if (eq(p, nn, "us")) {
+				op.arg = LF_RTIME_US;
+			} else {
+				return error(LF_ERR_UNRECOGNISED_RTIME_UNIT);
+			}
+			return true;
+
+		case handler::trailer:
+			i++;
+
+			if (peek(i) != 't') {
+				return error(LF_ERR_UNRECOGNISED_DIRECTIVE);
+			}
+
+			i++;
+
+			switch (peek(i)) {
+			case 'i': op.type = op_type::req_trailer;  break;
+			case 'o': op.type = op_type::resp_trailer; break;
+
+			default:
+				return error(LF_ERR_UNRECOGNISED_DIRECTIVE);
+			}
+
+			copy(op, p, nn);
+			return true;
+
+		case handler::missing:
+			return error(LF_ERR_MISSING_DIRECTIVE);
+
+		case handler::unrecognised:
+		default:
+			return error(LF_ERR_UNRECOGNISED_DIRECTIVE);
+		}
+	}
+
+	constexpr bool
+	element()
+	{
+		toomanyredirect = npos;
+		percent         = npos;
+		openingbrace    = npos;
+
+		switch (s[i]) {
+		case '\\':
+			return escape();
+
+		case '%':
+			return directive();
+
+		default:
+			return literal(i, s[i]);
+		}
+	}
+};
+
+template <std::size_t N>
+constexpr prog<N>
+parse(const char *s, std::size_t len, options o)
+{
+	prog<N> r = {};
+
+	parser<prog<N>>(r, s, len, o);
+
+	return r;
+}
+
+/*
+ * Instantiated for every format, this fails for those which didn't parse.
+ * The messages are lf_strerror()'s.
+ */
+template <bool Ok, lf_errno E, std::size_t At>
+constexpr bool
+check()
+{
+	static_assert(Ok || E != LF_ERR_MISSING_CLOSING_BRACE,   "Missing closing brace");
+	static_assert(Ok || E != LF_ERR_MISSING_DIRECTIVE,       "Missing directive");
+	static_assert(Ok || E != LF_ERR_MISSING_ESCAPE,          "Missing escape");
+	static_assert(Ok || E != LF_ERR_MISSING_NAME,            "Missing name");
+
+	static_assert(Ok || E != LF_ERR_UNRECOGNISED_DIRECTIVE,  "Unrecognised directive");
+	static_assert(Ok || E != LF_ERR_UNRECOGNISED_ESCAPE,     "Unrecognised escape");
+	static_assert(Ok || E != LF_ERR_UNRECOGNISED_IP_TYPE,    "Unrecognised ip type");
+	static_assert(Ok || E != LF_ERR_UNRECOGNISED_RTIME_UNIT, "Unrecognised rtime unit");
+	static_assert(Ok || E != LF_ERR_UNRECOGNISED_PORT_TYPE,  "Unrecognised port type");
+	static_assert(Ok || E != LF_ERR_UNRECOGNISED_ID_TYPE,    "Unrecognised id type");
+
+	static_assert(Ok || E != LF_ERR_STATUS_OVERFLOW,         "Status overflow");
+	static_assert(Ok || E != LF_ERR_TOO_MANY_STATUSES,       "Too many statuses");
+	static_assert(Ok || E != LF_ERR_TOO_MANY_REDIRECT_FLAGS, "Too many redirect flags");
+	static_assert(Ok || E != LF_ERR_EMPTY_NAME,              "Empty name");
+	static_assert(Ok || E != LF_ERR_UNWANTED_NAME,           "Unwanted name");
+
+	static_assert(Ok || E != LF_ERR_UNSUPPORTED,             "Unsupported directive");
+
+	/* every error lf_parse() gives for a format is above, and ours */
+	return true;
+}
+
+/* as lf_pred_match()'s bitmap */
+template <const auto &P, std::size_t I>
+constexpr auto
+pred_map()
+{
+	struct map {
+		unsigned char a[sizeof lf_pred::map];
+	} m = {};
+
+	for (std::size_t j = 0; j < P.op[I].count; j++) {
+		unsigned u = P.status[P.op[I].status + j];
+
+		if (u >= LF_PRED_MIN && u <= LF_PRED_MAX) {
+			u -= LF_PRED_MIN;
+			m.a[u / CHAR_BIT] |= 1U << (u % CHAR_BIT);
+		}
+	}
+
+	return m;
+}
+
+template <const auto &P, std::size_t I>
+inline bool
+match(unsigned status)
+{
+	constexpr const struct op &op = P.op[I];
+	static constexpr auto m = pred_map<P, I>();
+	bool r;
+
+	if (status >= LF_PRED_MIN && status <= LF_PRED_MAX) {
+		r = lfc_map(m.a, status);
+	} else {
+		r = false;
+
+		for (std::size_t j = 0; j < op.count; j++) {
+			if (P.status[op.status + j] == status) {
+				r = true;
+			}
+		}
+	}
+
+	return r != op.neg;
+}
+
+/*
+ * One directive, as lf_render() would output it. Everything about the op
+ * is a constant here, so only the code for its own type is generated.
+ */
+template <const auto &P, std::size_t I>
+inline void
+directive(lfc_out *o, const lf_record *r)
+{
+	constexpr const struct op &op = P.op[I];
+
+	if constexpr (op.type == op_type::ip) {
+		lfc_str(o, &r->ip[op.arg], 0);
+	} else if constexpr (op.type == op_type::resp_size) {
+		lfc_uint(o, r->resp_size, 10);
+	} else if constexpr (op.type == op_type::resp_size_clf) {
+		if (r->resp_size == 0) {
+			lfc_dash(o);
+		} else {
+			lfc_uint(o, r->resp_size, 10);
+		}
+	} else if constexpr (op.type == op_type::req_cookie) {
+		lfc_lookup(o, r, LF_TABLE_REQ_COOKIE, P.text + op.p, op.n);
+	} else if constexpr (op.type == op_type::env_var) {
+		lfc_lookup(o, r, LF_TABLE_ENV_VAR, P.text + op.p, op.n);
+	} else if constexpr (op.type == op_type::req_header) {
+		lfc_lookup(o, r, LF_TABLE_REQ_HEADER, P.text + op.p, op.n);
+	} else if constexpr (op.type == op_type::note) {
+		lfc_lookup(o, r, LF_TABLE_NOTE, P.text + op.p, op.n);
+	} else if constexpr (op.type == op_type::reply_header) {
+		lfc_lookup(o, r, LF_TABLE_REPLY_HEADER, P.text + op.p, op.n);
+	} else if constexpr (op.type == op_type::req_trailer) {
+		lfc_lookup(o, r, LF_TABLE_REQ_TRAILER, P.text + op.p, op.n);
+	} else if constexpr (op.type == op_type::resp_trailer) {
+		lfc_lookup(o, r, LF_TABLE_RESP_TRAILER, P.text + op.p, op.n);
+	} else if constexpr (op.type == op_type::filename) {
+		lfc_str(o, &r->filename, 0);
+	} else if constexpr (op.type == op_type::remote_hostname) {
+		if (op.arg && r->remote_host.p != NULL) {
+			lfc_str(o, &r->remote_host, 1);
+		} else {
+			lfc_str(o, &r->ip[LF_IP_CLIENT], 1);
+		}
+	} else if constexpr (op.type == op_type::req_protocol) {
+		lfc_str(o, &r->req_protocol, 1);
+	} else if constexpr (op.type == op_type::remote_logname) {
+		lfc_str(o, &r->remote_logname, 1);
+	} else if constexpr (op.type == op_type::req_logid) {
+		lfc_str(o, &r->req_logid, 0);
+	} else if constexpr (op.type == op_type::req_method) {
+		lfc_str(o, &r->req_method, 1);
+	} else if constexpr (op.type == op_type::req_first_line) {
+		lfc_str(o, &r->req_first_line, 1);
+	} else if constexpr (op.type == op_type::resp_handler) {
+		lfc_str(o, &r->resp_handler, 1);
+	} else if constexpr (op.type == op_type::url_path) {
+		lfc_str(o, &r->url_path, 1);
+	} else if constexpr (op.type == op_type::keepalive_reqs) {
+		lfc_uint(o, r->keepalive_reqs, 10);
+	} else if constexpr (op.type == op_type::server_port) {
+		lfc_uint(o, r->port[op.arg], 10);
+	} else if constexpr (op.type == op_type::id) {
+		if constexpr (op.arg == LF_ID_PID) {
+			lfc_uint(o, r->pid, 10);
+		} else if constexpr (op.arg == LF_ID_TID) {
+			lfc_uint(o, r->tid, 10);
+		} else {
+			lfc_uint(o, r->tid, 16);
+		}
+	} else if constexpr (op.type == op_type::query_string) {
+		if (r->query_string.p != NULL) {
+			lfc_putc(o, '?');
+			lfc_escaped(o, r->query_string.p, r->query_string.n);
+		}
+	} else if constexpr (op.type == op_type::status) {
+		if (r->status == 0) {
+			lfc_dash(o);
+		} else {
+			lfc_uint(o, r->status, 10);
+		}
+	} else if constexpr (op.type == op_type::time) {
+		lfc_time(o, r->time[op.when], op.p == npos ? clf_time : P.text + op.p);
+	} else if constexpr (op.type == op_type::time_frac) {
+		lfc_frac(o, r->time[op.when], lf_rtime(op.arg));
+	} else if constexpr (op.type == op_type::time_taken) {
+		long long d = r->time[LF_WHEN_END] - r->time[LF_WHEN_BEGIN];
+
+		if constexpr (op.arg == LF_RTIME_S) {
+			lfc_int(o, d / 1000000);
+		} else if constexpr (op.arg == LF_RTIME_MS) {
+			lfc_int(o, d / 1000);
+		} else {
+			lfc_int(o, d);
+		}
+	} else if constexpr (op.type == op_type::remote_user) {
+		if (r->remote_user.p != NULL && r->remote_user.n == 0) {
+			lfc_put(o, "\"\"", 2);
+		} else {
+			lfc_str(o, &r->remote_user, 1);
+		}
+	} else if constexpr (op.type == op_type::server_name) {
+		if (op.arg || r->host.p == NULL) {
+			lfc_str(o, &r->server_name, 1);
+		} else {
+			lfc_str(o, &r->host, 1);
+		}
+	} else if constexpr (op.type == op_type::conn_status) {
+		lfc_putc(o, r->aborted ? 'X' : r->keepalive ? '+' : '-');
+	} else if constexpr (op.type == op_type::bytes_recv) {
+		lfc_uint(o, r->bytes_recv, 10);
+	} else if constexpr (op.type == op_type::bytes_sent) {
+		lfc_uint(o, r->bytes_sent, 10);
+	} else if constexpr (op.type == op_type::bytes_xfer) {
+		lfc_uint(o, r->bytes_xfer, 10);
+	}
+}
+
+template <const auto &P, std::size_t I>
+inline void
+step(lfc_out *o, const lf_record *rec, const lf_record *final)
+{
+	constexpr const struct op &op = P.op[I];
+
+	if constexpr (op.type == op_type::literal) {
+		lfc_put(o, P.text + op.p, op.n);
+	} else {
+		if constexpr (op.count > 0) {
+			if (!match<P, I>(final->status)) {
+				lfc_dash(o);
+				return;
+			}
+		}
+
+		directive<P, I>(o, op.redirect == LF_REDIRECT_FINAL ? final : rec);
+	}
+}
+
+template <const auto &P, std::size_t... I>
+inline std::size_t
+render(const lf_record *rec, char *buf, std::size_t size,
+	std::index_sequence<I...>)
+{
+	const lf_record *final;
+	lfc_out o = { buf, size, 0 };
+
+	final = rec->final != NULL ? rec->final : rec;
+
+	(void) final; /* for formats with no directives */
+
+	(step<P, I>(&o, rec, final), ...);
+
+	return o.n;
+}
+
+
+/*
+ * Visitors have a member function for each hook they want, named for
+ * the field in struct lf_config, and taking the same arguments less the
+ * opaque pointer. For names, the pointer and length variant is preferred
+ * when a visitor has both. A hook which is left out is unsupported.
+ *
+ * Each call is resolved here when the visitor's type is known, and so
+ * can be inlined; call() gives an unsupported instead for a hook which
+ * is left out, and that costs nothing.
+ */
+struct unsupported {
+};
+
+#define LF_CALL(hook, ...)                              \
+	if constexpr (requires { v.hook(__VA_ARGS__); }) {  \
+		return bool(v.hook(__VA_ARGS__));               \
+	} else {                                            \
+		return unsupported();                           \
+	}
+
+#define LF_NAMED(hook)                                  \
+	if constexpr (requires { v.hook(pred, r, name, op.n); }) { \
+		return bool(v.hook(pred, r, name, op.n));       \
+	} else {                                            \
+		LF_CALL(hook, pred, r, name);                   \
+	}
+
+template <op_type T, class V>
+inline auto
+call(V &v, const lf_pred *pred, const struct op &op, const char *name)
+{
+	lf_redirect r = op.redirect;
+
+	if constexpr (T == op_type::ip) {
+		LF_CALL(ip, pred, r, lf_ip(op.arg));
+	} else if constexpr (T == op_type::resp_size) {
+		LF_CALL(resp_size, pred, r);
+	} else if constexpr (T == op_type::resp_size_clf) {
+		LF_CALL(resp_size_clf, pred, r);
+	} else if constexpr (T == op_type::req_cookie) {
+		LF_NAMED(req_cookie);
+	} else if constexpr (T == op_type::env_var) {
+		LF_NAMED(env_var);
+	} else if constexpr (T == op_type::filename) {
+		LF_CALL(filename, pred, r);
+	} else if constexpr (T == op_type::remote_hostname) {
+		LF_CALL(remote_hostname, pred, r, int(op.arg));
+	} else if constexpr (T == op_type::req_protocol) {
+		LF_CALL(req_protocol, pred, r);
+	} else if constexpr (T == op_type::req_header) {
+		LF_NAMED(req_header);
+	} else if constexpr (T == op_type::keepalive_reqs) {
+		LF_CALL(keepalive_reqs, pred, r);
+	} else if constexpr (T == op_type::remote_logname) {
+		LF_CALL(remote_logname, pred, r);
+	} else if constexpr (T == op_type::req_logid) {
+		LF_CALL(req_logid, pred, r);
+	} else if constexpr (T == op_type::req_method) {
+		LF_CALL(req_method, pred, r);
+	} else if constexpr (T == op_type::note) {
+		LF_NAMED(note);
+	} else if constexpr (T == op_type::reply_header) {
+		LF_NAMED(reply_header);
+	} else if constexpr (T == op_type::server_port) {
+		LF_CALL(server_port, pred, r, lf_port(op.arg));
+	} else if constexpr (T == op_type::id) {
+		LF_CALL(id, pred, r, lf_id(op.arg));
+	} else if constexpr (T == op_type::query_string) {
+		LF_CALL(query_string, pred, r);
+	} else if constexpr (T == op_type::req_first_line) {
+		LF_CALL(req_first_line, pred, r);
+	} else if constexpr (T == op_type::resp_handler) {
+		LF_CALL(resp_handler, pred, r);
+	} else if constexpr (T == op_type::status) {
+		LF_CALL(status, pred, r);
+	} else if constexpr (T == op_type::time) {
+		if constexpr (requires { v.time(pred, r, op.when, name, op.n); }) {
+			return bool(v.time(pred, r, op.when, name, op.n));
+		} else {
+			LF_CALL(time, pred, r, op.when, name);
+		}
+	} else if constexpr (T == op_type::time_frac) {
+		LF_CALL(time_frac, pred, r, op.when, lf_rtime(op.arg));
+	} else if constexpr (T == op_type::time_taken) {
+		LF_CALL(time_taken, pred, r, lf_rtime(op.arg));
+	} else if constexpr (T == op_type::remote_user) {
+		LF_CALL(remote_user, pred, r);
+	} else if constexpr (T == op_type::url_path) {
+		LF_CALL(url_path, pred, r);
+	} else if constexpr (T == op_type::server_name) {
+		LF_CALL(server_name, pred, r, int(op.arg));
+	} else if constexpr (T == op_type::conn_status) {
+		LF_CALL(conn_status, pred, r);
+	} else if constexpr (T == op_type::bytes_recv) {
+		LF_CALL(bytes_recv, pred, r);
+	} else if constexpr (T == op_type::bytes_sent) {
+		LF_CALL(bytes_sent, pred, r);
+	} else if constexpr (T == op_type::bytes_xfer) {
+		LF_CALL(bytes_xfer, pred, r);
+	} else if constexpr (T == op_type::req_trailer) {
+		LF_NAMED(req_trailer);
+	} else if constexpr (T == op_type::resp_trailer) {
+		LF_NAMED(resp_trailer);
+	} else {
+		return unsupported();
+	}
+}
+
+#undef LF_NAMED
+#undef LF_CALL
+
+/* a run of literal text; *k is the character which failed, if any */
+template <class V>
+inline auto
+literal(V &v, const char *p, std::size_t n, std::size_t *k)
+{
+	if constexpr (requires { v.literal_span(p, n); }) {
+		return bool(v.literal_span(p, n));
+	} else if constexpr (requires { v.literal(*p); }) {
+		for (*k = 0; *k < n; (*k)++) {
+			if (!v.literal(p[*k])) {
+				return false;
+			}
+		}
+
+		return true;
+	} else {
+		return unsupported();
+	}
+}
+
+template <class T>
+inline constexpr bool is_unsupported = std::is_same_v<T, unsupported>;
+
+/*
+ * As lf_exec()'s errors. A failing hook is LF_ERR_ERRNO, and points at
+ * the last character of its directive, or for literal text, at the
+ * character which failed.
+ */
+inline bool
+fail(lf_err *ep, lf_errno e, const char *fmt, const struct op &op, std::size_t k)
+{
+	if (ep == NULL) {
+		return false;
+	}
+
+	ep->errnum = e;
+
+	if (e != LF_ERR_ERRNO) {
+		ep->p = fmt + op.src;
+		ep->n = op.srcn;
+	} else if (op.type == op_type::literal && op.srcn == op.n) {
+		ep->p = fmt + op.src + k;
+		ep->n = 0;
+	} else {
+		ep->p = fmt + op.src + op.srcn - 1;
+		ep->n = 0;
+	}
+
+	return false;
+}
+
+/* lf_pred's .status isn't const, but is never written through */
+template <const auto &P, std::size_t I>
+constexpr lf_pred
+pred()
+{
+	constexpr const struct op &op = P.op[I];
+	lf_pred pred = {};
+
+	pred.neg    = op.neg;
+	pred.count  = op.count;
+	pred.status = const_cast<unsigned *>(P.status + op.status);
+
+	for (std::size_t j = 0; j < sizeof pred.map; j++) {
+		pred.map[j] = pred_map<P, I>().a[j];
+	}
+
+	return pred;
+}
+
+/*
+ * One op for a visitor. A hook which the visitor leaves out for a format
+ * known at compile time is a compile error, LF_ERR_UNSUPPORTED.
+ */
+template <const auto &P, std::size_t I, class V>
+inline bool
+visit(V &v, const char *fmt, lf_err *ep)
+{
+	constexpr const struct op &op = P.op[I];
+	std::size_t k = 0;
+
+	if constexpr (op.type == op_type::literal) {
+		using T = decltype(literal(v, P.text, op.n, &k));
+
+		static_assert(check<!is_unsupported<T>, LF_ERR_UNSUPPORTED, op.src>());
+
+		if constexpr (!is_unsupported<T>) {
+			if (!literal(v, P.text + op.p, op.n, &k)) {
+				return fail(ep, LF_ERR_ERRNO, fmt, op, k);
+			}
+		}
+	} else {
+		static constexpr lf_pred pr = pred<P, I>();
+		const char *name = op.p == npos ? clf_time : P.text + op.p;
+		using T = decltype(call<op.type>(v, &pr, op, name));
+
+		static_assert(check<!is_unsupported<T>, LF_ERR_UNSUPPORTED, op.src>());
+
+		if constexpr (!is_unsupported<T>) {
+			if (!call<op.type>(v, &pr, op, name)) {
+				return fail(ep, LF_ERR_ERRNO, fmt, op, k);
+			}
+		}
+	}
+
+	return true;
+}
+
+template <const auto &P, class V, std::size_t... I>
+inline bool
+exec(V &v, const char *fmt, lf_err *ep, std::index_sequence<I...>)
+{
+	(void) fmt;
+	(void) ep;
+
+	return (visit<P, I>(v, fmt, ep) && ...);
+}
+
+template <op_type T, class V>
+inline bool
+dispatch(V &v, const lf_pred *pred, const struct op &op, const char *name,
+	const char *fmt, lf_err *ep)
+{
+	if constexpr (is_unsupported<decltype(call<T>(v, pred, op, name))>) {
+		return fail(ep, LF_ERR_UNSUPPORTED, fmt, op, 0);
+	} else {
+		if (!call<T>(v, pred, op, name)) {
+			return fail(ep, LF_ERR_ERRNO, fmt, op, 0);
+		}
+
+		return true;
+	}
+}
+
+}
+
+/*
+ * A format parsed at compile time, for the given config flags.
+ * Naming lf::format<"..."> is enough to have the format checked.
+ */
+template <fmt F, options O = options()>
+struct format {
+	static constexpr auto prog = detail::parse<F.len() + 1>(F.s, F.len(), O);
+
+	static_assert(detail::check<prog.ok, prog.err, prog.at>());
+
+	/* as lf_render() */
+	static std::size_t
+	render(const lf_record *rec, char *buf, std::size_t size)
+	{
+		return detail::render<prog>(rec, buf, size,
+			std::make_index_sequence<prog.count>());
+	}
+
+	/*
+	 * As lf_exec(), calling the visitor's hooks for each op in turn.
+	 * Errors point into the format string.
+	 */
+	template <class V>
+	static int
+	exec(V &v, lf_err *ep = nullptr)
+	{
+		return detail::exec<prog>(v, F.s, ep,
+			std::make_index_sequence<prog.count>());
+	}
+};
+
+template <fmt F, options O = options()>
+inline std::size_t
+render(const lf_record *rec, char *buf, std::size_t size)
+{
+	return format<F, O>::render(rec, buf, size);
+}
+
+template <fmt F, options O = options(), class V>
+inline int
+exec(V &v, lf_err *ep = nullptr)
+{
+	return format<F, O>::template exec<V>(v, ep);
+}
+
+/*
+ * A format parsed at runtime by the same parser as lf::format<>.
+ * This keeps its own copy of the format, and so is self-contained,
+ * as lf_compile()'s programs are. Check .ok after construction.
+ */
+struct program {
+	std::string fmt;
+
+	bool ok;
+	lf_errno err;
+	std::size_t at;
+	std::size_t width;
+
+	std::size_t count;
+	std::vector<struct op> op;
+
+	std::size_t nstatus;
+	std::vector<unsigned> status;
+
+	std::size_t ntext;
+	std::vector<char> text;
+
+	std::vector<lf_pred> pred;
+
+	explicit
+	program(std::string_view s, options o = options()):
+		fmt(s), op(s.size() + 1), status(s.size() + 1), text(2 * (s.size() + 1))
+	{
+		detail::parser<program>(*this, fmt.data(), fmt.size(), o);
+
+		op.resize(count);
+		pred.resize(count);
+
+		for (std::size_t i = 0; i < count; i++) {
+			lf_pred &p = pred[i];
+
+			p.neg    = op[i].neg;
+			p.count  = op[i].count;
+			p.status = status.data() + op[i].status;
+
+			std::memset(p.map, 0, sizeof p.map);
+
+			for (std::size_t j = 0; j < p.count; j++) {
+				unsigned u = p.status[j];
+
+				if (u >= LF_PRED_MIN && u <= LF_PRED_MAX) {
+					u -= LF_PRED_MIN;
+					p.map[u / CHAR_BIT] |= 1U << (u % CHAR_BIT);
+				}
+			}
+		}
+	}
+
+	/* .pred points into .status */
+	program(const program &) = delete;
+	program &operator=(const program &) = delete;
+};
+
+/*
+ * As lf_exec() for a program parsed at runtime. Each op is dispatched
+ * by its type, to a call which was resolved for the visitor statically.
+ * A hook which the visitor leaves out is LF_ERR_UNSUPPORTED.
+ */
+template <class V>
+inline int
+exec(V &v, const program &prog, lf_err *ep = nullptr)
+{
+	const char *fmt = prog.fmt.data();
+
+	for (std::size_t i = 0; i < prog.count; i++) {
+		const struct op &op = prog.op[i];
+		const lf_pred *pred = &prog.pred[i];
+		const char *name;
+		std::size_t k = 0;
+
+		name = op.p == npos ? clf_time : prog.text.data() + op.p;
+
+		switch (op.type) {
+		case op_type::literal:
+			if constexpr (detail::is_unsupported<decltype(detail::literal(v, name, op.n, &k))>) {
+				return detail::fail(ep, LF_ERR_UNSUPPORTED, fmt, op, 0);
+			} else if (!detail::literal(v, name, op.n, &k)) {
+				return detail::fail(ep, LF_ERR_ERRNO, fmt, op, k);
+			}
+			break;
+
+#define LF_CASE(t)                                                           \
+		case op_type::t:                                                     \
+			if (!detail::dispatch<op_type::t>(v, pred, op, name, fmt, ep)) { \
+				return 0;                                                    \
+			}                                                                \
+			break;
+
+		LF_CASE(ip)
+		LF_CASE(resp_size)
+		LF_CASE(resp_size_clf)
+		LF_CASE(req_cookie)
+		LF_CASE(env_var)
+		LF_CASE(filename)
+		LF_CASE(remote_hostname)
+		LF_CASE(req_protocol)
+		LF_CASE(req_header)
+		LF_CASE(keepalive_reqs)
+		LF_CASE(remote_logname)
+		LF_CASE(req_logid)
+		LF_CASE(req_method)
+		LF_CASE(note)
+		LF_CASE(reply_header)
+		LF_CASE(server_port)
+		LF_CASE(id)
+		LF_CASE(query_string)
+		LF_CASE(req_first_line)
+		LF_CASE(resp_handler)
+		LF_CASE(status)
+		LF_CASE(time)
+		LF_CASE(time_frac)
+		LF_CASE(time_taken)
+		LF_CASE(remote_user)
+		LF_CASE(url_path)
+		LF_CASE(server_name)
+		LF_CASE(conn_status)
+		LF_CASE(bytes_recv)
+		LF_CASE(bytes_sent)
+		LF_CASE(bytes_xfer)
+		LF_CASE(req_trailer)
+		LF_CASE(resp_trailer)
+
+#undef LF_CASE
+		}
+	}
+
+	return 1;
+}
+
+/*
+ * As lf_parse(), for a visitor: the format is parsed here rather than
+ * by liblf, and then visited as a whole. So unlike lf_parse(), no hooks
+ * are called for a format which doesn't parse. Errors point into fmt.
+ */
+template <class V>
+inline int
+parse(V &v, std::string_view fmt, lf_err *ep = nullptr, options o = options())
+{
+	program prog(fmt, o);
+
+	if (!prog.ok) {
+		if (ep != NULL) {
+			ep->errnum = prog.err;
+			ep->p      = fmt.data() + prog.at;
+			ep->n      = prog.width;
+		}
+
+		return 0;
+	}
+
+	if (!exec(v, prog, ep)) {
+		if (ep != NULL) {
+			ep->p = fmt.data() + (ep->p - prog.fmt.data());
+		}
+
+		return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * For formats only known at runtime, parsed by liblf with a struct lf_config.
+ */
+inline int
+parse(lf_config *conf, void *opaque, std::string_view fmt, lf_err *ep)
+{
+	return lf_parsen(conf, opaque, fmt.data(), fmt.size(), ep);
+}
+
+inline lf_prog *
+compile(const lf_config *conf, std::string_view fmt, lf_err *ep)
+{
+	return lf_compilen(conf, fmt.data(), fmt.size(), ep);
+}
+
+inline std::size_t
+render(const lf_prog *prog, const lf_record *rec, char *buf, std::size_t size)
+{
+	return lf_render(prog, rec, buf, size);
+}
+
+}
+
+#endif
@@ -0,0 +1,225 @@
+/*
+ * Copyright 2017 Katherine Flavel
+ *
+ * See LICENCE for the full copyright terms.
+ */
+
+#ifndef LIBLF_LFC_H
+#define LIBLF_LFC_H
+
+/*
+ * Support for code generated by lfc, which compiles one format to C.
+ * The generated code needs this header and <lf/lf.h>, and links liblf
+ * for the pieces lf_render() and lf_scan() are made of, so that it
+ * behaves exactly as they do. What's here is only the glue between
+ * those, small enough to inline where it's called with constants.
+ */
+
+#include <stddef.h>
+#include <string.h>
+#include <limits.h>
+
+struct lfc_out {
+	char *p;
+	size_t size;
+	size_t n;
+};
+
+static inline void
+lfc_put(struct lfc_out *o, const char *p, size_t n)
+{
+	if (o->n < o->size) {
+		size_t z;
+
+		z = o->size - o->n;
+		if (z > n) {
+			z = n;
+		}
+
+		memcpy(o->p + o->n, p, z);
+	}
+
+	o->n += n;
+}
+
+/* the space left in o, for the lf_render_*() functions */
+static inline size_t
+lfc_room(const struct lfc_out *o, char **p)
+{
+	if (o->n >= o->size) {
+		*p = o->p;
+		return 0;
+	}
+
+	*p = o->p + o->n;
+
+	return o->size - o->n;
+}
+
+static inline void
+lfc_putc(struct lfc_out *o, char c)
+{
+	lfc_put(o, &c, 1);
+}
+
+static inline void
+lfc_dash(struct lfc_out *o)
+{
+	lfc_putc(o, '-');
+}
+
+static inline void
+lfc_escaped(struct lfc_out *o, const char *s, size_t n)
+{
+	size_t z;
+	char *p;
+
+	z = lfc_room(o, &p);
+	o->n += lf_render_escaped(p, z, s, n);
+}
+
+static inline void
+lfc_str(struct lfc_out *o, const struct lf_str *s, int escape)
+{
+	if (s->p == NULL) {
+		lfc_dash(o);
+	} else if (escape) {
+		lfc_escaped(o, s->p, s->n);
+	} else {
+		lfc_put(o, s->p, s->n);
+	}
+}
+
+static inline void
+lfc_uint(struct lfc_out *o, unsigned long long u, unsigned base)
+{
+	size_t z;
+	char *p;
+
+	z = lfc_room(o, &p);
+	o->n += lf_render_uint(p, z, u, base);
+}
+
+static inline void
+lfc_int(struct lfc_out *o, long long n)
+{
+	size_t z;
+	char *p;
+
+	z = lfc_room(o, &p);
+	o->n += lf_render_int(p, z, n);
+}
+
+static inline void
+lfc_frac(struct lfc_out *o, long long t, enum lf_rtime unit)
+{
+	size_t z;
+	char *p;
+
+	z = lfc_room(o, &p);
+	o->n += lf_render_frac(p, z, t, unit);
+}
+
+static inline void
+lfc_time(struct lfc_out *o, long long t, const char *fmt)
+{
+	size_t z;
+	char *p;
+
+	z = lfc_room(o, &p);
+	o->n += lf_render_time(p, z, t, fmt);
+}
+
+static inline void
+lfc_lookup(struct lfc_out *o, const struct lf_record *r, enum lf_table table,
+	const char *name, size_t n)
+{
+	struct lf_str s;
+
+	if (r->lookup == NULL) {
+		lfc_dash(o);
+		return;
+	}
+
+	s = r->lookup(r->opaque, table, name, n);
+
+	lfc_str(o, &s, 1);
+}
+
+/* for predicates, as lf_pred_match() */
+static inline int
+lfc_map(const unsigned char *map, unsigned status)
+{
+	unsigned u;
+
+	if (status < LF_PRED_MIN || status > LF_PRED_MAX) {
+		return 0;
+	}
+
+	u = status - LF_PRED_MIN;
+
+	return (map[u / CHAR_BIT] >> (u % CHAR_BIT)) & 1;
+}
+
+static inline int
+lfc_literal(const char **p, const char *end, const char *s, size_t n)
+{
+	if ((size_t) (end - *p) < n || 0 != memcmp(*p, s, n)) {
+		return 0;
+	}
+
+	*p += n;
+
+	return 1;
+}
+
+static inline const char *
+lfc_find(const char *p, const char *end, const char *s, size_t n)
+{
+	while ((size_t) (end - p) >= n) {
+		p = (const char *) memchr(p, s[0], end - p - n + 1);
+		if (p == NULL) {
+			return NULL;
+		}
+
+		if (0 == memcmp(p, s, n)) {
+			return p;
+		}
+
+		p++;
+	}
+
+	return NULL;
+}
+
+/* the delimiter, past skip occurrences of it */
+static inline const char *
+lfc_delim(const char *p, const char *end, const char *s, size_t n, size_t skip)
+{
+	for (;;) {
+		p = lfc_find(p, end, s, n);
+		if (p == NULL || skip-- == 0) {
+			return p;
+		}
+
+		p += n;
+	}
+}
+
+static inline const char *
+lfc_quote(const char *p, const char *end)
+{
+	for ( ; p < end; p++) {
+		if (*p == '"') {
+			return p;
+		}
+
+		if (*p == '\\' && p + 1 < end) {
+			p++;
+		}
+	}
+
+	return NULL;
+}
+
+#endif
@@ -0,0 +1,256 @@
+/*
+ * Copyright 2017 Katherine Flavel
+ *
+ * See LICENCE for the full copyright terms.
+ */
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <lf/lf.h>
+
+#include "internal.h"
+
+static const enum lf_kind kind[] = {
+	[OP_CUSTOM]          = LF_KIND_CUSTOM,
+	[OP_IP]              = LF_KIND_IP,
+	[OP_RESP_SIZE]       = LF_KIND_RESP_SIZE,
+	[OP_RESP_SIZE_CLF]   = LF_KIND_RESP_SIZE_CLF,
+	[OP_REQ_COOKIE]      = LF_KIND_REQ_COOKIE,
+	[OP_ENV_VAR]         = LF_KIND_ENV_VAR,
+	[OP_FILENAME]        = LF_KIND_FILENAME,
+	[OP_REMOTE_HOSTNAME] = LF_KIND_REMOTE_HOSTNAME,
+	[OP_REQ_PROTOCOL]    = LF_KIND_REQ_PROTOCOL,
+	[OP_REQ_HEADER]      = LF_KIND_REQ_HEADER,
+	[OP_KEEPALIVE_REQS]  = LF_KIND_KEEPALIVE_REQS,
+	[OP_REMOTE_LOGNAME]  = LF_KIND_REMOTE_LOGNAME,
+	[OP_REQ_LOGID]       = LF_KIND_REQ_LOGID,
+	[OP_REQ_METHOD]      = LF_KIND_REQ_METHOD,
+	[OP_NOTE]            = LF_KIND_NOTE,
+	[OP_REPLY_HEADER]    = LF_KIND_REPLY_HEADER,
+	[OP_SERVER_PORT]     = LF_KIND_SERVER_PORT,
+	[OP_ID]              = LF_KIND_ID,
+	[OP_QUERY_STRING]    = LF_KIND_QUERY_STRING,
+	[OP_REQ_FIRST_LINE]  = LF_KIND_REQ_FIRST_LINE,
+	[OP_RESP_HANDLER]    = LF_KIND_RESP_HANDLER,
+	[OP_STATUS]          = LF_KIND_STATUS,
+	[OP_TIME]            = LF_KIND_TIME,
+	[OP_TIME_FRAC]       = LF_KIND_TIME_FRAC,
+	[OP_TIME_TAKEN]      = LF_KIND_TIME_TAKEN,
+	[OP_REMOTE_USER]     = LF_KIND_REMOTE_USER,
+	[OP_URL_PATH]        = LF_KIND_URL_PATH,
+	[OP_SERVER_NAME]     = LF_KIND_SERVER_NAME,
+	[OP_CONN_STATUS]     = LF_KIND_CONN_STATUS,
+	[OP_BYTES_RECV]      = LF_KIND_BYTES_RECV,
+	[OP_BYTES_SENT]      = LF_KIND_BYTES_SENT,
+	[OP_BYTES_XFER]      = LF_KIND_BYTES_XFER,
+	[OP_REQ_TRAILER]     = LF_KIND_REQ_TRAILER,
+	[OP_RESP_TRAILER]    = LF_KIND_RESP_TRAILER
+};
+
+static unsigned
+needs(const struct op *op)
+{
+	unsigned v;
+
+	switch (op->type) {
+	case OP_REMOTE_HOSTNAME:
+		return op->arg ? LF_NEED_HOSTNAME_LOOKUP : 0;
+
+	case OP_TIME:
+		return op->when == LF_WHEN_END ? LF_NEED_TIME_END : LF_NEED_TIME_BEGIN;
+
+	case OP_TIME_FRAC:
+		v = op->when == LF_WHEN_END ? LF_NEED_TIME_END : LF_NEED_TIME_BEGIN;
+		return op->arg != LF_RTIME_S ? v | LF_NEED_TIME_SUBSEC : v;
+
+	case OP_TIME_TAKEN:
+		v = LF_NEED_TIME_BEGIN | LF_NEED_TIME_END;
+		return op->arg != LF_RTIME_S ? v | LF_NEED_TIME_SUBSEC : v;
+
+	default:
+		return 0;
+	}
+}
+
+static int
+same(enum lf_table t, const struct lf_str *a, const struct op *op)
+{
+	if (a->n != op->n) {
+		return 0;
+	}
+
+	if (t == LF_TABLE_REQ_COOKIE) {
+		return 0 == memcmp(a->p, op->p, a->n);
+	}
+
+	return name_same(a->p, op->p, a->n);
+}
+
+static int
+cmp_status(const void *a, const void *b)
+{
+	unsigned x = * (const unsigned *) a;
+	unsigned y = * (const unsigned *) b;
+
+	return (x > y) - (x < y);
+}
+
+/*
+ * The union of the directives' predicates. Only statuses named by some
+ * predicate can differ from any other, so each of those is tested
+ * against every directive. With any predicate negated, the union is the
+ * complement of those statuses no directive matches.
+ */
+static void
+pred_union(const struct lf_prog *prog, struct lf_pred *u, unsigned *status)
+{
+	const struct op *op;
+	size_t i, j, n;
+	int neg;
+
+	n = 0;
+	neg = 0;
+
+	for (op = prog->op; op < prog->op + prog->count; op++) {
+		if (op->type == OP_LITERAL) {
+			continue;
+		}
+
+		/* one directive matching everything means the union does */
+		if (op->pred.count == 0) {
+			u->neg   = 0;
+			u->count = 0;
+			return;
+		}
+
+		neg |= op->pred.neg;
+
+		memcpy(status + n, op->pred.status, op->pred.count * sizeof *status);
+		n += op->pred.count;
+	}
+
+	qsort(status, n, sizeof *status, cmp_status);
+
+	for (i = 0, j = 0; i < n; i++) {
+		int m;
+
+		if (i > 0 && status[i] == status[i - 1]) {
+			continue;
+		}
+
+		m = 0;
+
+		for (op = prog->op; op < prog->op + prog->count; op++) {
+			if (op->type != OP_LITERAL && lf_pred_match(&op->pred, status[i])) {
+				m = 1;
+				break;
+			}
+		}
+
+		if (m != neg) {
+			status[j++] = status[i];
+		}
+	}
+
+	u->neg    = neg;
+	u->count  = j;
+	u->status = status;
+
+	pred_map(u);
+}
+
+struct lf_analysis *
+lf_analyze(const struct lf_prog *prog)
+{
+	struct lf_analysis *a;
+	const struct op *op;
+	struct lf_str *name;
+	unsigned *status;
+	size_t names[TABLES];
+	size_t statuses;
+	size_t t, i;
+
+	assert(prog != NULL);
+
+	memset(names, 0, sizeof names);
+	statuses = 0;
+
+	for (op = prog->op; op < prog->op + prog->count; op++) {
+		int k;
+
+		statuses += op->pred.count;
+
+		k = op_table(op->type);
+		if (k != -1) {
+			names[k]++;
+		}
+	}
+
+	/* at most so many names and statuses, all in one block */
+	i = 0;
+	for (t = 0; t < TABLES; t++) {
+		i += names[t];
+	}
+
+	a = malloc(sizeof *a + i * sizeof *name + statuses * sizeof *status);
+	if (a == NULL) {
+		return NULL;
+	}
+
+	memset(a, 0, sizeof *a);
+
+	name   = (void *) (a + 1);
+	status = (void *) (name + i);
+
+	for (t = 0; t < TABLES; t++) {
+		a->table[t].name = name;
+		name += names[t];
+	}
+
+	for (op = prog->op; op < prog->op + prog->count; op++) {
+		struct lf_str *v;
+		int k;
+
+		if (op->type == OP_LITERAL) {
+			continue;
+		}
+
+		assert(op->type < sizeof kind / sizeof *kind);
+
+		a->kinds    |= 1ULL << kind[op->type];
+		a->needs    |= needs(op);
+		a->redirect |= 1U << op->redirect;
+
+		k = op_table(op->type);
+		if (k == -1) {
+			continue;
+		}
+
+		v = (struct lf_str *) a->table[k].name;
+
+		for (i = 0; i < a->table[k].count; i++) {
+			if (same(k, &v[i], op)) {
+				break;
+			}
+		}
+
+		if (i == a->table[k].count) {
+			v[i].p = op->p;
+			v[i].n = op->n;
+			a->table[k].count++;
+		}
+	}
+
+	pred_union(prog, &a->pred, status);
+
+	return a;
+}
+
+void
+lf_free_analysis(struct lf_analysis *a)
+{
+	free(a);
+}
@@ -0,0 +1,852 @@
+/*
+ * Copyright 2017 Katherine Flavel
+ *
+ * See LICENCE for the full copyright terms.
+ */
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+
+#include <lf/lf.h>
+
+#include "internal.h"
+
+/*
+ * Just enough of the Arrow columnar format to write an IPC stream.
+ * See format/Schema.fbs and format/Message.fbs in the Arrow sources
+ * for the tables below; their field ids are the order of their fields.
+ */
+enum {
+	ARROW_V5 = 4
+};
+
+/* union MessageHeader */
+enum {
+	HEADER_SCHEMA       = 1,
+	HEADER_RECORD_BATCH = 3
+};
+
+/* union Type */
+enum {
+	TYPE_INT       = 2,
+	TYPE_UTF8      = 5,
+	TYPE_TIMESTAMP = 10,
+	TYPE_DURATION  = 18
+};
+
+/* enum TimeUnit */
+enum {
+	UNIT_SECOND,
+	UNIT_MILLISECOND,
+	UNIT_MICROSECOND
+};
+
+struct buf {
+	unsigned char *p;
+	size_t n;
+	size_t size;
+};
+
+/* An Arrow type, for a directive */
+struct type {
+	unsigned type;   /* union Type */
+	unsigned width;  /* bytes per value, or 0 for utf8 */
+	unsigned sign;   /* the value is lf_field .t rather than .u */
+	unsigned unit;   /* enum TimeUnit, for timestamps and durations */
+	unsigned long long max;
+};
+
+struct column {
+	struct type t;
+	size_t nulls;
+	struct buf valid;  /* bitmap, one bit per row */
+	struct buf offset; /* int32, for utf8 only */
+	struct buf data;
+};
+
+struct lf_batch {
+	const struct lf_scanner *sc;
+	struct column *col;
+	struct lf_field *fields;
+	size_t count;
+	size_t rows;
+	char *tmp; /* for lf_scan() to unescape into */
+	size_t tmpsize;
+};
+
+static unsigned
+unit(enum lf_rtime rtime)
+{
+	switch (rtime) {
+	case LF_RTIME_S:  return UNIT_SECOND;
+	case LF_RTIME_MS: return UNIT_MILLISECOND;
+	case LF_RTIME_US: return UNIT_MICROSECOND;
+
+	default:
+		assert(!"unreached");
+		return UNIT_MICROSECOND;
+	}
+}
+
+static void
+uint_type(struct type *t, unsigned width)
+{
+	t->type  = TYPE_INT;
+	t->width = width;
+	t->sign  = 0;
+	t->unit  = 0;
+	t->max   = width == 8 ? ULLONG_MAX : (1ULL << width * 8) - 1;
+}
+
+static void
+time_type(struct type *t, unsigned type, enum lf_rtime rtime)
+{
+	t->type  = type;
+	t->width = 8;
+	t->sign  = 1;
+	t->unit  = unit(rtime);
+	t->max   = LLONG_MAX;
+}
+
+static void
+type(const struct op *op, struct type *t)
+{
+	assert(op != NULL);
+	assert(t != NULL);
+
+	switch (op->type) {
+	case OP_STATUS:
+	case OP_SERVER_PORT:
+		uint_type(t, 2);
+		return;
+
+	case OP_KEEPALIVE_REQS:
+		uint_type(t, 4);
+		return;
+
+	case OP_ID:
+		uint_type(t, op->arg == LF_ID_PID ? 4 : 8);
+		return;
+
+	case OP_RESP_SIZE:
+	case OP_RESP_SIZE_CLF:
+	case OP_BYTES_RECV:
+	case OP_BYTES_SENT:
+	case OP_BYTES_XFER:
+		uint_type(t, 8);
+		return;
+
+	case OP_TIME_FRAC:
+		switch (op->arg) {
+		case LF_RTIME_MS_FRAC: uint_type(t, 2); return;
+		case LF_RTIME_US_FRAC: uint_type(t, 4); return;
+		default: time_type(t, TYPE_TIMESTAMP, op->arg); return;
+		}
+
+	case OP_TIME_TAKEN:
+		time_type(t, TYPE_DURATION, op->arg);
+		return;
+
+	case OP_TIME:
+		/* strftime formats other than the default are kept as text */
+		if (0 == strcmp(op->p, "[%d/%b/%Y:%T %z]")) {
+			time_type(t, TYPE_TIMESTAMP, LF_RTIME_US);
+			return;
+		}
+		break;
+
+	default:
+		break;
+	}
+
+	t->type  = TYPE_UTF8;
+	t->width = 0;
+	t->sign  = 0;
+	t->unit  = 0;
+	t->max   = 0;
+}
+
+static int
+grow(struct buf *b, size_t n)
+{
+	unsigned char *tmp;
+	size_t z;
+
+	assert(b != NULL);
+
+	if (b->size - b->n >= n) {
+		return 1;
+	}
+
+	for (z = b->size == 0 ? 256 : b->size * 2; z - b->n < n; z *= 2)
+		;
+
+	tmp = realloc(b->p, z);
+	if (tmp == NULL) {
+		return 0;
+	}
+
+	b->p = tmp;
+	b->size = z;
+
+	return 1;
+}
+
+/* Arrow is little endian, whatever we are; callers grow() first */
+static void
+le(struct buf *b, unsigned long long v, size_t width)
+{
+	size_t i;
+
+	assert(b->size - b->n >= width);
+
+	for (i = 0; i < width; i++) {
+		b->p[b->n++] = (unsigned char) (v >> i * 8);
+	}
+}
+
+struct lf_batch *
+lf_new_batch(const struct lf_scanner *sc)
+{
+	struct lf_batch *b;
+	size_t i, count;
+
+	assert(sc != NULL);
+
+	(void) lf_scanner_columns(sc, &count);
+
+	b = malloc(sizeof *b
+		+ count * sizeof *b->col
+		+ count * sizeof *b->fields);
+	if (b == NULL) {
+		return NULL;
+	}
+
+	b->sc      = sc;
+	b->col     = (void *) (b + 1);
+	b->fields  = (void *) (b->col + count);
+	b->count   = count;
+	b->rows    = 0;
+	b->tmp     = NULL;
+	b->tmpsize = 0;
+
+	for (i = 0; i < count; i++) {
+		struct column *c = &b->col[i];
+
+		type(scanner_op(sc, i), &c->t);
+
+		c->nulls = 0;
+		memset(&c->valid,  0, sizeof c->valid);
+		memset(&c->offset, 0, sizeof c->offset);
+		memset(&c->data,   0, sizeof c->data);
+	}
+
+	return b;
+}
+
+void
+lf_free_batch(struct lf_batch *b)
+{
+	size_t i;
+
+	if (b == NULL) {
+		return;
+	}
+
+	for (i = 0; i < b->count; i++) {
+		free(b->col[i].valid.p);
+		free(b->col[i].offset.p);
+		free(b->col[i].data.p);
+	}
+
+	free(b->tmp);
+	free(b);
+}
+
+size_t
+lf_batch_rows(const struct lf_batch *b)
+{
+	assert(b != NULL);
+
+	return b->rows;
+}
+
+size_t
+lf_batch_size(const struct lf_batch *b)
+{
+	size_t i, n;
+
+	assert(b != NULL);
+
+	n = 0;
+
+	for (i = 0; i < b->count; i++) {
+		n += b->col[i].valid.n + b->col[i].offset.n + b->col[i].data.n;
+	}
+
+	return n;
+}
+
+static void
+batcherr(struct lf_err *ep, enum lf_errno e, const char *p, size_t n)
+{
+	if (ep == NULL) {
+		return;
+	}
+
+	ep->errnum = e;
+	ep->p = p;
+	ep->n = n;
+}
+
+int
+lf_batch_scan(struct lf_batch *b, const char *line, size_t len,
+	struct lf_err *ep)
+{
+	size_t i;
+
+	assert(b != NULL);
+	assert(line != NULL || len == 0);
+
+	if (len > b->tmpsize) {
+		char *tmp;
+
+		tmp = realloc(b->tmp, len);
+		if (tmp == NULL) {
+			batcherr(ep, LF_ERR_ERRNO, line, 0);
+			return 0;
+		}
+
+		b->tmp = tmp;
+		b->tmpsize = len;
+	}
+
+	if (!lf_scan(b->sc, line, len, b->fields, b->tmp, ep)) {
+		return 0;
+	}
+
+	/*
+	 * Everything which might fail is done before appending anything,
+	 * so that a row is appended either whole or not at all.
+	 */
+	for (i = 0; i < b->count; i++) {
+		const struct lf_field *f = &b->fields[i];
+		struct column *c = &b->col[i];
+		size_t n;
+
+		if (!f->absent && c->t.width > 0 && !c->t.sign && f->u > c->t.max) {
+			batcherr(ep, LF_ERR_MALFORMED_INTEGER, f->s.p, f->s.n);
+			return 0;
+		}
+
+		if (c->t.type == TYPE_UTF8) {
+			n = f->absent ? 0 : f->s.n;
+
+			if (c->data.n > INT_MAX || n > INT_MAX - c->data.n) {
+				errno = EOVERFLOW;
+				batcherr(ep, LF_ERR_ERRNO, line, 0);
+				return 0;
+			}
+
+			/* the first row also has the leading offset */
+			if (!grow(&c->offset, b->rows == 0 ? 8 : 4)) {
+				batcherr(ep, LF_ERR_ERRNO, line, 0);
+				return 0;
+			}
+		} else {
+			n = c->t.width;
+		}
+
+		if (!grow(&c->valid, 1) || !grow(&c->data, n)) {
+			batcherr(ep, LF_ERR_ERRNO, line, 0);
+			return 0;
+		}
+	}
+
+	for (i = 0; i < b->count; i++) {
+		const struct lf_field *f = &b->fields[i];
+		struct column *c = &b->col[i];
+
+		if (b->rows % 8 == 0) {
+			c->valid.p[c->valid.n++] = 0;
+		}
+
+		if (f->absent) {
+			c->nulls++;
+		} else {
+			c->valid.p[b->rows / 8] |= 1U << b->rows % 8;
+		}
+
+		switch (c->t.type) {
+		case TYPE_UTF8:
+			if (b->rows == 0) {
+				le(&c->offset, 0, 4);
+			}
+
+			if (!f->absent) {
+				memcpy(c->data.p + c->data.n, f->s.p, f->s.n);
+				c->data.n += f->s.n;
+			}
+
+			le(&c->offset, c->data.n, 4);
+			break;
+
+		default:
+			if (f->absent) {
+				le(&c->data, 0, c->t.width);
+			} else if (c->t.sign) {
+				le(&c->data, (unsigned long long) f->t, c->t.width);
+			} else {
+				le(&c->data, f->u, c->t.width);
+			}
+			break;
+		}
+	}
+
+	b->rows++;
+
+	return 1;
+}
+
+/*
+ * A flatbuffer, built front to back: each object is written before
+ * the objects it refers to, since offsets to objects are unsigned.
+ * Allocation failure is sticky, and checked once at the end.
+ */
+struct fb {
+	struct buf b;
+	int oom;
+};
+
+/* One field of a table; .size 0 means the field is absent */
+struct slot {
+	unsigned size;
+	int ref;       /* an offset to an object, filled in by ref() */
+	unsigned long long v;
+	size_t at;     /* where the field was written */
+};
+
+static void
+fb_le(struct fb *fb, unsigned long long v, size_t width)
+{
+	if (!grow(&fb->b, width)) {
+		fb->oom = 1;
+		return;
+	}
+
+	le(&fb->b, v, width);
+}
+
+static void
+fb_put(struct fb *fb, const void *p, size_t n)
+{
+	if (!grow(&fb->b, n)) {
+		fb->oom = 1;
+		return;
+	}
+
+	memcpy(fb->b.p + fb->b.n, p, n);
+	fb->b.n += n;
+}
+
+static void
+fb_align(struct fb *fb, size_t align)
+{
+	while (!fb->oom && fb->b.n % align != 0) {
+		fb_le(fb, 0, 1);
+	}
+}
+
+/* point the offset at the given position to the target */
+static void
+fb_ref(struct fb *fb, size_t at, size_t target)
+{
+	size_t i;
+
+	if (fb->oom) {
+		return;
+	}
+
+	assert(target > at);
+
+	for (i = 0; i < 4; i++) {
+		fb->b.p[at + i] = (unsigned char) ((target - at) >> i * 8);
+	}
+}
+
+/* a vtable, followed by its table; returns the table's position */
+static size_t
+fb_table(struct fb *fb, struct slot *s, size_t n)
+{
+	size_t off[8];
+	size_t i, o, vt, t, align;
+
+	assert(n <= sizeof off / sizeof *off);
+
+	align = 4;
+	o = 4; /* the offset to the vtable */
+
+	for (i = 0; i < n; i++) {
+		if (s[i].size == 0) {
+			off[i] = 0;
+			continue;
+		}
+
+		if (s[i].size > align) {
+			align = s[i].size;
+		}
+
+		o = (o + s[i].size - 1) / s[i].size * s[i].size;
+		off[i] = o;
+		o += s[i].size;
+	}
+
+	fb_align(fb, 2);
+	vt = fb->b.n;
+
+	fb_le(fb, 4 + 2 * n, 2);
+	fb_le(fb, o, 2);
+	for (i = 0; i < n; i++) {
+		fb_le(fb, off[i], 2);
+	}
+
+	fb_align(fb, align);
+	t = fb->b.n;
+
+	/* the vtable is at this table's position less this */
+	fb_le(fb, t - vt, 4);
+
+	for (i = 0; i < n; i++) {
+		if (s[i].size == 0) {
+			continue;
+		}
+
+		while (!fb->oom && fb->b.n < t + off[i]) {
+			fb_le(fb, 0, 1);
+		}
+
+		s[i].at = fb->b.n;
+		fb_le(fb, s[i].ref ? 0 : s[i].v, s[i].size);
+	}
+
+	return t;
+}
+
+/* a vector's length, placed so that its elements are aligned */
+static size_t
+fb_vector(struct fb *fb, size_t count, size_t align)
+{
+	size_t v;
+
+	fb_align(fb, 4);
+	while (!fb->oom && (fb->b.n + 4) % align != 0) {
+		fb_le(fb, 0, 4);
+	}
+
+	v = fb->b.n;
+	fb_le(fb, count, 4);
+
+	return v;
+}
+
+static size_t
+fb_string(struct fb *fb, const char *p, size_t n)
+{
+	size_t v;
+
+	v = fb_vector(fb, n, 4);
+	fb_put(fb, p, n);
+	fb_le(fb, 0, 1);
+
+	return v;
+}
+
+/* the root offset, and a Message; returns where to point .header */
+static size_t
+message(struct fb *fb, unsigned header, unsigned long long body)
+{
+	struct slot s[] = {
+		{ 2, 0, ARROW_V5, 0 }, /* version */
+		{ 1, 0, header,   0 }, /* header_type */
+		{ 4, 1, 0,        0 }, /* header */
+		{ 8, 0, body,     0 }  /* bodyLength */
+	};
+
+	fb_le(fb, 0, 4);
+	fb_ref(fb, 0, fb_table(fb, s, sizeof s / sizeof *s));
+
+	return s[2].at;
+}
+
+static void
+field(struct fb *fb, size_t at, const struct lf_column *col, const struct type *t)
+{
+	struct slot s[] = {
+		{ 4, 1, 0,       0 }, /* name */
+		{ 1, 0, 1,       0 }, /* nullable */
+		{ 1, 0, t->type, 0 }, /* type_type */
+		{ 4, 1, 0,       0 }, /* type */
+		{ 0, 0, 0,       0 }, /* dictionary */
+		{ 4, 1, 0,       0 }  /* children */
+	};
+
+	fb_ref(fb, at, fb_table(fb, s, sizeof s / sizeof *s));
+
+	fb_ref(fb, s[0].at, fb_string(fb, col->src, col->n));
+
+	switch (t->type) {
+	case TYPE_INT: {
+		struct slot ts[] = {
+			{ 4, 0, t->width * 8, 0 }, /* bitWidth */
+			{ 1, 0, t->sign,      0 }  /* is_signed */
+		};
+
+		fb_ref(fb, s[3].at, fb_table(fb, ts, sizeof ts / sizeof *ts));
+		break;
+	}
+
+	case TYPE_TIMESTAMP: {
+		struct slot ts[] = {
+			{ 2, 0, t->unit, 0 }, /* unit */
+			{ 4, 1, 0,       0 }  /* timezone */
+		};
+
+		fb_ref(fb, s[3].at, fb_table(fb, ts, sizeof ts / sizeof *ts));
+		fb_ref(fb, ts[1].at, fb_string(fb, "UTC", 3));
+		break;
+	}
+
+	case TYPE_DURATION: {
+		struct slot ts[] = {
+			{ 2, 0, t->unit, 0 } /* unit */
+		};
+
+		fb_ref(fb, s[3].at, fb_table(fb, ts, sizeof ts / sizeof *ts));
+		break;
+	}
+
+	case TYPE_UTF8:
+		fb_ref(fb, s[3].at, fb_table(fb, NULL, 0));
+		break;
+
+	default:
+		assert(!"unreached");
+		break;
+	}
+
+	/* Arrow requires children, even when there are none */
+	fb_ref(fb, s[5].at, fb_vector(fb, 0, 4));
+}
+
+static int
+pad(lf_write *w, void *opaque, size_t n)
+{
+	static const char zero[8];
+
+	assert(n < sizeof zero);
+
+	return n == 0 || w(opaque, zero, n);
+}
+
+/* The encapsulation for the metadata, which ends 8-byte aligned */
+static int
+emit(struct fb *fb, lf_write *w, void *opaque)
+{
+	unsigned char prefix[8];
+	size_t i;
+
+	fb_align(fb, 8);
+
+	if (fb->oom) {
+		free(fb->b.p);
+		errno = ENOMEM;
+		return 0;
+	}
+
+	for (i = 0; i < 4; i++) {
+		prefix[i]     = 0xff; /* continuation */
+		prefix[i + 4] = (unsigned char) (fb->b.n >> i * 8);
+	}
+
+	if (!w(opaque, prefix, sizeof prefix) || !w(opaque, fb->b.p, fb->b.n)) {
+		free(fb->b.p);
+		return 0;
+	}
+
+	free(fb->b.p);
+
+	return 1;
+}
+
+int
+lf_arrow_schema(const struct lf_scanner *sc, lf_write *w, void *opaque)
+{
+	const struct lf_column *col;
+	struct fb fb;
+	size_t i, count, v, hdr;
+
+	assert(sc != NULL);
+	assert(w != NULL);
+
+	col = lf_scanner_columns(sc, &count);
+
+	memset(&fb, 0, sizeof fb);
+
+	{
+		struct slot s[] = {
+			{ 2, 0, 0, 0 }, /* endianness: Little */
+			{ 4, 1, 0, 0 }  /* fields */
+		};
+
+		hdr = message(&fb, HEADER_SCHEMA, 0);
+		fb_ref(&fb, hdr, fb_table(&fb, s, sizeof s / sizeof *s));
+
+		v = fb_vector(&fb, count, 4);
+		fb_ref(&fb, s[1].at, v);
+	}
+
+	for (i = 0; i < count; i++) {
+		fb_le(&fb, 0, 4);
+	}
+
+	for (i = 0; i < count; i++) {
+		struct type t;
+
+		type(scanner_op(sc, i), &t);
+		field(&fb, v + 4 + i * 4, &col[i], &t);
+	}
+
+	if (!emit(&fb, w, opaque)) {
+		return 0;
+	}
+
+	return 1;
+}
+
+/* validity, offsets (for utf8 only), and data; in that order */
+static const struct buf *
+buffer(const struct column *c, size_t i)
+{
+	switch (i) {
+	case 0:  return &c->valid;
+	case 1:  return c->t.type == TYPE_UTF8 ? &c->offset : &c->data;
+	default: return &c->data;
+	}
+}
+
+static size_t
+buffers(const struct column *c)
+{
+	return c->t.type == TYPE_UTF8 ? 3 : 2;
+}
+
+/* the bitmap is only written if there's something null */
+static size_t
+length(const struct column *c, size_t i)
+{
+	return i == 0 && c->nulls == 0 ? 0 : buffer(c, i)->n;
+}
+
+int
+lf_arrow_batch(struct lf_batch *b, lf_write *w, void *opaque)
+{
+	unsigned long long body;
+	struct fb fb;
+	size_t i, j, v, hdr;
+	int r;
+
+	assert(b != NULL);
+	assert(w != NULL);
+
+	if (b->rows == 0) {
+		return 1;
+	}
+
+	body = 0;
+	for (i = 0; i < b->count; i++) {
+		for (j = 0; j < buffers(&b->col[i]); j++) {
+			body += (length(&b->col[i], j) + 7) / 8 * 8;
+		}
+	}
+
+	memset(&fb, 0, sizeof fb);
+
+	{
+		struct slot s[] = {
+			{ 8, 0, b->rows, 0 }, /* length */
+			{ 4, 1, 0,       0 }, /* nodes */
+			{ 4, 1, 0,       0 }  /* buffers */
+		};
+
+		hdr = message(&fb, HEADER_RECORD_BATCH, body);
+		fb_ref(&fb, hdr, fb_table(&fb, s, sizeof s / sizeof *s));
+
+		/* struct FieldNode { length: long; null_count: long; } */
+		v = fb_vector(&fb, b->count, 8);
+		fb_ref(&fb, s[1].at, v);
+
+		for (i = 0; i < b->count; i++) {
+			fb_le(&fb, b->rows, 8);
+			fb_le(&fb, b->col[i].nulls, 8);
+		}
+
+		v = 0;
+		for (i = 0; i < b->count; i++) {
+			v += buffers(&b->col[i]);
+		}
+
+		/* struct Buffer { offset: long; length: long; } */
+		fb_ref(&fb, s[2].at, fb_vector(&fb, v, 8));
+
+		body = 0;
+		for (i = 0; i < b->count; i++) {
+			for (j = 0; j < buffers(&b->col[i]); j++) {
+				fb_le(&fb, body, 8);
+				fb_le(&fb, length(&b->col[i], j), 8);
+				body += (length(&b->col[i], j) + 7) / 8 * 8;
+			}
+		}
+	}
+
+	if (!emit(&fb, w, opaque)) {
+		return 0;
+	}
+
+	r = 1;
+
+	for (i = 0; i < b->count && r; i++) {
+		for (j = 0; j < buffers(&b->col[i]) && r; j++) {
+			size_t n;
+
+			n = length(&b->col[i], j);
+
+			r = (n == 0 || w(opaque, buffer(&b->col[i], j)->p, n))
+				&& pad(w, opaque, (8 - n % 8) % 8);
+		}
+	}
+
+	for (i = 0; i < b->count; i++) {
+		b->col[i].nulls    = 0;
+		b->col[i].valid.n  = 0;
+		b->col[i].offset.n = 0;
+		b->col[i].data.n   = 0;
+	}
+
+	b->rows = 0;
+
+	return r;
+}
+
+int
+lf_arrow_eos(lf_write *w, void *opaque)
+{
+	static const unsigned char eos[8] = { 0xff, 0xff, 0xff, 0xff };
+
+	assert(w != NULL);
+
+	return w(opaque, eos, sizeof eos);
+}
@@ -0,0 +1,311 @@
+/*
+ * Copyright 2017 Katherine Flavel
+ *
+ * See LICENCE for the full copyright terms.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include <lf/lf.h>
+
+#include "internal.h"
+
+/*
+ * Programs are immutable, and so one program may be shared by everyone
+ * using the same format. Entries are found by hash, in a fixed table of
+ * chains. A chain only grows at its head, and entries stay linked until
+ * lf_free_cache(), so a lookup walks it with no lock. Adding an entry,
+ * or compiling again for a purged one, takes the cache's lock.
+ *
+ * An entry's .refs counts its users. Purging swaps an unused entry's
+ * count from 0 to PURGED before freeing its program, and a lookup takes
+ * a reference by swapping from any count but PURGED, so a program can't
+ * be both freed and handed out. Only the lock's holder may swap back.
+ */
+
+#define PURGED ((size_t) -1)
+
+enum {
+	CACHE_BUCKETS = 256
+};
+
+/* the parts of struct lf_config which lf_compile() reads */
+enum {
+	KEY_HOSTNAME_LOOKUPS   = 1 << 0,
+	KEY_USE_CANONICAL_NAME = 1 << 1,
+	KEY_OVERRIDE           = 1 << 2
+};
+
+struct entry {
+	struct entry *next;     /* set before the entry is published */
+	unsigned long hash;
+	unsigned flags;
+	size_t len;             /* of fmt */
+	const char *override;   /* into .key, or NULL */
+
+	struct lf_prog *prog;   /* set under the lock, NULL when purged */
+	size_t refs;
+
+	char key[];             /* fmt, then .override, each NUL terminated */
+};
+
+struct lf_cache {
+	pthread_mutex_t lock;
+	struct entry *bucket[CACHE_BUCKETS];
+};
+
+static struct entry *
+find(struct entry *e, unsigned long h, unsigned flags,
+	const char *fmt, size_t len, const char *override)
+{
+	for ( ; e != NULL; e = e->next) {
+		if (e->hash != h || e->flags != flags || e->len != len) {
+			continue;
+		}
+
+		if (0 != memcmp(e->key, fmt, len)) {
+			continue;
+		}
+
+		if (override != NULL && 0 != strcmp(e->override, override)) {
+			continue;
+		}
+
+		return e;
+	}
+
+	return NULL;
+}
+
+static int
+ref(struct entry *e)
+{
+	size_t r;
+
+	r = LOAD(&e->refs);
+
+	do {
+		if (r == PURGED) {
+			return 0;
+		}
+	} while (!CAS(&e->refs, &r, r + 1));
+
+	return 1;
+}
+
+struct lf_cache *
+lf_new_cache(void)
+{
+	struct lf_cache *c;
+
+	c = malloc(sizeof *c);
+	if (c == NULL) {
+		return NULL;
+	}
+
+	errno = pthread_mutex_init(&c->lock, NULL);
+	if (errno != 0) {
+		free(c);
+		return NULL;
+	}
+
+	memset(c->bucket, 0, sizeof c->bucket);
+
+	return c;
+}
+
+const struct lf_prog *
+lf_cache_get(struct lf_cache *c, const struct lf_config *conf, const char *fmt,
+	struct lf_err *ep)
+{
+	assert(fmt != NULL);
+
+	return lf_cache_getn(c, conf, fmt, strlen(fmt), ep);
+}
+
+const struct lf_prog *
+lf_cache_getn(struct lf_cache *c, const struct lf_config *conf, const char *fmt, size_t len,
+	struct lf_err *ep)
+{
+	struct entry **b, *e;
+	struct lf_prog *prog;
+	unsigned long h;
+	unsigned flags;
+	int new;
+
+	assert(c != NULL);
+	assert(conf != NULL);
+	assert(fmt != NULL);
+	assert(ep != NULL);
+
+	flags = 0;
+	flags |= conf->hostname_lookups   ? KEY_HOSTNAME_LOOKUPS   : 0;
+	flags |= conf->use_canonical_name ? KEY_USE_CANONICAL_NAME : 0;
+	flags |= conf->override != NULL   ? KEY_OVERRIDE           : 0;
+
+	h = fnv1a(FNV_BASIS, fmt, len, 0);
+	if (conf->override != NULL) {
+		h = fnv1a(h, conf->override, strlen(conf->override) + 1, 0);
+	}
+	h = fnv1a(h, (const char *) &flags, sizeof flags, 0);
+
+	b = &c->bucket[h % CACHE_BUCKETS];
+
+	e = find(LOAD(b), h, flags, fmt, len, conf->override);
+	if (e != NULL && ref(e)) {
+		return LOAD(&e->prog);
+	}
+
+	pthread_mutex_lock(&c->lock);
+
+	/* someone else may have added it since */
+	e = find(LOAD(b), h, flags, fmt, len, conf->override);
+	new = e == NULL;
+
+	if (new) {
+		size_t z;
+
+		z = conf->override != NULL ? strlen(conf->override) + 1 : 0;
+
+		e = malloc(sizeof *e + len + 1 + z);
+		if (e == NULL) {
+			pthread_mutex_unlock(&c->lock);
+			ep->errnum = LF_ERR_ERRNO;
+			ep->p = fmt;
+			ep->n = 0;
+			return NULL;
+		}
+
+		if (len > 0) {
+			memcpy(e->key, fmt, len);
+		}
+		e->key[len] = '\0';
+
+		e->override = NULL;
+		if (conf->override != NULL) {
+			e->override = memcpy(e->key + len + 1, conf->override, z);
+		}
+
+		e->next  = *b;
+		e->hash  = h;
+		e->flags = flags;
+		e->len   = len;
+		e->prog  = NULL;
+		e->refs  = PURGED;
+	}
+
+	/* purged, and so only we may compile it again */
+	if (!ref(e)) {
+		prog = lf_compilen(conf, fmt, len, ep);
+		if (prog == NULL) {
+			pthread_mutex_unlock(&c->lock);
+			if (new) {
+				free(e);
+			}
+			return NULL;
+		}
+
+		prog->cached = e;
+
+		STORE(&e->prog, prog);
+		STORE(&e->refs, 1);
+	}
+
+	if (new) {
+		STORE(b, e);
+	}
+
+	pthread_mutex_unlock(&c->lock);
+
+	return e->prog;
+}
+
+void
+lf_cache_put(struct lf_cache *c, const struct lf_prog *prog)
+{
+	struct entry *e;
+	size_t r;
+
+	assert(c != NULL);
+
+	if (prog == NULL) {
+		return;
+	}
+
+	e = prog->cached;
+	assert(e != NULL);
+
+	r = __atomic_fetch_sub(&e->refs, 1, __ATOMIC_RELEASE);
+	assert(r != 0 && r != PURGED);
+
+	(void) c;
+	(void) r;
+}
+
+size_t
+lf_cache_purge(struct lf_cache *c)
+{
+	struct entry *e;
+	size_t i, n, r;
+
+	assert(c != NULL);
+
+	n = 0;
+
+	pthread_mutex_lock(&c->lock);
+
+	for (i = 0; i < CACHE_BUCKETS; i++) {
+		for (e = c->bucket[i]; e != NULL; e = e->next) {
+			r = 0;
+			if (!CAS(&e->refs, &r, PURGED)) {
+				continue;
+			}
+
+			e->prog->cached = NULL;
+			lf_free(e->prog);
+			STORE(&e->prog, NULL);
+
+			n++;
+		}
+	}
+
+	pthread_mutex_unlock(&c->lock);
+
+	return n;
+}
+
+void
+lf_free_cache(struct lf_cache *c)
+{
+	struct entry *e, *next;
+	size_t i;
+
+	if (c == NULL) {
+		return;
+	}
+
+	for (i = 0; i < CACHE_BUCKETS; i++) {
+		for (e = c->bucket[i]; e != NULL; e = next) {
+			next = e->next;
+
+			assert(e->refs == 0 || e->refs == PURGED);
+
+			if (e->prog != NULL) {
+				e->prog->cached = NULL;
+				lf_free(e->prog);
+			}
+
+			free(e);
+		}
+	}
+
+	pthread_mutex_destroy(&c->lock);
+	free(c);
+}
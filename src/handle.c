@@ -0,0 +1,268 @@
+/*
+ * Copyright 2017 Katherine Flavel
+ *
+ * See LICENCE for the full copyright terms.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include <lf/lf.h>
+
+#include "internal.h"
+
+/*
+ * Epoch-based reclamation. The handle's epoch counts reloads. A reader
+ * pins by publishing the epoch it saw, then loading the program, and
+ * unpins by publishing 0. A reload swaps the program first and counts
+ * the epoch after, and so a reader which got the old program must have
+ * published an epoch from before the count. The old program is retired
+ * tagged with the new epoch, and freed once no reader is pinned in an
+ * epoch before that.
+ *
+ * Publishing the epoch and loading the program must not be reordered,
+ * nor swapping the program and checking the readers, so those are all
+ * sequentially consistent. The lock is only for reloading, and for the
+ * lists of readers and retired programs; readers never take it.
+ */
+
+struct retired {
+	struct retired *next;
+	struct lf_prog *prog;
+	unsigned long epoch;    /* the first in which no reader can hold it */
+};
+
+struct lf_reader {
+	struct lf_reader *next; /* under h->lock */
+	struct lf_handle *h;
+	unsigned long epoch;    /* pinned in, or 0 */
+};
+
+struct lf_handle {
+	struct lf_prog *prog;
+	unsigned long epoch;    /* written under .lock */
+
+	pthread_mutex_t lock;
+	struct lf_reader *readers;
+	struct retired *retired;
+};
+
+/* free what no reader can hold; called with the lock held */
+static void
+reclaim(struct lf_handle *h)
+{
+	struct retired **rp, *rt;
+	struct lf_reader *r;
+	unsigned long min, e;
+
+	min = LOAD(&h->epoch);
+
+	for (r = h->readers; r != NULL; r = r->next) {
+		e = LOAD_SC(&r->epoch);
+		if (e != 0 && e < min) {
+			min = e;
+		}
+	}
+
+	for (rp = &h->retired; *rp != NULL; ) {
+		rt = *rp;
+
+		if (rt->epoch > min) {
+			rp = &rt->next;
+			continue;
+		}
+
+		*rp = rt->next;
+		lf_free(rt->prog);
+		free(rt);
+	}
+}
+
+struct lf_handle *
+lf_new_handle(const struct lf_config *conf, const char *fmt,
+	struct lf_err *ep)
+{
+	struct lf_handle *h;
+
+	assert(conf != NULL);
+	assert(fmt != NULL);
+	assert(ep != NULL);
+
+	h = malloc(sizeof *h);
+	if (h == NULL) {
+		goto error;
+	}
+
+	errno = pthread_mutex_init(&h->lock, NULL);
+	if (errno != 0) {
+		free(h);
+		goto error;
+	}
+
+	h->prog = lf_compile(conf, fmt, ep);
+	if (h->prog == NULL) {
+		pthread_mutex_destroy(&h->lock);
+		free(h);
+		return NULL;
+	}
+
+	h->epoch   = 1;
+	h->readers = NULL;
+	h->retired = NULL;
+
+	return h;
+
+error:
+
+	ep->errnum = LF_ERR_ERRNO;
+	ep->p = fmt;
+	ep->n = 0;
+
+	return NULL;
+}
+
+int
+lf_handle_reload(struct lf_handle *h, const struct lf_config *conf, const char *fmt,
+	struct lf_err *ep)
+{
+	struct lf_prog *prog;
+	struct retired *rt;
+
+	assert(h != NULL);
+	assert(conf != NULL);
+	assert(fmt != NULL);
+	assert(ep != NULL);
+
+	/* the old program stays, if the new one is no good */
+	prog = lf_compile(conf, fmt, ep);
+	if (prog == NULL) {
+		return 0;
+	}
+
+	rt = malloc(sizeof *rt);
+	if (rt == NULL) {
+		lf_free(prog);
+		ep->errnum = LF_ERR_ERRNO;
+		ep->p = fmt;
+		ep->n = 0;
+		return 0;
+	}
+
+	pthread_mutex_lock(&h->lock);
+
+	rt->prog = h->prog;
+	STORE_SC(&h->prog, prog);
+
+	rt->epoch = h->epoch + 1;
+	STORE_SC(&h->epoch, rt->epoch);
+
+	rt->next = h->retired;
+	h->retired = rt;
+
+	reclaim(h);
+
+	pthread_mutex_unlock(&h->lock);
+
+	return 1;
+}
+
+void
+lf_free_handle(struct lf_handle *h)
+{
+	struct retired *rt, *next;
+
+	if (h == NULL) {
+		return;
+	}
+
+	assert(h->readers == NULL);
+
+	for (rt = h->retired; rt != NULL; rt = next) {
+		next = rt->next;
+		lf_free(rt->prog);
+		free(rt);
+	}
+
+	lf_free(h->prog);
+
+	pthread_mutex_destroy(&h->lock);
+	free(h);
+}
+
+struct lf_reader *
+lf_handle_reader(struct lf_handle *h)
+{
+	struct lf_reader *r;
+
+	assert(h != NULL);
+
+	r = malloc(sizeof *r);
+	if (r == NULL) {
+		return NULL;
+	}
+
+	r->h     = h;
+	r->epoch = 0;
+
+	pthread_mutex_lock(&h->lock);
+	r->next = h->readers;
+	h->readers = r;
+	pthread_mutex_unlock(&h->lock);
+
+	return r;
+}
+
+const struct lf_prog *
+lf_reader_pin(struct lf_reader *r)
+{
+	assert(r != NULL);
+	assert(r->epoch == 0);
+
+	STORE_SC(&r->epoch, LOAD(&r->h->epoch));
+
+	return LOAD_SC(&r->h->prog);
+}
+
+void
+lf_reader_unpin(struct lf_reader *r)
+{
+	assert(r != NULL);
+	assert(r->epoch != 0);
+
+	STORE(&r->epoch, 0);
+}
+
+void
+lf_free_reader(struct lf_reader *r)
+{
+	struct lf_reader **rp;
+	struct lf_handle *h;
+
+	if (r == NULL) {
+		return;
+	}
+
+	assert(r->epoch == 0);
+
+	h = r->h;
+
+	pthread_mutex_lock(&h->lock);
+
+	for (rp = &h->readers; *rp != r; rp = &(*rp)->next) {
+		assert(*rp != NULL);
+	}
+
+	*rp = r->next;
+
+	reclaim(h);
+
+	pthread_mutex_unlock(&h->lock);
+
+	free(r);
+}
@@ -0,0 +1,257 @@
+/*
+ * Copyright 2017 Katherine Flavel
+ *
+ * See LICENCE for the full copyright terms.
+ */
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <lf/lf.h>
+
+#include "internal.h"
+
+struct lf_headers {
+	const struct lf_prog *prog;
+	size_t want[TABLES];  /* slots for each table */
+
+	lf_lookup *lookup;    /* for everything else */
+	void *opaque;
+
+	struct lf_str value[]; /* by slot */
+};
+
+static int
+folded_table(enum lf_table t)
+{
+	return t == LF_TABLE_REQ_HEADER  || t == LF_TABLE_REPLY_HEADER
+	    || t == LF_TABLE_REQ_TRAILER || t == LF_TABLE_RESP_TRAILER;
+}
+
+int
+name_folded(enum op_type type)
+{
+	int t;
+
+	t = op_table(type);
+
+	return t != -1 && folded_table(t);
+}
+
+static unsigned
+name_hash(const char *p, size_t n)
+{
+	assert(p != NULL || n == 0);
+
+	return (unsigned) fnv1a(FNV_BASIS, p, n, 1);
+}
+
+int
+name_same(const char *a, const char *b, size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		if (fold(a[i]) != fold(b[i])) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/* the slot for this name, or -1 */
+static long
+find(const struct header_name *name, const unsigned *index, size_t mask,
+	unsigned t, unsigned h, const char *p, size_t n)
+{
+	size_t i;
+
+	for (i = h & mask; index[i] != 0; i = (i + 1) & mask) {
+		const struct header_name *v = &name[index[i] - 1];
+
+		if (v->hash == h && v->table == t && v->n == n && name_same(v->p, p, n)) {
+			return (long) index[i] - 1;
+		}
+	}
+
+	return -1;
+}
+
+size_t
+name_slots(struct op *op, size_t count, struct header_name *name,
+	unsigned *index, size_t mask)
+{
+	size_t i, k, names;
+
+	assert(op != NULL);
+	assert(name != NULL);
+	assert(index != NULL);
+
+	memset(index, 0, (mask + 1) * sizeof *index);
+
+	names = 0;
+
+	for (i = 0; i < count; i++) {
+		unsigned h;
+		long s;
+		int t;
+
+		if (!name_folded(op[i].type)) {
+			continue;
+		}
+
+		t = op_table(op[i].type);
+
+		h = name_hash(op[i].p, op[i].n);
+
+		s = find(name, index, mask, t, h, op[i].p, op[i].n);
+		if (s == -1) {
+			s = (long) names++;
+
+			name[s].table = t;
+			name[s].hash  = h;
+			name[s].p     = op[i].p;
+			name[s].n     = op[i].n;
+
+			for (k = h & mask; index[k] != 0; k = (k + 1) & mask)
+				;
+
+			index[k] = (unsigned) s + 1;
+		}
+
+		op[i].slot = (unsigned) s;
+	}
+
+	return names;
+}
+
+const struct lf_str *
+headers_value(const struct lf_headers *hs, const struct lf_prog *prog,
+	const struct op *op)
+{
+	assert(hs != NULL);
+	assert(op != NULL);
+
+	if (hs->prog != prog || !name_folded(op->type)) {
+		return NULL;
+	}
+
+	assert(op->slot < prog->names);
+
+	return &hs->value[op->slot];
+}
+
+struct lf_headers *
+lf_new_headers(const struct lf_prog *prog)
+{
+	struct lf_headers *hs;
+	size_t i;
+
+	assert(prog != NULL);
+
+	hs = malloc(sizeof *hs + prog->names * sizeof *hs->value);
+	if (hs == NULL) {
+		return NULL;
+	}
+
+	hs->prog = prog;
+
+	memset(hs->want, 0, sizeof hs->want);
+
+	for (i = 0; i < prog->names; i++) {
+		hs->want[prog->name[i].table]++;
+	}
+
+	lf_headers_reset(hs, NULL, NULL);
+
+	return hs;
+}
+
+void
+lf_headers_reset(struct lf_headers *hs, lf_lookup *lookup, void *opaque)
+{
+	size_t i;
+
+	assert(hs != NULL);
+
+	for (i = 0; i < hs->prog->names; i++) {
+		hs->value[i].p = NULL;
+		hs->value[i].n = 0;
+	}
+
+	hs->lookup = lookup;
+	hs->opaque = opaque;
+}
+
+size_t
+lf_headers_resolve(struct lf_headers *hs, enum lf_table table,
+	const struct lf_header *h, size_t n)
+{
+	const struct lf_prog *prog;
+	size_t i, found;
+	long s;
+
+	assert(hs != NULL);
+	assert(h != NULL || n == 0);
+	assert((size_t) table < TABLES);
+
+	prog  = hs->prog;
+	found = 0;
+
+	for (i = 0; i < n && found < hs->want[table]; i++) {
+		if (h[i].value.p == NULL) {
+			continue;
+		}
+
+		s = find(prog->name, prog->index, prog->mask, table,
+			name_hash(h[i].name.p, h[i].name.n), h[i].name.p, h[i].name.n);
+		if (s == -1 || hs->value[s].p != NULL) {
+			continue;
+		}
+
+		hs->value[s] = h[i].value;
+		found++;
+	}
+
+	return found;
+}
+
+struct lf_str
+lf_headers_lookup(void *opaque, enum lf_table table, const char *name, size_t n)
+{
+	const struct lf_headers *hs = opaque;
+	const struct lf_prog *prog;
+	struct lf_str none;
+	long s;
+
+	assert(hs != NULL);
+	assert(name != NULL);
+
+	prog = hs->prog;
+
+	if (folded_table(table) && prog->names > 0) {
+		s = find(prog->name, prog->index, prog->mask, table,
+			name_hash(name, n), name, n);
+		if (s != -1) {
+			return hs->value[s];
+		}
+	}
+
+	if (hs->lookup != NULL) {
+		return hs->lookup(hs->opaque, table, name, n);
+	}
+
+	none.p = NULL;
+	none.n = 0;
+
+	return none;
+}
+
+void
+lf_free_headers(struct lf_headers *hs)
+{
+	free(hs);
+}
@@ -0,0 +1,249 @@
+/*
+ * Copyright 2017 Katherine Flavel
+ *
+ * See LICENCE for the full copyright terms.
+ */
+
+#ifndef LF_INTERNAL_H
+#define LF_INTERNAL_H
+
+/*
+ * One op per directive, and one per run of literal text.
+ * These correspond to the hooks in struct lf_config.
+ */
+enum op_type {
+	OP_LITERAL,
+	OP_CUSTOM,
+
+	OP_IP,
+	OP_RESP_SIZE,
+	OP_RESP_SIZE_CLF,
+	OP_REQ_COOKIE,
+	OP_ENV_VAR,
+	OP_FILENAME,
+	OP_REMOTE_HOSTNAME,
+	OP_REQ_PROTOCOL,
+	OP_REQ_HEADER,
+	OP_KEEPALIVE_REQS,
+	OP_REMOTE_LOGNAME,
+	OP_REQ_LOGID,
+	OP_REQ_METHOD,
+	OP_NOTE,
+	OP_REPLY_HEADER,
+	OP_SERVER_PORT,
+	OP_ID,
+	OP_QUERY_STRING,
+	OP_REQ_FIRST_LINE,
+	OP_RESP_HANDLER,
+	OP_STATUS,
+	OP_TIME,
+	OP_TIME_FRAC,
+	OP_TIME_TAKEN,
+	OP_REMOTE_USER,
+	OP_URL_PATH,
+	OP_SERVER_NAME,
+	OP_CONN_STATUS,
+	OP_BYTES_RECV,
+	OP_BYTES_SENT,
+	OP_BYTES_XFER,
+	OP_REQ_TRAILER,
+	OP_RESP_TRAILER
+};
+
+#define TABLES (LF_TABLE_RESP_TRAILER + 1)
+
+/*
+ * Atomics for the writer, cache and handle. Plain loads and stores
+ * pair acquire with release; the _SC variants are sequentially
+ * consistent, for where a store mustn't pass a later load.
+ */
+#define LOAD(p)        __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define STORE(p, v)    __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define LOAD_SC(p)     __atomic_load_n((p), __ATOMIC_SEQ_CST)
+#define STORE_SC(p, v) __atomic_store_n((p), (v), __ATOMIC_SEQ_CST)
+#define CAS(p, o, n)   __atomic_compare_exchange_n((p), (o), (n), 0, \
+	__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+
+#define FNV_BASIS 2166136261UL
+
+struct op {
+	unsigned type     :8; /* enum op_type */
+	unsigned redirect :1; /* enum lf_redirect */
+	unsigned when     :1; /* enum lf_when */
+	unsigned arg      :4; /* enum lf_ip, lf_port, lf_id, lf_rtime or a boolean */
+	char c;               /* custom specifier, or a literal character */
+
+	struct lf_pred pred;
+
+	/*
+	 * The name for named directives (including the strftime format
+	 * for OP_TIME), or the text for OP_LITERAL. Names are NUL terminated.
+	 */
+	const char *p;
+	size_t n;
+
+	/* OP_TIME's format compiled, by lf_compile() only; NULL for strftime() */
+	const struct tf *tf;
+	size_t tfn;
+
+	size_t src; /* offset into the format string, for errors */
+
+	/* for header and trailer names, by lf_compile() only; see struct header_name */
+	unsigned slot;
+};
+
+/*
+ * One conversion of a compiled strftime() format, or a run of literal
+ * text where c is '\0'. Composites like %T are expanded.
+ */
+struct tf {
+	char c;
+	const char *p;
+	size_t n;
+};
+
+/*
+ * Each distinct name for the header and trailer tables (whose names
+ * are case-insensitive) is given a slot, with its hash case-folded.
+ * The slots are indexed by hash, open addressed, for lf_headers_resolve().
+ */
+struct header_name {
+	unsigned table :3; /* enum lf_table */
+	unsigned hash;
+	const char *p;     /* the first directive's */
+	size_t n;
+};
+
+/*
+ * The ops, names, statuses, literal text, and a copy of the format
+ * string are all allocated along with this struct, in one block.
+ */
+struct lf_prog {
+	const struct op *op;
+	size_t count;
+	const char *fmt;
+	size_t len;
+
+	const struct header_name *name;
+	size_t names;
+	const unsigned *index; /* slot + 1, or 0 for none */
+	size_t mask;           /* of .index, a power of 2 less 1 */
+
+	void *cached; /* its entry, if held by an lf_cache */
+};
+
+/* the lookup table for a named directive, or -1 */
+static inline int
+op_table(enum op_type type)
+{
+	switch (type) {
+	case OP_REQ_COOKIE:   return LF_TABLE_REQ_COOKIE;
+	case OP_ENV_VAR:      return LF_TABLE_ENV_VAR;
+	case OP_REQ_HEADER:   return LF_TABLE_REQ_HEADER;
+	case OP_NOTE:         return LF_TABLE_NOTE;
+	case OP_REPLY_HEADER: return LF_TABLE_REPLY_HEADER;
+	case OP_REQ_TRAILER:  return LF_TABLE_REQ_TRAILER;
+	case OP_RESP_TRAILER: return LF_TABLE_RESP_TRAILER;
+
+	default:
+		return -1;
+	}
+}
+
+/*
+ * A-Z as a-z, for header names. This is ASCII only, rather than
+ * tolower(), which depends on the locale; a name hashed by lf_compile()
+ * must hash the same when resolved.
+ */
+static inline unsigned char
+fold(unsigned char c)
+{
+	return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+}
+
+/*
+ * FNV-1a for p..n, continuing from h, which is FNV_BASIS to begin with.
+ * Where folded is true, each byte is hashed as fold() gives it.
+ */
+static inline unsigned long
+fnv1a(unsigned long h, const char *p, size_t n, int folded)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		h ^= folded ? fold(p[i]) : (unsigned char) p[i];
+		h *= 16777619UL;
+		h &= 0xffffffffUL;
+	}
+
+	return h;
+}
+
+void
+pred_map(struct lf_pred *pred);
+
+/* true for the directives whose names are header or trailer names */
+int
+name_folded(enum op_type type);
+
+/* true if a and b are the same name, folded as for header names */
+int
+name_same(const char *a, const char *b, size_t n);
+
+/*
+ * Give each header and trailer name in op[0..count] its slot, the first
+ * time each is seen, and index those. name[] and index[] must have room
+ * for one slot per op named, and mask + 1 must be at least twice that.
+ * Returns the number of slots.
+ */
+size_t
+name_slots(struct op *op, size_t count, struct header_name *name,
+	unsigned *index, size_t mask);
+
+/* op's value resolved, or NULL if hs is for some other program */
+const struct lf_str *
+headers_value(const struct lf_headers *hs, const struct lf_prog *prog,
+	const struct op *op);
+
+/*
+ * The first byte in p..end which is either a or b, or end if none is.
+ * Pass the same byte twice to search for just one.
+ */
+const char *
+memchr2(const char *p, const char *end, char a, char b);
+
+/*
+ * The first byte in p..end which Apache's ap_escape_logitem() escapes
+ * (quotes, backslashes and anything unprintable), or end if none is.
+ */
+const char *
+memesc(const char *p, const char *end);
+
+/* days since the epoch, for the proleptic Gregorian calendar */
+long long
+days(long long y, unsigned m, unsigned d);
+
+/*
+ * Compile the strftime() format fmt..len, appending to tf (which may be
+ * NULL, just to count) and advancing *n. Returns 0 if the format has
+ * conversions which must be left to strftime().
+ */
+int
+tf_compile(const char *fmt, size_t len, struct tf *tf, size_t *n);
+
+struct tm;
+
+/*
+ * Render a compiled format for t, which is broken down as tm, to buf.
+ * Returns the length written, or 0 where strftime() is needed after all.
+ */
+size_t
+tf_render(const struct tf *tf, size_t count, long long t, const struct tm *tm,
+	char *buf, size_t size);
+
+/* The directive for a scanner's column i */
+const struct op *
+scanner_op(const struct lf_scanner *sc, size_t i);
+
+#endif
+
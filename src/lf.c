@@ -9,15 +9,26 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <ctype.h>
+#include <limits.h>
 
 #include <lf/lf.h>
 
+#include "internal.h"
+
 #define MAX_STATUS 0xffffU /* minimum UINT_MAX */
+#define MAX_STATUSES 128   /* arbitrary limit */
+#define MAX_NAME 127       /* longer names are copied to the heap */
+#define MAX_SPAN 256       /* arbitrary limit */
 
 #define ERR(code)         \
 	*e = LF_ERR_ ## code; \
 	return 0;
 
+#define OP(t, a)            \
+	op->type = OP_ ## t;    \
+	op->arg  = (a);         \
+	return 1;
+
 struct errstuff {
 	const char *toomanyredirect;
 	const char *percent;
@@ -30,6 +41,14 @@ struct txt {
 	size_t n;
 };
 
+struct counts {
+	size_t ops;
+	size_t status;
+	size_t text;
+	size_t tf;
+	size_t names;
+};
+
 static int
 uintcmp(const void *a, const void *b)
 {
@@ -60,16 +79,83 @@ nameeq(const char *p, size_t n, const char *s)
 	return 0 == memcmp(p, s, n);
 }
 
+static int
+prefix(struct txt *t, const char *s)
+{
+	size_t z;
+
+	assert(t != NULL && t->p != NULL);
+	assert(s != NULL);
+
+	z = strlen(s);
+
+	if (t->n < z || 0 != memcmp(t->p, s, z)) {
+		return 0;
+	}
+
+	t->p += z;
+	t->n -= z;
+
+	return 1;
+}
+
+/*
+ * The character at p, or '\0' when p is at the end of input.
+ */
+static char
+peek(const char *p, const char *end)
+{
+	assert(p != NULL);
+	assert(end != NULL);
+	assert(p <= end);
+
+	return p < end ? *p : '\0';
+}
+
+/*
+ * Length-bounded equivalents to strspn(3) and strcspn(3).
+ */
+static size_t
+nspn(const char *p, const char *end, const char *set)
+{
+	const char *q;
+
+	assert(p != NULL);
+	assert(end != NULL);
+	assert(set != NULL);
+
+	for (q = p; q < end && *q != '\0' && strchr(set, *q); q++)
+		;
+
+	return q - p;
+}
+
+static size_t
+ncspn(const char *p, const char *end, const char *set)
+{
+	const char *q;
+
+	assert(p != NULL);
+	assert(end != NULL);
+	assert(set != NULL);
+
+	for (q = p; q < end && (*q == '\0' || !strchr(set, *q)); q++)
+		;
+
+	return q - p;
+}
+
 static unsigned
-parse_status(const char *p, const char **e)
+parse_status(const char *p, const char *end, const char **e)
 {
 	unsigned u;
 
 	assert(p != NULL);
+	assert(end != NULL);
 
 	u = 0;
 
-	while (*p != '\0' && isdigit((unsigned char) *p)) {
+	while (p < end && isdigit((unsigned char) *p)) {
 		if (u >= MAX_STATUS / 10U) {
 			u = 0;
 			break;
@@ -110,133 +196,279 @@ uniq(unsigned a[], size_t *count)
 	*count = j + 1;
 }
 
-static int
-notcustom(struct lf_config *conf, void *opaque,
-	const char **p, const struct lf_pred *pred, enum lf_redirect redirect,
-	const struct txt *name, enum lf_errno *e)
+/*
+ * How each specifier character treats a {name}.
+ */
+enum name {
+	NAME_OPTIONAL,
+	NAME_REQUIRED,
+	NAME_FORBIDDEN
+};
+
+/*
+ * What to do for each specifier character. H_SIMPLE directives are
+ * entirely described by their op and arg; the others decode something
+ * further from the format string.
+ */
+enum handler {
+	H_UNRECOGNISED,
+	H_MISSING,
+	H_CUSTOM,
+	H_PERCENT,
+	H_SIMPLE,
+	H_IP,
+	H_PORT,
+	H_ID,
+	H_TIME,
+	H_RTIME,
+	H_TRAILER
+};
+
+/*
+ * The rules for one specifier character.
+ */
+struct spec {
+	unsigned handler  :4;
+	unsigned name     :2;
+	unsigned redirect :1; /* default enum lf_redirect */
+	unsigned op       :6;
+	unsigned arg      :4;
+};
+
+/*
+ * The rules for each specifier character under one config, decided
+ * the first time each character is seen while parsing a format, so
+ * that parsing needn't decide them repeatedly.
+ */
+struct specs {
+	const struct lf_config *conf;
+	unsigned char seen[(UCHAR_MAX + 1) / CHAR_BIT];
+	struct spec spec[UCHAR_MAX + 1];
+};
+
+#define SPEC(h, n, o, a)         \
+	s.handler = H_    ## h;      \
+	s.name    = NAME_ ## n;      \
+	s.op      = OP_   ## o;      \
+	s.arg     = (a);             \
+	break;
+
+/*
+ * The rules for a single specifier character.
+ */
+static struct spec
+specifier(const struct lf_config *conf, unsigned char c)
 {
-	const char *fmt;
-	char buf[128]; /* arbitrary limit */
+	struct spec s;
 
 	assert(conf != NULL);
-	assert(p != NULL && *p != NULL);
-	assert(pred != NULL);
-	assert(name != NULL);
-	assert(e != NULL);
 
-	switch (**p) {
-	case 't':
-		/*
-		 * LogFormat:
-		 * "Time the request was received, in the format
-		 * [18/Sep/2011:19:18:28 -0400]"
-		 */
-		if (name->p == NULL) {
-			fmt = "[%d/%b/%Y:%T %z]";
-			break;
-		}
+	/*
+	 * LogFormat:
+	 * "By default, the % directives %s, %U, %T, %D, and %r
+	 * look at the original request while all others look at
+	 * the final request."
+	 *
+	 * There is currently no way to specify equivalent defaults
+	 * for custom directives.
+	 */
+	switch (c) {
+	case 's':
+	case 'U':
+	case 'T':
+	case 'D':
+	case 'r': s.redirect = LF_REDIRECT_ORIG;  break;
+	default:  s.redirect = LF_REDIRECT_FINAL; break;
+	}
+
+	/*
+	 * The custom callback decides if the character is relevant.
+	 * Note handling for non-alpha characters falls through to
+	 * the non-custom directives below, which will then error out.
+	 */
+	if (conf->override != NULL && isalpha(c) && strchr(conf->override, c)) {
+		assert(conf->custom != NULL);
 
-		fmt = buf;
+		s.handler = H_CUSTOM;
+		s.name    = NAME_OPTIONAL;
+		s.op      = OP_CUSTOM;
+		s.arg     = 0;
 
-		/* fallthrough */
+		return s;
+	}
 
-	case 'C':
-	case 'e':
-	case 'i':
-	case 'n':
-	case 'o':
-	case '^':
-		if (name->p == NULL) {
-			ERR(MISSING_NAME);
-		}
+	switch (c) {
+	case '\0': SPEC(MISSING,  OPTIONAL,  LITERAL,         0);
+	case '%':  SPEC(PERCENT,  OPTIONAL,  LITERAL,         0);
+
+	case 'A':  SPEC(SIMPLE,   FORBIDDEN, IP,              LF_IP_LOCAL);
+	case 'B':  SPEC(SIMPLE,   FORBIDDEN, RESP_SIZE,       0);
+	case 'b':  SPEC(SIMPLE,   FORBIDDEN, RESP_SIZE_CLF,   0);
+	case 'C':  SPEC(SIMPLE,   REQUIRED,  REQ_COOKIE,      0);
+	case 'D':  SPEC(SIMPLE,   FORBIDDEN, TIME_TAKEN,      LF_RTIME_US);
+	case 'e':  SPEC(SIMPLE,   REQUIRED,  ENV_VAR,         0);
+	case 'f':  SPEC(SIMPLE,   FORBIDDEN, FILENAME,        0);
+	case 'h':  SPEC(SIMPLE,   FORBIDDEN, REMOTE_HOSTNAME, conf->hostname_lookups);
+	case 'H':  SPEC(SIMPLE,   FORBIDDEN, REQ_PROTOCOL,    0);
+	case 'i':  SPEC(SIMPLE,   REQUIRED,  REQ_HEADER,      0);
+	case 'k':  SPEC(SIMPLE,   FORBIDDEN, KEEPALIVE_REQS,  0);
+	case 'l':  SPEC(SIMPLE,   FORBIDDEN, REMOTE_LOGNAME,  0);
+	case 'L':  SPEC(SIMPLE,   FORBIDDEN, REQ_LOGID,       0);
+	case 'm':  SPEC(SIMPLE,   FORBIDDEN, REQ_METHOD,      0);
+	case 'n':  SPEC(SIMPLE,   REQUIRED,  NOTE,            0);
+	case 'o':  SPEC(SIMPLE,   REQUIRED,  REPLY_HEADER,    0);
+	case 'u':  SPEC(SIMPLE,   FORBIDDEN, REMOTE_USER,     0);
+	case 'U':  SPEC(SIMPLE,   FORBIDDEN, URL_PATH,        0);
+	case 'v':  SPEC(SIMPLE,   FORBIDDEN, SERVER_NAME,     1);
+	case 'V':  SPEC(SIMPLE,   FORBIDDEN, SERVER_NAME,     conf->use_canonical_name);
+	case 'X':  SPEC(SIMPLE,   FORBIDDEN, CONN_STATUS,     0);
+	case 'I':  SPEC(SIMPLE,   FORBIDDEN, BYTES_RECV,      0);
+	case 'O':  SPEC(SIMPLE,   FORBIDDEN, BYTES_SENT,      0);
+	case 'q':  SPEC(SIMPLE,   FORBIDDEN, QUERY_STRING,    0);
+	case 'r':  SPEC(SIMPLE,   FORBIDDEN, REQ_FIRST_LINE,  0);
+	case 'R':  SPEC(SIMPLE,   FORBIDDEN, RESP_HANDLER,    0);
+	case 's':  SPEC(SIMPLE,   FORBIDDEN, STATUS,          0);
+	case 'S':  SPEC(SIMPLE,   FORBIDDEN, BYTES_XFER,      0);
+
+	case 'a':  SPEC(IP,       OPTIONAL,  IP,              0);
+	case 'p':  SPEC(PORT,     OPTIONAL,  SERVER_PORT,     0);
+	case 'P':  SPEC(ID,       OPTIONAL,  ID,              0);
+	case 't':  SPEC(TIME,     OPTIONAL,  TIME,            0);
+	case 'T':  SPEC(RTIME,    OPTIONAL,  TIME_TAKEN,      0);
+	case '^':  SPEC(TRAILER,  REQUIRED,  REQ_TRAILER,     0);
 
-		/* XXX: pass pointer and length instead */
-		if (name->n > (sizeof buf) - 1) {
-			ERR(NAME_OVERFLOW);
+	default:
+		if (isalpha(c)) {
+			SPEC(UNRECOGNISED, FORBIDDEN, LITERAL, 0);
+		} else {
+			SPEC(UNRECOGNISED, OPTIONAL,  LITERAL, 0);
 		}
+	}
 
-		memcpy(buf, name->p, name->n);
-		buf[name->n] = '\0';
+	return s;
+}
 
-		break;
+static void
+specs_init(struct specs *specs, const struct lf_config *conf)
+{
+	assert(specs != NULL);
+	assert(conf != NULL);
 
-	case 'a':
-	case 'p':
-	case 'P':
-	case 'T':
-		break;
+	specs->conf = conf;
 
-	default:
-		if (!isalpha((unsigned char) **p)) {
-			break;
+	memset(specs->seen, 0, sizeof specs->seen);
+}
+
+static const struct spec *
+specs_get(struct specs *specs, unsigned char c)
+{
+	assert(specs != NULL);
+
+	if (!(specs->seen[c / CHAR_BIT] & (1U << (c % CHAR_BIT)))) {
+		specs->spec[c] = specifier(specs->conf, c);
+		specs->seen[c / CHAR_BIT] |= 1U << (c % CHAR_BIT);
+	}
+
+	return &specs->spec[c];
+}
+
+/*
+ * Decode the directive at *p per its specifier's rules,
+ * including whatever its name selects.
+ */
+static int
+decode(const struct spec *s,
+	const char **p, const char *end, const struct txt *name,
+	struct op *op, enum lf_errno *e)
+{
+	assert(s != NULL);
+	assert(p != NULL && *p != NULL);
+	assert(end != NULL);
+	assert(name != NULL);
+	assert(op != NULL);
+	assert(e != NULL);
+
+	switch (s->name) {
+	case NAME_REQUIRED:
+		if (name->p == NULL) {
+			ERR(MISSING_NAME);
 		}
 
+		op->p = name->p;
+		op->n = name->n;
+		break;
+
+	case NAME_FORBIDDEN:
 		if (name->p != NULL) {
 			ERR(UNWANTED_NAME);
 		}
+		break;
 
+	case NAME_OPTIONAL:
 		break;
 	}
 
-	switch (**p) {
-	case '%':
+	op->type = s->op;
+	op->arg  = s->arg;
+
+	switch (s->handler) {
+	case H_SIMPLE:
+		return 1;
+
+	case H_PERCENT:
 		/* TODO: is a status list permitted here? i don't see why not */
-		return conf->literal(opaque, '%');
-
-	case 'A': return conf->ip(opaque, pred, redirect, LF_IP_LOCAL);
-	case 'B': return conf->resp_size(opaque, pred, redirect);
-	case 'b': return conf->resp_size_clf(opaque, pred, redirect);
-	case 'C': return conf->req_cookie(opaque, pred, redirect, buf);
-	case 'D': return conf->time_taken(opaque, pred, redirect, LF_RTIME_US);
-	case 'e': return conf->env_var(opaque, pred, redirect, buf);
-	case 'f': return conf->filename(opaque, pred, redirect);
-	case 'h': return conf->remote_hostname(opaque, pred, redirect, conf->hostname_lookups);
-	case 'H': return conf->req_protocol(opaque, pred, redirect);
-	case 'i': return conf->req_header(opaque, pred, redirect, buf);
-	case 'k': return conf->keepalive_reqs(opaque, pred, redirect);
-	case 'l': return conf->remote_logname(opaque, pred, redirect);
-	case 'L': return conf->req_logid(opaque, pred, redirect);
-	case 'm': return conf->req_method(opaque, pred, redirect);
-	case 'n': return conf->note(opaque, pred, redirect, buf);
-	case 'o': return conf->reply_header(opaque, pred, redirect, buf);
-
-	case 'a':
+		op->c = '%';
+		OP(LITERAL, 0);
+
+	case H_IP:
 		if (name->p == NULL) {
-			return conf->ip(opaque, pred, redirect, LF_IP_CLIENT);
+			OP(IP, LF_IP_CLIENT);
 		} else if (nameeq(name->p, name->n, "c")) {
-			return conf->ip(opaque, pred, redirect, LF_IP_PEER);
+			OP(IP, LF_IP_PEER);
 		} else {
 			ERR(UNRECOGNISED_IP_TYPE);
 		}
 
-	case 'p':
+	case H_PORT:
 		if (name->p == NULL) {
-			return conf->server_port(opaque, pred, redirect, LF_PORT_CANONICAL);
+			OP(SERVER_PORT, LF_PORT_CANONICAL);
 		} else if (nameeq(name->p, name->n, "canonical")) {
-			return conf->server_port(opaque, pred, redirect, LF_PORT_CANONICAL);
+			OP(SERVER_PORT, LF_PORT_CANONICAL);
 		} else if (nameeq(name->p, name->n, "local")) {
-			return conf->server_port(opaque, pred, redirect, LF_PORT_LOCAL);
+			OP(SERVER_PORT, LF_PORT_LOCAL);
 		} else if (nameeq(name->p, name->n, "remote")) {
-			return conf->server_port(opaque, pred, redirect, LF_PORT_REMOTE);
+			OP(SERVER_PORT, LF_PORT_REMOTE);
 		} else {
 			ERR(UNRECOGNISED_PORT_TYPE);
 		}
 
-	case 'P':
+	case H_ID:
 		if (name->p == NULL) {
-			return conf->id(opaque, pred, redirect, LF_ID_PID);
+			OP(ID, LF_ID_PID);
 		} else if (nameeq(name->p, name->n, "pid")) {
-			return conf->id(opaque, pred, redirect, LF_ID_PID);
+			OP(ID, LF_ID_PID);
 		} else if (nameeq(name->p, name->n, "tid")) {
-			return conf->id(opaque, pred, redirect, LF_ID_TID);
+			OP(ID, LF_ID_TID);
 		} else if (nameeq(name->p, name->n, "hextid")) {
-			return conf->id(opaque, pred, redirect, LF_ID_HEXTID);
+			OP(ID, LF_ID_HEXTID);
 		} else {
 			ERR(UNRECOGNISED_ID_TYPE);
 		}
 
-	case 't': {
-		enum lf_when when;
+	case H_TIME: {
+		struct txt fmt;
+
+		/*
+		 * LogFormat:
+		 * "Time the request was received, in the format
+		 * [18/Sep/2011:19:18:28 -0400]"
+		 */
+		if (name->p == NULL) {
+			fmt.p = "[%d/%b/%Y:%T %z]";
+			fmt.n = strlen(fmt.p);
+		} else {
+			fmt = *name;
+		}
 
 		/*
 		 * LogFormat:
@@ -246,14 +478,12 @@ notcustom(struct lf_config *conf, void *opaque,
 		 * gets written, close to the end of the req processing."
 		 */
 
-		if (0 == strncmp(fmt, "begin:", strlen("begin:"))) {
-			when = LF_WHEN_BEGIN;
-			fmt += strlen("begin:");
-		} else if (0 == strncmp(fmt, "end:", strlen("end:"))) {
-			when = LF_WHEN_END;
-			fmt += strlen("end:");
+		if (prefix(&fmt, "begin:")) {
+			op->when = LF_WHEN_BEGIN;
+		} else if (prefix(&fmt, "end:")) {
+			op->when = LF_WHEN_END;
 		} else {
-			when = LF_WHEN_BEGIN;
+			op->when = LF_WHEN_BEGIN;
 		}
 
 		/*
@@ -264,78 +494,70 @@ notcustom(struct lf_config *conf, void *opaque,
 		 * or strftime(3) formatting in the same format string.
 		 */
 
-		if (0 == strcmp(fmt, "sec")) {
-			return conf->time_frac(opaque, pred, redirect, when, LF_RTIME_S);
-		} else if (0 == strcmp(fmt, "msec")) {
-			return conf->time_frac(opaque, pred, redirect, when, LF_RTIME_MS);
-		} else if (0 == strcmp(fmt, "usec")) {
-			return conf->time_frac(opaque, pred, redirect, when, LF_RTIME_US);
-		} else if (0 == strcmp(fmt, "msec_frac")) {
-			return conf->time_frac(opaque, pred, redirect, when, LF_RTIME_MS_FRAC);
-		} else if (0 == strcmp(fmt, "usec_frac")) {
-			return conf->time_frac(opaque, pred, redirect, when, LF_RTIME_US_FRAC);
+		if (nameeq(fmt.p, fmt.n, "sec")) {
+			OP(TIME_FRAC, LF_RTIME_S);
+		} else if (nameeq(fmt.p, fmt.n, "msec")) {
+			OP(TIME_FRAC, LF_RTIME_MS);
+		} else if (nameeq(fmt.p, fmt.n, "usec")) {
+			OP(TIME_FRAC, LF_RTIME_US);
+		} else if (nameeq(fmt.p, fmt.n, "msec_frac")) {
+			OP(TIME_FRAC, LF_RTIME_MS_FRAC);
+		} else if (nameeq(fmt.p, fmt.n, "usec_frac")) {
+			OP(TIME_FRAC, LF_RTIME_US_FRAC);
 		} else {
-			return conf->time(opaque, pred, redirect, when, fmt);
+			op->p = fmt.p;
+			op->n = fmt.n;
+			OP(TIME, 0);
 		}
 	}
 
-	case 'T':
+	case H_RTIME:
 		if (name->p == NULL) {
-			return conf->time_taken(opaque, pred, redirect, LF_RTIME_S);
+			OP(TIME_TAKEN, LF_RTIME_S);
 		} else if (nameeq(name->p, name->n, "ms")) {
-			return conf->time_taken(opaque, pred, redirect, LF_RTIME_MS);
+			OP(TIME_TAKEN, LF_RTIME_MS);
 		} else if (nameeq(name->p, name->n, "us")) {
-			return conf->time_taken(opaque, pred, redirect, LF_RTIME_US);
+			OP(TIME_TAKEN, LF_RTIME_US);
 		} else if (nameeq(name->p, name->n, "s")) {
-			return conf->time_taken(opaque, pred, redirect, LF_RTIME_S);
+			OP(TIME_TAKEN, LF_RTIME_S);
 		} else {
 			ERR(UNRECOGNISED_RTIME_UNIT);
 		}
 
-	case 'u': return conf->remote_user(opaque, pred, redirect);
-	case 'U': return conf->url_path(opaque, pred, redirect);
-	case 'v': return conf->server_name(opaque, pred, redirect, 1);
-	case 'V': return conf->server_name(opaque, pred, redirect, conf->use_canonical_name);
-	case 'X': return conf->conn_status(opaque, pred, redirect);
-	case 'I': return conf->bytes_recv(opaque, pred, redirect);
-	case 'O': return conf->bytes_sent(opaque, pred, redirect);
-	case 'q': return conf->query_string(opaque, pred, redirect);
-	case 'r': return conf->req_first_line(opaque, pred, redirect);
-	case 'R': return conf->resp_handler(opaque, pred, redirect);
-	case 's': return conf->status(opaque, pred, redirect);
-	case 'S': return conf->bytes_xfer(opaque, pred, redirect);
-
-	case '^':
+	case H_TRAILER:
 		(*p)++;
 
-		if (**p != 't') {
+		if (peek(*p, end) != 't') {
 			ERR(UNRECOGNISED_DIRECTIVE);
 		}
 
 		(*p)++;
 
-		switch (**p) {
-		case 'i': return conf->req_trailer (opaque, pred, redirect, buf);
-		case 'o': return conf->resp_trailer(opaque, pred, redirect, buf);
+		switch (peek(*p, end)) {
+		case 'i': OP(REQ_TRAILER,  0);
+		case 'o': OP(RESP_TRAILER, 0);
 
 		default:
 			ERR(UNRECOGNISED_DIRECTIVE);
 		}
 
-	case '\0':
+	case H_MISSING:
 		ERR(MISSING_DIRECTIVE);
 
+	case H_CUSTOM:
+	case H_UNRECOGNISED:
 	default:
 		ERR(UNRECOGNISED_DIRECTIVE);
 	}
 }
 
 static int
-parse_escape(struct lf_config *conf, void *opaque, const char **p,
+parse_escape(const char **p, const char *end, struct op *op,
 	enum lf_errno *e)
 {
-	assert(conf != NULL);
 	assert(p != NULL && *p != NULL);
+	assert(end != NULL);
+	assert(op != NULL);
 	assert(e != NULL);
 
 	(*p)++;
@@ -347,14 +569,12 @@ parse_escape(struct lf_config *conf, void *opaque, const char **p,
 	 * should be escaped with backslashes."
 	 */
 
-	assert(conf->literal != NULL);
-
-	switch (**p) {
-	case 't':  return conf->literal(opaque, '\t');
-	case 'n':  return conf->literal(opaque, '\n');
-	case '\'': return conf->literal(opaque, '\'');
-	case '\"': return conf->literal(opaque, '\"');
-	case '\\': return conf->literal(opaque, '\\');
+	switch (peek(*p, end)) {
+	case 't':  op->c = '\t'; break;
+	case 'n':  op->c = '\n'; break;
+	case '\'': op->c = '\''; break;
+	case '\"': op->c = '\"'; break;
+	case '\\': op->c = '\\'; break;
 
 	case '\0':
 		ERR(MISSING_ESCAPE);
@@ -362,29 +582,35 @@ parse_escape(struct lf_config *conf, void *opaque, const char **p,
 	default:
 		ERR(UNRECOGNISED_ESCAPE);
 	}
+
+	op->type = OP_LITERAL;
+
+	return 1;
 }
 
 static int
-parse_directive(struct lf_config *conf, void *opaque, const char **p,
+parse_directive(struct specs *specs, const char **p, const char *end,
+	struct op *op, unsigned status[],
 	enum lf_errno *e, struct errstuff *errstuff)
 {
+	const struct spec *spec;
 	const char *redirectp;
-	unsigned status[128]; /* arbitrary limit */
 	struct txt name;
-	struct lf_pred pred;
-	enum lf_redirect redirect;
-	int r;
+	char c;
 
-	assert(conf != NULL);
+	assert(specs != NULL);
 	assert(p != NULL && *p != NULL);
+	assert(end != NULL);
+	assert(op != NULL);
+	assert(status != NULL);
 	assert(e != NULL);
 	assert(errstuff != NULL);
 
 	name.p = NULL;
 
-	pred.neg    = 0;
-	pred.count  = 0;
-	pred.status = status;
+	op->pred.neg    = 0;
+	op->pred.count  = 0;
+	op->pred.status = status;
 
 	errstuff->percent = *p;
 
@@ -398,18 +624,18 @@ parse_directive(struct lf_config *conf, void *opaque, const char **p,
 	 * list may be preceded by a "!" to indicate negation.
 	 */
 
-	if (**p == '!') {
-		pred.neg = 1;
+	if (peek(*p, end) == '!') {
+		op->pred.neg = 1;
 		(*p)++;
 	}
 
 	do {
-		const char *end;
+		const char *q;
 		unsigned u;
 
 		/* skip comma-separated list of digits */
-		u = parse_status(*p, &end);
-		if (u == 0 && end != *p) {
+		u = parse_status(*p, end, &q);
+		if (u == 0 && q != *p) {
 			ERR(STATUS_OVERFLOW);
 		}
 
@@ -417,41 +643,43 @@ parse_directive(struct lf_config *conf, void *opaque, const char **p,
 			break;
 		}
 
-		*p = end;
+		*p = q;
 
-		errstuff->endofstatuslist = end;
+		errstuff->endofstatuslist = q;
 
-		if (pred.count == sizeof status / sizeof *status) {
+		if (op->pred.count == MAX_STATUSES) {
 			ERR(TOO_MANY_STATUSES);
 		}
 
-		status[pred.count] = u;
-		pred.count++;
+		status[op->pred.count] = u;
+		op->pred.count++;
 
-	} while (**p == ',' && (*p)++);
+	} while (peek(*p, end) == ',' && (*p)++);
 
-	if (pred.count > 0) {
-		qsort(pred.status, pred.count, sizeof *pred.status,	uintcmp);
+	if (op->pred.count > 0) {
+		qsort(status, op->pred.count, sizeof *status, uintcmp);
 	}
 
-	uniq(pred.status, &pred.count);
+	uniq(status, &op->pred.count);
+
+	pred_map(&op->pred);
 
-	if (**p == '<' || **p == '>') {
+	if (peek(*p, end) == '<' || peek(*p, end) == '>') {
 		redirectp = *p;
 		(*p)++;
 	} else {
 		redirectp = NULL;
 	}
 
-	if (**p == '{') {
+	if (peek(*p, end) == '{') {
 		size_t n;
 
 		errstuff->openingbrace = *p;
 
 		(*p)++;
 
-		n = strcspn(*p, "}");
-		if ((*p)[n] != '}') {
+		n = ncspn(*p, end, "}");
+		if (peek(*p + n, end) != '}') {
 			ERR(MISSING_CLOSING_BRACE);
 		}
 
@@ -469,28 +697,17 @@ parse_directive(struct lf_config *conf, void *opaque, const char **p,
 		(*p)++;
 	}
 
-	/*
-	 * LogFormat:
-	 * "By default, the % directives %s, %U, %T, %D, and %r
-	 * look at the original request while all others look at
-	 * the final request."
-	 *
-	 * There is currently no way to specify equivalent defaults
-	 * for custom directives.
-	 */
-	switch (**p) {
-	case 's':
-	case 'U':
-	case 'T':
-	case 'D':
-	case 'r': redirect = LF_REDIRECT_ORIG;  break;
-	default:  redirect = LF_REDIRECT_FINAL; break;
-	}
+	c = peek(*p, end);
+
+	/* one lookup decides everything about the specifier */
+	spec = specs_get(specs, (unsigned char) c);
+
+	op->redirect = spec->redirect;
 
 	if (redirectp != NULL) {
 		switch (*redirectp) {
-		case '<': redirect = LF_REDIRECT_ORIG;  break;
-		case '>': redirect = LF_REDIRECT_FINAL; break;
+		case '<': op->redirect = LF_REDIRECT_ORIG;  break;
+		case '>': op->redirect = LF_REDIRECT_FINAL; break;
 
 		default:
 			assert(!"unreached");
@@ -500,60 +717,448 @@ parse_directive(struct lf_config *conf, void *opaque, const char **p,
 
 		redirectp++;
 
-		if (*redirectp == '<' || *redirectp == '>') {
+		if (peek(redirectp, end) == '<' || peek(redirectp, end) == '>') {
 			ERR(TOO_MANY_REDIRECT_FLAGS);
 		}
 	}
 
+	if (spec->handler == H_CUSTOM) {
+		op->c = c;
+		op->p = name.p;
+		op->n = name.n;
+
+		OP(CUSTOM, 0);
+	}
+
+	return decode(spec, p, end, &name, op, e);
+}
+
+/*
+ * Parse one literal character, escape, or directive.
+ * This leaves *p pointing at the last character consumed.
+ */
+static int
+parse_element(struct specs *specs, const char **p, const char *end,
+	struct op *op, unsigned status[],
+	enum lf_errno *e, struct errstuff *errstuff)
+{
+	assert(specs != NULL);
+	assert(p != NULL && *p != NULL);
+	assert(end != NULL && *p < end);
+	assert(op != NULL);
+	assert(e != NULL);
+	assert(errstuff != NULL);
+
+	errstuff->toomanyredirect = NULL;
+	errstuff->percent         = NULL;
+	errstuff->endofstatuslist = NULL;
+	errstuff->openingbrace    = NULL;
+
+	op->pred.neg    = 0;
+	op->pred.count  = 0;
+	op->pred.status = status;
+	op->redirect    = LF_REDIRECT_FINAL;
+	op->when        = LF_WHEN_BEGIN;
+	op->arg         = 0;
+	op->c           = '\0';
+	op->p           = NULL;
+	op->n           = 0;
+
+	switch (**p) {
+	case '\\':
+		return parse_escape(p, end, op, e);
+
+	case '%':
+		return parse_directive(specs, p, end, op, status, e, errstuff);
+
+	default:
+		op->c = **p;
+		OP(LITERAL, 0);
+	}
+}
+
+/*
+ * Whether the hook for a directive takes its name by pointer and length.
+ * If not, the name must be NUL terminated before calling dispatch().
+ */
+static int
+zerocopy(const struct lf_config *conf, const struct op *op)
+{
+	assert(conf != NULL);
+	assert(op != NULL);
+
+	switch (op->type) {
+	case OP_REQ_COOKIE:   return conf->req_cookien   != NULL;
+	case OP_ENV_VAR:      return conf->env_varn      != NULL;
+	case OP_REQ_HEADER:   return conf->req_headern   != NULL;
+	case OP_NOTE:         return conf->noten         != NULL;
+	case OP_REPLY_HEADER: return conf->reply_headern != NULL;
+	case OP_TIME:         return conf->timen         != NULL;
+	case OP_REQ_TRAILER:  return conf->req_trailern  != NULL;
+	case OP_RESP_TRAILER: return conf->resp_trailern != NULL;
+
+	default:
+		return 1;
+	}
+}
+
+#define NAMED(hook)                                                   \
+	if (conf->hook ## n != NULL) {                                    \
+		return conf->hook ## n(opaque, pred, redirect, op->p, op->n); \
+	}                                                                 \
+	return conf->hook(opaque, pred, redirect, op->p);
+
+/*
+ * Call the hook for a directive. Names are expected to be NUL terminated
+ * here, unless zerocopy() says otherwise.
+ */
+static int
+dispatch(const struct lf_config *conf, void *opaque,
+	const struct op *op, enum lf_errno *e)
+{
+	const struct lf_pred *pred;
+	enum lf_redirect redirect;
+
+	assert(conf != NULL);
+	assert(op != NULL);
+	assert(e != NULL);
+
+	pred     = &op->pred;
+	redirect = op->redirect;
+
+	switch (op->type) {
+	case OP_CUSTOM:
+		return conf->custom(conf, opaque, op->c, pred, redirect, op->p, op->n, e);
+
+	case OP_IP:              return conf->ip(opaque, pred, redirect, op->arg);
+	case OP_RESP_SIZE:       return conf->resp_size(opaque, pred, redirect);
+	case OP_RESP_SIZE_CLF:   return conf->resp_size_clf(opaque, pred, redirect);
+	case OP_REQ_COOKIE:      NAMED(req_cookie);
+	case OP_ENV_VAR:         NAMED(env_var);
+	case OP_FILENAME:        return conf->filename(opaque, pred, redirect);
+	case OP_REMOTE_HOSTNAME: return conf->remote_hostname(opaque, pred, redirect, op->arg);
+	case OP_REQ_PROTOCOL:    return conf->req_protocol(opaque, pred, redirect);
+	case OP_REQ_HEADER:      NAMED(req_header);
+	case OP_KEEPALIVE_REQS:  return conf->keepalive_reqs(opaque, pred, redirect);
+	case OP_REMOTE_LOGNAME:  return conf->remote_logname(opaque, pred, redirect);
+	case OP_REQ_LOGID:       return conf->req_logid(opaque, pred, redirect);
+	case OP_REQ_METHOD:      return conf->req_method(opaque, pred, redirect);
+	case OP_NOTE:            NAMED(note);
+	case OP_REPLY_HEADER:    NAMED(reply_header);
+	case OP_SERVER_PORT:     return conf->server_port(opaque, pred, redirect, op->arg);
+	case OP_ID:              return conf->id(opaque, pred, redirect, op->arg);
+	case OP_QUERY_STRING:    return conf->query_string(opaque, pred, redirect);
+	case OP_REQ_FIRST_LINE:  return conf->req_first_line(opaque, pred, redirect);
+	case OP_RESP_HANDLER:    return conf->resp_handler(opaque, pred, redirect);
+	case OP_STATUS:          return conf->status(opaque, pred, redirect);
+	case OP_TIME:
+		if (conf->timen != NULL) {
+			return conf->timen(opaque, pred, redirect, op->when, op->p, op->n);
+		}
+		return conf->time(opaque, pred, redirect, op->when, op->p);
+
+	case OP_TIME_FRAC:       return conf->time_frac(opaque, pred, redirect, op->when, op->arg);
+	case OP_TIME_TAKEN:      return conf->time_taken(opaque, pred, redirect, op->arg);
+	case OP_REMOTE_USER:     return conf->remote_user(opaque, pred, redirect);
+	case OP_URL_PATH:        return conf->url_path(opaque, pred, redirect);
+	case OP_SERVER_NAME:     return conf->server_name(opaque, pred, redirect, op->arg);
+	case OP_CONN_STATUS:     return conf->conn_status(opaque, pred, redirect);
+	case OP_BYTES_RECV:      return conf->bytes_recv(opaque, pred, redirect);
+	case OP_BYTES_SENT:      return conf->bytes_sent(opaque, pred, redirect);
+	case OP_BYTES_XFER:      return conf->bytes_xfer(opaque, pred, redirect);
+	case OP_REQ_TRAILER:     NAMED(req_trailer);
+	case OP_RESP_TRAILER:    NAMED(resp_trailer);
+
+	case OP_LITERAL:
+	default:
+		assert(!"unreached");
+		abort();
+	}
+}
+
+static void
+seterr(struct lf_err *ep, enum lf_errno e, const char *p, const char *end,
+	const struct errstuff *errstuff)
+{
+	assert(ep != NULL);
+	assert(p != NULL);
+	assert(end != NULL);
+	assert(errstuff != NULL);
+
+	ep->errnum = e;
+
 	/*
-	 * The custom callback decides if the character is relevant.
-	 * Note handling for non-alpha characters falls through to
-	 * the non-custom directives below, which will then error out.
+	 * Errors from errno are expected to typically come from hooks,
+	 * (e.g. some error on printing output). These don't pertain to
+	 * any particular input in the fmt string, but we point to where
+	 * the cursor is anyway.
+	 *
+	 * LF_ERR_ERRNO can also be produced by a custom directive,
+	 * where the error may or may not be directly caused by the input.
+	 * We don't know the difference here.
 	 */
+	if (e == LF_ERR_ERRNO) {
+		ep->p = p;
+		ep->n = 0;
 
-	if (conf->override != NULL && isalpha((unsigned char) **p) && strchr(conf->override, **p)) {
-		assert(conf->custom != NULL);
+		return;
+	}
 
-		r = conf->custom(conf, opaque, **p, &pred, redirect, name.p, name.n, e);
-	} else {
-		r = notcustom(conf, opaque, p, &pred, redirect, &name, e);
+	/*
+	 * Henceforth we know .percent is set for both errors produced by
+	 * custom directives (because .custom is only called after '%'
+	 * is parsed), and errors about other things (e.g. pointing at
+	 * escapes) do not expect .percent to be set.
+	 */
+
+	switch (e) {
+	case LF_ERR_MISSING_CLOSING_BRACE:
+		if (errstuff->openingbrace == NULL) {
+			goto percent;
+		}
+		ep->p = errstuff->openingbrace;
+		ep->n = 1;
+		break;
+
+	case LF_ERR_MISSING_ESCAPE:
+	case LF_ERR_UNRECOGNISED_ESCAPE:
+		ep->p = p - 1;
+		ep->n = 1 + (p < end);
+		break;
+
+	case LF_ERR_TOO_MANY_STATUSES:
+		if (errstuff->endofstatuslist == NULL) {
+			goto percent;
+		}
+		ep->p = p;
+		ep->n = errstuff->endofstatuslist - p;
+		break;
+
+	case LF_ERR_STATUS_OVERFLOW:
+		ep->p = p;
+		ep->n = nspn(p, end, "0123456789");
+		break;
+
+	case LF_ERR_TOO_MANY_REDIRECT_FLAGS:
+		if (errstuff->toomanyredirect == NULL) {
+			goto percent;
+		}
+		ep->p = errstuff->toomanyredirect;
+		ep->n = nspn(errstuff->toomanyredirect, end, "<>");
+		break;
+
+	case LF_ERR_NAME_OVERFLOW:
+	case LF_ERR_UNRECOGNISED_ID_TYPE:
+	case LF_ERR_UNRECOGNISED_IP_TYPE:
+	case LF_ERR_UNRECOGNISED_PORT_TYPE:
+	case LF_ERR_UNRECOGNISED_RTIME_UNIT:
+		if (errstuff->openingbrace == NULL) {
+			goto percent;
+		}
+		ep->p = errstuff->openingbrace + 1;
+		ep->n = ncspn(ep->p, end, "}");
+		break;
+
+	case LF_ERR_EMPTY_NAME:
+	case LF_ERR_UNWANTED_NAME:
+		if (errstuff->openingbrace == NULL) {
+			goto percent;
+		}
+		ep->p = errstuff->openingbrace;
+		ep->n = ncspn(ep->p, end, "}") + 1;
+		break;
+
+percent:
+
+	case LF_ERR_UNSUPPORTED:
+	case LF_ERR_MISSING_NAME:
+	case LF_ERR_UNRECOGNISED_DIRECTIVE:
+		assert(errstuff->percent != NULL);
+		ep->p = errstuff->percent;
+		ep->n = p - errstuff->percent + (p < end);
+		break;
+
+	case LF_ERR_MISSING_DIRECTIVE:
+		assert(errstuff->percent != NULL);
+		ep->p = errstuff->percent;
+		ep->n = p - errstuff->percent;
+		break;
+
+	default:
+		assert(!"unreached");
 	}
+}
+
+static int
+flush(const struct lf_config *conf, void *opaque,
+	const char *span, size_t *n)
+{
+	size_t z;
+
+	assert(conf != NULL);
+	assert(span != NULL);
+	assert(n != NULL);
 
-	return r;
+	if (*n == 0) {
+		return 1;
+	}
+
+	z = *n;
+	*n = 0;
+
+	assert(conf->literal_span != NULL);
+
+	return conf->literal_span(opaque, span, z);
 }
 
 int
 lf_parse(struct lf_config *conf, void *opaque, const char *fmt,
 	struct lf_err *ep)
 {
+	assert(fmt != NULL);
+
+	return lf_parsen(conf, opaque, fmt, strlen(fmt), ep);
+}
+
+int
+lf_parsen(struct lf_config *conf, void *opaque, const char *fmt, size_t len,
+	struct lf_err *ep)
+{
+	unsigned status[MAX_STATUSES];
 	struct errstuff errstuff;
+	struct specs specs;
+	char buf[MAX_NAME + 1];
+	char span[MAX_SPAN];
+	const char *spanp;
+	size_t spann;
 	enum lf_errno e;
-	const char *p;
+	const char *p, *end;
 
 	assert(conf != NULL);
+	assert(fmt != NULL);
 	assert(ep != NULL);
 
-	for (p = fmt; *p != '\0'; p++) {
-		int r;
+	end = fmt + len;
+
+	specs_init(&specs, conf);
+
+	/*
+	 * For .literal_span, plain text and escapes are gathered up together
+	 * and passed on as one run before the next directive; only text which
+	 * doesn't fit in span[] goes out by itself. spanp is the position of
+	 * the first character in the run, which is where a failed span is reported.
+	 */
+	spanp = NULL;
+	spann = 0;
 
-		errstuff.toomanyredirect = NULL;
-		errstuff.percent         = NULL;
-		errstuff.endofstatuslist = NULL;
-		errstuff.openingbrace    = NULL;
+	for (p = fmt; p < end; p++) {
+		struct op op;
+		int r;
 
 		e = LF_ERR_ERRNO;
 
-		switch (*p) {
-		case '\\':
-			r = parse_escape(conf, opaque, &p, &e);
+		/* plain text needs no parsing, and goes out as one run */
+		if (*p != '%' && *p != '\\') {
+			const char *q;
+
+			q = memchr2(p, end, '%', '\\');
+
+			if (conf->literal_span != NULL && (size_t) (q - p) <= sizeof span - spann) {
+				/* gathered up, to join any escapes either side */
+				if (spann == 0) {
+					spanp = p;
+				}
+
+				memcpy(span + spann, p, q - p);
+				spann += q - p;
+			} else if (conf->literal_span != NULL) {
+				if (!flush(conf, opaque, span, &spann)) {
+					p = spanp;
+					goto error;
+				}
+
+				if (!conf->literal_span(opaque, p, q - p)) {
+					goto error;
+				}
+			} else {
+				assert(conf->literal != NULL);
+
+				for ( ; p < q; p++) {
+					if (!conf->literal(opaque, *p)) {
+						goto error;
+					}
+				}
+			}
+
+			p = q - 1;
+			continue;
+		}
+
+		if (!parse_element(&specs, &p, end, &op, status, &e, &errstuff)) {
+			/* literals preceding the error are still output */
+			if (!flush(conf, opaque, span, &spann)) {
+				e = LF_ERR_ERRNO;
+				p = spanp;
+			}
+
+			goto error;
+		}
+
+		if (op.type == OP_LITERAL && conf->literal_span != NULL) {
+			if (spann == sizeof span && !flush(conf, opaque, span, &spann)) {
+				p = spanp;
+				goto error;
+			}
+
+			if (spann == 0) {
+				spanp = p;
+			}
+
+			span[spann++] = op.c;
+			continue;
+		}
+
+		if (!flush(conf, opaque, span, &spann)) {
+			p = spanp;
+			goto error;
+		}
+
+		switch (op.type) {
+		case OP_LITERAL:
+			assert(conf->literal != NULL);
+
+			r = conf->literal(opaque, op.c);
 			break;
 
-		case '%':
-			r = parse_directive(conf, opaque, &p, &e, &errstuff);
+		case OP_CUSTOM:
+			r = dispatch(conf, opaque, &op, &e);
 			break;
 
 		default:
-			r = conf->literal(opaque, *p);
+			if (op.p == NULL || zerocopy(conf, &op)) {
+				r = dispatch(conf, opaque, &op, &e);
+				break;
+			}
+
+			{
+				char *s;
+
+				s = op.n < sizeof buf ? buf : malloc(op.n + 1);
+				if (s == NULL) {
+					goto error;
+				}
+
+				memcpy(s, op.p, op.n);
+				s[op.n] = '\0';
+
+				op.p = s;
+
+				r = dispatch(conf, opaque, &op, &e);
+
+				if (s != buf) {
+					free(s);
+				}
+			}
 			break;
 		}
 
@@ -562,116 +1167,367 @@ lf_parse(struct lf_config *conf, void *opaque, const char *fmt,
 		}
 	}
 
+	if (!flush(conf, opaque, span, &spann)) {
+		p = spanp;
+		goto error;
+	}
+
 	return 1;
 
 error:
 
 	if (ep != NULL) {
-		ep->errnum = e;
+		seterr(ep, e, p, end, &errstuff);
+	}
 
-		/*
-		 * Errors from errno are expected to typically come from hooks,
-		 * (e.g. some error on printing output). These don't pertain to
-		 * any particular input in the fmt string, but we point to where
-		 * the cursor is anyway.
-		 *
-		 * LF_ERR_ERRNO can also be produced by a custom directive,
-		 * where the error may or may not be directly caused by the input.
-		 * We don't know the difference here.
-		 */
-		if (e == LF_ERR_ERRNO) {
-			ep->p = p;
-			ep->n = 0;
+	return 0;
+}
+
+/*
+ * Append the plain text following *p to the current literal op,
+ * up to the next escape or directive, leaving *p at its last character.
+ */
+static void
+run(const char *end, const char **p,
+	struct op *op, char *text, struct counts *c)
+{
+	const char *q;
+	size_t n;
+
+	assert(end != NULL);
+	assert(p != NULL && *p < end);
+	assert(c != NULL);
+
+	q = memchr2(*p + 1, end, '%', '\\');
+	n = q - (*p + 1);
+
+	if (op != NULL) {
+		memcpy(text + c->text, *p + 1, n);
+		op[c->ops - 1].n += n;
+	}
+
+	c->text += n;
+	*p = q - 1;
+}
+
+/*
+ * Walk the format, either counting how much space a program needs
+ * (when op is NULL), or filling in that program's arrays.
+ * Consecutive literal characters are coalesced into a single op.
+ */
+static int
+compile(struct specs *specs, const char *fmt, const char *end,
+	const char **p,
+	struct op *op, struct tf *tf, unsigned *status, char *text, struct counts *c,
+	enum lf_errno *e, struct errstuff *errstuff)
+{
+	unsigned buf[MAX_STATUSES];
+	int literal;
+
+	assert(specs != NULL);
+	assert(fmt != NULL);
+	assert(end != NULL);
+	assert(p != NULL);
+	assert(c != NULL);
+	assert(e != NULL);
+	assert(errstuff != NULL);
+
+	c->ops    = 0;
+	c->status = 0;
+	c->text   = 0;
+	c->tf     = 0;
+	c->names  = 0;
+
+	literal = 0;
+
+	for (*p = fmt; *p < end; (*p)++) {
+		const char *start;
+		struct op o;
+
+		start = *p;
 
+		*e = LF_ERR_ERRNO;
+
+		if (!parse_element(specs, p, end, &o, buf, e, errstuff)) {
 			return 0;
 		}
 
-		/*
-		 * Henceforth we know .percent is set for both errors produced by
-		 * custom directives (because .custom is only called after '%'
-		 * is parsed), and errors about other things (e.g. pointing at
-		 * escapes) do not expect .percent to be set.
-		 */
-
-		switch (e) {
-		case LF_ERR_MISSING_CLOSING_BRACE:
-			if (errstuff.openingbrace == NULL) {
-				goto percent;
+		if (o.type == OP_LITERAL && literal) {
+			if (op != NULL) {
+				text[c->text] = o.c;
+				op[c->ops - 1].n++;
 			}
-			ep->p = errstuff.openingbrace;
-			ep->n = 1;
-			break;
 
-		case LF_ERR_MISSING_ESCAPE:
-		case LF_ERR_UNRECOGNISED_ESCAPE:
-			ep->p = p - 1;
-			ep->n = 1 + (*p != '\0');
-			break;
+			c->text++;
+			run(end, p, op, text, c);
+			continue;
+		}
 
-		case LF_ERR_TOO_MANY_STATUSES:
-			if (errstuff.endofstatuslist == NULL) {
-				goto percent;
+		literal = o.type == OP_LITERAL;
+
+		if (op != NULL) {
+			struct op *q = &op[c->ops];
+
+			*q = o;
+
+			q->src = start - fmt;
+
+			q->pred.status = status + c->status;
+			memcpy(status + c->status, buf, o.pred.count * sizeof *buf);
+
+			if (literal) {
+				text[c->text] = o.c;
+				q->p = text + c->text;
+				q->n = 1;
+			} else if (o.p != NULL) {
+				memcpy(text + c->text, o.p, o.n);
+				text[c->text + o.n] = '\0';
+				q->p = text + c->text;
 			}
-			ep->p = p;
-			ep->n = errstuff.endofstatuslist - p;
-			break;
 
-		case LF_ERR_STATUS_OVERFLOW:
-			ep->p = p;
-			ep->n = strspn(p, "0123456789");
-			break;
+			q->tf   = NULL;
+			q->tfn  = 0;
+			q->slot = 0;
+		}
+
+		/* strftime() formats are compiled too, where they can be */
+		if (o.type == OP_TIME) {
+			size_t n;
+
+			n = 0;
+
+			if (tf_compile(o.p, o.n, NULL, &n)) {
+				if (op != NULL) {
+					struct op *q = &op[c->ops];
 
-		case LF_ERR_TOO_MANY_REDIRECT_FLAGS:
-			if (errstuff.toomanyredirect == NULL) {
-				goto percent;
+					n = 0;
+
+					if (!tf_compile(q->p, q->n, tf + c->tf, &n)) {
+						assert(!"unreached");
+					}
+
+					q->tf  = tf + c->tf;
+					q->tfn = n;
+				}
+
+				c->tf += n;
 			}
-			ep->p = errstuff.toomanyredirect;
-			ep->n = strspn(errstuff.toomanyredirect, "<>");
-			break;
+		}
+
+		c->ops++;
+		c->status += o.pred.count;
+
+		if (name_folded(o.type)) {
+			c->names++;
+		}
+
+		if (literal) {
+			c->text += 1;
+			run(end, p, op, text, c);
+		} else if (o.p != NULL) {
+			c->text += o.n + 1;
+		}
+	}
+
+	return 1;
+}
+
+struct lf_prog *
+lf_compile(const struct lf_config *conf, const char *fmt,
+	struct lf_err *ep)
+{
+	assert(fmt != NULL);
+
+	return lf_compilen(conf, fmt, strlen(fmt), ep);
+}
+
+struct lf_prog *
+lf_compilen(const struct lf_config *conf, const char *fmt, size_t len,
+	struct lf_err *ep)
+{
+	struct errstuff errstuff;
+	struct lf_prog *prog;
+	struct specs specs;
+	struct counts c;
+	enum lf_errno e;
+	const char *p;
+	unsigned *status, *index;
+	struct header_name *name;
+	char *text, *q;
+	struct op *op;
+	struct tf *tf;
+	size_t mask;
+
+	assert(conf != NULL);
+	assert(fmt != NULL);
+
+	specs_init(&specs, conf);
+
+	if (!compile(&specs, fmt, fmt + len, &p, NULL, NULL, NULL, NULL, &c, &e, &errstuff)) {
+		goto error;
+	}
+
+	/* the index is at most half full */
+	for (mask = 0; mask + 1 < c.names * 2; mask = mask * 2 + 1)
+		;
+
+	/* the copy of fmt is NUL terminated, for convenience */
+	prog = malloc(sizeof *prog
+		+ c.ops    * sizeof *op
+		+ c.tf     * sizeof *tf
+		+ c.names  * sizeof *name
+		+ (c.names > 0 ? mask + 1 : 0) * sizeof *index
+		+ c.status * sizeof *status
+		+ c.text + len + 1);
+	if (prog == NULL) {
+		e = LF_ERR_ERRNO;
+		p = fmt;
+		goto error;
+	}
+
+	op     = (void *) (prog + 1);
+	tf     = (void *) (op + c.ops);
+	name   = (void *) (tf + c.tf);
+	index  = (void *) (name + c.names);
+	status = (void *) (index + (c.names > 0 ? mask + 1 : 0));
+	text   = (void *) (status + c.status);
+
+	q = text + c.text;
+	if (len > 0) {
+		memcpy(q, fmt, len);
+	}
+	q[len] = '\0';
+
+	prog->op    = op;
+	prog->count = c.ops;
+	prog->fmt   = q;
+	prog->len   = len;
+
+	prog->cached = NULL;
+
+	/* the same format again, so this cannot fail */
+	if (!compile(&specs, q, q + len, &p, op, tf, status, text, &c, &e, &errstuff)) {
+		assert(!"unreached");
+	}
 
-		case LF_ERR_NAME_OVERFLOW:
-		case LF_ERR_UNRECOGNISED_ID_TYPE:
-		case LF_ERR_UNRECOGNISED_IP_TYPE:
-		case LF_ERR_UNRECOGNISED_PORT_TYPE:
-		case LF_ERR_UNRECOGNISED_RTIME_UNIT:
-			if (errstuff.openingbrace == NULL) {
-				goto percent;
+	prog->name  = name;
+	prog->index = index;
+	prog->mask  = mask;
+	prog->names = 0;
+
+	if (c.names > 0) {
+		prog->names = name_slots(op, c.ops, name, index, mask);
+	}
+
+	return prog;
+
+error:
+
+	if (ep != NULL) {
+		seterr(ep, e, p, fmt + len, &errstuff);
+	}
+
+	return NULL;
+}
+
+int
+lf_exec(const struct lf_config *conf, void *opaque, const struct lf_prog *prog,
+	struct lf_err *ep)
+{
+	const struct op *op;
+	enum lf_errno e;
+	size_t i;
+
+	assert(conf != NULL);
+	assert(prog != NULL);
+
+	for (op = prog->op; op < prog->op + prog->count; op++) {
+		e = LF_ERR_ERRNO;
+
+		if (op->type == OP_LITERAL) {
+			i = 0;
+
+			if (conf->literal_span != NULL) {
+				if (!conf->literal_span(opaque, op->p, op->n)) {
+					goto error;
+				}
+
+				continue;
 			}
-			ep->p = errstuff.openingbrace + 1;
-			ep->n = strcspn(ep->p, "}");
-			/* TODO: cut down xn to (sizeof buf) - 1 here */
-			break;
 
-		case LF_ERR_EMPTY_NAME:
-		case LF_ERR_UNWANTED_NAME:
-			if (errstuff.openingbrace == NULL) {
-				goto percent;
+			assert(conf->literal != NULL);
+
+			for (i = 0; i < op->n; i++) {
+				if (!conf->literal(opaque, op->p[i])) {
+					goto error;
+				}
 			}
-			ep->p = errstuff.openingbrace;
-			ep->n = strcspn(ep->p, "}") + 1;
-			break;
 
-percent:
+			continue;
+		}
 
-		case LF_ERR_UNSUPPORTED:
-		case LF_ERR_MISSING_NAME:
-		case LF_ERR_UNRECOGNISED_DIRECTIVE:
-			assert(errstuff.percent != NULL);
-			ep->p = errstuff.percent;
-			ep->n = p - errstuff.percent + (*p != '\0');
-			break;
+		i = 0;
 
-		case LF_ERR_MISSING_DIRECTIVE:
-			assert(errstuff.percent != NULL);
-			ep->p = errstuff.percent;
-			ep->n = p - errstuff.percent;
-			break;
+		if (!dispatch(conf, opaque, op, &e)) {
+			goto error;
+		}
+	}
 
-		default:
-			assert(!"unreached");
+	return 1;
+
+error:
+
+	if (ep != NULL) {
+		unsigned status[MAX_STATUSES];
+		struct errstuff errstuff;
+		struct specs specs;
+		enum lf_errno dummy;
+		const char *p, *end;
+		struct op o;
+
+		/*
+		 * The program doesn't keep the parser's state for each op,
+		 * so we re-parse the element which failed in order to point
+		 * at the same place lf_parse() would. For a literal op,
+		 * i is the index of the offending character within its run.
+		 */
+		p   = prog->fmt + op->src;
+		end = prog->fmt + prog->len;
+
+		specs_init(&specs, conf);
+
+		for (;;) {
+			if (!parse_element(&specs, &p, end, &o, status, &dummy, &errstuff)) {
+				assert(!"unreached");
+			}
+
+			if (i == 0) {
+				break;
+			}
+
+			i--;
+			p++;
 		}
+
+		seterr(ep, e, p, end, &errstuff);
 	}
 
 	return 0;
 }
 
+const char *
+lf_fmt(const struct lf_prog *prog)
+{
+	assert(prog != NULL);
+
+	return prog->fmt;
+}
+
+void
+lf_free(struct lf_prog *prog)
+{
+	assert(prog == NULL || prog->cached == NULL);
+
+	free(prog);
+}
+
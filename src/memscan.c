@@ -0,0 +1,218 @@
+/*
+ * Copyright 2017 Katherine Flavel
+ *
+ * See LICENCE for the full copyright terms.
+ */
+
+#include <assert.h>
+#include <stddef.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define MEMSCAN_X86
+#include <immintrin.h>
+#endif
+
+#include <lf/lf.h>
+
+#include "internal.h"
+
+/*
+ * Most of a format, most of a log line, and most of a value to escape
+ * is text up to the next special byte. These skip over it 16 or 32
+ * bytes at a time where the CPU allows, and a byte at a time otherwise.
+ */
+
+static const char *
+memchr2_scalar(const char *p, const char *end, char a, char b)
+{
+	for ( ; p < end; p++) {
+		if (*p == a || *p == b) {
+			return p;
+		}
+	}
+
+	return end;
+}
+
+/* as Apache's ap_escape_logitem(): quotes, backslashes and anything unprintable */
+static int
+unsafe(unsigned char c)
+{
+	return c < 0x20 || c >= 0x7f || c == '"' || c == '\\';
+}
+
+static const char *
+memesc_scalar(const char *p, const char *end)
+{
+	for ( ; p < end; p++) {
+		if (unsafe((unsigned char) *p)) {
+			return p;
+		}
+	}
+
+	return end;
+}
+
+#ifdef MEMSCAN_X86
+
+__attribute__((target("sse2")))
+static const char *
+memchr2_sse2(const char *p, const char *end, char a, char b)
+{
+	const __m128i va = _mm_set1_epi8(a);
+	const __m128i vb = _mm_set1_epi8(b);
+
+	while (end - p >= 16) {
+		__m128i v;
+		unsigned m;
+
+		v = _mm_loadu_si128((const void *) p);
+		m = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, va),
+			_mm_cmpeq_epi8(v, vb)));
+
+		if (m != 0) {
+			return p + __builtin_ctz(m);
+		}
+
+		p += 16;
+	}
+
+	return memchr2_scalar(p, end, a, b);
+}
+
+__attribute__((target("avx2")))
+static const char *
+memchr2_avx2(const char *p, const char *end, char a, char b)
+{
+	const __m256i va = _mm256_set1_epi8(a);
+	const __m256i vb = _mm256_set1_epi8(b);
+
+	while (end - p >= 32) {
+		__m256i v;
+		unsigned m;
+
+		v = _mm256_loadu_si256((const void *) p);
+		m = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, va),
+			_mm256_cmpeq_epi8(v, vb)));
+
+		if (m != 0) {
+			return p + __builtin_ctz(m);
+		}
+
+		p += 32;
+	}
+
+	return memchr2_scalar(p, end, a, b);
+}
+
+/*
+ * Printable bytes are 0x20..0x7e; less 0x20, that's 0..0x5e, and so
+ * everything else is at least 0x5f as unsigned, wrapping around.
+ */
+__attribute__((target("sse2")))
+static const char *
+memesc_sse2(const char *p, const char *end)
+{
+	const __m128i sp = _mm_set1_epi8(0x20);
+	const __m128i hi = _mm_set1_epi8(0x5f);
+	const __m128i dq = _mm_set1_epi8('"');
+	const __m128i bs = _mm_set1_epi8('\\');
+
+	while (end - p >= 16) {
+		__m128i v, t;
+		unsigned m;
+
+		v = _mm_loadu_si128((const void *) p);
+		t = _mm_sub_epi8(v, sp);
+		m = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(_mm_max_epu8(t, hi), t),
+			_mm_or_si128(_mm_cmpeq_epi8(v, dq), _mm_cmpeq_epi8(v, bs))));
+
+		if (m != 0) {
+			return p + __builtin_ctz(m);
+		}
+
+		p += 16;
+	}
+
+	return memesc_scalar(p, end);
+}
+
+__attribute__((target("avx2")))
+static const char *
+memesc_avx2(const char *p, const char *end)
+{
+	const __m256i sp = _mm256_set1_epi8(0x20);
+	const __m256i hi = _mm256_set1_epi8(0x5f);
+	const __m256i dq = _mm256_set1_epi8('"');
+	const __m256i bs = _mm256_set1_epi8('\\');
+
+	while (end - p >= 32) {
+		__m256i v, t;
+		unsigned m;
+
+		v = _mm256_loadu_si256((const void *) p);
+		t = _mm256_sub_epi8(v, sp);
+		m = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(t, hi), t),
+			_mm256_or_si256(_mm256_cmpeq_epi8(v, dq), _mm256_cmpeq_epi8(v, bs))));
+
+		if (m != 0) {
+			return p + __builtin_ctz(m);
+		}
+
+		p += 32;
+	}
+
+	return memesc_sse2(p, end);
+}
+
+#endif
+
+const char *
+memchr2(const char *p, const char *end, char a, char b)
+{
+	assert(p != NULL);
+	assert(end != NULL);
+	assert(p <= end);
+
+	/* short runs aren't worth the setup */
+	if (end - p < 16) {
+		return memchr2_scalar(p, end, a, b);
+	}
+
+#ifdef MEMSCAN_X86
+	/* these test bits set by CPUID, once, at startup */
+	if (__builtin_cpu_supports("avx2")) {
+		return memchr2_avx2(p, end, a, b);
+	}
+
+	if (__builtin_cpu_supports("sse2")) {
+		return memchr2_sse2(p, end, a, b);
+	}
+#endif
+
+	return memchr2_scalar(p, end, a, b);
+}
+
+const char *
+memesc(const char *p, const char *end)
+{
+	assert(p != NULL);
+	assert(end != NULL);
+	assert(p <= end);
+
+	if (end - p < 16) {
+		return memesc_scalar(p, end);
+	}
+
+#ifdef MEMSCAN_X86
+	if (__builtin_cpu_supports("avx2")) {
+		return memesc_avx2(p, end);
+	}
+
+	if (__builtin_cpu_supports("sse2")) {
+		return memesc_sse2(p, end);
+	}
+#endif
+
+	return memesc_scalar(p, end);
+}
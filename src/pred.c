@@ -0,0 +1,100 @@
+/*
+ * Copyright 2017 Katherine Flavel
+ *
+ * See LICENCE for the full copyright terms.
+ */
+
+#include <assert.h>
+#include <stddef.h>
+#include <string.h>
+#include <limits.h>
+
+#include <lf/lf.h>
+
+#include "internal.h"
+
+/*
+ * Populate .map from .status, which must already be sorted.
+ * Statuses outside LF_PRED_MIN..LF_PRED_MAX are left to the search
+ * in lf_pred_match().
+ */
+void
+pred_map(struct lf_pred *pred)
+{
+	size_t i;
+
+	assert(pred != NULL);
+	assert(pred->count == 0 || pred->status != NULL);
+
+	memset(pred->map, 0, sizeof pred->map);
+
+	for (i = 0; i < pred->count; i++) {
+		unsigned u;
+
+		if (pred->status[i] < LF_PRED_MIN) {
+			continue;
+		}
+
+		if (pred->status[i] > LF_PRED_MAX) {
+			break;
+		}
+
+		u = pred->status[i] - LF_PRED_MIN;
+
+		pred->map[u / CHAR_BIT] |= 1U << (u % CHAR_BIT);
+	}
+}
+
+static int
+search(const unsigned *a, size_t n, unsigned status)
+{
+	size_t lo, hi;
+
+	assert(a != NULL);
+
+	lo = 0;
+	hi = n;
+
+	while (lo < hi) {
+		size_t mid;
+
+		mid = lo + (hi - lo) / 2;
+
+		if (a[mid] == status) {
+			return 1;
+		}
+
+		if (a[mid] < status) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	return 0;
+}
+
+int
+lf_pred_match(const struct lf_pred *pred, unsigned status)
+{
+	int r;
+
+	assert(pred != NULL);
+
+	if (pred->count == 0) {
+		return 1;
+	}
+
+	if (status >= LF_PRED_MIN && status <= LF_PRED_MAX) {
+		unsigned u;
+
+		u = status - LF_PRED_MIN;
+
+		r = (pred->map[u / CHAR_BIT] >> (u % CHAR_BIT)) & 1;
+	} else {
+		r = search(pred->status, pred->count, status);
+	}
+
+	return r != pred->neg;
+}
+
@@ -0,0 +1,1033 @@
+/*
+ * Copyright 2017 Katherine Flavel
+ *
+ * See LICENCE for the full copyright terms.
+ */
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+
+#include <lf/lf.h>
+
+#include "internal.h"
+
+/*
+ * A record is one value for each slot, in order. The slots are derived
+ * from the compiled format's ops: each field a directive reads, from the
+ * original or the final request, once each. The encoder and decoder both
+ * derive them from the same format, and so the stream needn't say.
+ *
+ * Strings are a varint v: 0 is NULL, odd is v >> 1 bytes which follow,
+ * and even refers to dictionary entry (v >> 1) - 1. Short strings are
+ * entered in the dictionary by hash, replacing whatever was there.
+ * Entries made for a record take effect after it, for both sides alike,
+ * so that a record never refers to an entry it replaces.
+ *
+ * Times are UTC, and so the header carries the encoder's TZ (as a string
+ * is, 0 for unset), for the decoder to render them in the same zone.
+ */
+
+#define MAGIC "LFB\001"
+
+enum {
+	DICT_SIZE = 1024, /* power of 2 */
+	DICT_LEN  = 64,   /* longer strings aren't entered */
+	VARINT    = 10    /* bytes, at most */
+};
+
+enum slot_kind {
+	KIND_STR,
+	KIND_UINT,
+	KIND_ULONG,
+	KIND_ULLONG,
+	KIND_TIME,
+	KIND_CONN,  /* .aborted and .keepalive */
+	KIND_LOOKUP
+};
+
+enum {
+	FLAG_KEEP_ALIVE         = 1 << 0,
+	FLAG_HOSTNAME_LOOKUPS   = 1 << 1,
+	FLAG_IDENTITY_CHECK     = 1 << 2,
+	FLAG_USE_CANONICAL_NAME = 1 << 3
+};
+
+struct slot {
+	unsigned kind  :3; /* enum slot_kind */
+	unsigned which :1; /* enum lf_redirect */
+	unsigned table :3; /* enum lf_table, for KIND_LOOKUP */
+	size_t off;        /* into struct lf_record */
+	const char *name;  /* for KIND_LOOKUP */
+	size_t n;
+};
+
+struct entry {
+	size_t n;
+	char p[DICT_LEN];
+};
+
+/* a dictionary entry to make after the current record */
+struct pending {
+	size_t i;
+	const char *p;
+	size_t n;
+};
+
+struct dict {
+	struct entry entry[DICT_SIZE];
+	struct pending *pending;
+	size_t npending;
+};
+
+struct lf_encoder {
+	const struct lf_prog *prog;
+	unsigned flags;
+	const char *override;
+
+	struct slot *slot;
+	size_t count;
+
+	struct dict dict;
+
+	unsigned char *buf;
+	size_t size;
+};
+
+/* for lookups, the decoder and which request */
+struct side {
+	const struct lf_decoder *d;
+	enum lf_redirect which;
+};
+
+struct lf_decoder {
+	struct lf_prog *prog;
+	struct side side[2];
+
+	struct slot *slot;
+	size_t count;
+
+	struct dict dict;
+
+	char *tz;              /* the encoder's TZ, or NULL */
+
+	struct lf_record final;
+	struct lf_str *value;  /* for KIND_LOOKUP, by slot */
+
+	char *arena;           /* strings copied for the current record */
+	size_t size;
+};
+
+static void
+add(struct slot *slot, size_t *count, enum slot_kind kind, enum lf_redirect which,
+	size_t off, const struct op *op)
+{
+	struct slot s;
+	size_t i;
+
+	s.kind  = kind;
+	s.which = which;
+	s.table = 0;
+	s.off   = off;
+	s.name  = NULL;
+	s.n     = 0;
+
+	if (kind == KIND_LOOKUP) {
+		switch (op->type) {
+		case OP_REQ_COOKIE:   s.table = LF_TABLE_REQ_COOKIE;   break;
+		case OP_ENV_VAR:      s.table = LF_TABLE_ENV_VAR;      break;
+		case OP_REQ_HEADER:   s.table = LF_TABLE_REQ_HEADER;   break;
+		case OP_NOTE:         s.table = LF_TABLE_NOTE;         break;
+		case OP_REPLY_HEADER: s.table = LF_TABLE_REPLY_HEADER; break;
+		case OP_REQ_TRAILER:  s.table = LF_TABLE_REQ_TRAILER;  break;
+		case OP_RESP_TRAILER: s.table = LF_TABLE_RESP_TRAILER; break;
+
+		default:
+			assert(!"unreached");
+		}
+
+		s.name = op->p;
+		s.n    = op->n;
+	}
+
+	for (i = 0; i < *count; i++) {
+		if (slot[i].kind == s.kind && slot[i].which == s.which && slot[i].off == s.off
+		 && slot[i].table == s.table && slot[i].n == s.n
+		 && (s.n == 0 || 0 == memcmp(slot[i].name, s.name, s.n))) {
+			return;
+		}
+	}
+
+	slot[(*count)++] = s;
+}
+
+#define STR(field)  add(slot, &count, KIND_STR,    w, offsetof(struct lf_record, field), op)
+#define UINT(field) add(slot, &count, KIND_UINT,   w, offsetof(struct lf_record, field), op)
+#define ULL(field)  add(slot, &count, KIND_ULLONG, w, offsetof(struct lf_record, field), op)
+#define TIME(i)     add(slot, &count, KIND_TIME,   w, offsetof(struct lf_record, time) + (i) * sizeof (long long), op)
+
+/* slot has room for three per op, which is the most any op reads */
+static size_t
+slots(const struct lf_prog *prog, struct slot *slot)
+{
+	size_t i, count;
+
+	count = 0;
+
+	for (i = 0; i < prog->count; i++) {
+		const struct op *op = &prog->op[i];
+		enum lf_redirect w = op->redirect;
+
+		if (op->type == OP_LITERAL || op->type == OP_CUSTOM) {
+			continue;
+		}
+
+		/* predicates are for the final status */
+		if (op->pred.count > 0) {
+			add(slot, &count, KIND_UINT, LF_REDIRECT_FINAL, offsetof(struct lf_record, status), op);
+		}
+
+		switch (op->type) {
+		case OP_IP:             STR(ip[op->arg]);    break;
+		case OP_RESP_SIZE:      ULL(resp_size);      break;
+		case OP_RESP_SIZE_CLF:  ULL(resp_size);      break;
+		case OP_FILENAME:       STR(filename);       break;
+		case OP_REQ_PROTOCOL:   STR(req_protocol);   break;
+		case OP_KEEPALIVE_REQS: UINT(keepalive_reqs); break;
+		case OP_REMOTE_LOGNAME: STR(remote_logname); break;
+		case OP_REQ_LOGID:      STR(req_logid);      break;
+		case OP_REQ_METHOD:     STR(req_method);     break;
+		case OP_SERVER_PORT:    UINT(port[op->arg]); break;
+		case OP_QUERY_STRING:   STR(query_string);   break;
+		case OP_REQ_FIRST_LINE: STR(req_first_line); break;
+		case OP_RESP_HANDLER:   STR(resp_handler);   break;
+		case OP_STATUS:         UINT(status);        break;
+		case OP_TIME:           TIME(op->when);      break;
+		case OP_TIME_FRAC:      TIME(op->when);      break;
+		case OP_REMOTE_USER:    STR(remote_user);    break;
+		case OP_URL_PATH:       STR(url_path);       break;
+		case OP_BYTES_RECV:     ULL(bytes_recv);     break;
+		case OP_BYTES_SENT:     ULL(bytes_sent);     break;
+		case OP_BYTES_XFER:     ULL(bytes_xfer);     break;
+
+		case OP_REQ_COOKIE:
+		case OP_ENV_VAR:
+		case OP_REQ_HEADER:
+		case OP_NOTE:
+		case OP_REPLY_HEADER:
+		case OP_REQ_TRAILER:
+		case OP_RESP_TRAILER:
+			add(slot, &count, KIND_LOOKUP, w, 0, op);
+			break;
+
+		case OP_REMOTE_HOSTNAME:
+			if (op->arg) {
+				STR(remote_host);
+			}
+			STR(ip[LF_IP_CLIENT]);
+			break;
+
+		case OP_ID:
+			if (op->arg == LF_ID_PID) {
+				add(slot, &count, KIND_ULONG, w, offsetof(struct lf_record, pid), op);
+			} else {
+				ULL(tid);
+			}
+			break;
+
+		case OP_TIME_TAKEN:
+			TIME(LF_WHEN_BEGIN);
+			TIME(LF_WHEN_END);
+			break;
+
+		case OP_SERVER_NAME:
+			STR(server_name);
+			if (!op->arg) {
+				STR(host);
+			}
+			break;
+
+		case OP_CONN_STATUS:
+			add(slot, &count, KIND_CONN, w, 0, op);
+			break;
+
+		default:
+			assert(!"unreached");
+		}
+	}
+
+	return count;
+}
+
+#undef STR
+#undef UINT
+#undef ULL
+#undef TIME
+
+static struct slot *
+new_slots(const struct lf_prog *prog, size_t *count)
+{
+	struct slot *slot;
+
+	slot = malloc((prog->count * 3 + 1) * sizeof *slot);
+	if (slot == NULL) {
+		return NULL;
+	}
+
+	*count = slots(prog, slot);
+
+	return slot;
+}
+
+static int
+new_dict(struct dict *d, size_t count)
+{
+	memset(d->entry, 0, sizeof d->entry);
+
+	d->pending  = malloc((count + 1) * sizeof *d->pending);
+	d->npending = 0;
+
+	return d->pending != NULL;
+}
+
+static size_t
+dict_index(const char *p, size_t n)
+{
+	return fnv1a(FNV_BASIS, p, n, 0) & (DICT_SIZE - 1);
+}
+
+static void
+dict_commit(struct dict *d)
+{
+	size_t i;
+
+	for (i = 0; i < d->npending; i++) {
+		struct entry *e = &d->entry[d->pending[i].i];
+
+		memcpy(e->p, d->pending[i].p, d->pending[i].n);
+		e->n = d->pending[i].n;
+	}
+
+	d->npending = 0;
+}
+
+static void
+dict_defer(struct dict *d, size_t i, const char *p, size_t n)
+{
+	d->pending[d->npending].i = i;
+	d->pending[d->npending].p = p;
+	d->pending[d->npending].n = n;
+	d->npending++;
+}
+
+static unsigned char *
+put_varint(unsigned char *q, unsigned long long v)
+{
+	while (v >= 0x80) {
+		*q++ = (unsigned char) (v | 0x80);
+		v >>= 7;
+	}
+
+	*q++ = (unsigned char) v;
+
+	return q;
+}
+
+static unsigned char *
+put_time(unsigned char *q, long long t)
+{
+	unsigned long long u;
+	int i;
+
+	u = (unsigned long long) t;
+
+	for (i = 0; i < 8; i++) {
+		*q++ = (unsigned char) (u >> (i * 8));
+	}
+
+	return q;
+}
+
+/* room for another n bytes at q, which may move */
+static unsigned char *
+reserve(struct lf_encoder *e, unsigned char *q, size_t n)
+{
+	unsigned char *tmp;
+	size_t used, size;
+
+	used = q - e->buf;
+
+	if (e->size - used >= n) {
+		return q;
+	}
+
+	for (size = e->size * 2; size - used < n; size *= 2)
+		;
+
+	tmp = realloc(e->buf, size);
+	if (tmp == NULL) {
+		return NULL;
+	}
+
+	e->buf  = tmp;
+	e->size = size;
+
+	return tmp + used;
+}
+
+static unsigned char *
+put_str(struct lf_encoder *e, unsigned char *q, const struct lf_str *s)
+{
+	struct entry *ent;
+	size_t i;
+
+	if (s->p == NULL) {
+		*q++ = 0;
+		return q;
+	}
+
+	if (s->n > 0 && s->n <= DICT_LEN) {
+		i = dict_index(s->p, s->n);
+		ent = &e->dict.entry[i];
+
+		if (ent->n == s->n && 0 == memcmp(ent->p, s->p, s->n)) {
+			return put_varint(q, (i + 1) << 1);
+		}
+
+		dict_defer(&e->dict, i, s->p, s->n);
+	}
+
+	q = reserve(e, q, VARINT + s->n);
+	if (q == NULL) {
+		return NULL;
+	}
+
+	q = put_varint(q, (unsigned long long) s->n << 1 | 1);
+	memcpy(q, s->p, s->n);
+
+	return q + s->n;
+}
+
+struct lf_encoder *
+lf_new_encoder(const struct lf_config *conf, const struct lf_prog *prog)
+{
+	struct lf_encoder *e;
+
+	assert(conf != NULL);
+	assert(prog != NULL);
+
+	e = malloc(sizeof *e);
+	if (e == NULL) {
+		return NULL;
+	}
+
+	memset(e, 0, sizeof *e);
+
+	e->prog     = prog;
+	e->override = conf->override;
+	e->flags    = (conf->keep_alive         ? FLAG_KEEP_ALIVE         : 0)
+	            | (conf->hostname_lookups   ? FLAG_HOSTNAME_LOOKUPS   : 0)
+	            | (conf->identity_check     ? FLAG_IDENTITY_CHECK     : 0)
+	            | (conf->use_canonical_name ? FLAG_USE_CANONICAL_NAME : 0);
+
+	e->size = 256;
+	e->buf  = malloc(e->size);
+	e->slot = new_slots(prog, &e->count);
+
+	if (e->buf == NULL || e->slot == NULL || !new_dict(&e->dict, e->count)) {
+		lf_free_encoder(e);
+		return NULL;
+	}
+
+	return e;
+}
+
+int
+lf_encode_header(const struct lf_encoder *e, lf_write *w, void *opaque)
+{
+	unsigned char buf[4 + VARINT * 3], *q;
+	const char *tz;
+	size_t n;
+
+	assert(e != NULL);
+	assert(w != NULL);
+
+	n = e->override != NULL ? strlen(e->override) : 0;
+
+	memcpy(buf, MAGIC, 4);
+	q = put_varint(buf + 4, e->flags);
+	q = put_varint(q, n);
+
+	if (!w(opaque, buf, q - buf) || (n > 0 && !w(opaque, e->override, n))) {
+		return 0;
+	}
+
+	tz = getenv("TZ");
+	n = tz != NULL ? strlen(tz) : 0;
+
+	q = put_varint(buf, tz != NULL ? (unsigned long long) n << 1 | 1 : 0);
+
+	if (!w(opaque, buf, q - buf) || (n > 0 && !w(opaque, tz, n))) {
+		return 0;
+	}
+
+	q = put_varint(buf, e->prog->len);
+
+	return w(opaque, buf, q - buf) && w(opaque, e->prog->fmt, e->prog->len);
+}
+
+int
+lf_encode(struct lf_encoder *e, const struct lf_record *rec,
+	lf_write *w, void *opaque)
+{
+	const struct lf_record *r;
+	unsigned char tmp[VARINT];
+	unsigned char *q, *len;
+	struct lf_str s;
+	size_t i, n, k;
+
+	assert(e != NULL);
+	assert(rec != NULL);
+	assert(w != NULL);
+
+	/* the body follows space for its length */
+	q = e->buf + VARINT;
+
+	e->dict.npending = 0;
+
+	for (i = 0; i < e->count; i++) {
+		const struct slot *slot = &e->slot[i];
+		const char *f;
+
+		r = rec;
+		if (slot->which == LF_REDIRECT_FINAL && rec->final != NULL) {
+			r = rec->final;
+		}
+
+		f = (const char *) r + slot->off;
+
+		q = reserve(e, q, VARINT);
+		if (q == NULL) {
+			return 0;
+		}
+
+		switch (slot->kind) {
+		case KIND_UINT:   q = put_varint(q, * (const unsigned *) f);           break;
+		case KIND_ULONG:  q = put_varint(q, * (const unsigned long *) f);      break;
+		case KIND_ULLONG: q = put_varint(q, * (const unsigned long long *) f); break;
+		case KIND_TIME:   q = put_time(q, * (const long long *) f);            break;
+		case KIND_CONN:   q = put_varint(q, r->aborted | r->keepalive << 1);   break;
+		case KIND_STR:    q = put_str(e, q, (const struct lf_str *) f);        break;
+
+		case KIND_LOOKUP:
+			if (r->lookup == NULL) {
+				s.p = NULL;
+				s.n = 0;
+			} else {
+				s = r->lookup(r->opaque, (enum lf_table) slot->table, slot->name, slot->n);
+			}
+
+			q = put_str(e, q, &s);
+			break;
+
+		default:
+			assert(!"unreached");
+		}
+
+		if (q == NULL) {
+			return 0;
+		}
+	}
+
+	n = q - (e->buf + VARINT);
+
+	k = put_varint(tmp, n) - tmp;
+	len = e->buf + VARINT - k;
+	memcpy(len, tmp, k);
+
+	if (!w(opaque, len, q - len)) {
+		return 0;
+	}
+
+	/* the strings are rec's, so entries are made before returning */
+	dict_commit(&e->dict);
+
+	return 1;
+}
+
+void
+lf_free_encoder(struct lf_encoder *e)
+{
+	if (e == NULL) {
+		return;
+	}
+
+	free(e->dict.pending);
+	free(e->slot);
+	free(e->buf);
+	free(e);
+}
+
+static void
+recerr(struct lf_err *ep, enum lf_errno e, const char *p, size_t n)
+{
+	if (ep != NULL) {
+		ep->errnum = e;
+		ep->p = p;
+		ep->n = n;
+	}
+}
+
+/* 0 for truncated, -1 for malformed */
+static int
+get_varint(const char **p, const char *end, unsigned long long *v)
+{
+	const char *q;
+	unsigned shift;
+
+	*v = 0;
+
+	for (q = *p, shift = 0; q < end; q++, shift += 7) {
+		unsigned char c = *q;
+
+		if (shift == 63 && c > 1) {
+			return -1;
+		}
+
+		*v |= (unsigned long long) (c & 0x7f) << shift;
+
+		if (!(c & 0x80)) {
+			*p = q + 1;
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Never called; lf_compilen() only needs a hook for the specifiers
+ * in .override, and lf_render() outputs "-" for those directives.
+ */
+static int
+custom(const struct lf_config *conf, void *opaque,
+	char c, const struct lf_pred *pred, enum lf_redirect redirect, const char *p, size_t n,
+	enum lf_errno *e)
+{
+	(void) conf;
+	(void) opaque;
+	(void) c;
+	(void) pred;
+	(void) redirect;
+	(void) p;
+	(void) n;
+	(void) e;
+
+	return 1;
+}
+
+struct lf_decoder *
+lf_new_decoder(const char *p, size_t n, size_t *used, struct lf_err *ep)
+{
+	struct lf_decoder *d;
+	struct lf_config conf;
+	unsigned long long flags, len, tzlen, fmtlen;
+	const char *q, *end, *override, *tz, *fmt;
+	char *o, *z;
+	int r;
+
+	assert(p != NULL || n == 0);
+	assert(used != NULL);
+
+	q   = p;
+	end = p + n;
+
+	if (n < 4) {
+		recerr(ep, n == 0 || 0 == memcmp(p, MAGIC, n) ? LF_ERR_TRUNCATED_RECORD : LF_ERR_MALFORMED_RECORD, p, n);
+		return NULL;
+	}
+
+	if (0 != memcmp(p, MAGIC, 4)) {
+		recerr(ep, LF_ERR_MALFORMED_RECORD, p, 4);
+		return NULL;
+	}
+
+	q += 4;
+
+	if ((r = get_varint(&q, end, &flags)) != 1 || (r = get_varint(&q, end, &len)) != 1) {
+		recerr(ep, r == 0 ? LF_ERR_TRUNCATED_RECORD : LF_ERR_MALFORMED_RECORD, p, q - p);
+		return NULL;
+	}
+
+	if (len > (unsigned long long) (end - q)) {
+		recerr(ep, LF_ERR_TRUNCATED_RECORD, p, n);
+		return NULL;
+	}
+
+	override = q;
+	q += len;
+
+	if ((r = get_varint(&q, end, &tzlen)) != 1) {
+		recerr(ep, r == 0 ? LF_ERR_TRUNCATED_RECORD : LF_ERR_MALFORMED_RECORD, p, q - p);
+		return NULL;
+	}
+
+	if (tzlen >> 1 > (unsigned long long) (end - q)) {
+		recerr(ep, LF_ERR_TRUNCATED_RECORD, p, n);
+		return NULL;
+	}
+
+	tz = q;
+	q += tzlen >> 1;
+
+	if ((r = get_varint(&q, end, &fmtlen)) != 1) {
+		recerr(ep, r == 0 ? LF_ERR_TRUNCATED_RECORD : LF_ERR_MALFORMED_RECORD, p, q - p);
+		return NULL;
+	}
+
+	if (fmtlen > (unsigned long long) (end - q)) {
+		recerr(ep, LF_ERR_TRUNCATED_RECORD, p, n);
+		return NULL;
+	}
+
+	fmt = q;
+	q += fmtlen;
+
+	if (flags > (FLAG_KEEP_ALIVE | FLAG_HOSTNAME_LOOKUPS | FLAG_IDENTITY_CHECK | FLAG_USE_CANONICAL_NAME)
+	 || memchr(override, '\0', len) != NULL
+	 || (tzlen != 0 && !(tzlen & 1)) || memchr(tz, '\0', tzlen >> 1) != NULL) {
+		recerr(ep, LF_ERR_MALFORMED_RECORD, p, q - p);
+		return NULL;
+	}
+
+	/* lf_compilen() needs .override as a string, and TZ is kept as one */
+	o = malloc(len + 1);
+	z = tzlen != 0 ? malloc((tzlen >> 1) + 1) : NULL;
+	if (o == NULL || (tzlen != 0 && z == NULL)) {
+		free(o);
+		free(z);
+		recerr(ep, LF_ERR_ERRNO, p, 0);
+		return NULL;
+	}
+
+	if (z != NULL) {
+		memcpy(z, tz, tzlen >> 1);
+		z[tzlen >> 1] = '\0';
+	}
+
+	memcpy(o, override, len);
+	o[len] = '\0';
+
+	memset(&conf, 0, sizeof conf);
+
+	conf.keep_alive         = !!(flags & FLAG_KEEP_ALIVE);
+	conf.hostname_lookups   = !!(flags & FLAG_HOSTNAME_LOOKUPS);
+	conf.identity_check     = !!(flags & FLAG_IDENTITY_CHECK);
+	conf.use_canonical_name = !!(flags & FLAG_USE_CANONICAL_NAME);
+	conf.override           = len > 0 ? o : NULL;
+	conf.custom             = custom;
+
+	d = malloc(sizeof *d);
+	if (d == NULL) {
+		free(o);
+		free(z);
+		recerr(ep, LF_ERR_ERRNO, p, 0);
+		return NULL;
+	}
+
+	memset(d, 0, sizeof *d);
+
+	d->tz   = z;
+	d->prog = lf_compilen(&conf, fmt, fmtlen, ep);
+
+	free(o);
+
+	if (d->prog == NULL) {
+		free(d->tz);
+		free(d);
+		return NULL;
+	}
+
+	d->slot  = new_slots(d->prog, &d->count);
+	d->value = malloc((d->count + 1) * sizeof *d->value);
+
+	if (d->slot == NULL || d->value == NULL || !new_dict(&d->dict, d->count)) {
+		lf_free_decoder(d);
+		recerr(ep, LF_ERR_ERRNO, p, 0);
+		return NULL;
+	}
+
+	d->side[LF_REDIRECT_ORIG].d      = d;
+	d->side[LF_REDIRECT_ORIG].which  = LF_REDIRECT_ORIG;
+	d->side[LF_REDIRECT_FINAL].d     = d;
+	d->side[LF_REDIRECT_FINAL].which = LF_REDIRECT_FINAL;
+
+	*used = q - p;
+
+	return d;
+}
+
+const struct lf_prog *
+lf_decoder_prog(const struct lf_decoder *d)
+{
+	assert(d != NULL);
+
+	return d->prog;
+}
+
+const char *
+lf_decoder_tz(const struct lf_decoder *d)
+{
+	assert(d != NULL);
+
+	return d->tz;
+}
+
+static struct lf_str
+lookup(void *opaque, enum lf_table table, const char *name, size_t n)
+{
+	const struct side *side = opaque;
+	const struct lf_decoder *d;
+	struct lf_str none = { NULL, 0 };
+	size_t i;
+
+	assert(side != NULL);
+	assert(name != NULL);
+
+	d = side->d;
+
+	for (i = 0; i < d->count; i++) {
+		const struct slot *slot = &d->slot[i];
+
+		if (slot->kind == KIND_LOOKUP && slot->which == side->which
+		 && slot->table == table && slot->n == n && 0 == memcmp(slot->name, name, n)) {
+			return d->value[i];
+		}
+	}
+
+	return none;
+}
+
+/* 0 for truncated, -1 for malformed */
+static int
+get_str(struct lf_decoder *d, const char **p, const char *end, char **a,
+	struct lf_str *s)
+{
+	unsigned long long v;
+	int r;
+
+	r = get_varint(p, end, &v);
+	if (r != 1) {
+		return r;
+	}
+
+	if (v == 0) {
+		s->p = NULL;
+		s->n = 0;
+		return 1;
+	}
+
+	if (v & 1) {
+		v >>= 1;
+
+		if (v > (unsigned long long) (end - *p)) {
+			return -1;
+		}
+
+		/* copied, so that the caller may discard its buffer */
+		memcpy(*a, *p, v);
+		s->p = *a;
+		s->n = v;
+
+		*a += v;
+		*p += v;
+
+		if (v <= DICT_LEN) {
+			dict_defer(&d->dict, dict_index(s->p, s->n), s->p, s->n);
+		}
+
+		return 1;
+	}
+
+	v = (v >> 1) - 1;
+
+	if (v >= DICT_SIZE || d->dict.entry[v].n == 0) {
+		return -1;
+	}
+
+	s->p = d->dict.entry[v].p;
+	s->n = d->dict.entry[v].n;
+
+	return 1;
+}
+
+int
+lf_decode(struct lf_decoder *d, const char *p, size_t n, size_t *used,
+	struct lf_record *rec, struct lf_err *ep)
+{
+	unsigned long long len, v;
+	const char *q, *end;
+	struct lf_record *r;
+	char *a;
+	size_t i, k;
+	int final;
+	int e;
+
+	assert(d != NULL);
+	assert(p != NULL || n == 0);
+	assert(used != NULL);
+	assert(rec != NULL);
+
+	/* the previous record's entries, which point into the arena */
+	dict_commit(&d->dict);
+
+	q   = p;
+	end = p + n;
+
+	e = get_varint(&q, end, &len);
+	if (e != 1) {
+		recerr(ep, e == 0 ? LF_ERR_TRUNCATED_RECORD : LF_ERR_MALFORMED_RECORD, p, q - p);
+		return 0;
+	}
+
+	if (len > (unsigned long long) (end - q)) {
+		recerr(ep, LF_ERR_TRUNCATED_RECORD, p, n);
+		return 0;
+	}
+
+	end = q + len;
+
+	/* strings are at most the length of the record, so a is never moved */
+	if (d->size < len) {
+		a = realloc(d->arena, len);
+		if (a == NULL) {
+			recerr(ep, LF_ERR_ERRNO, p, 0);
+			return 0;
+		}
+
+		d->arena = a;
+		d->size  = len;
+	}
+
+	a = d->arena;
+
+	memset(rec, 0, sizeof *rec);
+	memset(&d->final, 0, sizeof d->final);
+
+	final = 0;
+
+	for (i = 0; i < d->count; i++) {
+		const struct slot *slot = &d->slot[i];
+		char *f;
+
+		r = slot->which == LF_REDIRECT_FINAL ? &d->final : rec;
+		f = (char *) r + slot->off;
+
+		final |= slot->which == LF_REDIRECT_FINAL;
+
+		switch (slot->kind) {
+		case KIND_UINT:
+			e = get_varint(&q, end, &v);
+			if (e == 1 && v > UINT_MAX) {
+				e = -1;
+			}
+			* (unsigned *) f = (unsigned) v;
+			break;
+
+		case KIND_ULONG:
+			e = get_varint(&q, end, &v);
+			if (e == 1 && v > ULONG_MAX) {
+				e = -1;
+			}
+			* (unsigned long *) f = (unsigned long) v;
+			break;
+
+		case KIND_ULLONG:
+			e = get_varint(&q, end, &v);
+			* (unsigned long long *) f = v;
+			break;
+
+		case KIND_TIME:
+			if (end - q < 8) {
+				e = -1;
+				break;
+			}
+
+			for (v = 0, k = 0; k < 8; k++) {
+				v |= (unsigned long long) (unsigned char) q[k] << (k * 8);
+			}
+
+			* (long long *) f = v > LLONG_MAX ? -(long long) (~v) - 1 : (long long) v;
+			q += 8;
+			e = 1;
+			break;
+
+		case KIND_CONN:
+			e = get_varint(&q, end, &v);
+			if (e == 1 && v > 3) {
+				e = -1;
+			}
+			r->aborted   = v & 1;
+			r->keepalive = v >> 1 & 1;
+			break;
+
+		case KIND_STR:
+			e = get_str(d, &q, end, &a, (struct lf_str *) f);
+			break;
+
+		case KIND_LOOKUP:
+			e = get_str(d, &q, end, &a, &d->value[i]);
+			break;
+
+		default:
+			assert(!"unreached");
+			e = -1;
+		}
+
+		/* a record is never truncated within its length */
+		if (e != 1) {
+			d->dict.npending = 0;
+			recerr(ep, LF_ERR_MALFORMED_RECORD, p, end - p);
+			return 0;
+		}
+	}
+
+	if (q != end) {
+		d->dict.npending = 0;
+		recerr(ep, LF_ERR_MALFORMED_RECORD, p, end - p);
+		return 0;
+	}
+
+	rec->lookup = lookup;
+	rec->opaque = &d->side[LF_REDIRECT_ORIG];
+
+	d->final.lookup = lookup;
+	d->final.opaque = &d->side[LF_REDIRECT_FINAL];
+
+	/* otherwise the final request's fields are the same as the original's */
+	rec->final = final ? &d->final : NULL;
+
+	*used = end - p;
+
+	return 1;
+}
+
+void
+lf_free_decoder(struct lf_decoder *d)
+{
+	if (d == NULL) {
+		return;
+	}
+
+	lf_free(d->prog);
+
+	free(d->dict.pending);
+	free(d->value);
+	free(d->slot);
+	free(d->arena);
+	free(d->tz);
+	free(d);
+}
@@ -0,0 +1,724 @@
+/*
+ * Copyright 2017 Katherine Flavel
+ *
+ * See LICENCE for the full copyright terms.
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <assert.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+
+#include <lf/lf.h>
+
+#include "internal.h"
+
+/*
+ * Output is counted whether or not it fits, so that lf_render()
+ * can say how much space it would have needed.
+ */
+struct out {
+	char *p;
+	size_t size;
+	size_t n;
+
+	const struct lf_prog *prog;
+};
+
+static void
+start(struct out *o, char *buf, size_t size)
+{
+	assert(buf != NULL || size == 0);
+
+	o->p    = buf;
+	o->size = size;
+	o->n    = 0;
+	o->prog = NULL;
+}
+
+static void
+put(struct out *o, const char *p, size_t n)
+{
+	assert(o != NULL);
+	assert(p != NULL || n == 0);
+
+	if (o->n < o->size) {
+		size_t z;
+
+		z = o->size - o->n;
+		if (z > n) {
+			z = n;
+		}
+
+		memcpy(o->p + o->n, p, z);
+	}
+
+	o->n += n;
+}
+
+static void
+putc_(struct out *o, char c)
+{
+	put(o, &c, 1);
+}
+
+static void
+dash(struct out *o)
+{
+	putc_(o, '-');
+}
+
+/*
+ * As Apache's ap_escape_logitem(): quotes, backslashes and anything
+ * unprintable are escaped, so that a log line stays one line.
+ * Runs between these are copied whole.
+ */
+static void
+put_escaped(struct out *o, const char *p, size_t n)
+{
+	const char *s, *e;
+
+	assert(o != NULL);
+	assert(p != NULL || n == 0);
+
+	s = p;
+	e = p + n;
+
+	while (s < e) {
+		const char *q;
+		char buf[4];
+
+		q = memesc(s, e);
+
+		put(o, s, q - s);
+
+		if (q == e) {
+			break;
+		}
+
+		buf[0] = '\\';
+
+		switch (*q) {
+		case '\b': buf[1] = 'b'; put(o, buf, 2); break;
+		case '\n': buf[1] = 'n'; put(o, buf, 2); break;
+		case '\r': buf[1] = 'r'; put(o, buf, 2); break;
+		case '\t': buf[1] = 't'; put(o, buf, 2); break;
+		case '\v': buf[1] = 'v'; put(o, buf, 2); break;
+
+		case '\\':
+		case '"':
+			buf[1] = *q;
+			put(o, buf, 2);
+			break;
+
+		default:
+			buf[1] = 'x';
+			buf[2] = "0123456789abcdef"[(unsigned char) *q >> 4];
+			buf[3] = "0123456789abcdef"[(unsigned char) *q & 0xf];
+			put(o, buf, 4);
+			break;
+		}
+
+		s = q + 1;
+	}
+}
+
+/* absent strings are logged as "-" */
+static void
+put_str(struct out *o, const struct lf_str *s, int escape)
+{
+	assert(s != NULL);
+
+	if (s->p == NULL) {
+		dash(o);
+	} else if (escape) {
+		put_escaped(o, s->p, s->n);
+	} else {
+		put(o, s->p, s->n);
+	}
+}
+
+/* "00" to "99", so that decimals are written two digits at a time */
+static const char pairs[] =
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899";
+
+/* u in decimal, ending at end; returns its first digit */
+static char *
+dec(char *end, unsigned long long u)
+{
+	while (u >= 100) {
+		end -= 2;
+		memcpy(end, pairs + u % 100 * 2, 2);
+		u /= 100;
+	}
+
+	if (u >= 10) {
+		end -= 2;
+		memcpy(end, pairs + u * 2, 2);
+	} else {
+		*--end = '0' + u;
+	}
+
+	return end;
+}
+
+/* width is the minimum number of digits, zero padded */
+static void
+put_uint(struct out *o, unsigned long long u, unsigned base, size_t width)
+{
+	char buf[sizeof u * 8];
+	char *p, *end;
+
+	assert(base == 10 || base == 16);
+	assert(width <= sizeof buf);
+
+	end = buf + sizeof buf;
+
+	if (base == 10) {
+		p = dec(end, u);
+	} else {
+		p = end;
+
+		do {
+			*--p = "0123456789abcdef"[u % base];
+			u /= base;
+		} while (u > 0);
+	}
+
+	while ((size_t) (end - p) < width) {
+		*--p = '0';
+	}
+
+	put(o, p, end - p);
+}
+
+/* exactly width digits, for fractions of a second */
+static void
+put_fixed(struct out *o, unsigned u, size_t width)
+{
+	char buf[6];
+	size_t i;
+
+	assert(width <= sizeof buf);
+
+	for (i = width; i >= 2; i -= 2) {
+		memcpy(buf + i - 2, pairs + u % 100 * 2, 2);
+		u /= 100;
+	}
+
+	if (i == 1) {
+		buf[0] = '0' + u;
+	}
+
+	put(o, buf, width);
+}
+
+static void
+put_int(struct out *o, long long n)
+{
+	if (n < 0) {
+		putc_(o, '-');
+		put_uint(o, 0ULL - (unsigned long long) n, 10, 0);
+	} else {
+		put_uint(o, n, 10, 0);
+	}
+}
+
+/* floor division, so times before the epoch round consistently */
+static long long
+fdiv(long long n, long long d)
+{
+	return n / d - (n % d < 0);
+}
+
+static void
+put_frac(struct out *o, long long t, enum lf_rtime unit)
+{
+	switch (unit) {
+	case LF_RTIME_S:  put_int(o, fdiv(t, 1000000)); break;
+	case LF_RTIME_MS: put_int(o, fdiv(t, 1000));    break;
+	case LF_RTIME_US: put_int(o, t);                break;
+
+	case LF_RTIME_MS_FRAC:
+		put_fixed(o, fdiv(t, 1000) - fdiv(t, 1000000) * 1000, 3);
+		break;
+
+	case LF_RTIME_US_FRAC:
+		put_fixed(o, t - fdiv(t, 1000000) * 1000000, 6);
+		break;
+	}
+}
+
+/*
+ * A log sees the same few seconds over and over, so the text strftime()
+ * gave for each of the last few is kept, per thread, as Apache keeps its
+ * recent times. strftime() has no finer resolution than a second, and a
+ * second already kept is rendered again without calling localtime_r().
+ *
+ * The zone is re-validated only when a second isn't found: if tzname[]
+ * has changed since the thread last looked, everything kept is for some
+ * other zone, and is dropped. Changes tzname[] can't show (say, of only
+ * the rules for DST) are seen by lf_tzset() bumping time_gen, which no
+ * kept time matches afterwards.
+ */
+#if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L && !defined(__STDC_NO_THREADS__)
+#define THREAD_LOCAL _Thread_local
+#elif defined(__GNUC__)
+#define THREAD_LOCAL __thread
+#endif
+
+static unsigned long time_gen;
+
+#ifdef THREAD_LOCAL
+
+enum {
+	TIME_CACHE  = 4,  /* %{begin:...}t and %{end:...}t, for a few formats */
+	TIME_FMTMAX = 64, /* longer formats aren't cached */
+	TIME_MAX    = 64  /* nor is longer text */
+};
+
+struct time_cache {
+	int used;
+	char f[TIME_FMTMAX];
+	time_t t;
+	size_t n;
+	char s[TIME_MAX];
+};
+
+/* the zone which everything in time_cache[] was rendered for */
+struct time_zone {
+	unsigned long gen;
+	const char *name[2];
+};
+
+static THREAD_LOCAL struct time_cache time_cache[TIME_CACHE];
+static THREAD_LOCAL struct time_zone time_zone;
+static THREAD_LOCAL unsigned time_next;
+
+static const struct time_cache *
+time_find(time_t tt, unsigned long gen, const char *fmt)
+{
+	size_t i;
+
+	if (time_zone.gen != gen) {
+		return NULL;
+	}
+
+	for (i = 0; i < TIME_CACHE; i++) {
+		const struct time_cache *c = &time_cache[i];
+
+		if (!c->used || c->t != tt) {
+			continue;
+		}
+
+		if (0 != strcmp(c->f, fmt)) {
+			continue;
+		}
+
+		return c;
+	}
+
+	return NULL;
+}
+
+/* for a second just broken down by localtime_r() */
+static void
+time_keep(time_t tt, unsigned long gen, const char *fmt,
+	const char *s, size_t n)
+{
+	struct time_cache *c;
+	size_t i, z;
+
+	if (time_zone.gen != gen
+	 || time_zone.name[0] != tzname[0] || time_zone.name[1] != tzname[1]) {
+		for (i = 0; i < TIME_CACHE; i++) {
+			time_cache[i].used = 0;
+		}
+
+		time_zone.gen     = gen;
+		time_zone.name[0] = tzname[0];
+		time_zone.name[1] = tzname[1];
+	}
+
+	z = strlen(fmt);
+	if (z >= sizeof c->f || n > sizeof c->s) {
+		return;
+	}
+
+	c = &time_cache[time_next++ % TIME_CACHE];
+
+	memcpy(c->f, fmt, z + 1);
+	memcpy(c->s, s, n);
+
+	c->used = 1;
+	c->t    = tt;
+	c->n    = n;
+}
+
+#endif
+
+void
+lf_tzset(void)
+{
+	unsigned long gen;
+
+	tzset();
+
+	gen = LOAD(&time_gen);
+
+	do {
+		/* CAS() reloads gen on failure */
+	} while (!CAS(&time_gen, &gen, gen + 1));
+}
+
+/* tf is fmt compiled, or NULL for strftime() */
+static void
+put_time(struct out *o, long long t, const char *fmt,
+	const struct tf *tf, size_t tfn)
+{
+	/* as Apache's MAX_STRING_LEN, for the same formats */
+	char buf[8192];
+	struct tm tm;
+	time_t tt;
+	size_t n;
+#ifdef THREAD_LOCAL
+	unsigned long gen;
+#endif
+
+	assert(fmt != NULL);
+
+	tt = fdiv(t, 1000000);
+
+#ifdef THREAD_LOCAL
+	{
+		const struct time_cache *c;
+
+		gen = LOAD(&time_gen);
+
+		c = time_find(tt, gen, fmt);
+		if (c != NULL) {
+			put(o, c->s, c->n);
+			return;
+		}
+	}
+#endif
+
+	if (localtime_r(&tt, &tm) == NULL) {
+		dash(o);
+		return;
+	}
+
+	n = 0;
+
+	if (tf != NULL) {
+		n = tf_render(tf, tfn, tt, &tm, buf, sizeof buf);
+	}
+
+	if (n == 0) {
+		n = strftime(buf, sizeof buf, fmt, &tm);
+	}
+
+	if (n == 0 && *fmt != '\0') {
+		dash(o);
+		return;
+	}
+
+#ifdef THREAD_LOCAL
+	time_keep(tt, gen, fmt, buf, n);
+#endif
+
+	put(o, buf, n);
+}
+
+static void
+lookup(struct out *o, const struct lf_record *r, enum lf_table table,
+	const struct op *op)
+{
+	const struct lf_str *v;
+	struct lf_str s;
+
+	if (r->lookup == NULL) {
+		dash(o);
+		return;
+	}
+
+	/* resolved already, by slot */
+	if (r->lookup == lf_headers_lookup) {
+		v = headers_value(r->opaque, o->prog, op);
+		if (v != NULL) {
+			put_str(o, v, 1);
+			return;
+		}
+	}
+
+	s = r->lookup(r->opaque, table, op->p, op->n);
+
+	put_str(o, &s, 1);
+}
+
+static void
+render(struct out *o, const struct lf_record *rec, const struct op *op)
+{
+	const struct lf_record *r;
+
+	assert(o != NULL);
+	assert(rec != NULL);
+	assert(op != NULL);
+
+	r = rec;
+	if (op->redirect == LF_REDIRECT_FINAL && rec->final != NULL) {
+		r = rec->final;
+	}
+
+	switch (op->type) {
+	case OP_LITERAL:
+		put(o, op->p, op->n);
+		return;
+
+	case OP_CUSTOM:
+		dash(o);
+		return;
+
+	case OP_IP:
+		put_str(o, &r->ip[op->arg], 0);
+		return;
+
+	case OP_RESP_SIZE:
+		put_uint(o, r->resp_size, 10, 0);
+		return;
+
+	case OP_RESP_SIZE_CLF:
+		if (r->resp_size == 0) {
+			dash(o);
+		} else {
+			put_uint(o, r->resp_size, 10, 0);
+		}
+		return;
+
+	case OP_REQ_COOKIE:   lookup(o, r, LF_TABLE_REQ_COOKIE,   op); return;
+	case OP_ENV_VAR:      lookup(o, r, LF_TABLE_ENV_VAR,      op); return;
+	case OP_REQ_HEADER:   lookup(o, r, LF_TABLE_REQ_HEADER,   op); return;
+	case OP_NOTE:         lookup(o, r, LF_TABLE_NOTE,         op); return;
+	case OP_REPLY_HEADER: lookup(o, r, LF_TABLE_REPLY_HEADER, op); return;
+	case OP_REQ_TRAILER:  lookup(o, r, LF_TABLE_REQ_TRAILER,  op); return;
+	case OP_RESP_TRAILER: lookup(o, r, LF_TABLE_RESP_TRAILER, op); return;
+
+	case OP_FILENAME:
+		put_str(o, &r->filename, 0);
+		return;
+
+	case OP_REMOTE_HOSTNAME:
+		/* without a lookup, the hostname is the client's address */
+		if (op->arg && r->remote_host.p != NULL) {
+			put_str(o, &r->remote_host, 1);
+		} else {
+			put_str(o, &r->ip[LF_IP_CLIENT], 1);
+		}
+		return;
+
+	case OP_REQ_PROTOCOL:   put_str(o, &r->req_protocol,   1); return;
+	case OP_REMOTE_LOGNAME: put_str(o, &r->remote_logname, 1); return;
+	case OP_REQ_LOGID:      put_str(o, &r->req_logid,      0); return;
+	case OP_REQ_METHOD:     put_str(o, &r->req_method,     1); return;
+	case OP_REQ_FIRST_LINE: put_str(o, &r->req_first_line, 1); return;
+	case OP_RESP_HANDLER:   put_str(o, &r->resp_handler,   1); return;
+	case OP_URL_PATH:       put_str(o, &r->url_path,       1); return;
+
+	case OP_KEEPALIVE_REQS:
+		put_uint(o, r->keepalive_reqs, 10, 0);
+		return;
+
+	case OP_SERVER_PORT:
+		put_uint(o, r->port[op->arg], 10, 0);
+		return;
+
+	case OP_ID:
+		switch (op->arg) {
+		case LF_ID_PID:    put_uint(o, r->pid, 10, 0); break;
+		case LF_ID_TID:    put_uint(o, r->tid, 10, 0); break;
+		case LF_ID_HEXTID: put_uint(o, r->tid, 16, 0); break;
+		}
+		return;
+
+	case OP_QUERY_STRING:
+		/* an empty string rather than "-" when there's no query */
+		if (r->query_string.p != NULL) {
+			putc_(o, '?');
+			put_escaped(o, r->query_string.p, r->query_string.n);
+		}
+		return;
+
+	case OP_STATUS:
+		if (r->status == 0) {
+			dash(o);
+		} else {
+			put_uint(o, r->status, 10, 0);
+		}
+		return;
+
+	case OP_TIME:
+		put_time(o, r->time[op->when], op->p, op->tf, op->tfn);
+		return;
+
+	case OP_TIME_FRAC:
+		put_frac(o, r->time[op->when], op->arg);
+		return;
+
+	case OP_TIME_TAKEN:
+		/* truncated rather than floored, as Apache does */
+		switch (op->arg) {
+		case LF_RTIME_S:  put_int(o, (r->time[LF_WHEN_END] - r->time[LF_WHEN_BEGIN]) / 1000000); break;
+		case LF_RTIME_MS: put_int(o, (r->time[LF_WHEN_END] - r->time[LF_WHEN_BEGIN]) / 1000);    break;
+		case LF_RTIME_US: put_int(o, (r->time[LF_WHEN_END] - r->time[LF_WHEN_BEGIN]));           break;
+		}
+		return;
+
+	case OP_REMOTE_USER:
+		/* Apache distinguishes an empty user from no user */
+		if (r->remote_user.p != NULL && r->remote_user.n == 0) {
+			put(o, "\"\"", 2);
+		} else {
+			put_str(o, &r->remote_user, 1);
+		}
+		return;
+
+	case OP_SERVER_NAME:
+		if (op->arg || r->host.p == NULL) {
+			put_str(o, &r->server_name, 1);
+		} else {
+			put_str(o, &r->host, 1);
+		}
+		return;
+
+	case OP_CONN_STATUS:
+		putc_(o, r->aborted ? 'X' : r->keepalive ? '+' : '-');
+		return;
+
+	case OP_BYTES_RECV: put_uint(o, r->bytes_recv, 10, 0); return;
+	case OP_BYTES_SENT: put_uint(o, r->bytes_sent, 10, 0); return;
+	case OP_BYTES_XFER: put_uint(o, r->bytes_xfer, 10, 0); return;
+
+	default:
+		assert(!"unreached");
+		dash(o);
+		return;
+	}
+}
+
+size_t
+lf_render(const struct lf_prog *prog, const struct lf_record *rec,
+	char *buf, size_t size)
+{
+	const struct lf_record *final;
+	struct out o;
+	size_t i;
+
+	assert(prog != NULL);
+	assert(rec != NULL);
+
+	start(&o, buf, size);
+	o.prog = prog;
+
+	final = rec->final != NULL ? rec->final : rec;
+
+	for (i = 0; i < prog->count; i++) {
+		const struct op *op;
+
+		op = &prog->op[i];
+
+		if (op->type != OP_LITERAL && !lf_pred_match(&op->pred, final->status)) {
+			dash(&o);
+			continue;
+		}
+
+		render(&o, rec, op);
+	}
+
+	return o.n;
+}
+
+size_t
+lf_render_escaped(char *buf, size_t size, const char *p, size_t n)
+{
+	struct out o;
+
+	start(&o, buf, size);
+	put_escaped(&o, p, n);
+
+	return o.n;
+}
+
+size_t
+lf_render_uint(char *buf, size_t size, unsigned long long u, unsigned base)
+{
+	struct out o;
+
+	start(&o, buf, size);
+	put_uint(&o, u, base, 0);
+
+	return o.n;
+}
+
+size_t
+lf_render_int(char *buf, size_t size, long long n)
+{
+	struct out o;
+
+	start(&o, buf, size);
+	put_int(&o, n);
+
+	return o.n;
+}
+
+size_t
+lf_render_frac(char *buf, size_t size, long long t, enum lf_rtime unit)
+{
+	struct out o;
+
+	start(&o, buf, size);
+	put_frac(&o, t, unit);
+
+	return o.n;
+}
+
+size_t
+lf_render_time(char *buf, size_t size, long long t, const char *fmt)
+{
+	/* longer formats are left to strftime() */
+	struct tf tf[32];
+	struct out o;
+	size_t len, n;
+
+	assert(fmt != NULL);
+
+	start(&o, buf, size);
+
+	len = strlen(fmt);
+	n = 0;
+
+	if (!tf_compile(fmt, len, NULL, &n) || n > sizeof tf / sizeof *tf) {
+		put_time(&o, t, fmt, NULL, 0);
+		return o.n;
+	}
+
+	n = 0;
+
+	if (!tf_compile(fmt, len, tf, &n)) {
+		assert(!"unreached");
+	}
+
+	put_time(&o, t, fmt, tf, n);
+
+	return o.n;
+}
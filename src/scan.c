@@ -0,0 +1,806 @@
+/*
+ * Copyright 2017 Katherine Flavel
+ *
+ * See LICENCE for the full copyright terms.
+ */
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include <lf/lf.h>
+
+#include "internal.h"
+
+#define CLF_TIME "[%d/%b/%Y:%T %z]"
+
+/* how a field's extent is found */
+enum lex {
+	LEX_INT,      /* decimal digits, or "-" */
+	LEX_HEX,      /* hex digits, or "-" */
+	LEX_SINT,     /* decimal digits with an optional leading "-", or "-" */
+	LEX_CLF_TIME, /* as CLF_TIME */
+	LEX_QUOTED,   /* to the first unescaped '"' */
+	LEX_DELIM,    /* to the next literal, skipping .skip occurrences */
+	LEX_REST      /* to the end of the line */
+};
+
+struct field {
+	const struct op *op;
+	const struct op *delim; /* the following literal, or NULL */
+	unsigned lex     :3;    /* enum lex */
+	unsigned escaped :1;    /* Apache escapes this field */
+	unsigned clf     :1;    /* "-" means 0 */
+	size_t skip;
+};
+
+struct lf_scanner {
+	struct lf_prog *prog;
+	const struct field *field;
+	const struct lf_column *col;
+	size_t count;
+};
+
+static enum lf_type
+type(const struct op *op)
+{
+	assert(op != NULL);
+
+	switch (op->type) {
+	case OP_RESP_SIZE:
+	case OP_RESP_SIZE_CLF:
+	case OP_KEEPALIVE_REQS:
+	case OP_SERVER_PORT:
+	case OP_ID:
+	case OP_STATUS:
+	case OP_BYTES_RECV:
+	case OP_BYTES_SENT:
+	case OP_BYTES_XFER:
+		return LF_TYPE_INT;
+
+	/* times rendered relative to the epoch or to each other may be negative */
+	case OP_TIME_FRAC:
+		return op->arg == LF_RTIME_MS_FRAC || op->arg == LF_RTIME_US_FRAC
+			? LF_TYPE_INT : LF_TYPE_SINT;
+
+	case OP_TIME_TAKEN:
+		return LF_TYPE_SINT;
+
+	case OP_TIME:
+		return 0 == strcmp(op->p, CLF_TIME) ? LF_TYPE_TIME : LF_TYPE_STR;
+
+	default:
+		return LF_TYPE_STR;
+	}
+}
+
+static int
+numeric(const struct op *op)
+{
+	return type(op) == LF_TYPE_INT || type(op) == LF_TYPE_SINT;
+}
+
+/* as lf_render() */
+static int
+escaped(const struct op *op)
+{
+	assert(op != NULL);
+
+	switch (op->type) {
+	case OP_REQ_COOKIE:
+	case OP_ENV_VAR:
+	case OP_REQ_HEADER:
+	case OP_NOTE:
+	case OP_REPLY_HEADER:
+	case OP_REQ_TRAILER:
+	case OP_RESP_TRAILER:
+	case OP_REMOTE_HOSTNAME:
+	case OP_REQ_PROTOCOL:
+	case OP_REMOTE_LOGNAME:
+	case OP_REQ_METHOD:
+	case OP_REQ_FIRST_LINE:
+	case OP_RESP_HANDLER:
+	case OP_URL_PATH:
+	case OP_QUERY_STRING:
+	case OP_REMOTE_USER:
+	case OP_SERVER_NAME:
+		return 1;
+
+	default:
+		return 0;
+	}
+}
+
+/*
+ * Occurrences of the delimiter in the literal parts of a strftime format,
+ * which the rendered time will also contain.
+ */
+static size_t
+occurrences(const char *fmt, const struct op *delim)
+{
+	const char *s;
+	size_t count;
+
+	assert(fmt != NULL);
+	assert(delim != NULL);
+
+	count = 0;
+
+	for (s = fmt; *s != '\0'; s++) {
+		if (*s == '%') {
+			if (s[1] == 'E' || s[1] == 'O') {
+				s++;
+			}
+			if (s[1] != '\0') {
+				s++;
+			}
+			continue;
+		}
+
+		if (0 == strncmp(s, delim->p, delim->n)
+		 && memchr(s, '%', delim->n) == NULL) {
+			count++;
+		}
+	}
+
+	return count;
+}
+
+static int
+quoted(const struct op *prev, const struct op *next)
+{
+	return prev != NULL && prev->p[prev->n - 1] == '"'
+		&& next != NULL && next->p[0] == '"';
+}
+
+struct lf_scanner *
+lf_compile_scanner(const struct lf_config *conf, const char *fmt,
+	struct lf_err *ep)
+{
+	struct lf_scanner *sc;
+	struct lf_prog *prog;
+	struct lf_column *col;
+	struct field *field;
+	size_t i, j, count;
+
+	assert(conf != NULL);
+	assert(fmt != NULL);
+
+	prog = lf_compile(conf, fmt, ep);
+	if (prog == NULL) {
+		return NULL;
+	}
+
+	count = 0;
+	for (i = 0; i < prog->count; i++) {
+		count += prog->op[i].type != OP_LITERAL;
+	}
+
+	sc = malloc(sizeof *sc
+		+ count * sizeof *field
+		+ count * sizeof *col);
+	if (sc == NULL) {
+		if (ep != NULL) {
+			ep->errnum = LF_ERR_ERRNO;
+			ep->p = fmt;
+			ep->n = 0;
+		}
+		lf_free(prog);
+		return NULL;
+	}
+
+	field = (void *) (sc + 1);
+	col   = (void *) (field + count);
+
+	for (i = 0, j = 0; i < prog->count; i++) {
+		const struct op *op, *prev, *next;
+		struct field *f;
+		size_t end;
+
+		op = &prog->op[i];
+
+		if (op->type == OP_LITERAL) {
+			continue;
+		}
+
+		prev = i > 0 && prog->op[i - 1].type == OP_LITERAL
+			? &prog->op[i - 1] : NULL;
+		next = i + 1 < prog->count && prog->op[i + 1].type == OP_LITERAL
+			? &prog->op[i + 1] : NULL;
+
+		end = i + 1 < prog->count ? prog->op[i + 1].src : prog->len;
+
+		f = &field[j];
+
+		f->op      = op;
+		f->delim   = next;
+		f->escaped = escaped(op);
+		f->clf     = op->type == OP_RESP_SIZE_CLF;
+		f->skip    = 0;
+
+		col[j].type     = type(op);
+		col[j].redirect = op->redirect;
+		col[j].src      = prog->fmt + op->src;
+		col[j].n        = end - op->src;
+		col[j].name     = op->p;
+
+		if (col[j].type == LF_TYPE_INT) {
+			f->lex = op->type == OP_ID && op->arg == LF_ID_HEXTID ? LEX_HEX : LEX_INT;
+		} else if (col[j].type == LF_TYPE_SINT) {
+			f->lex = LEX_SINT;
+		} else if (col[j].type == LF_TYPE_TIME) {
+			f->lex = LEX_CLF_TIME;
+		} else if (quoted(prev, next)) {
+			f->lex = LEX_QUOTED;
+		} else if (next != NULL) {
+			f->lex = LEX_DELIM;
+
+			if (op->type == OP_TIME) {
+				f->skip = occurrences(op->p, next);
+			}
+		} else {
+			f->lex = LEX_REST;
+		}
+
+		/* a string directly followed by anything, or a number by another */
+		if (next == NULL && i + 1 < prog->count
+		 && (f->lex == LEX_REST || (f->lex <= LEX_SINT && numeric(&prog->op[i + 1])))) {
+			if (ep != NULL) {
+				ep->errnum = LF_ERR_AMBIGUOUS_DIRECTIVES;
+				ep->p = fmt + op->src;
+				ep->n = end - op->src;
+			}
+			free(sc);
+			lf_free(prog);
+			return NULL;
+		}
+
+		j++;
+	}
+
+	assert(j == count);
+
+	sc->prog  = prog;
+	sc->field = field;
+	sc->col   = col;
+	sc->count = count;
+
+	return sc;
+}
+
+const struct lf_column *
+lf_scanner_columns(const struct lf_scanner *sc, size_t *count)
+{
+	assert(sc != NULL);
+
+	if (count != NULL) {
+		*count = sc->count;
+	}
+
+	return sc->col;
+}
+
+const struct op *
+scanner_op(const struct lf_scanner *sc, size_t i)
+{
+	assert(sc != NULL);
+	assert(i < sc->count);
+
+	return sc->field[i].op;
+}
+
+void
+lf_free_scanner(struct lf_scanner *sc)
+{
+	if (sc == NULL) {
+		return;
+	}
+
+	lf_free(sc->prog);
+	free(sc);
+}
+
+static const char *
+find(const char *p, const char *end, const char *s, size_t n)
+{
+	assert(p != NULL);
+	assert(end != NULL);
+	assert(s != NULL);
+	assert(n > 0);
+
+	while ((size_t) (end - p) >= n) {
+		p = memchr2(p, end - n + 1, s[0], s[0]);
+		if (p == end - n + 1) {
+			return NULL;
+		}
+
+		if (0 == memcmp(p, s, n)) {
+			return p;
+		}
+
+		p++;
+	}
+
+	return NULL;
+}
+
+static int
+xdigit(char c)
+{
+	switch (c) {
+	case '0': case '1': case '2': case '3': case '4':
+	case '5': case '6': case '7': case '8': case '9':
+		return c - '0';
+
+	case 'a': case 'b': case 'c': case 'd': case 'e': case 'f':
+		return c - 'a' + 10;
+
+	case 'A': case 'B': case 'C': case 'D': case 'E': case 'F':
+		return c - 'A' + 10;
+
+	default:
+		return -1;
+	}
+}
+
+/* digits in the given base, stopping at the first non-digit */
+static const char *
+number(const char *p, const char *end, unsigned base, unsigned long long *u)
+{
+	unsigned long long v;
+	int d;
+
+	assert(p != NULL);
+	assert(u != NULL);
+
+	v = 0;
+
+	for ( ; p < end && (d = xdigit(*p), d != -1 && (unsigned) d < base); p++) {
+		if (v > (ULLONG_MAX - d) / base) {
+			return NULL;
+		}
+
+		v = v * base + d;
+	}
+
+	*u = v;
+
+	return p;
+}
+
+/* to the first unescaped quote */
+static const char *
+quote(const char *p, const char *end)
+{
+	assert(p != NULL);
+	assert(end != NULL);
+
+	for (;;) {
+		p = memchr2(p, end, '"', '\\');
+		if (p == end) {
+			return NULL;
+		}
+
+		if (*p == '"') {
+			return p;
+		}
+
+		p += 1 + (p + 1 < end);
+	}
+}
+
+/* the reverse of ap_escape_logitem(); unrecognised escapes are kept */
+static size_t
+unescape(const char *p, size_t n, char *buf)
+{
+	const char *s, *end;
+	char *q;
+
+	assert(p != NULL);
+	assert(buf != NULL);
+
+	q = buf;
+	end = p + n;
+
+	for (s = p; s < end; s++) {
+		const char *r;
+
+		/* the run up to the next escape, whole */
+		r = memchr2(s, end, '\\', '\\');
+		memcpy(q, s, r - s);
+		q += r - s;
+		s = r;
+
+		if (s == end) {
+			break;
+		}
+
+		if (s + 1 == end) {
+			*q++ = *s;
+			continue;
+		}
+
+		switch (s[1]) {
+		case 'b':  *q++ = '\b'; s++; continue;
+		case 'n':  *q++ = '\n'; s++; continue;
+		case 'r':  *q++ = '\r'; s++; continue;
+		case 't':  *q++ = '\t'; s++; continue;
+		case 'v':  *q++ = '\v'; s++; continue;
+		case '\\': *q++ = '\\'; s++; continue;
+		case '"':  *q++ = '"';  s++; continue;
+
+		case 'x':
+			if (end - s >= 4 && xdigit(s[2]) != -1 && xdigit(s[3]) != -1) {
+				*q++ = (char) (xdigit(s[2]) << 4 | xdigit(s[3]));
+				s += 3;
+				continue;
+			}
+			break;
+		}
+
+		*q++ = *s;
+	}
+
+	return q - buf;
+}
+
+static int
+digits(const char *p, size_t n, unsigned *u)
+{
+	size_t i;
+
+	*u = 0;
+
+	for (i = 0; i < n; i++) {
+		if (p[i] < '0' || p[i] > '9') {
+			return 0;
+		}
+
+		*u = *u * 10 + (p[i] - '0');
+	}
+
+	return 1;
+}
+
+/* "[10/Oct/2000:13:55:36 -0700]" */
+static int
+clf_time(const char *p, long long *t)
+{
+	static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+	unsigned d, m, y, hh, mm, ss, zh, zm;
+	const char *s;
+	long long z;
+
+	assert(p != NULL);
+	assert(t != NULL);
+
+	if (p[0] != '[' || p[3] != '/' || p[7] != '/' || p[12] != ':'
+	 || p[15] != ':' || p[18] != ':' || p[21] != ' ' || p[27] != ']') {
+		return 0;
+	}
+
+	if (p[22] != '+' && p[22] != '-') {
+		return 0;
+	}
+
+	for (s = months; *s != '\0'; s += 3) {
+		if (0 == memcmp(s, p + 4, 3)) {
+			break;
+		}
+	}
+
+	if (*s == '\0') {
+		return 0;
+	}
+
+	m = (s - months) / 3 + 1;
+
+	if (!digits(p +  1, 2, &d)  || !digits(p +  8, 4, &y)
+	 || !digits(p + 13, 2, &hh) || !digits(p + 16, 2, &mm) || !digits(p + 19, 2, &ss)
+	 || !digits(p + 23, 2, &zh) || !digits(p + 25, 2, &zm)) {
+		return 0;
+	}
+
+	if (d < 1 || d > 31 || hh > 23 || mm > 59 || ss > 60 || zm > 59) {
+		return 0;
+	}
+
+	z = (zh * 60LL + zm) * 60;
+	if (p[22] == '-') {
+		z = -z;
+	}
+
+	*t = ((days(y, m, d) * 86400 + hh * 3600LL + mm * 60 + ss) - z) * 1000000;
+
+	return 1;
+}
+
+const char *
+lf_scan_int(const char *p, const char *end, unsigned base, int clf,
+	struct lf_field *f)
+{
+	const char *q;
+
+	assert(p != NULL);
+	assert(end != NULL);
+	assert(base == 10 || base == 16);
+	assert(f != NULL);
+
+	f->absent = 0;
+	f->u = 0;
+	f->t = 0;
+	f->s.p = p;
+	f->s.n = 0;
+
+	if (p < end && *p == '-') {
+		f->absent = !clf;
+		f->s.n = 1;
+		return p + 1;
+	}
+
+	q = number(p, end, base, &f->u);
+	if (q == NULL || q == p) {
+		return NULL;
+	}
+
+	f->s.n = q - p;
+
+	return q;
+}
+
+const char *
+lf_scan_sint(const char *p, const char *end, struct lf_field *f)
+{
+	unsigned long long u;
+	const char *q;
+	int neg;
+
+	assert(p != NULL);
+	assert(end != NULL);
+	assert(f != NULL);
+
+	f->absent = 0;
+	f->u = 0;
+	f->t = 0;
+	f->s.p = p;
+	f->s.n = 0;
+
+	neg = p < end && *p == '-';
+
+	q = number(p + neg, end, 10, &u);
+	if (q == NULL) {
+		return NULL;
+	}
+
+	if (q == p + neg) {
+		if (!neg) {
+			return NULL;
+		}
+
+		f->absent = 1;
+		f->s.n = 1;
+		return q;
+	}
+
+	if (u > (unsigned long long) LLONG_MAX + neg) {
+		return NULL;
+	}
+
+	/* -(u - 1) - 1 reaches LLONG_MIN without overflow */
+	f->t = !neg ? (long long) u : u == 0 ? 0 : -(long long) (u - 1) - 1;
+	f->s.n = q - p;
+
+	return q;
+}
+
+const char *
+lf_scan_time(const char *p, const char *end, struct lf_field *f)
+{
+	assert(p != NULL);
+	assert(end != NULL);
+	assert(f != NULL);
+
+	f->absent = 0;
+	f->u = 0;
+	f->t = 0;
+	f->s.p = p;
+	f->s.n = 0;
+
+	if (p < end && *p == '-') {
+		f->absent = 1;
+		f->s.n = 1;
+		return p + 1;
+	}
+
+	if (end - p < 28 || !clf_time(p, &f->t)) {
+		return NULL;
+	}
+
+	f->s.n = 28;
+
+	return p + 28;
+}
+
+void
+lf_scan_str(const char *p, const char *q, int escaped, int user,
+	struct lf_field *f, char *buf, size_t *bufn)
+{
+	assert(p != NULL);
+	assert(q != NULL);
+	assert(f != NULL);
+	assert(!escaped || bufn != NULL);
+
+	f->absent = 0;
+	f->u = 0;
+	f->t = 0;
+	f->s.p = p;
+	f->s.n = q - p;
+
+	if (f->s.n == 1 && *p == '-') {
+		f->absent = 1;
+	} else if (user && f->s.n == 2 && 0 == memcmp(p, "\"\"", 2)) {
+		/* Apache's way of logging an empty user */
+		f->s.n = 0;
+	} else if (escaped && memchr2(p, q, '\\', '\\') != q) {
+		f->s.p = buf + *bufn;
+		f->s.n = unescape(p, q - p, buf + *bufn);
+		*bufn += f->s.n;
+	}
+}
+
+static void
+scanerr(struct lf_err *ep, enum lf_errno e, const char *p, size_t n)
+{
+	if (ep == NULL) {
+		return;
+	}
+
+	ep->errnum = e;
+	ep->p = p;
+	ep->n = n;
+}
+
+int
+lf_scan(const struct lf_scanner *sc, const char *line, size_t len,
+	struct lf_field *fields, char *buf, struct lf_err *ep)
+{
+	const struct lf_prog *prog;
+	const char *p, *end;
+	size_t i, j, bufn;
+
+	assert(sc != NULL);
+	assert(line != NULL || len == 0);
+	assert(fields != NULL || sc->count == 0);
+	assert(buf != NULL || len == 0);
+
+	prog = sc->prog;
+
+	p    = line;
+	end  = line + len;
+	bufn = 0;
+
+	for (i = 0, j = 0; i < prog->count; i++) {
+		const struct op *op;
+		const struct field *f;
+		struct lf_field *out;
+		const char *q;
+
+		op = &prog->op[i];
+
+		if (op->type == OP_LITERAL) {
+			size_t k;
+
+			for (k = 0; k < op->n; k++) {
+				if (p + k == end || p[k] != op->p[k]) {
+					scanerr(ep, LF_ERR_EXPECTED_LITERAL, p + k, p + k < end);
+					return 0;
+				}
+			}
+
+			p += op->n;
+			continue;
+		}
+
+		f   = &sc->field[j];
+		out = &fields[j];
+
+		j++;
+
+		switch (f->lex) {
+		case LEX_INT:
+		case LEX_HEX:
+			q = lf_scan_int(p, end, f->lex == LEX_HEX ? 16 : 10, f->clf, out);
+			if (q == NULL) {
+				q = p;
+				while (q < end && xdigit(*q) != -1) {
+					q++;
+				}
+				scanerr(ep, LF_ERR_MALFORMED_INTEGER, p, q - p + (q == p && q < end));
+				return 0;
+			}
+			break;
+
+		case LEX_SINT:
+			q = lf_scan_sint(p, end, out);
+			if (q == NULL) {
+				q = p + (p < end && *p == '-');
+				while (q < end && xdigit(*q) != -1) {
+					q++;
+				}
+				scanerr(ep, LF_ERR_MALFORMED_INTEGER, p, q - p + (q == p && q < end));
+				return 0;
+			}
+			break;
+
+		case LEX_CLF_TIME:
+			q = lf_scan_time(p, end, out);
+			if (q == NULL) {
+				q = p;
+				while (q < end && *q != ']') {
+					q++;
+				}
+				scanerr(ep, LF_ERR_MALFORMED_TIME, p, q - p + (q < end));
+				return 0;
+			}
+			break;
+
+		case LEX_QUOTED:
+			q = quote(p, end);
+			if (q == NULL) {
+				scanerr(ep, LF_ERR_MISSING_CLOSING_QUOTE, p, end - p);
+				return 0;
+			}
+			break;
+
+		case LEX_DELIM: {
+			size_t k;
+
+			assert(f->delim != NULL);
+
+			q = p;
+
+			for (k = 0; ; k++) {
+				q = find(q, end, f->delim->p, f->delim->n);
+				if (q == NULL) {
+					scanerr(ep, LF_ERR_MISSING_DELIMITER, p, end - p);
+					return 0;
+				}
+
+				if (k == f->skip) {
+					break;
+				}
+
+				q += f->delim->n;
+			}
+			break;
+		}
+
+		case LEX_REST:
+			q = end;
+			break;
+
+		default:
+			assert(!"unreached");
+			return 0;
+		}
+
+		/* strings, as opposed to numbers and times */
+		if (f->lex >= LEX_QUOTED) {
+			lf_scan_str(p, q, f->escaped, f->op->type == OP_REMOTE_USER,
+				out, buf, &bufn);
+		}
+
+		p = q;
+	}
+
+	assert(j == sc->count);
+
+	if (p != end) {
+		scanerr(ep, LF_ERR_TRAILING_TEXT, p, end - p);
+		return 0;
+	}
+
+	return 1;
+}
@@ -37,6 +37,17 @@ lf_strerror(enum lf_errno e)
 	case LF_ERR_UNSUPPORTED:             return "Unsupported directive";
 	case LF_ERR_ERRNO:                   return strerror(errno);
 
+	case LF_ERR_AMBIGUOUS_DIRECTIVES:    return "Ambiguous adjacent directives";
+	case LF_ERR_EXPECTED_LITERAL:        return "Expected literal text";
+	case LF_ERR_MISSING_DELIMITER:       return "Missing delimiter";
+	case LF_ERR_MISSING_CLOSING_QUOTE:   return "Missing closing quote";
+	case LF_ERR_MALFORMED_INTEGER:       return "Malformed integer";
+	case LF_ERR_MALFORMED_TIME:          return "Malformed time";
+	case LF_ERR_TRAILING_TEXT:           return "Trailing text";
+
+	case LF_ERR_MALFORMED_RECORD:        return "Malformed record";
+	case LF_ERR_TRUNCATED_RECORD:        return "Truncated record";
+
 	default:
 		return "?";
 	}
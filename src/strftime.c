@@ -0,0 +1,266 @@
+/*
+ * Copyright 2017 Katherine Flavel
+ *
+ * See LICENCE for the full copyright terms.
+ */
+
+#include <assert.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+
+#include <lf/lf.h>
+
+#include "internal.h"
+
+/*
+ * strftime() formats for %{...}t, compiled once to a list of conversions
+ * and literal text, rather than interpreted for every line rendered.
+ * The output is strftime()'s in the C locale, as for glibc.
+ *
+ * Conversions which depend on more than struct tm and the C locale
+ * (%Z, %G, %g, %V), and the E and O modifiers, flags and widths,
+ * are not compiled; those formats are left to strftime() whole.
+ */
+
+/* the C locale's expansions */
+static const struct {
+	char c;
+	const char *s;
+} composite[] = {
+	{ 'c', "%a %b %e %H:%M:%S %Y" },
+	{ 'D', "%m/%d/%y"             },
+	{ 'F', "%Y-%m-%d"             },
+	{ 'r', "%I:%M:%S %p"          },
+	{ 'R', "%H:%M"                },
+	{ 'T', "%H:%M:%S"             },
+	{ 'x', "%m/%d/%y"             },
+	{ 'X', "%H:%M:%S"             }
+};
+
+static const char *const wday[] = {
+	"Sunday", "Monday", "Tuesday", "Wednesday", "Thursday", "Friday", "Saturday"
+};
+
+static const char *const month[] = {
+	"January", "February", "March",     "April",   "May",      "June",
+	"July",    "August",   "September", "October", "November", "December"
+};
+
+/* days since the epoch, for the proleptic Gregorian calendar */
+long long
+days(long long y, unsigned m, unsigned d)
+{
+	long long era;
+	unsigned yoe, doy, doe;
+
+	y -= m <= 2;
+	era = (y >= 0 ? y : y - 399) / 400;
+	yoe = (unsigned) (y - era * 400);
+	doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+	doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+
+	return era * 146097 + (long long) doe - 719468;
+}
+
+static void
+add(struct tf *tf, size_t *n, char c, const char *p, size_t len)
+{
+	if (tf != NULL) {
+		tf[*n].c = c;
+		tf[*n].p = p;
+		tf[*n].n = len;
+	}
+
+	(*n)++;
+}
+
+int
+tf_compile(const char *fmt, size_t len, struct tf *tf, size_t *n)
+{
+	const char *p, *q, *end;
+	size_t i;
+
+	assert(fmt != NULL);
+	assert(n != NULL);
+
+	/* strftime() stops at the first NUL */
+	q = memchr(fmt, '\0', len);
+	end = q != NULL ? q : fmt + len;
+
+	for (p = fmt; p < end; p = q) {
+		if (*p != '%') {
+			q = memchr(p, '%', end - p);
+			if (q == NULL) {
+				q = end;
+			}
+
+			add(tf, n, '\0', p, q - p);
+			continue;
+		}
+
+		if (p + 1 == end) {
+			return 0;
+		}
+
+		q = p + 2;
+
+		switch (p[1]) {
+		case 'a': case 'A': case 'b': case 'B': case 'C':
+		case 'd': case 'e': case 'H': case 'I': case 'j':
+		case 'k': case 'l': case 'm': case 'M': case 'n':
+		case 'p': case 'P': case 's': case 'S': case 't':
+		case 'u': case 'U': case 'w': case 'W': case 'y':
+		case 'Y': case 'z': case '%':
+			add(tf, n, p[1], NULL, 0);
+			continue;
+
+		case 'h':
+			add(tf, n, 'b', NULL, 0);
+			continue;
+		}
+
+		for (i = 0; i < sizeof composite / sizeof *composite; i++) {
+			if (composite[i].c == p[1]) {
+				break;
+			}
+		}
+
+		if (i == sizeof composite / sizeof *composite) {
+			return 0;
+		}
+
+		if (!tf_compile(composite[i].s, strlen(composite[i].s), tf, n)) {
+			assert(!"unreached");
+		}
+	}
+
+	return 1;
+}
+
+static char *
+num(char *q, long long v, unsigned width, char pad)
+{
+	char buf[24];
+	unsigned long long u;
+	size_t i;
+
+	u = v < 0 ? 0ULL - (unsigned long long) v : (unsigned long long) v;
+	i = sizeof buf;
+
+	do {
+		buf[--i] = '0' + u % 10;
+		u /= 10;
+	} while (u > 0);
+
+	while (sizeof buf - i < width) {
+		buf[--i] = pad;
+	}
+
+	if (v < 0) {
+		*q++ = '-';
+	}
+
+	memcpy(q, buf + i, sizeof buf - i);
+
+	return q + (sizeof buf - i);
+}
+
+size_t
+tf_render(const struct tf *tf, size_t count, long long t, const struct tm *tm,
+	char *buf, size_t size)
+{
+	long long year, off;
+	char *q, *end;
+	size_t i, z;
+
+	assert(tf != NULL || count == 0);
+	assert(tm != NULL);
+	assert(buf != NULL);
+
+	year = tm->tm_year + 1900LL;
+
+	/* strftime() pads and signs years outside these differently; leap seconds */
+	if (year < 1000 || year > 9999 || tm->tm_sec > 59) {
+		return 0;
+	}
+
+	q   = buf;
+	end = buf + size;
+
+	for (i = 0; i < count; i++) {
+		const struct tf *f = &tf[i];
+
+		/* enough for any one conversion; if not, strftime() decides */
+		if ((size_t) (end - q) <= (f->c == '\0' ? f->n : 24)) {
+			return 0;
+		}
+
+		switch (f->c) {
+		case '\0':
+			memcpy(q, f->p, f->n);
+			q += f->n;
+			break;
+
+		case 'a': memcpy(q, wday[tm->tm_wday], 3);  q += 3; break;
+		case 'b': memcpy(q, month[tm->tm_mon], 3);  q += 3; break;
+
+		case 'A':
+			z = strlen(wday[tm->tm_wday]);
+			memcpy(q, wday[tm->tm_wday], z);
+			q += z;
+			break;
+
+		case 'B':
+			z = strlen(month[tm->tm_mon]);
+			memcpy(q, month[tm->tm_mon], z);
+			q += z;
+			break;
+
+		case 'C': q = num(q, year / 100,                                    2, '0'); break;
+		case 'd': q = num(q, tm->tm_mday,                                   2, '0'); break;
+		case 'e': q = num(q, tm->tm_mday,                                   2, ' '); break;
+		case 'H': q = num(q, tm->tm_hour,                                   2, '0'); break;
+		case 'I': q = num(q, (tm->tm_hour + 11) % 12 + 1,                   2, '0'); break;
+		case 'j': q = num(q, tm->tm_yday + 1,                               3, '0'); break;
+		case 'k': q = num(q, tm->tm_hour,                                   2, ' '); break;
+		case 'l': q = num(q, (tm->tm_hour + 11) % 12 + 1,                   2, ' '); break;
+		case 'm': q = num(q, tm->tm_mon + 1,                                2, '0'); break;
+		case 'M': q = num(q, tm->tm_min,                                    2, '0'); break;
+		case 's': q = num(q, t,                                             1, '0'); break;
+		case 'S': q = num(q, tm->tm_sec,                                    2, '0'); break;
+		case 'u': q = num(q, (tm->tm_wday + 6) % 7 + 1,                     1, '0'); break;
+		case 'U': q = num(q, (tm->tm_yday + 7 - tm->tm_wday) / 7,           2, '0'); break;
+		case 'w': q = num(q, tm->tm_wday,                                   1, '0'); break;
+		case 'W': q = num(q, (tm->tm_yday + 7 - (tm->tm_wday + 6) % 7) / 7, 2, '0'); break;
+		case 'y': q = num(q, year % 100,                                    2, '0'); break;
+		case 'Y': q = num(q, year,                                          1, '0'); break;
+
+		case 'p': memcpy(q, tm->tm_hour < 12 ? "AM" : "PM", 2); q += 2; break;
+		case 'P': memcpy(q, tm->tm_hour < 12 ? "am" : "pm", 2); q += 2; break;
+
+		case 'n': *q++ = '\n'; break;
+		case 't': *q++ = '\t'; break;
+		case '%': *q++ = '%';  break;
+
+		case 'z':
+			/* the zone's offset, from the local time given for t */
+			off = days(year, tm->tm_mon + 1, tm->tm_mday) * 86400
+				+ tm->tm_hour * 3600 + tm->tm_min * 60 + tm->tm_sec - t;
+
+			*q++ = off < 0 ? '-' : '+';
+			if (off < 0) {
+				off = -off;
+			}
+
+			q = num(q, off / 3600 * 100 + off / 60 % 60, 4, '0');
+			break;
+
+		default:
+			assert(!"unreached");
+			return 0;
+		}
+	}
+
+	return q - buf;
+}
@@ -0,0 +1,664 @@
+/*
+ * Copyright 2017 Katherine Flavel
+ *
+ * See LICENCE for the full copyright terms.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+
+#include <lf/lf.h>
+
+#include "internal.h"
+
+/*
+ * Each ring is a single producer, single consumer queue of bytes. Its
+ * thread copies whole lines in and then publishes .head; the writer
+ * publishes .tail once what's between has been written. Anything
+ * published is whole lines, so the writer may write any ring's pending
+ * bytes next to any other's, and lines never interleave.
+ *
+ * Lines spilled from a full ring are pushed to a list per ring, each
+ * with the ring's .head at the time. The writer takes the list, then
+ * writes the ring's bytes up to each spilled line's .head before that
+ * line, and so each thread's lines are written in order. The thread
+ * goes back to its ring as soon as there's space again.
+ *
+ * The writer's lock is only for waking and waiting, and for the list
+ * of rings; the lines themselves never need it.
+ */
+
+enum {
+	WRITER_IOV = 64
+};
+
+#if defined(IOV_MAX) && IOV_MAX < WRITER_IOV
+#error IOV_MAX is too small
+#endif
+
+struct spill {
+	struct spill *next;
+	size_t head; /* the ring's .head when this was pushed */
+	size_t n;
+	char p[];
+};
+
+struct lf_ring {
+	struct lf_ring *next;   /* under w->lock */
+	struct lf_writer *w;
+
+	char *buf;
+	size_t mask;
+
+	size_t head;            /* written by the thread */
+	size_t ptail;           /* the thread's last view of .tail */
+	size_t tail;            /* written by the writer */
+	size_t drained;         /* the writer's, up to .head */
+
+	struct spill *spill;    /* pushed by the thread, taken by the writer */
+	int closed;
+};
+
+struct lf_writer {
+	struct lf_writer_config wc;
+	size_t ring_size;
+
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t wake;    /* for the writer */
+	pthread_cond_t space;   /* for threads blocked on a full ring */
+
+	struct lf_ring *rings;  /* under .lock */
+	unsigned waiters;       /* under .lock */
+	int stop;               /* under .lock */
+	int kick;
+
+	unsigned long long dropped;
+	int error;              /* the writer's, until joined */
+
+	struct iovec iov[WRITER_IOV];
+	size_t iovcnt;
+	struct spill *done;     /* spilled lines in .iov */
+};
+
+static void
+kick(struct lf_writer *w)
+{
+	if (__atomic_exchange_n(&w->kick, 1, __ATOMIC_ACQ_REL)) {
+		return;
+	}
+
+	pthread_mutex_lock(&w->lock);
+	pthread_cond_signal(&w->wake);
+	pthread_mutex_unlock(&w->lock);
+}
+
+static int
+drop(struct lf_writer *w, int e)
+{
+	__atomic_fetch_add(&w->dropped, 1, __ATOMIC_RELAXED);
+
+	errno = e;
+	return 0;
+}
+
+/* contiguous space at .head, of at least n bytes of space in all */
+static size_t
+reserve(struct lf_ring *r, size_t n)
+{
+	size_t size, off;
+
+	size = r->mask + 1;
+
+	if (size - (r->head - r->ptail) < n) {
+		r->ptail = LOAD(&r->tail);
+
+		if (size - (r->head - r->ptail) < n) {
+			return 0;
+		}
+	}
+
+	off = r->head & r->mask;
+
+	if (size - off < size - (r->head - r->ptail)) {
+		return size - off;
+	}
+
+	return size - (r->head - r->ptail);
+}
+
+static void
+copy(struct lf_ring *r, const char *p, size_t n)
+{
+	size_t off, z;
+
+	off = r->head & r->mask;
+	z   = r->mask + 1 - off;
+
+	if (z > n) {
+		z = n;
+	}
+
+	memcpy(r->buf + off, p, z);
+	memcpy(r->buf, p + z, n - z);
+}
+
+static void
+commit(struct lf_ring *r, size_t n)
+{
+	STORE(&r->head, r->head + n);
+
+	/* .ptail may be stale, and so pending is at most this */
+	if (r->head - r->ptail < r->w->wc.flush_size) {
+		return;
+	}
+
+	r->ptail = LOAD(&r->tail);
+
+	if (r->head - r->ptail >= r->w->wc.flush_size && !LOAD(&r->w->kick)) {
+		kick(r->w);
+	}
+}
+
+static int
+block(struct lf_ring *r, size_t n)
+{
+	struct lf_writer *w = r->w;
+
+	kick(w);
+
+	pthread_mutex_lock(&w->lock);
+	w->waiters++;
+
+	while (reserve(r, n) == 0) {
+		pthread_cond_wait(&w->space, &w->lock);
+	}
+
+	w->waiters--;
+	pthread_mutex_unlock(&w->lock);
+
+	return 1;
+}
+
+static int
+spill(struct lf_ring *r, const char *p, size_t n)
+{
+	struct spill *s;
+
+	s = malloc(sizeof *s + n);
+	if (s == NULL) {
+		return drop(r->w, ENOMEM);
+	}
+
+	s->head = r->head;
+	s->n    = n;
+	memcpy(s->p, p, n);
+
+	s->next = __atomic_load_n(&r->spill, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&r->spill, &s->next, s, 0,
+		__ATOMIC_RELEASE, __ATOMIC_RELAXED))
+		;
+
+	kick(r->w);
+
+	return 1;
+}
+
+int
+lf_ring_write(struct lf_ring *r, const char *line, size_t n)
+{
+	assert(r != NULL);
+	assert(line != NULL || n == 0);
+
+	if (n == 0) {
+		return 1;
+	}
+
+	if (reserve(r, n) > 0) {
+		copy(r, line, n);
+		commit(r, n);
+		return 1;
+	}
+
+	switch (r->w->wc.full) {
+	case LF_FULL_BLOCK:
+		if (n > r->mask + 1) {
+			return drop(r->w, EMSGSIZE);
+		}
+
+		(void) block(r, n);
+		copy(r, line, n);
+		commit(r, n);
+		return 1;
+
+	case LF_FULL_DROP:
+		if (n > r->mask + 1) {
+			return drop(r->w, EMSGSIZE);
+		}
+
+		return drop(r->w, ENOBUFS);
+
+	case LF_FULL_SPILL:
+		return spill(r, line, n);
+
+	default:
+		assert(!"unreached");
+		errno = EINVAL;
+		return 0;
+	}
+}
+
+int
+lf_ring_render(struct lf_ring *r, const struct lf_prog *prog,
+	const struct lf_record *rec)
+{
+	char a[1024], *p;
+	size_t n, z;
+	int ok;
+
+	assert(r != NULL);
+	assert(prog != NULL);
+	assert(rec != NULL);
+
+	p = a;
+
+	/* in place, where there's contiguous space for most lines */
+	if ((z = reserve(r, sizeof a)) > 0) {
+		n = lf_render(prog, rec, r->buf + (r->head & r->mask), z);
+		if (n < z) {
+			r->buf[(r->head & r->mask) + n] = '\n';
+			commit(r, n + 1);
+			return 1;
+		}
+
+		/* near the end of the ring, or longer than a */
+		if (n < sizeof a) {
+			(void) lf_render(prog, rec, a, sizeof a);
+		}
+	} else {
+		n = lf_render(prog, rec, a, sizeof a);
+	}
+
+	if (n >= sizeof a) {
+		p = malloc(n + 1);
+		if (p == NULL) {
+			return drop(r->w, ENOMEM);
+		}
+
+		(void) lf_render(prog, rec, p, n);
+	}
+
+	p[n] = '\n';
+
+	ok = lf_ring_write(r, p, n + 1);
+
+	if (p != a) {
+		free(p);
+	}
+
+	return ok;
+}
+
+/* write everything in .iov, and then let the rings reuse it */
+static void
+flush(struct lf_writer *w)
+{
+	struct iovec *iov;
+	struct lf_ring *r;
+	struct spill *s;
+	size_t cnt;
+	ssize_t n;
+
+	iov = w->iov;
+	cnt = w->iovcnt;
+
+	while (cnt > 0) {
+		n = writev(w->wc.fd, iov, (int) cnt);
+		if (n == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				struct pollfd pfd;
+
+				pfd.fd     = w->wc.fd;
+				pfd.events = POLLOUT;
+
+				(void) poll(&pfd, 1, -1);
+				continue;
+			}
+
+			if (w->error == 0) {
+				w->error = errno;
+			}
+
+			break;
+		}
+
+		/* the remainder of a short write */
+		while (cnt > 0 && (size_t) n >= iov->iov_len) {
+			n -= iov->iov_len;
+			iov++;
+			cnt--;
+		}
+
+		if (cnt > 0) {
+			iov->iov_base = (char *) iov->iov_base + n;
+			iov->iov_len -= n;
+		}
+	}
+
+	w->iovcnt = 0;
+
+	for (r = LOAD(&w->rings); r != NULL; r = r->next) {
+		STORE(&r->tail, r->drained);
+	}
+
+	while (w->done != NULL) {
+		s = w->done;
+		w->done = s->next;
+		free(s);
+	}
+}
+
+static void
+add(struct lf_writer *w, void *p, size_t n)
+{
+	if (w->iovcnt == WRITER_IOV) {
+		flush(w);
+	}
+
+	w->iov[w->iovcnt].iov_base = p;
+	w->iov[w->iovcnt].iov_len  = n;
+	w->iovcnt++;
+}
+
+/*
+ * The ring's bytes from .drained up to head, if any. head may be behind
+ * .drained where a line was spilled after head was loaded.
+ */
+static void
+take(struct lf_writer *w, struct lf_ring *r, size_t head)
+{
+	size_t off, z;
+
+	if (head - r->drained == 0 || head - r->drained > r->mask + 1) {
+		return;
+	}
+
+	off = r->drained & r->mask;
+	z   = r->mask + 1 - off;
+
+	if (z > head - r->drained) {
+		z = head - r->drained;
+	}
+
+	if (w->iovcnt + 2 > WRITER_IOV) {
+		flush(w);
+	}
+
+	add(w, r->buf + off, z);
+	if (z < head - r->drained) {
+		add(w, r->buf, head - r->drained - z);
+	}
+
+	r->drained = head;
+}
+
+static void
+drain(struct lf_writer *w)
+{
+	struct lf_ring *r, **rp;
+	struct spill *s, *next, *fifo;
+	size_t head;
+
+	for (r = LOAD(&w->rings); r != NULL; r = r->next) {
+		/*
+		 * .head is loaded before taking the list, so any line spilled
+		 * after the list is taken has a .head of at least this,
+		 * and isn't overtaken by the ring's bytes written here.
+		 */
+		head = LOAD(&r->head);
+
+		s = __atomic_exchange_n(&r->spill, NULL, __ATOMIC_ACQUIRE);
+
+		for (fifo = NULL; s != NULL; s = next) {
+			next = s->next;
+			s->next = fifo;
+			fifo = s;
+		}
+
+		/* each after the ring's bytes which were appended before it */
+		for (s = fifo; s != NULL; s = next) {
+			next = s->next;
+
+			take(w, r, s->head);
+
+			add(w, s->p, s->n);
+			s->next = w->done;
+			w->done = s;
+		}
+
+		take(w, r, head);
+	}
+
+	flush(w);
+
+	/* rings given back, once they're empty */
+	pthread_mutex_lock(&w->lock);
+
+	for (rp = &w->rings; *rp != NULL; ) {
+		r = *rp;
+
+		if (!LOAD(&r->closed) || LOAD(&r->head) != r->drained || LOAD(&r->spill) != NULL) {
+			rp = &r->next;
+			continue;
+		}
+
+		*rp = r->next;
+		free(r->buf);
+		free(r);
+	}
+
+	pthread_mutex_unlock(&w->lock);
+}
+
+static void *
+writer_main(void *opaque)
+{
+	struct lf_writer *w = opaque;
+	struct timespec ts;
+	int stop;
+
+	do {
+		pthread_mutex_lock(&w->lock);
+
+		/* space made by the last drain */
+		if (w->waiters > 0) {
+			pthread_cond_broadcast(&w->space);
+		}
+
+		if (!w->stop && !LOAD(&w->kick)) {
+			clock_gettime(CLOCK_REALTIME, &ts);
+			ts.tv_sec  += w->wc.flush_ms / 1000;
+			ts.tv_nsec += w->wc.flush_ms % 1000 * 1000000L;
+			if (ts.tv_nsec >= 1000000000L) {
+				ts.tv_sec++;
+				ts.tv_nsec -= 1000000000L;
+			}
+
+			(void) pthread_cond_timedwait(&w->wake, &w->lock, &ts);
+		}
+
+		stop = w->stop;
+
+		pthread_mutex_unlock(&w->lock);
+
+		STORE(&w->kick, 0);
+
+		drain(w);
+	} while (!stop);
+
+	return NULL;
+}
+
+struct lf_writer *
+lf_new_writer(const struct lf_writer_config *wc)
+{
+	struct lf_writer *w;
+	size_t size;
+	int e;
+
+	assert(wc != NULL);
+
+	if (wc->ring_size == 0 || wc->flush_ms == 0 || wc->ring_size > (size_t) -1 / 2 + 1) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	for (size = 1; size < wc->ring_size; size <<= 1)
+		;
+
+	w = malloc(sizeof *w);
+	if (w == NULL) {
+		return NULL;
+	}
+
+	memset(w, 0, sizeof *w);
+
+	w->wc = *wc;
+	w->ring_size = size;
+
+	pthread_mutex_init(&w->lock, NULL);
+	pthread_cond_init(&w->wake, NULL);
+	pthread_cond_init(&w->space, NULL);
+
+	e = pthread_create(&w->thread, NULL, writer_main, w);
+	if (e != 0) {
+		pthread_cond_destroy(&w->space);
+		pthread_cond_destroy(&w->wake);
+		pthread_mutex_destroy(&w->lock);
+		free(w);
+		errno = e;
+		return NULL;
+	}
+
+	return w;
+}
+
+struct lf_ring *
+lf_writer_ring(struct lf_writer *w)
+{
+	struct lf_ring *r;
+
+	assert(w != NULL);
+
+	r = malloc(sizeof *r);
+	if (r == NULL) {
+		return NULL;
+	}
+
+	memset(r, 0, sizeof *r);
+
+	r->buf = malloc(w->ring_size);
+	if (r->buf == NULL) {
+		free(r);
+		return NULL;
+	}
+
+	r->w    = w;
+	r->mask = w->ring_size - 1;
+
+	pthread_mutex_lock(&w->lock);
+	r->next = w->rings;
+	STORE(&w->rings, r);
+	pthread_mutex_unlock(&w->lock);
+
+	return r;
+}
+
+void
+lf_free_ring(struct lf_ring *r)
+{
+	struct lf_writer *w;
+
+	if (r == NULL) {
+		return;
+	}
+
+	w = r->w;
+
+	/* the writer frees it, once it's written out */
+	STORE(&r->closed, 1);
+
+	kick(w);
+}
+
+unsigned long long
+lf_writer_dropped(const struct lf_writer *w)
+{
+	assert(w != NULL);
+
+	return __atomic_load_n(&w->dropped, __ATOMIC_RELAXED);
+}
+
+int
+lf_free_writer(struct lf_writer *w)
+{
+	struct lf_ring *r;
+	struct spill *s;
+	int e;
+
+	if (w == NULL) {
+		return 1;
+	}
+
+	pthread_mutex_lock(&w->lock);
+	w->stop = 1;
+	pthread_cond_signal(&w->wake);
+	pthread_mutex_unlock(&w->lock);
+
+	(void) pthread_join(w->thread, NULL);
+
+	while (w->rings != NULL) {
+		r = w->rings;
+		w->rings = r->next;
+
+		while (r->spill != NULL) {
+			s = r->spill;
+			r->spill = s->next;
+			free(s);
+		}
+
+		free(r->buf);
+		free(r);
+	}
+
+	pthread_cond_destroy(&w->space);
+	pthread_cond_destroy(&w->wake);
+	pthread_mutex_destroy(&w->lock);
+
+	e = w->error;
+
+	free(w);
+
+	if (e != 0) {
+		errno = e;
+		return 0;
+	}
+
+	return 1;
+}
@@ -0,0 +1,201 @@
+/*
+ * Copyright 2017 Katherine Flavel
+ *
+ * See LICENCE for the full copyright terms.
+ */
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include <lf/lf.h>
+
+/*
+ * Each format's analysis is checked against what's expected: the kinds
+ * of directive and the needs, the redirects, the names for each table,
+ * and which statuses the union of predicates matches (tested over
+ * every status from 0 to 999). Exits non-zero on any difference.
+ */
+
+#define K(kind) (1ULL << LF_KIND_ ## kind)
+#define R(redirect) (1U << LF_REDIRECT_ ## redirect)
+
+struct expect {
+	const char *fmt;
+	unsigned long long kinds;
+	unsigned needs;
+	unsigned redirect;
+	const char *names[LF_TABLE_RESP_TRAILER + 1]; /* space separated */
+	const char *pred; /* the statuses matched, as ranges, or NULL for all */
+};
+
+static const struct expect a[] = {
+	{ LF_CLF,
+		K(REMOTE_HOSTNAME) | K(REMOTE_LOGNAME) | K(REMOTE_USER) | K(TIME)
+		| K(REQ_FIRST_LINE) | K(STATUS) | K(RESP_SIZE_CLF),
+		LF_NEED_HOSTNAME_LOOKUP | LF_NEED_TIME_BEGIN, R(ORIG) | R(FINAL),
+		{ "", "", "", "", "", "", "" }, NULL },
+
+	{ "%{Referer}i %{referer}i %{User-agent}i %{X}o %{a}C %{A}C %{x}e %{X}e %{n}n %{t}^ti %{T}^to",
+		K(REQ_HEADER) | K(REPLY_HEADER) | K(REQ_COOKIE) | K(ENV_VAR) | K(NOTE)
+		| K(REQ_TRAILER) | K(RESP_TRAILER),
+		0, R(FINAL),
+		{ "a A", "x", "Referer User-agent", "n", "X", "t", "T" }, NULL },
+
+	{ "%{end:%s}t %{begin:msec_frac}t",
+		K(TIME) | K(TIME_FRAC),
+		LF_NEED_TIME_BEGIN | LF_NEED_TIME_END | LF_NEED_TIME_SUBSEC, R(FINAL),
+		{ "", "", "", "", "", "", "" }, NULL },
+
+	{ "%T %{sec}t",
+		K(TIME_TAKEN) | K(TIME_FRAC),
+		LF_NEED_TIME_BEGIN | LF_NEED_TIME_END, R(ORIG) | R(FINAL),
+		{ "", "", "", "", "", "", "" }, NULL },
+
+	{ "%D %>U",
+		K(TIME_TAKEN) | K(URL_PATH),
+		LF_NEED_TIME_BEGIN | LF_NEED_TIME_END | LF_NEED_TIME_SUBSEC, R(ORIG) | R(FINAL),
+		{ "", "", "", "", "", "", "" }, NULL },
+
+	{ "%<U %<s",
+		K(URL_PATH) | K(STATUS),
+		0, R(ORIG),
+		{ "", "", "", "", "", "", "" }, NULL },
+
+	{ "- %400,501{X}i %200{Y}i %200U",
+		K(REQ_HEADER) | K(URL_PATH),
+		0, R(ORIG) | R(FINAL),
+		{ "", "", "X Y", "", "", "", "" }, "200 400 501" },
+
+	{ "%!200,404U %!200,500{X}i %302q",
+		K(URL_PATH) | K(REQ_HEADER) | K(QUERY_STRING),
+		0, R(ORIG) | R(FINAL),
+		{ "", "", "X", "", "", "", "" }, "0-199 201-999" },
+
+	{ "%!200,404U %!200,500{X}i %200q",
+		K(URL_PATH) | K(REQ_HEADER) | K(QUERY_STRING),
+		0, R(ORIG) | R(FINAL),
+		{ "", "", "X", "", "", "", "" }, NULL },
+
+	{ "literal only",
+		0, 0, 0,
+		{ "", "", "", "", "", "", "" }, NULL }
+};
+
+/* statuses as space separated ranges, e.g. "0-199 201-999" */
+static int
+in(const char *ranges, unsigned status)
+{
+	unsigned lo, hi;
+	int k;
+
+	if (ranges == NULL) {
+		return 1;
+	}
+
+	while (*ranges != '\0') {
+		if (2 != sscanf(ranges, "%u-%u%n", &lo, &hi, &k)) {
+			(void) sscanf(ranges, "%u%n", &lo, &k);
+			hi = lo;
+		}
+
+		if (status >= lo && status <= hi) {
+			return 1;
+		}
+
+		ranges += k;
+		ranges += strspn(ranges, " ");
+	}
+
+	return 0;
+}
+
+static int
+names(const struct lf_names *n, const char *expect)
+{
+	char buf[256];
+	size_t i, z;
+
+	z = 0;
+
+	for (i = 0; i < n->count; i++) {
+		z += sprintf(buf + z, "%s%.*s", i > 0 ? " " : "", (int) n->name[i].n, n->name[i].p);
+	}
+
+	buf[z] = '\0';
+
+	return 0 == strcmp(buf, expect);
+}
+
+int
+main(void)
+{
+	struct lf_analysis *an;
+	struct lf_config conf;
+	struct lf_prog *prog;
+	struct lf_err err;
+	unsigned status;
+	size_t i, t;
+	int r;
+
+	memset(&conf, 0, sizeof conf);
+
+	conf.hostname_lookups = 1;
+
+	r = 0;
+
+	for (i = 0; i < sizeof a / sizeof *a; i++) {
+		prog = lf_compile(&conf, a[i].fmt, &err);
+		if (prog == NULL) {
+			fprintf(stderr, "analyze: %s: error: %s\n", a[i].fmt, lf_strerror(err.errnum));
+			return 1;
+		}
+
+		an = lf_analyze(prog);
+		if (an == NULL) {
+			perror("lf_analyze");
+			return 1;
+		}
+
+		if (an->kinds != a[i].kinds) {
+			fprintf(stderr, "analyze: %s: kinds %llx, expected %llx\n",
+				a[i].fmt, an->kinds, a[i].kinds);
+			r = 1;
+		}
+
+		if (an->needs != a[i].needs) {
+			fprintf(stderr, "analyze: %s: needs %x, expected %x\n",
+				a[i].fmt, an->needs, a[i].needs);
+			r = 1;
+		}
+
+		if (an->redirect != a[i].redirect) {
+			fprintf(stderr, "analyze: %s: redirect %x, expected %x\n",
+				a[i].fmt, an->redirect, a[i].redirect);
+			r = 1;
+		}
+
+		for (t = 0; t <= LF_TABLE_RESP_TRAILER; t++) {
+			if (!names(&an->table[t], a[i].names[t])) {
+				fprintf(stderr, "analyze: %s: table %u differs from '%s'\n",
+					a[i].fmt, (unsigned) t, a[i].names[t]);
+				r = 1;
+			}
+		}
+
+		for (status = 0; status < 1000; status++) {
+			if (lf_pred_match(&an->pred, status) != in(a[i].pred, status)) {
+				fprintf(stderr, "analyze: %s: predicate differs for %u\n",
+					a[i].fmt, status);
+				r = 1;
+				break;
+			}
+		}
+
+		lf_free_analysis(an);
+		lf_free(prog);
+	}
+
+	return r;
+}
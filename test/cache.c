@@ -0,0 +1,233 @@
+/*
+ * Copyright 2017 Katherine Flavel
+ *
+ * See LICENCE for the full copyright terms.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include <lf/lf.h>
+
+/*
+ * The same format for configs which agree shares one program, and
+ * formats differing in the text or in the flags lf_compile() reads do
+ * not. Then several threads take and give back programs for a few
+ * formats while another purges, and each program taken must render as
+ * its format compiled alone does. Exits non-zero on any difference.
+ */
+
+enum {
+	THREADS = 4,
+	ROUNDS  = 20000
+};
+
+static const char *const fmt[] = {
+	LF_CLF, LF_VHLF, LF_NSCA, "%h %V %U", "%{Referer}i -> %U", ""
+};
+
+enum {
+	FORMATS = sizeof fmt / sizeof *fmt
+};
+
+static struct lf_cache *cache;
+static struct lf_config conf[2]; /* .hostname_lookups and not */
+static char expect[2][FORMATS][512];
+static int stop;
+
+static struct lf_record rec;
+
+static int
+custom(const struct lf_config *conf, void *opaque,
+	char c, const struct lf_pred *pred, enum lf_redirect redirect, const char *p, size_t n,
+	enum lf_errno *e)
+{
+	(void) conf;
+	(void) opaque;
+	(void) c;
+	(void) pred;
+	(void) redirect;
+	(void) p;
+	(void) n;
+	(void) e;
+
+	return 1;
+}
+
+static const struct lf_prog *
+get(const struct lf_config *conf, const char *fmt)
+{
+	const struct lf_prog *prog;
+	struct lf_err err;
+
+	prog = lf_cache_get(cache, conf, fmt, &err);
+	if (prog == NULL) {
+		fprintf(stderr, "cache: %s: error: %s\n", fmt, lf_strerror(err.errnum));
+		exit(1);
+	}
+
+	return prog;
+}
+
+static void *
+user(void *opaque)
+{
+	const struct lf_prog *prog;
+	unsigned t, i, k, h;
+	char line[512];
+	size_t n;
+
+	t = (unsigned) (size_t) opaque;
+
+	for (i = 0; i < ROUNDS; i++) {
+		k = (i * 7 + t) % FORMATS;
+		h = (i / 3 + t) % 2;
+
+		prog = get(&conf[h], fmt[k]);
+
+		n = lf_render(prog, &rec, line, sizeof line);
+		if (n >= sizeof line || 0 != strncmp(line, expect[h][k], n) || expect[h][k][n] != '\0') {
+			fprintf(stderr, "cache: '%.*s' differs from '%s'\n", (int) n, line, expect[h][k]);
+			exit(1);
+		}
+
+		lf_cache_put(cache, prog);
+	}
+
+	return NULL;
+}
+
+static void *
+purger(void *opaque)
+{
+	(void) opaque;
+
+	while (!__atomic_load_n(&stop, __ATOMIC_ACQUIRE)) {
+		(void) lf_cache_purge(cache);
+	}
+
+	return NULL;
+}
+
+int
+main(void)
+{
+	const struct lf_prog *a, *b, *c, *x, *y, *z;
+	struct lf_config other, over;
+	pthread_t thread[THREADS + 1];
+	struct lf_prog *prog;
+	struct lf_err err;
+	size_t i, k, h, n;
+
+	memset(&rec, 0, sizeof rec);
+	rec.ip[LF_IP_CLIENT].p = "192.0.2.1";
+	rec.ip[LF_IP_CLIENT].n = 9;
+	rec.remote_host.p      = "client.example.com";
+	rec.remote_host.n      = 18;
+	rec.url_path.p         = "/index.html";
+	rec.url_path.n         = 11;
+	rec.status             = 200;
+
+	for (h = 0; h < 2; h++) {
+		memset(&conf[h], 0, sizeof conf[h]);
+		conf[h].hostname_lookups = h;
+
+		for (k = 0; k < FORMATS; k++) {
+			prog = lf_compile(&conf[h], fmt[k], &err);
+			if (prog == NULL) {
+				fprintf(stderr, "cache: %s: error: %s\n", fmt[k], lf_strerror(err.errnum));
+				return 1;
+			}
+
+			n = lf_render(prog, &rec, expect[h][k], sizeof expect[h][k]);
+			assert(n < sizeof expect[h][k]);
+			expect[h][k][n] = '\0';
+
+			lf_free(prog);
+		}
+	}
+
+	cache = lf_new_cache();
+	if (cache == NULL) {
+		perror("lf_new_cache");
+		return 1;
+	}
+
+	/* a different config with the same flags shares the program */
+	other = conf[0];
+	other.keep_alive = 1;
+
+	memset(&over, 0, sizeof over);
+	over.override = "h";
+	over.custom   = custom;
+
+	a = get(&conf[0], LF_CLF);
+	b = get(&other,   LF_CLF);
+	x = get(&conf[1], LF_CLF);
+	y = get(&over,    LF_CLF);
+	z = get(&conf[0], LF_CLF " ");
+
+	/* the same format by length, not NUL terminated */
+	c = lf_cache_getn(cache, &conf[0], LF_CLF "xyz", strlen(LF_CLF), &err);
+
+	if (a != b || a != c || a == x || a == y || a == z || x == y
+	 || 0 != strcmp(lf_fmt(a), LF_CLF)) {
+		fprintf(stderr, "cache: programs shared wrongly\n");
+		return 1;
+	}
+
+	/* a failure isn't cached */
+	if (lf_cache_get(cache, &conf[0], "%", &err) != NULL || err.errnum == LF_ERR_ERRNO) {
+		fprintf(stderr, "cache: expected an error\n");
+		return 1;
+	}
+
+	/* held, so nothing to purge */
+	if (lf_cache_purge(cache) != 0) {
+		fprintf(stderr, "cache: programs purged while held\n");
+		return 1;
+	}
+
+	lf_cache_put(cache, a);
+	lf_cache_put(cache, b);
+	lf_cache_put(cache, c);
+	lf_cache_put(cache, x);
+	lf_cache_put(cache, y);
+	lf_cache_put(cache, z);
+
+	if (lf_cache_purge(cache) != 4) {
+		fprintf(stderr, "cache: expected 4 programs purged\n");
+		return 1;
+	}
+
+	for (i = 0; i < THREADS; i++) {
+		errno = pthread_create(&thread[i], NULL, user, (void *) i);
+		if (errno != 0) {
+			perror("pthread_create");
+			return 1;
+		}
+	}
+
+	errno = pthread_create(&thread[THREADS], NULL, purger, NULL);
+	if (errno != 0) {
+		perror("pthread_create");
+		return 1;
+	}
+
+	for (i = 0; i < THREADS; i++) {
+		(void) pthread_join(thread[i], NULL);
+	}
+
+	__atomic_store_n(&stop, 1, __ATOMIC_RELEASE);
+	(void) pthread_join(thread[THREADS], NULL);
+
+	lf_free_cache(cache);
+
+	return 0;
+}
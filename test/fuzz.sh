@@ -38,7 +38,7 @@ while true; do
 		;;
 	esac | radamsa -o $BUILD/test/fuzz.fmt
 
-	$BUILD/bin/lfdump "`cat $BUILD/test/fuzz.fmt`" \
+	$BUILD/bin/lfdump -- "`cat $BUILD/test/fuzz.fmt`" \
 		>  $BUILD/test/fuzz.out \
 		2> $BUILD/test/fuzz.err
 	r=$?
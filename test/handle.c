@@ -0,0 +1,202 @@
+/*
+ * Copyright 2017 Katherine Flavel
+ *
+ * See LICENCE for the full copyright terms.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include <lf/lf.h>
+
+/*
+ * Several threads render with whichever program is pinned, while
+ * another reloads among a few formats, and sometimes a format which
+ * fails to compile. Each line must render as its program's format did
+ * compiled alone, a failed reload must keep the program there was,
+ * and (under a sanitizer) nothing may be used once freed, or leaked.
+ * Exits non-zero on any difference.
+ */
+
+enum {
+	THREADS = 4,
+	ROUNDS  = 50000,
+	RELOADS = 5000
+};
+
+static const char *const fmt[] = {
+	LF_CLF, LF_VHLF, LF_NSCA, "%h %U", "%{Referer}i -> %U"
+};
+
+enum {
+	FORMATS = sizeof fmt / sizeof *fmt
+};
+
+static struct lf_handle *handle;
+static struct lf_config conf;
+static char expect[FORMATS][512];
+
+static struct lf_record rec;
+
+static void *
+user(void *opaque)
+{
+	const struct lf_prog *prog;
+	struct lf_reader *r;
+	char line[512];
+	size_t k, n;
+	unsigned i;
+
+	(void) opaque;
+
+	r = lf_handle_reader(handle);
+	if (r == NULL) {
+		perror("lf_handle_reader");
+		exit(1);
+	}
+
+	for (i = 0; i < ROUNDS; i++) {
+		prog = lf_reader_pin(r);
+
+		for (k = 0; k < FORMATS; k++) {
+			if (0 == strcmp(lf_fmt(prog), fmt[k])) {
+				break;
+			}
+		}
+
+		n = lf_render(prog, &rec, line, sizeof line);
+		if (k == FORMATS || n >= sizeof line
+		 || 0 != strncmp(line, expect[k], n) || expect[k][n] != '\0') {
+			fprintf(stderr, "handle: '%.*s' differs\n", (int) n, line);
+			exit(1);
+		}
+
+		lf_reader_unpin(r);
+	}
+
+	lf_free_reader(r);
+
+	return NULL;
+}
+
+int
+main(void)
+{
+	const struct lf_prog *prog;
+	pthread_t thread[THREADS];
+	struct lf_reader *r;
+	struct lf_err err;
+	size_t i, n;
+
+	memset(&rec, 0, sizeof rec);
+	rec.ip[LF_IP_CLIENT].p = "192.0.2.1";
+	rec.ip[LF_IP_CLIENT].n = 9;
+	rec.url_path.p         = "/index.html";
+	rec.url_path.n         = 11;
+	rec.status             = 200;
+
+	memset(&conf, 0, sizeof conf);
+
+	for (i = 0; i < FORMATS; i++) {
+		struct lf_prog *p;
+
+		p = lf_compile(&conf, fmt[i], &err);
+		if (p == NULL) {
+			fprintf(stderr, "handle: %s: error: %s\n", fmt[i], lf_strerror(err.errnum));
+			return 1;
+		}
+
+		n = lf_render(p, &rec, expect[i], sizeof expect[i]);
+		assert(n < sizeof expect[i]);
+		expect[i][n] = '\0';
+
+		lf_free(p);
+	}
+
+	handle = lf_new_handle(&conf, fmt[0], &err);
+	if (handle == NULL) {
+		fprintf(stderr, "handle: error: %s\n", lf_strerror(err.errnum));
+		return 1;
+	}
+
+	/* a program pinned stays, across reloads */
+	r = lf_handle_reader(handle);
+	if (r == NULL) {
+		perror("lf_handle_reader");
+		return 1;
+	}
+
+	prog = lf_reader_pin(r);
+
+	if (!lf_handle_reload(handle, &conf, fmt[1], &err)
+	 || !lf_handle_reload(handle, &conf, fmt[2], &err)) {
+		fprintf(stderr, "handle: error: %s\n", lf_strerror(err.errnum));
+		return 1;
+	}
+
+	if (0 != strcmp(lf_fmt(prog), fmt[0])) {
+		fprintf(stderr, "handle: pinned program changed\n");
+		return 1;
+	}
+
+	lf_reader_unpin(r);
+
+	prog = lf_reader_pin(r);
+	if (0 != strcmp(lf_fmt(prog), fmt[2])) {
+		fprintf(stderr, "handle: reload not seen\n");
+		return 1;
+	}
+	lf_reader_unpin(r);
+
+	/* a failed reload keeps what was there */
+	if (lf_handle_reload(handle, &conf, "%{x", &err) || err.errnum == LF_ERR_ERRNO) {
+		fprintf(stderr, "handle: expected an error\n");
+		return 1;
+	}
+
+	prog = lf_reader_pin(r);
+	if (0 != strcmp(lf_fmt(prog), fmt[2])) {
+		fprintf(stderr, "handle: failed reload changed the program\n");
+		return 1;
+	}
+	lf_reader_unpin(r);
+
+	lf_free_reader(r);
+
+	for (i = 0; i < THREADS; i++) {
+		errno = pthread_create(&thread[i], NULL, user, NULL);
+		if (errno != 0) {
+			perror("pthread_create");
+			return 1;
+		}
+	}
+
+	for (i = 0; i < RELOADS; i++) {
+		if (i % 10 == 9) {
+			if (lf_handle_reload(handle, &conf, "%!", &err)) {
+				fprintf(stderr, "handle: expected an error\n");
+				return 1;
+			}
+			continue;
+		}
+
+		if (!lf_handle_reload(handle, &conf, fmt[i % FORMATS], &err)) {
+			fprintf(stderr, "handle: error: %s\n", lf_strerror(err.errnum));
+			return 1;
+		}
+	}
+
+	for (i = 0; i < THREADS; i++) {
+		(void) pthread_join(thread[i], NULL);
+	}
+
+	lf_free_handle(handle);
+
+	return 0;
+}
@@ -0,0 +1,225 @@
+/*
+ * Copyright 2017 Katherine Flavel
+ *
+ * See LICENCE for the full copyright terms.
+ */
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <locale.h>
+
+#include <lf/lf.h>
+
+/*
+ * Made-up requests, with headers named in any case, some repeated,
+ * are rendered with their headers resolved by lf_headers_resolve(),
+ * and must render as they do when each directive searches the headers
+ * itself. The same again for another program of the same format,
+ * which looks up by name instead. Exits non-zero on any difference.
+ *
+ * Names fold as ASCII whatever the locale, so this runs in a Turkish
+ * locale where there is one, for which tolower('I') isn't 'i'.
+ */
+
+#define FMT "%{Referer}i %{referer}i %{HOST}i %{X-Missing}i %{Content-Type}o" \
+	" %{x-trailer}^ti %{X-Trailer}^to %{Host}o %{session}C %400{Referer}i %<{User-Agent}i"
+
+enum {
+	REQUESTS = 5000,
+	HEADERS  = 12
+};
+
+static unsigned long long seed = 88172645463325252ULL;
+
+static unsigned long long
+next(void)
+{
+	seed ^= seed << 13;
+	seed ^= seed >> 7;
+	seed ^= seed << 17;
+
+	return seed;
+}
+
+static const char *const names[] = {
+	"Referer", "Host", "Content-Type", "X-Trailer", "User-Agent", "Accept", "X-Other"
+};
+
+static const char *const values[] = {
+	"a", "http://example.com/", "text/html", "", "curl/8.4.0", "b c"
+};
+
+struct req {
+	struct lf_header h[4][HEADERS]; /* by table, for those folded */
+	size_t n[4];
+	char name[4][HEADERS][16];
+};
+
+static const enum lf_table tables[] = {
+	LF_TABLE_REQ_HEADER, LF_TABLE_REPLY_HEADER, LF_TABLE_REQ_TRAILER, LF_TABLE_RESP_TRAILER
+};
+
+static char
+fold(char c)
+{
+	return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+}
+
+static struct lf_str
+str(const char *s)
+{
+	struct lf_str r;
+
+	r.p = s;
+	r.n = s != NULL ? strlen(s) : 0;
+
+	return r;
+}
+
+/* cookies aren't resolved, and so come from here either way */
+static struct lf_str
+cookie(void *opaque, enum lf_table table, const char *name, size_t n)
+{
+	(void) opaque;
+
+	if (table == LF_TABLE_REQ_COOKIE && n == 7 && 0 == memcmp(name, "session", n)) {
+		return str("s1");
+	}
+
+	return str(NULL);
+}
+
+/* the first header of this name, compared one by one */
+static struct lf_str
+naive(void *opaque, enum lf_table table, const char *name, size_t n)
+{
+	const struct req *q = opaque;
+	size_t t, i, k;
+
+	for (t = 0; t < 4; t++) {
+		if (tables[t] != table) {
+			continue;
+		}
+
+		for (i = 0; i < q->n[t]; i++) {
+			if (q->h[t][i].name.n != n) {
+				continue;
+			}
+
+			for (k = 0; k < n; k++) {
+				if (fold(q->h[t][i].name.p[k]) != fold(name[k])) {
+					break;
+				}
+			}
+
+			if (k == n) {
+				return q->h[t][i].value;
+			}
+		}
+
+		return str(NULL);
+	}
+
+	return cookie(NULL, table, name, n);
+}
+
+static void
+make(struct req *q)
+{
+	size_t t, i, k;
+
+	for (t = 0; t < 4; t++) {
+		q->n[t] = next() % HEADERS;
+
+		for (i = 0; i < q->n[t]; i++) {
+			char *s = q->name[t][i];
+
+			strcpy(s, names[next() % (sizeof names / sizeof *names)]);
+
+			/* any case */
+			for (k = 0; s[k] != '\0'; k++) {
+				if (next() % 3 == 0 && fold(s[k]) == fold(s[k] ^ 0x20)) {
+					s[k] ^= 0x20;
+				}
+			}
+
+			q->h[t][i].name  = str(s);
+			q->h[t][i].value = str(values[next() % (sizeof values / sizeof *values)]);
+		}
+	}
+}
+
+int
+main(void)
+{
+	static struct req q;
+	struct lf_headers *hs;
+	struct lf_prog *prog, *other;
+	struct lf_config conf;
+	struct lf_record rec;
+	struct lf_err err;
+	char a[1024], b[1024];
+	size_t i, t, n, m;
+
+	/* not there on every system, which is fine */
+	(void) setlocale(LC_CTYPE, "tr_TR.ISO-8859-9");
+
+	memset(&conf, 0, sizeof conf);
+
+	prog  = lf_compile(&conf, FMT, &err);
+	other = lf_compile(&conf, FMT, &err);
+	if (prog == NULL || other == NULL) {
+		fprintf(stderr, "error: %s\n", lf_strerror(err.errnum));
+		return 1;
+	}
+
+	hs = lf_new_headers(prog);
+	if (hs == NULL) {
+		perror("lf_new_headers");
+		return 1;
+	}
+
+	memset(&rec, 0, sizeof rec);
+
+	for (i = 0; i < REQUESTS; i++) {
+		make(&q);
+
+		rec.status = next() % 2 ? 200 : 400;
+
+		rec.lookup = naive;
+		rec.opaque = &q;
+
+		n = lf_render(prog, &rec, a, sizeof a);
+		assert(n < sizeof a);
+
+		lf_headers_reset(hs, cookie, NULL);
+
+		for (t = 0; t < 4; t++) {
+			(void) lf_headers_resolve(hs, tables[t], q.h[t], q.n[t]);
+		}
+
+		rec.lookup = lf_headers_lookup;
+		rec.opaque = hs;
+
+		m = lf_render(prog, &rec, b, sizeof b);
+		if (m != n || 0 != memcmp(a, b, n)) {
+			fprintf(stderr, "headers: '%.*s' differs from '%.*s'\n", (int) m, b, (int) n, a);
+			return 1;
+		}
+
+		/* by name, for a program these weren't resolved for */
+		m = lf_render(other, &rec, b, sizeof b);
+		if (m != n || 0 != memcmp(a, b, n)) {
+			fprintf(stderr, "headers: by name: '%.*s' differs from '%.*s'\n", (int) m, b, (int) n, a);
+			return 1;
+		}
+	}
+
+	lf_free_headers(hs);
+	lf_free(other);
+	lf_free(prog);
+
+	return 0;
+}
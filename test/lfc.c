@@ -0,0 +1,150 @@
+/*
+ * Copyright 2017 Katherine Flavel
+ *
+ * See LICENCE for the full copyright terms.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include <lf/lf.h>
+
+#include "sample.h"
+
+/*
+ * Checks the code lfc generated for one format against the interpreter:
+ * the sample request from lfrender is rendered by both lf_render() and
+ * lfc_render(), and the line is scanned back by both lf_scan() and
+ * lfc_scan(). Exits non-zero if they differ in any way.
+ */
+
+extern const char lfc_fmt[];
+
+size_t
+lfc_render(const struct lf_record *rec, char *buf, size_t size);
+
+int
+lfc_scan(const char *line, size_t len, struct lf_field *fields, char *buf);
+
+static int
+fail(const char *what)
+{
+	fprintf(stderr, "lfc: %s differs for '%s'\n", what, lfc_fmt);
+	return 1;
+}
+
+static int
+same(const struct lf_column *col, const struct lf_field *a, const struct lf_field *b)
+{
+	if (a->absent != b->absent) {
+		return 0;
+	}
+
+	if (a->absent) {
+		return 1;
+	}
+
+	switch (col->type) {
+	case LF_TYPE_INT:  return a->u == b->u;
+	case LF_TYPE_TIME:
+	case LF_TYPE_SINT: return a->t == b->t;
+
+	case LF_TYPE_STR:
+		return a->s.n == b->s.n && 0 == memcmp(a->s.p, b->s.p, a->s.n);
+	}
+
+	return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct lf_record rec, final;
+	struct lf_config conf;
+	struct lf_scanner *sc;
+	const struct lf_column *col;
+	struct lf_field *fa, *fb;
+	struct lf_prog *prog;
+	struct lf_err err;
+	char a[8192], b[sizeof a];
+	char *ta, *tb;
+	size_t n, m, i, count;
+	int ra, rb;
+
+	(void) argv;
+
+	memset(&conf, 0, sizeof conf);
+
+	prog = lf_compile(&conf, lfc_fmt, &err);
+	sc   = lf_compile_scanner(&conf, lfc_fmt, &err);
+	if (prog == NULL || sc == NULL) {
+		fprintf(stderr, "error: %s\n", lf_strerror(err.errnum));
+		return 1;
+	}
+
+	sample(&rec);
+
+	/* any argument internally redirects to an error page, as lfrender -r */
+	if (argc > 1) {
+		final = rec;
+		final.status = 404;
+		final.url_path.p = "/404.html";
+		final.url_path.n = 9;
+		final.resp_size = 0;
+
+		rec.final = &final;
+	}
+
+	n = lf_render(prog, &rec, a, sizeof a);
+	m = lfc_render(&rec, b, sizeof b);
+	if (n != m || n > sizeof a || 0 != memcmp(a, b, n)) {
+		return fail("rendering");
+	}
+
+	/* truncated output is counted the same */
+	if (lfc_render(&rec, b, n / 2) != n || 0 != memcmp(a, b, n / 2)) {
+		return fail("truncation");
+	}
+
+	col = lf_scanner_columns(sc, &count);
+
+	fa = malloc(count * sizeof *fa + 1);
+	fb = malloc(count * sizeof *fb + 1);
+	ta = malloc(n + 1);
+	tb = malloc(n + 1);
+	if (fa == NULL || fb == NULL || ta == NULL || tb == NULL) {
+		perror("malloc");
+		return 1;
+	}
+
+	ra = lf_scan(sc, a, n, fa, ta, NULL);
+	rb = lfc_scan(a, n, fb, tb);
+	if (ra != rb) {
+		return fail("scanning");
+	}
+
+	for (i = 0; ra && i < count; i++) {
+		if (!same(&col[i], &fa[i], &fb[i])) {
+			return fail("a field");
+		}
+	}
+
+	/* and a line which doesn't match, truncated */
+	if (n > 0 && lf_scan(sc, a, n - 1, fa, ta, NULL) != lfc_scan(a, n - 1, fb, tb)) {
+		return fail("scanning a truncated line");
+	}
+
+	free(fa);
+	free(fb);
+	free(ta);
+	free(tb);
+
+	lf_free_scanner(sc);
+	lf_free(prog);
+
+	return 0;
+}
@@ -0,0 +1,377 @@
+/*
+ * Copyright 2017 Katherine Flavel
+ *
+ * See LICENCE for the full copyright terms.
+ */
+
+#include <cerrno>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <unistd.h>
+
+#include <lf/lf.hpp>
+
+#ifdef FMT
+#include "sample.h"
+#endif
+
+/*
+ * Checks <lf/lf.hpp> against liblf.
+ *
+ * lfhpp -p fmt parses fmt at runtime with lf::parse(), and prints each
+ * hook as it's visited, exactly as lfdump -c does, errors included.
+ *
+ * When built with FMT defined (test/Makefile gives lfhpp.fmt.h by
+ * -include for each format), FMT is also parsed at compile time, and:
+ *
+ *   lfhpp [-r]  renders the sample request by both lf::render() and
+ *               lf_render(), redirected for -r, and exits non-zero
+ *               if they differ in any way;
+ *   lfhpp -d    prints each hook as lf::exec() visits it, as for -p.
+ */
+
+/* as lfdump's hooks, which are resolved statically here */
+struct dump {
+	static void
+	print(const lf_pred *pred, lf_redirect redirect)
+	{
+		size_t i;
+
+		if (pred->count > 0) {
+			if (pred->neg) {
+				std::printf("!");
+			}
+
+			for (i = 0; i < pred->count; i++) {
+				std::printf("%u%s", pred->status[i], i + 1 < pred->count ? "," : "");
+			}
+
+			std::printf(": ");
+		}
+
+		std::printf("%s", redirect == LF_REDIRECT_ORIG ? "<" : ">");
+	}
+
+	static int
+	simple(const lf_pred *pred, lf_redirect redirect, const char *s)
+	{
+		print(pred, redirect);
+		std::printf("%s\n", s);
+		return 1;
+	}
+
+	static int
+	named(const lf_pred *pred, lf_redirect redirect, const char *s, const char *name)
+	{
+		print(pred, redirect);
+		std::printf("%s: %s\n", s, name);
+		return 1;
+	}
+
+	int
+	literal(char c)
+	{
+		if (c == '\n' || c == '\t') {
+			errno = EDOM;
+			return 0;
+		}
+
+		if (std::isalnum((unsigned char) c) || std::ispunct((unsigned char) c) || c == ' ') {
+			std::printf("literal: '%c'\n", c);
+		} else {
+			std::printf("literal: \\x%02X\n", (unsigned char) c);
+		}
+		return 1;
+	}
+
+	int
+	ip(const lf_pred *pred, lf_redirect redirect, lf_ip ip)
+	{
+		static const char *s[] = { "client", "peer", "local" };
+
+		print(pred, redirect);
+		std::printf("ip (%s)\n", s[ip]);
+		return 1;
+	}
+
+	int
+	remote_hostname(const lf_pred *pred, lf_redirect redirect, int hostname_lookups)
+	{
+		print(pred, redirect);
+		std::printf("remote_hostname (hostname_lookups=%s)\n",
+			hostname_lookups ? "true" : "false");
+		return 1;
+	}
+
+	int
+	server_port(const lf_pred *pred, lf_redirect redirect, lf_port port)
+	{
+		static const char *s[] = { "canonical", "local", "remote" };
+
+		print(pred, redirect);
+		std::printf("server_port (%s)\n", s[port]);
+		return 1;
+	}
+
+	int
+	id(const lf_pred *pred, lf_redirect redirect, lf_id id)
+	{
+		static const char *s[] = { "pid", "tid", "hextid" };
+
+		print(pred, redirect);
+		std::printf("id (%s)\n", s[id]);
+		return 1;
+	}
+
+	int
+	time(const lf_pred *pred, lf_redirect redirect, lf_when when, const char *fmt)
+	{
+		print(pred, redirect);
+		std::printf("strftime: (when=%d, fmt=%s)\n", when, fmt);
+		return 1;
+	}
+
+	int
+	time_frac(const lf_pred *pred, lf_redirect redirect, lf_when when, lf_rtime unit)
+	{
+		static const char *s[] = { "%ms", "%us", "ms", "us", "s" };
+
+		print(pred, redirect);
+		std::printf("time_frac (when=%d, unit=%s)\n", when, s[unit]);
+		return 1;
+	}
+
+	int
+	time_taken(const lf_pred *pred, lf_redirect redirect, lf_rtime unit)
+	{
+		static const char *s[] = { "%ms", "%us", "ms", "us", "s" };
+
+		print(pred, redirect);
+		std::printf("time_taken (unit=%s)\n", s[unit]);
+		return 1;
+	}
+
+	int
+	server_name(const lf_pred *pred, lf_redirect redirect, int use_canonical_name)
+	{
+		print(pred, redirect);
+		std::printf("server_name: use_canonical_name=%s\n",
+			use_canonical_name ? "true" : "false");
+		return 1;
+	}
+
+	int resp_size(const lf_pred *p, lf_redirect r)      { return simple(p, r, "resp_size");      }
+	int resp_size_clf(const lf_pred *p, lf_redirect r)  { return simple(p, r, "resp_size_clf");  }
+	int filename(const lf_pred *p, lf_redirect r)       { return simple(p, r, "filename");       }
+	int req_protocol(const lf_pred *p, lf_redirect r)   { return simple(p, r, "req_header");     } /* sic, as lfdump */
+	int keepalive_reqs(const lf_pred *p, lf_redirect r) { return simple(p, r, "keepalive_reqs"); }
+	int remote_logname(const lf_pred *p, lf_redirect r) { return simple(p, r, "remote_logname"); }
+	int req_logid(const lf_pred *p, lf_redirect r)      { return simple(p, r, "req_logid");      }
+	int req_method(const lf_pred *p, lf_redirect r)     { return simple(p, r, "req_method");     }
+	int query_string(const lf_pred *p, lf_redirect r)   { return simple(p, r, "query_string");   }
+	int req_first_line(const lf_pred *p, lf_redirect r) { return simple(p, r, "req_first_line"); }
+	int resp_handler(const lf_pred *p, lf_redirect r)   { return simple(p, r, "resp_handler");   }
+	int status(const lf_pred *p, lf_redirect r)         { return simple(p, r, "status");         }
+	int remote_user(const lf_pred *p, lf_redirect r)    { return simple(p, r, "remote_user");    }
+	int url_path(const lf_pred *p, lf_redirect r)       { return simple(p, r, "url_path");       }
+	int conn_status(const lf_pred *p, lf_redirect r)    { return simple(p, r, "conn_status");    }
+	int bytes_recv(const lf_pred *p, lf_redirect r)     { return simple(p, r, "bytes_recv");     }
+	int bytes_sent(const lf_pred *p, lf_redirect r)     { return simple(p, r, "bytes_sent");     }
+	int bytes_xfer(const lf_pred *p, lf_redirect r)     { return simple(p, r, "bytes_xfer");     }
+
+	int req_cookie(const lf_pred *p, lf_redirect r, const char *n)   { return named(p, r, "req_cookie",   n); }
+	int env_var(const lf_pred *p, lf_redirect r, const char *n)      { return named(p, r, "env_var",      n); }
+	int req_header(const lf_pred *p, lf_redirect r, const char *n)   { return named(p, r, "req_header",   n); }
+	int note(const lf_pred *p, lf_redirect r, const char *n)         { return named(p, r, "note",         n); }
+	int reply_header(const lf_pred *p, lf_redirect r, const char *n) { return named(p, r, "reply_header", n); }
+	int req_trailer(const lf_pred *p, lf_redirect r, const char *n)  { return named(p, r, "req_trailer",  n); }
+	int resp_trailer(const lf_pred *p, lf_redirect r, const char *n) { return named(p, r, "resp_trailer", n); }
+};
+
+/* as lfdump's */
+static void
+print_error(const char *fmt, const lf_err *err)
+{
+	size_t i, z, n;
+	int r;
+
+	z = std::strlen(fmt);
+
+	if (err->errnum == LF_ERR_ERRNO && errno == EDOM) {
+		std::fprintf(stderr, "error: Disallowed character\n");
+	} else {
+		std::fprintf(stderr, "error: %s\n", lf_strerror(err->errnum));
+	}
+
+	r = std::fprintf(stderr, "at %lu: ", (unsigned long) (err->p - fmt));
+	std::fprintf(stderr, "'");
+	for (i = 0; i < z; i++) {
+		unsigned char c = fmt[i];
+		if (std::isalnum(c) || std::ispunct(c) || c == ' ') {
+			std::fprintf(stderr, "%c", c);
+		} else {
+			std::fprintf(stderr, ".");
+		}
+	}
+	std::fprintf(stderr, "'\n");
+
+	for (i = 0; (int) i < r + 1; i++) {
+		std::fprintf(stderr, "-");
+	}
+
+	for (i = 0; i < (size_t) (err->p - fmt); i++) {
+		std::fprintf(stderr, "-");
+	}
+
+	n = err->n;
+	if (n == 0) {
+		n++;
+	}
+
+	for (i = 0; i < n; i++) {
+		std::fprintf(stderr, "^");
+	}
+
+	std::fprintf(stderr, "\n");
+}
+
+#ifdef FMT
+
+using format = lf::format<FMT>;
+
+static int
+fail(const char *what)
+{
+	std::fprintf(stderr, "lfhpp: %s differs for '%s'\n", what, FMT);
+	return 1;
+}
+
+static int
+render(int redirect)
+{
+	struct lf_record rec, final;
+	struct lf_config conf;
+	struct lf_prog *prog;
+	struct lf_err err;
+	char a[8192], b[sizeof a];
+	std::size_t n, m;
+
+	std::memset(&conf, 0, sizeof conf);
+
+	prog = lf::compile(&conf, std::string_view(FMT, sizeof FMT - 1), &err);
+	if (prog == NULL) {
+		std::fprintf(stderr, "error: %s\n", lf_strerror(err.errnum));
+		return 1;
+	}
+
+	sample(&rec);
+
+	/* internally redirected to an error page, as lfrender -r */
+	if (redirect) {
+		final = rec;
+		final.status = 404;
+		final.url_path.p = "/404.html";
+		final.url_path.n = 9;
+		final.resp_size = 0;
+
+		rec.final = &final;
+	}
+
+	n = lf::render(prog, &rec, a, sizeof a);
+	m = format::render(&rec, b, sizeof b);
+	if (n != m || n > sizeof a || 0 != std::memcmp(a, b, n)) {
+		return fail("rendering");
+	}
+
+	/* truncated output is counted the same */
+	if (format::render(&rec, b, n / 2) != n || 0 != std::memcmp(a, b, n / 2)) {
+		return fail("truncation");
+	}
+
+	lf_free(prog);
+
+	return 0;
+}
+
+#endif
+
+static void
+usage(void)
+{
+	std::fprintf(stderr, "usage: lfhpp [-dr] [-p fmt]\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct lf_err err;
+	struct dump v;
+	const char *fmt;
+	int dump;
+	int redirect;
+
+	{
+		int c;
+
+		fmt      = NULL;
+		dump     = 0;
+		redirect = 0;
+
+		while (c = getopt(argc, argv, "dp:r"), c != -1) {
+			switch (c) {
+			case 'd':
+				dump = 1;
+				break;
+
+			case 'p':
+				fmt = optarg;
+				break;
+
+			case 'r':
+				redirect = 1;
+				break;
+
+			case '?':
+			default:
+				usage();
+				return 1;
+			}
+		}
+
+		if (argc != optind) {
+			usage();
+			return 1;
+		}
+	}
+
+	if (fmt != NULL) {
+		if (!lf::parse(v, fmt, &err)) {
+			print_error(fmt, &err);
+			return 1;
+		}
+
+		return 0;
+	}
+
+#ifdef FMT
+	if (dump) {
+		if (!format::exec(v, &err)) {
+			print_error(FMT, &err);
+			return 1;
+		}
+
+		return 0;
+	}
+
+	return render(redirect);
+#else
+	(void) dump;
+	(void) redirect;
+
+	usage();
+	return 1;
+#endif
+}
@@ -0,0 +1,107 @@
+/*
+ * Copyright 2017 Katherine Flavel
+ *
+ * See LICENCE for the full copyright terms.
+ */
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include <lf/lf.h>
+
+/*
+ * Each format's predicate is matched by lf_pred_match() against every
+ * status from 0 to 65535, which covers statuses inside the bitmap
+ * (LF_PRED_MIN..LF_PRED_MAX) and either side of it. Exits non-zero on
+ * any difference from what's expected.
+ */
+
+struct expect {
+	const char *fmt;
+	const char *status; /* space separated, or "" for an empty predicate */
+	int neg;
+};
+
+static const struct expect a[] = {
+	{ "%s",              "",             0 },
+	{ "%200s",           "200",          0 },
+	{ "%200,404s",       "200 404",      0 },
+	{ "%404,200,404s",   "200 404",      0 },
+	{ "%100,599s",       "100 599",      0 },
+	{ "%101,598s",       "101 598",      0 },
+	{ "%1,99,600,999s",  "1 99 600 999", 0 },
+	{ "%99,200,600s",    "99 200 600",   0 },
+	{ "%9999s",          "9999",         0 },
+	{ "%!200,404s",      "200 404",      1 },
+	{ "%!99,600s",       "99 600",       1 },
+	{ "%!1,100,599,9999s", "1 100 599 9999", 1 }
+};
+
+static int
+in(const char *list, unsigned status)
+{
+	unsigned u;
+	int k;
+
+	while (1 == sscanf(list, "%u%n", &u, &k)) {
+		if (u == status) {
+			return 1;
+		}
+
+		list += k;
+	}
+
+	return 0;
+}
+
+static int
+match(void *opaque, const struct lf_pred *pred, enum lf_redirect redirect)
+{
+	const struct expect *x = opaque;
+	unsigned status;
+	int r;
+
+	assert(x != NULL);
+	assert(pred != NULL);
+
+	(void) redirect;
+
+	for (status = 0; status <= 0xffffU; status++) {
+		if (*x->status == '\0') {
+			r = 1;
+		} else {
+			r = in(x->status, status) != x->neg;
+		}
+
+		if (lf_pred_match(pred, status) != r) {
+			fprintf(stderr, "pred: %s: %s for %u\n",
+				x->fmt, r ? "no match" : "unexpected match", status);
+			exit(1);
+		}
+	}
+
+	return 1;
+}
+
+int
+main(void)
+{
+	struct lf_config conf;
+	struct lf_err err;
+	size_t i;
+
+	memset(&conf, 0, sizeof conf);
+
+	conf.status = match;
+
+	for (i = 0; i < sizeof a / sizeof *a; i++) {
+		if (!lf_parse(&conf, (void *) &a[i], a[i].fmt, &err)) {
+			fprintf(stderr, "pred: %s: error: %s\n", a[i].fmt, lf_strerror(err.errnum));
+			return 1;
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,362 @@
+/*
+ * Copyright 2017 Katherine Flavel
+ *
+ * See LICENCE for the full copyright terms.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include <lf/lf.h>
+
+/*
+ * Encodes a stream of made-up requests, some redirected, with strings
+ * both repeated (for the dictionary) and not. The stream is decoded in
+ * pieces of every size, and each record must render as its request did.
+ * Then every truncation of the stream must say so, and corrupted streams
+ * must decode or fail, but not crash. Exits non-zero on any difference.
+ */
+
+#define FMT LF_NSCA " %v %V %m %H %q %L %k %p %{remote}p %P %{hextid}P %X %D %{%s}t" \
+	" %{end:usec_frac}t %I %O %S %>U %<U %400,501{X-Err}o %!200>s %{note}n %{X-Empty}i"
+
+enum {
+	RECORDS = 2000
+};
+
+static unsigned long long seed = 88172645463325252ULL;
+
+static unsigned long long
+next(void)
+{
+	seed ^= seed << 13;
+	seed ^= seed >> 7;
+	seed ^= seed << 17;
+
+	return seed;
+}
+
+static const char *const agent[] = {
+	"Mozilla/5.0 (X11; Linux x86_64; rv:109.0) Gecko/20100101 Firefox/115.0",
+	"curl/8.4.0",
+	"Mozilla/5.0 (Macintosh; Intel Mac OS X 10_15_7) AppleWebKit/605.1.15 (KHTML, like Gecko) Version/17.0 Safari/605.1.15"
+};
+
+static const char *const path[] = {
+	"/", "/index.html", "/a b", "/\"quoted\"", "/404.html"
+};
+
+struct req {
+	struct lf_record rec;
+	struct lf_record final;
+	char url[32];
+	char referer[96];
+	const char *agent;
+	const char *note;
+};
+
+static struct lf_str
+str(const char *s)
+{
+	struct lf_str r;
+
+	r.p = s;
+	r.n = s != NULL ? strlen(s) : 0;
+
+	return r;
+}
+
+static struct lf_str
+lookup(void *opaque, enum lf_table table, const char *name, size_t n)
+{
+	const struct req *q = opaque;
+
+	if (table == LF_TABLE_REQ_HEADER && n == 7 && 0 == memcmp(name, "Referer", n)) {
+		return str(q->referer[0] != '\0' ? q->referer : NULL);
+	}
+
+	if (table == LF_TABLE_REQ_HEADER && n == 10 && 0 == memcmp(name, "User-agent", n)) {
+		return str(q->agent);
+	}
+
+	if (table == LF_TABLE_REQ_HEADER && n == 7 && 0 == memcmp(name, "X-Empty", n)) {
+		return str("");
+	}
+
+	if (table == LF_TABLE_NOTE) {
+		return str(q->note);
+	}
+
+	return str(NULL);
+}
+
+static void
+make(struct req *q, unsigned i)
+{
+	struct lf_record *r = &q->rec;
+
+	memset(q, 0, sizeof *q);
+
+	/* unique, so never from the dictionary */
+	sprintf(q->url, "/item/%u", i * 7919u);
+	if (next() % 3 != 0) {
+		sprintf(q->referer, "http://www.example.com/page/%u", (unsigned) (next() % 50));
+	}
+
+	q->agent = next() % 5 == 0 ? NULL : agent[next() % 3];
+	q->note  = next() % 2 == 0 ? NULL : "noted";
+
+	r->ip[LF_IP_CLIENT] = str(next() % 4 == 0 ? "2001:db8::1" : "192.0.2.1");
+	r->remote_host      = str(NULL);
+	r->remote_logname   = str(NULL);
+	r->remote_user      = str(next() % 2 ? "frank" : next() % 2 ? "" : NULL);
+	r->server_name      = str("www.example.com");
+	r->host             = str(next() % 2 ? "example.com" : NULL);
+	r->req_method       = str(next() % 4 == 0 ? "POST" : "GET");
+	r->req_protocol     = str("HTTP/1.1");
+	r->req_first_line   = str("GET /x HTTP/1.1");
+	r->url_path         = str(path[next() % 5]);
+	r->query_string     = str(next() % 2 ? "x=1&y=\"2\"" : NULL);
+	r->req_logid        = str(q->url);
+
+	r->port[LF_PORT_CANONICAL] = 80;
+	r->port[LF_PORT_REMOTE]    = (unsigned) (next() % 65536);
+
+	r->status         = next() % 4 == 0 ? 404 : 200;
+	r->keepalive_reqs = (unsigned) (next() % 100);
+	r->aborted        = next() % 8 == 0;
+	r->keepalive      = next() % 2;
+
+	r->resp_size  = next() % 8 == 0 ? 0 : next() >> (next() % 64);
+	r->bytes_recv = next() >> 40;
+	r->bytes_sent = r->resp_size + 200;
+	r->bytes_xfer = r->bytes_recv + r->bytes_sent;
+
+	r->pid = 1234;
+	r->tid = next();
+
+	/* either side of the epoch */
+	r->time[LF_WHEN_BEGIN] = (long long) (next() % 4000000000000000ULL) - 1000000000000000LL;
+	r->time[LF_WHEN_END]   = r->time[LF_WHEN_BEGIN] + (long long) (next() % 5000000);
+
+	r->lookup = lookup;
+	r->opaque = q;
+
+	/* internally redirected to an error page */
+	if (next() % 4 == 0) {
+		q->final = *r;
+		q->final.status    = 501;
+		q->final.url_path  = str("/404.html");
+		q->final.resp_size = 0;
+
+		r->final = &q->final;
+	}
+}
+
+struct buf {
+	char *p;
+	size_t n;
+	size_t size;
+};
+
+static int
+put(void *opaque, const void *p, size_t n)
+{
+	struct buf *b = opaque;
+
+	if (b->size - b->n < n) {
+		char *tmp;
+
+		tmp = realloc(b->p, (b->size + n) * 2);
+		if (tmp == NULL) {
+			return 0;
+		}
+
+		b->p = tmp;
+		b->size = (b->size + n) * 2;
+	}
+
+	memcpy(b->p + b->n, p, n);
+	b->n += n;
+
+	return 1;
+}
+
+/* the whole stream, handed over step bytes at a time */
+static int
+decode(const struct buf *b, const struct buf *text, size_t step)
+{
+	struct lf_decoder *d;
+	struct lf_record rec;
+	struct lf_err err;
+	size_t off, avail, used, t;
+	char line[4096];
+	size_t n;
+
+	d = NULL;
+	off = 0;
+	avail = 0;
+	t = 0;
+
+	while (off < b->n) {
+		int ok;
+
+		if (d == NULL) {
+			d = lf_new_decoder(b->p + off, avail, &used, &err);
+			ok = d != NULL;
+		} else {
+			ok = lf_decode(d, b->p + off, avail, &used, &rec, &err);
+		}
+
+		if (!ok && err.errnum == LF_ERR_TRUNCATED_RECORD && off + avail < b->n) {
+			avail = avail + step < b->n - off ? avail + step : b->n - off;
+			continue;
+		}
+
+		if (!ok) {
+			fprintf(stderr, "record: step %lu: error: %s at %lu\n",
+				(unsigned long) step, lf_strerror(err.errnum), (unsigned long) off);
+			lf_free_decoder(d);
+			return 0;
+		}
+
+		if (off > 0) {
+			n = lf_render(lf_decoder_prog(d), &rec, line, sizeof line);
+			if (n > sizeof line || t + n + 1 > text->n
+			 || 0 != memcmp(line, text->p + t, n) || text->p[t + n] != '\n') {
+				fprintf(stderr, "record: step %lu: '%.*s' differs from the text at %lu\n",
+					(unsigned long) step, (int) n, line, (unsigned long) t);
+				lf_free_decoder(d);
+				return 0;
+			}
+
+			t += n + 1;
+		}
+
+		off   += used;
+		avail -= used;
+	}
+
+	lf_free_decoder(d);
+
+	if (t != text->n) {
+		fprintf(stderr, "record: step %lu: records missing\n", (unsigned long) step);
+		return 0;
+	}
+
+	return 1;
+}
+
+int
+main(void)
+{
+	static struct req q;
+	struct lf_config conf;
+	struct lf_encoder *e;
+	struct lf_decoder *d;
+	struct lf_record rec;
+	struct lf_prog *prog;
+	struct lf_err err;
+	struct buf b, text;
+	char line[4096];
+	size_t i, n, off, used, step;
+
+	memset(&conf, 0, sizeof conf);
+
+	conf.hostname_lookups = 1;
+
+	prog = lf_compile(&conf, FMT, &err);
+	if (prog == NULL) {
+		fprintf(stderr, "error: %s\n", lf_strerror(err.errnum));
+		return 1;
+	}
+
+	e = lf_new_encoder(&conf, prog);
+	if (e == NULL) {
+		perror("lf_new_encoder");
+		return 1;
+	}
+
+	memset(&b, 0, sizeof b);
+	memset(&text, 0, sizeof text);
+
+	if (!lf_encode_header(e, put, &b)) {
+		perror("lf_encode_header");
+		return 1;
+	}
+
+	for (i = 0; i < RECORDS; i++) {
+		make(&q, (unsigned) i);
+
+		n = lf_render(prog, &q.rec, line, sizeof line);
+		assert(n < sizeof line);
+		line[n++] = '\n';
+
+		if (!put(&text, line, n) || !lf_encode(e, &q.rec, put, &b)) {
+			perror("lf_encode");
+			return 1;
+		}
+	}
+
+	lf_free_encoder(e);
+
+	for (step = 1; step < 64; step += 13) {
+		if (!decode(&b, &text, step)) {
+			return 1;
+		}
+	}
+
+	if (!decode(&b, &text, b.n)) {
+		return 1;
+	}
+
+	/* a stream cut short anywhere in its first few records */
+	for (n = 0; n < 400; n++) {
+		d = lf_new_decoder(b.p, n, &used, &err);
+
+		for (off = used; d != NULL; off += used) {
+			if (!lf_decode(d, b.p + off, n - off, &used, &rec, &err)) {
+				break;
+			}
+		}
+
+		lf_free_decoder(d);
+
+		if (err.errnum != LF_ERR_TRUNCATED_RECORD) {
+			fprintf(stderr, "record: cut at %lu: error: %s\n",
+				(unsigned long) n, lf_strerror(err.errnum));
+			return 1;
+		}
+	}
+
+	/* any byte changed must not crash, though it may decode (to any time) */
+	for (i = 0; i < 2000; i++) {
+		size_t k = next() % 4000;
+		char c = b.p[k];
+
+		b.p[k] ^= 1 << (next() % 8);
+
+		d = lf_new_decoder(b.p, b.n, &used, &err);
+
+		for (off = used; d != NULL && off < b.n; off += used) {
+			if (!lf_decode(d, b.p + off, b.n - off, &used, &rec, &err)) {
+				break;
+			}
+		}
+
+		lf_free_decoder(d);
+
+		b.p[k] = c;
+	}
+
+	free(b.p);
+	free(text.p);
+
+	lf_free(prog);
+
+	return 0;
+}
@@ -0,0 +1,142 @@
+/*
+ * Copyright 2017 Katherine Flavel
+ *
+ * See LICENCE for the full copyright terms.
+ */
+
+#ifndef LF_TEST_SAMPLE_H
+#define LF_TEST_SAMPLE_H
+
+/*
+ * The sample request from lfrender, for the drivers which check
+ * generated code against lf_render(). This is C, and C++ too.
+ */
+
+#include <assert.h>
+#include <string.h>
+#include <ctype.h>
+
+#define STR(s) { s, sizeof s - 1 }
+
+struct entry {
+	enum lf_table table;
+	const char *name;
+	struct lf_str value;
+};
+
+/*
+ * A made-up request, after the example in Apache's documentation.
+ * Every field is populated, so that each directive has something to show.
+ */
+static const struct entry entries[] = {
+	{ LF_TABLE_REQ_HEADER,   "Referer",      STR("http://www.example.com/start.html") },
+	{ LF_TABLE_REQ_HEADER,   "User-agent",   STR("Mozilla/4.08 [en] (Win98; I ;Nav)") },
+	{ LF_TABLE_REQ_HEADER,   "X-Escape",     STR("a\"b\\c\nd\te\001f\377") },
+	{ LF_TABLE_REQ_HEADER,   "X-Empty",      STR("") },
+	{ LF_TABLE_REQ_HEADER,   "X-Long",       STR("Mozilla/5.0 (X11; Linux x86_64; rv:109.0) Gecko/20100101 ~_~ Firefox/115.0 "
+	                                             "\"quoted\" back\\slash\x7f del \xc3\xa9 utf-8 \x1f us, "
+	                                             "and then a clean tail of more than thirty-two bytes") },
+	{ LF_TABLE_REQ_COOKIE,   "session",      STR("abc123") },
+	{ LF_TABLE_ENV_VAR,      "HOME",         STR("/home/frank") },
+	{ LF_TABLE_NOTE,         "note",         STR("noted") },
+	{ LF_TABLE_REPLY_HEADER, "Content-Type", STR("image/gif") },
+	{ LF_TABLE_REQ_TRAILER,  "X-Checksum",   STR("d41d8cd9") },
+	{ LF_TABLE_RESP_TRAILER, "X-Status",     STR("done") }
+};
+
+static int
+caseeq(const char *a, const char *b, size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		if (tolower((unsigned char) a[i]) != tolower((unsigned char) b[i])) {
+			return 0;
+		}
+	}
+
+	return b[n] == '\0';
+}
+
+static struct lf_str
+lookup(void *opaque, enum lf_table table, const char *name, size_t n)
+{
+	struct lf_str none = { NULL, 0 };
+	size_t i;
+
+	assert(opaque == NULL);
+	assert(name != NULL);
+
+	for (i = 0; i < sizeof entries / sizeof *entries; i++) {
+		if (entries[i].table != table) {
+			continue;
+		}
+
+		/* header names are case-insensitive; the rest aren't */
+		if (table == LF_TABLE_REQ_HEADER || table == LF_TABLE_REPLY_HEADER
+		 || table == LF_TABLE_REQ_TRAILER || table == LF_TABLE_RESP_TRAILER) {
+			if (caseeq(name, entries[i].name, n)) {
+				return entries[i].value;
+			}
+		} else if (strlen(entries[i].name) == n && 0 == memcmp(name, entries[i].name, n)) {
+			return entries[i].value;
+		}
+	}
+
+	return none;
+}
+
+static void
+sample(struct lf_record *rec)
+{
+	struct lf_str none = { NULL, 0 };
+
+	assert(rec != NULL);
+
+	rec->final = NULL;
+
+	rec->ip[LF_IP_CLIENT].p = "192.0.2.1";    rec->ip[LF_IP_CLIENT].n = 9;
+	rec->ip[LF_IP_PEER  ].p = "192.0.2.2";    rec->ip[LF_IP_PEER  ].n = 9;
+	rec->ip[LF_IP_LOCAL ].p = "198.51.100.7"; rec->ip[LF_IP_LOCAL ].n = 12;
+
+	rec->port[LF_PORT_CANONICAL] = 80;
+	rec->port[LF_PORT_LOCAL]     = 8080;
+	rec->port[LF_PORT_REMOTE]    = 51234;
+
+	rec->remote_host    = none;
+	rec->remote_logname = none;
+
+	rec->remote_user.p    = "frank";                           rec->remote_user.n    = 5;
+	rec->server_name.p    = "www.example.com";                 rec->server_name.n    = 15;
+	rec->host.p           = "example.com";                     rec->host.n           = 11;
+	rec->req_first_line.p = "GET /apache_pb.gif?x=1 HTTP/1.0"; rec->req_first_line.n = 31;
+	rec->req_method.p     = "GET";                             rec->req_method.n     = 3;
+	rec->req_protocol.p   = "HTTP/1.0";                        rec->req_protocol.n   = 8;
+	rec->url_path.p       = "/apache_pb.gif";                  rec->url_path.n       = 14;
+	rec->query_string.p   = "x=1";                             rec->query_string.n   = 3;
+	rec->filename.p       = "/var/www/apache_pb.gif";          rec->filename.n       = 22;
+	rec->resp_handler     = none;
+	rec->req_logid.p      = "WhR2Uw";                          rec->req_logid.n      = 6;
+
+	rec->status         = 200;
+	rec->keepalive_reqs = 2;
+	rec->aborted        = 0;
+	rec->keepalive      = 1;
+
+	rec->resp_size  = 2326;
+	rec->bytes_recv = 512;
+	rec->bytes_sent = 2600;
+	rec->bytes_xfer = 3112;
+
+	rec->pid = 1234;
+	rec->tid = 140734567890432ULL;
+
+	/* 10/Oct/2000:20:55:36 UTC */
+	rec->time[LF_WHEN_BEGIN] = 971211336LL * 1000000 + 123456;
+	rec->time[LF_WHEN_END]   = rec->time[LF_WHEN_BEGIN] + 1500250;
+
+	rec->lookup = lookup;
+	rec->opaque = NULL;
+}
+
+#endif
@@ -0,0 +1,204 @@
+/*
+ * Copyright 2017 Katherine Flavel
+ *
+ * See LICENCE for the full copyright terms.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+
+#include <lf/lf.h>
+
+#include "sample.h"
+
+/*
+ * Checks times rendered by lf_render() against localtime_r() and
+ * strftime() directly, for seconds either side of changes for DST and
+ * for a range of years, rendered more than once, and again after each
+ * change of TZ. Exits non-zero if they differ in any way.
+ */
+
+/* POSIX TZ rules, so that no tz database is needed */
+static const char *zones[] = {
+	"UTC0",
+	"GMT0BST,M3.5.0/1,M10.5.0",
+	"EST5EDT,M3.2.0,M11.1.0",
+	"EST5EDT,M4.1.0,M10.5.0", /* the same names, but DST for less of the year */
+	"<+0530>-5:30",
+	"NZST-12NZDT,M9.5.0,M4.1.0/3"
+};
+
+/* changes for DST during 2017 in the zones above, in UTC */
+static const long long changes[] = {
+	1490490000, /* 26/Mar/2017:01:00:00, BST begins */
+	1509238800, /* 29/Oct/2017:01:00:00, BST ends */
+	1489302000, /* 12/Mar/2017:07:00:00, EDT begins */
+	1509861600, /* 05/Nov/2017:06:00:00, EDT ends */
+	1491055200, /* 01/Apr/2017:14:00:00, NZDT ends */
+	1506175200  /* 23/Sep/2017:14:00:00, NZDT begins */
+};
+
+/* the first and last years compiled formats render, and a sweep between */
+static const long long edges[] = {
+	-30610224001LL, /* 31/Dec/0999:23:59:59 */
+	-30610224000LL, /* 01/Jan/1000:00:00:00 */
+	253402300799LL, /* 31/Dec/9999:23:59:59 */
+	253402300800LL  /* 01/Jan/10000:00:00:00 */
+};
+
+enum {
+	SWEEP_FROM = -631152000,     /* 01/Jan/1950 */
+	SWEEP_STEP = 37 * 86400 + 3607
+};
+
+static const struct {
+	const char *fmt;
+	const char *begin;
+	const char *end;
+} cases[] = {
+	{ "%t %{end:[%d/%b/%Y:%T %z]}t",         "[%d/%b/%Y:%T %z]", "[%d/%b/%Y:%T %z]" },
+	{ "%{begin:%d/%b/%Y:%T %z}t %{end:%Z}t", "%d/%b/%Y:%T %z",   "%Z"               },
+	{ "%{%H:%M:%S %Z}t %{end:%H:%M:%S %Z}t", "%H:%M:%S %Z",      "%H:%M:%S %Z"      },
+
+	/* every conversion which is compiled */
+	{ "%{%a %A %b %B %C %d %e %H %I %j %k %l %m %M %n %p %P %s %S %t %u %U %w %W %y %Y %z %%}t "
+	  "%{end:%c|%D|%F|%h|%r|%R|%T|%x|%X}t",
+	  "%a %A %b %B %C %d %e %H %I %j %k %l %m %M %n %p %P %s %S %t %u %U %w %W %y %Y %z %%",
+	  "%c|%D|%F|%h|%r|%R|%T|%x|%X" },
+
+	/* and some which are left to strftime() */
+	{ "%{%G-W%V-%u %g}t %{end:%Ey %Od %-d %_H %10Y %}t",
+	  "%G-W%V-%u %g",
+	  "%Ey %Od %-d %_H %10Y %" }
+};
+
+static long long
+fdiv(long long n, long long d)
+{
+	return n / d - (n % d < 0);
+}
+
+static size_t
+expect(char *buf, size_t size, long long t, const char *fmt)
+{
+	struct tm tm;
+	time_t tt;
+
+	tt = (time_t) t;
+
+	if (localtime_r(&tt, &tm) == NULL) {
+		return 0;
+	}
+
+	return strftime(buf, size, fmt, &tm);
+}
+
+static int
+check(const struct lf_prog *prog, size_t i, const struct lf_record *rec)
+{
+	char a[256], b[256];
+	size_t n, m;
+
+	m  = expect(b, sizeof b, fdiv(rec->time[LF_WHEN_BEGIN], 1000000), cases[i].begin);
+	b[m++] = ' ';
+	m += expect(b + m, sizeof b - m, fdiv(rec->time[LF_WHEN_END], 1000000), cases[i].end);
+
+	n = lf_render(prog, rec, a, sizeof a);
+	if (n != m || 0 != memcmp(a, b, n)) {
+		fprintf(stderr, "time: TZ=%s: '%.*s', expected '%.*s'\n",
+			getenv("TZ"), (int) n, a, (int) m, b);
+		return 0;
+	}
+
+	return 1;
+}
+
+/* each zone twice, so that every change of TZ is for a cached second */
+static int
+zones_check(const struct lf_prog *prog, size_t i, const struct lf_record *rec)
+{
+	size_t z;
+	int k;
+
+	for (k = 0; k < 2; k++) {
+		for (z = 0; z < sizeof zones / sizeof *zones; z++) {
+			if (-1 == setenv("TZ", zones[z], 1)) {
+				perror("setenv");
+				return 0;
+			}
+
+			lf_tzset();
+
+			/* and again, from the cache */
+			if (!check(prog, i, rec) || !check(prog, i, rec)) {
+				return 0;
+			}
+		}
+	}
+
+	return 1;
+}
+
+int
+main(void)
+{
+	struct lf_record rec;
+	struct lf_config conf;
+	struct lf_prog *prog;
+	struct lf_err err;
+	long long t;
+	size_t i, j;
+	int d;
+
+	memset(&conf, 0, sizeof conf);
+
+	sample(&rec);
+
+	for (i = 0; i < sizeof cases / sizeof *cases; i++) {
+		prog = lf_compile(&conf, cases[i].fmt, &err);
+		if (prog == NULL) {
+			fprintf(stderr, "error: %s\n", lf_strerror(err.errnum));
+			return 1;
+		}
+
+		for (j = 0; j < sizeof changes / sizeof *changes; j++) {
+			for (d = -2; d <= 2; d++) {
+				/* the end is in the next second, across the change at d = -1 */
+				rec.time[LF_WHEN_BEGIN] = (changes[j] + d) * 1000000 + 999999;
+				rec.time[LF_WHEN_END]   = rec.time[LF_WHEN_BEGIN] + 1;
+
+				if (!zones_check(prog, i, &rec)) {
+					return 1;
+				}
+			}
+		}
+
+		for (j = 0; j < sizeof edges / sizeof *edges; j++) {
+			rec.time[LF_WHEN_BEGIN] = edges[j] * 1000000;
+			rec.time[LF_WHEN_END]   = rec.time[LF_WHEN_BEGIN] - 1;
+
+			if (!zones_check(prog, i, &rec)) {
+				return 1;
+			}
+		}
+
+		/* to 2100, both sides of the epoch */
+		for (t = SWEEP_FROM; t < 4102444800LL; t += SWEEP_STEP) {
+			rec.time[LF_WHEN_BEGIN] = t * 1000000;
+			rec.time[LF_WHEN_END]   = (t + 43200) * 1000000;
+
+			if (!zones_check(prog, i, &rec)) {
+				return 1;
+			}
+		}
+
+		lf_free(prog);
+	}
+
+	return 0;
+}
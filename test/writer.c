@@ -0,0 +1,242 @@
+/*
+ * Copyright 2017 Katherine Flavel
+ *
+ * See LICENCE for the full copyright terms.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+
+#include <lf/lf.h>
+
+/*
+ * Several threads append lines to one writer, through rings small enough
+ * to fill, for each enum lf_full. Every line must come out whole, and
+ * each thread's lines in order; none may be missing except those counted
+ * as dropped. Lines are alternately rendered and written as text,
+ * some too long to render in place, and (when spilling) some longer
+ * than a ring. Spilling is run again with each thread pausing between
+ * bursts, so that it goes back and forth between its ring and spilling.
+ * Exits non-zero on any difference.
+ */
+
+enum {
+	THREADS   = 4,
+	LINES     = 20000,
+	RING_SIZE = 4096,
+	LONG_LINE = 6000,
+	BURST     = 500
+};
+
+static const char *full[] = { "block", "drop", "spill" };
+
+static const struct {
+	enum lf_full policy;
+	int bursty;
+} runs[] = {
+	{ LF_FULL_BLOCK, 0 },
+	{ LF_FULL_DROP,  0 },
+	{ LF_FULL_SPILL, 0 },
+	{ LF_FULL_SPILL, 1 }
+};
+
+static struct lf_prog *prog;
+static struct lf_writer *writer;
+static enum lf_full policy;
+static int bursty;
+
+static char pad[LONG_LINE];
+
+/* some lines longer than a ring, for spilling only */
+static size_t
+padding(unsigned seq)
+{
+	if (policy == LF_FULL_SPILL && seq % 1000 == 999) {
+		return LONG_LINE;
+	}
+
+	return seq * 7 % 1500 + 1;
+}
+
+static void *
+producer(void *opaque)
+{
+	struct lf_record rec;
+	struct lf_ring *r;
+	unsigned t, seq;
+	char buf[LONG_LINE + 64];
+	int n;
+
+	t = (unsigned) (size_t) opaque;
+
+	r = lf_writer_ring(writer);
+	if (r == NULL) {
+		perror("lf_writer_ring");
+		exit(1);
+	}
+
+	memset(&rec, 0, sizeof rec);
+
+	for (seq = 0; seq < LINES; seq++) {
+		/* long enough for the writer to empty the ring */
+		if (bursty && seq % BURST == 0) {
+			struct timespec ts = { 0, 2000000L };
+
+			(void) nanosleep(&ts, NULL);
+		}
+
+		if (seq % 2 == 0) {
+			rec.keepalive_reqs = t;
+			rec.bytes_recv     = seq;
+			rec.url_path.p     = pad;
+			rec.url_path.n     = padding(seq);
+
+			(void) lf_ring_render(r, prog, &rec);
+		} else {
+			n = sprintf(buf, "%u %u %.*s\n", t, seq, (int) padding(seq), pad);
+
+			(void) lf_ring_write(r, buf, n);
+		}
+	}
+
+	lf_free_ring(r);
+
+	return NULL;
+}
+
+static int
+check(FILE *f, unsigned long long dropped)
+{
+	unsigned next[THREADS];
+	unsigned long long lines;
+	char buf[LONG_LINE + 64];
+	unsigned t, seq;
+	size_t n;
+	int k;
+
+	memset(next, 0, sizeof next);
+	lines = 0;
+
+	while (fgets(buf, sizeof buf, f) != NULL) {
+		n = strlen(buf);
+
+		if (2 != sscanf(buf, "%u %u %n", &t, &seq, &k) || t >= THREADS || seq >= LINES
+		 || n != k + padding(seq) + 1 || 0 != memcmp(buf + k, pad, padding(seq))
+		 || buf[n - 1] != '\n') {
+			fprintf(stderr, "writer: %s%s: garbled line '%.*s'\n",
+				full[policy], bursty ? " bursty" : "", (int) (n > 80 ? 80 : n), buf);
+			return 0;
+		}
+
+		if (seq < next[t] || (policy != LF_FULL_DROP && seq != next[t])) {
+			fprintf(stderr, "writer: %s%s: thread %u line %u out of order, expected %u\n",
+				full[policy], bursty ? " bursty" : "", t, seq, next[t]);
+			return 0;
+		}
+
+		next[t] = seq + 1;
+		lines++;
+	}
+
+	if (lines + dropped != (unsigned long long) THREADS * LINES) {
+		fprintf(stderr, "writer: %s%s: %llu lines and %llu dropped, expected %llu\n",
+			full[policy], bursty ? " bursty" : "", lines, dropped,
+			(unsigned long long) THREADS * LINES);
+		return 0;
+	}
+
+	if (policy != LF_FULL_DROP && dropped != 0) {
+		fprintf(stderr, "writer: %s%s: lines dropped\n", full[policy], bursty ? " bursty" : "");
+		return 0;
+	}
+
+	return 1;
+}
+
+int
+main(void)
+{
+	struct lf_writer_config wc;
+	struct lf_config conf;
+	struct lf_err err;
+	pthread_t thread[THREADS];
+	unsigned long long dropped;
+	FILE *f;
+	size_t i, k;
+	int ok;
+
+	memset(pad, 'x', sizeof pad);
+
+	memset(&conf, 0, sizeof conf);
+
+	prog = lf_compile(&conf, "%k %I %U", &err);
+	if (prog == NULL) {
+		fprintf(stderr, "error: %s\n", lf_strerror(err.errnum));
+		return 1;
+	}
+
+	for (k = 0; k < sizeof runs / sizeof *runs; k++) {
+		policy = runs[k].policy;
+		bursty = runs[k].bursty;
+
+		f = tmpfile();
+		if (f == NULL) {
+			perror("tmpfile");
+			return 1;
+		}
+
+		memset(&wc, 0, sizeof wc);
+		wc.fd         = fileno(f);
+		wc.ring_size  = RING_SIZE;
+		wc.flush_size = RING_SIZE / 4;
+		wc.flush_ms   = 1;
+		wc.full       = policy;
+
+		writer = lf_new_writer(&wc);
+		if (writer == NULL) {
+			perror("lf_new_writer");
+			return 1;
+		}
+
+		for (i = 0; i < THREADS; i++) {
+			errno = pthread_create(&thread[i], NULL, producer, (void *) i);
+			if (errno != 0) {
+				perror("pthread_create");
+				return 1;
+			}
+		}
+
+		for (i = 0; i < THREADS; i++) {
+			(void) pthread_join(thread[i], NULL);
+		}
+
+		dropped = lf_writer_dropped(writer);
+
+		/* everything pending is written by now */
+		if (!lf_free_writer(writer)) {
+			perror("lf_free_writer");
+			return 1;
+		}
+
+		rewind(f);
+
+		ok = check(f, dropped);
+
+		fclose(f);
+
+		if (!ok) {
+			return 1;
+		}
+	}
+
+	lf_free(prog);
+
+	return 0;
+}